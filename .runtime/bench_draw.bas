@@ -0,0 +1,18 @@
+10 REM Drawing benchmark. Each frame fills the screen with BAR in the four writing modes, then draws lines,
+20 REM boxes and circles. Run with "REBASIC -bench 600 bench_draw.bas" and compare the VM time.
+30 CURS_OFF
+40 FOR F = 1 TO 600
+50 FOR M = 1 TO 4
+60 WRITING M
+70 PEN F + M - ( ( F + M ) / 32 ) * 32
+80 BAR 0, 0, 319, 199
+90 NEXT M
+100 WRITING 1
+110 FOR I = 0 TO 99
+120 PEN I - ( I / 32 ) * 32
+130 DRAW I * 3, 0, 319 - I * 3, 199
+140 BOX I, I, 319 - I, 199 - I
+150 CIRCLE 160, 100, I + F - ( F / 100 ) * 100
+160 NEXT I
+170 WAITVBL
+180 NEXT F
@@ -0,0 +1,9 @@
+10 REM Palette expansion benchmark. Scrolls the screen every frame, so every row is redrawn and converted
+20 REM from palette indices to colours each frame. Run with "REBASIC -bench 600 bench_palette.bas" and compare
+30 REM the render time.
+40 FOR F = 1 TO 600
+50 PEN F - ( F / 16 ) * 16
+60 PAPER 16 + F - ( F / 16 ) * 16
+70 PRINT "PALETTE BENCHMARK " + STR(F) + " ABCDEFGHIJKLMNOP"
+80 WAITVBL
+90 NEXT F
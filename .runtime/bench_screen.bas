@@ -0,0 +1,20 @@
+10 REM Screen mode benchmark. Fills a 1280x720 screen with 256 colours with text, then moves 32 sprites
+20 REM across it for 600 frames. Run with "REBASIC -bench 600 bench_screen.bas" and compare the render time.
+30 REM Change the SCREEN line to measure other modes.
+40 SCREEN 1280, 720, 256
+50 W = 1280
+60 H = 720
+70 FOR I = 1 TO 90
+80 PAPER I + 100
+90 PEN I * 3 + 40
+100 PRINT "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 SCREEN MODE BENCHMARK LINE"
+110 NEXT I
+120 GETSPRITE 0, 0, 64, 64, 1, 5
+130 FOR F = 0 TO 600
+140 FOR S = 1 TO 32
+150 X = ( S * 37 + F * 3 ) - ( ( S * 37 + F * 3 ) / W ) * W - 20
+160 Y = ( S * 23 + F ) - ( ( S * 23 + F ) / H ) * H - 10
+170 SPRITE S, X, Y, 1
+180 NEXT S
+190 WAITVBL
+200 NEXT F
@@ -0,0 +1,6 @@
+10 REM Text scrolling benchmark. Prints 10,000 lines, so the screen scrolls once per line after it fills up.
+20 REM Run with "REBASIC -bench 600 bench_scroll.bas" and compare the VM time. For a large screen, add
+30 REM SCREEN 1280, 720, 256 before the loop.
+40 FOR I = 1 TO 10000
+50 PRINT "LOG LINE " + STR(I)
+60 NEXT I
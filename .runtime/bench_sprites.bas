@@ -0,0 +1,15 @@
+10 REM Sprite benchmark. Moves 32 sprites of 64x64 pixels over a full text screen for 600 frames.
+20 REM Run with "REBASIC -bench 600 bench_sprites.bas" and compare the render time.
+30 PAPER 3
+40 FOR I = 1 TO 25
+50 PRINT "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+60 NEXT I
+70 GETSPRITE 0, 0, 64, 64, 1, 5
+80 FOR F = 0 TO 600
+90 FOR S = 1 TO 32
+100 X = ( S * 9 + F ) - ( ( S * 9 + F ) / 300 ) * 300 - 20
+110 Y = ( S * 5 + F ) - ( ( S * 5 + F ) / 180 ) * 180 - 10
+120 SPRITE S, X, Y, 1
+130 NEXT S
+140 WAITVBL
+150 NEXT F
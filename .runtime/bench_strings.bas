@@ -0,0 +1,7 @@
+10 REM String building benchmark. Appends one character at a time until the string is 64 KB long.
+20 REM Run with "REBASIC -bench 1000 bench_strings.bas" and compare the VM time.
+30 X$ = ""
+40 FOR I = 1 TO 65536
+50 X$ = X$ + "x"
+60 NEXT I
+70 PRINT "STRING BUILT"
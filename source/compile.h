@@ -15,9 +15,12 @@ enum compile_op_t
     COMPILE_OP_MOD, COMPILE_OP_AND, COMPILE_OP_NEG, COMPILE_OP_NOT, 
     COMPILE_OP_ORB, COMPILE_OP_XORB, COMPILE_OP_ANDB, COMPILE_OP_NOTB,  
     COMPILE_OP_ADDF, COMPILE_OP_SUBF, COMPILE_OP_MULF, COMPILE_OP_DIVF, COMPILE_OP_MODF, COMPILE_OP_NEGF,   
-    COMPILE_OP_CATC,
-    COMPILE_OP_READ, COMPILE_OP_READF, COMPILE_OP_READC, COMPILE_OP_READB, COMPILE_OP_RSTO,
-    COMPILE_OP_RTSS,
+    COMPILE_OP_CATC, COMPILE_OP_APPENDC,
+    COMPILE_OP_LEN, COMPILE_OP_LEFT, COMPILE_OP_RIGHT, COMPILE_OP_MID, COMPILE_OP_INSTR, COMPILE_OP_CHR, COMPILE_OP_ASC, COMPILE_OP_UPPER, COMPILE_OP_VAL,
+    COMPILE_OP_STR, COMPILE_OP_STRF,
+    COMPILE_OP_READ, COMPILE_OP_READF, COMPILE_OP_READC, COMPILE_OP_READB, COMPILE_OP_RSTO, COMPILE_OP_READA,
+    COMPILE_OP_INDEX, COMPILE_OP_LOADA, COMPILE_OP_STOREA, COMPILE_OP_LOADAC, COMPILE_OP_STOREAC,
+    COMPILE_OP_JTAB,
 
     COMPILE_OPCOUNT,
     };
@@ -45,6 +48,11 @@ struct compile_bytecode_t
 compile_bytecode_t compile( char const* sourcecode, int length, compile_opcode_map_t* opcode_map, int opcode_count,
     char const** host_func_signatures, int host_func_count, int* error_pos, char error_msg[ 256 ] );
 
+// Translates the program to C code, for building a native version of it (see REBASIC_AOT in main.cpp).
+// Returns a zero terminated string allocated with malloc, or NULL on error.
+char* compile_to_c( char const* sourcecode, int length, char const** host_func_signatures, int host_func_count, 
+    int* error_pos, char error_msg[ 256 ] );
+
 #endif /* compile_h */
 
 
@@ -58,6 +66,9 @@ compile_bytecode_t compile( char const* sourcecode, int length, compile_opcode_m
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdarg.h>
 
 #include "libs/strpool.h"
 
@@ -161,7 +172,7 @@ static token_t next_token( lexer_context_t* ctx )
         
         if( length == 3 && strnicmp( start, "REM", 3 ) == 0 )
             {
-            last = '\''; // Comment until end of line
+            if( last != '\n' && last != 0 ) last = '\''; // Comment until end of line, unless REM already ended it
             }
         else
             {
@@ -173,10 +184,10 @@ static token_t next_token( lexer_context_t* ctx )
             }
         }
 
-    // Comment until end of line
+    // Comment until end of line, including any '\r' before the newline
     if( last == '\'' ) 
         {
-        while( last != 0 && last != '\n' && last != '\r' ) 
+        while( last != 0 && last != '\n' ) 
             {
             last = get_char( ctx );
             }
@@ -355,6 +366,7 @@ enum ast_node_t
     AST_DIM,
     AST_DATA,
     AST_READ,
+    AST_READARRAY,
     AST_RESTORE,
     AST_BRANCH,
     AST_RETURN,
@@ -374,6 +386,10 @@ enum ast_node_t
     AST_END,
     AST_TRON,
     AST_TROFF,
+    AST_ON,
+    AST_SELECT,
+    AST_CASE,
+    AST_ENDSELECT,
     };
 
 struct ast_var_t
@@ -390,9 +406,10 @@ struct ast_line_t { int number; int statement; };
 struct ast_statement_t {  };
 struct ast_proccall_t { u32 id; int arg_list; ast_type_t type; };
 struct ast_read_t { int var_list; };
+struct ast_readarray_t { int var_index; int count; };
 struct ast_restore_t { int index; };
 struct ast_branch_t { enum brachtype_t { BRANCH_JUMP, BRANCH_SUB, BRANCH_COND, BRANCH_LOOP, }; brachtype_t type; int target; };
-struct ast_loop_t { int assignment; };
+struct ast_loop_t { int assignment; int limit; int step; int next; };
 struct ast_next_t { int assignment; int condition; };
 struct ast_condition_t { int expression; int branch; };
 struct ast_assignment_t { int variable; int expression; };
@@ -404,7 +421,11 @@ struct ast_unaryexp_t { enum optype_t { OP_NEG, OP_NOT, }; optype_t op; int fact
 struct ast_float_t { float value; };
 struct ast_integer_t { int value; };
 struct ast_string_t { u32 handle; };
-struct ast_variable_t { int index; int offset_a; int offset_b; };
+struct ast_variable_t { int index; int offset_a; int offset_b; bool in_bounds; };
+struct ast_on_t { int expression; int branch_list; int count; bool gosub; };
+struct ast_select_t { int expression; int case_list; int else_case; int end; int end_target; int min; int max; };
+struct ast_case_t { int select; int value_list; int target; };
+struct ast_endselect_t { int select; };
 
 
 union ast_data_t
@@ -415,6 +436,7 @@ union ast_data_t
     ast_statement_t statement;
     ast_proccall_t proccall;
     ast_read_t read;
+    ast_readarray_t readarray;
     ast_restore_t restore;
     ast_branch_t branch;
     ast_loop_t loop;
@@ -430,6 +452,10 @@ union ast_data_t
     ast_integer_t integer;
     ast_string_t string;
     ast_variable_t variable;
+    ast_on_t on;
+    ast_select_t select;
+    ast_case_t case_;
+    ast_endselect_t endselect;
     };
 
 
@@ -452,9 +478,27 @@ struct host_funcs_t
     };
 
 
+// Built-in functions, which are called with the same syntax as host functions, but compile to their own opcodes
+static struct { char const* signature; compile_op_t op; char const* vm_op; } const builtin_funcs[] = 
+    {
+    { "Func Integer LEN( String )", COMPILE_OP_LEN, "VM_OP_LEN" },
+    { "Func String LEFT$( String, Integer )", COMPILE_OP_LEFT, "VM_OP_LEFT" },
+    { "Func String RIGHT$( String, Integer )", COMPILE_OP_RIGHT, "VM_OP_RIGHT" },
+    { "Func String MID$( String, Integer, Integer )", COMPILE_OP_MID, "VM_OP_MID" },
+    { "Func Integer INSTR( String, String )", COMPILE_OP_INSTR, "VM_OP_INSTR" },
+    { "Func String CHR$( Integer )", COMPILE_OP_CHR, "VM_OP_CHR" },
+    { "Func Integer ASC( String )", COMPILE_OP_ASC, "VM_OP_ASC" },
+    { "Func String UPPER$( String )", COMPILE_OP_UPPER, "VM_OP_UPPER" },
+    { "Func Real VAL( String )", COMPILE_OP_VAL, "VM_OP_VAL" },
+    { "Func String STR( Integer )", COMPILE_OP_STR, "VM_OP_STR" },
+    { "Func String STR( Real )", COMPILE_OP_STRF, "VM_OP_STRF" },
+    };
+
+
 struct parser_context_t
     {
     host_funcs_t host_funcs;
+    host_funcs_t builtin_funcs;
 
     token_t* tokens;
     int pos;
@@ -496,6 +540,10 @@ struct parser_context_t
     int loop_stack_capacity;
     int loop_stack_count;
 
+    int* select_stack;
+    int select_stack_capacity;
+    int select_stack_count;
+
     struct data_t
         {
         u32 type;
@@ -532,6 +580,11 @@ struct parser_context_t
     u32 keyword_STOP;
     u32 keyword_TRON;
     u32 keyword_TROFF;
+    u32 keyword_ON;
+    u32 keyword_SELECT;
+    u32 keyword_CASE;
+    u32 keyword_ELSE;
+    u32 keyword_ARRAY;
     };
 
 
@@ -555,6 +608,35 @@ static token_t* peek_token( parser_context_t* ctx )
     }
 
 
+// Commands of two words, like SCREEN SWAP, are procedures named with an underscore, like SCREEN_SWAP. Returns the
+// joined name if the next token is a second word that makes such a procedure name, or 0. A word followed by a comma 
+// is taken as the first argument instead.
+static u32 two_word_command( parser_context_t* ctx, u32 first )
+    {
+    token_t* second = peek_token( ctx );
+    if( second->type != TOKEN_IDENTIFIER ) return 0;
+    token_t* after = second + 1;
+    if( after->type == TOKEN_SYMBOL && after->symbol == ',' ) return 0;
+
+    char name[ 256 ];
+    char const* a = strpool_cstr( ctx->identifier_pool, first );
+    char const* b = strpool_cstr( ctx->identifier_pool, second->identifier );
+    if( strlen( a ) + strlen( b ) + 2 > sizeof( name ) ) return 0;
+    strcpy( name, a );
+    strcat( name, "_" );
+    strcat( name, b );
+    u32 joined = (u32) strpool_inject( ctx->identifier_pool, name, (int) strlen( name ) );
+
+    for( int table = 0; table < 2; ++table )
+        {
+        host_funcs_t* funcs = table == 0 ? &ctx->builtin_funcs : &ctx->host_funcs;
+        for( int i = 0; i < funcs->func_count; ++i )
+            if( funcs->funcs[ i ].identifier == joined && funcs->funcs[ i ].ret_type == AST_TYPE_NONE ) return joined;
+        }
+    return 0;
+    }
+
+
 static ast_type_t ast_get_type( const ast_node_t* node_type, const ast_data_t* node_data, const ast_var_t* vars, int index )
     {
     switch( node_type[ index ] )
@@ -579,6 +661,7 @@ static ast_type_t ast_get_type( const ast_node_t* node_type, const ast_data_t* n
         case AST_DIM:
         case AST_DATA:
         case AST_READ:
+        case AST_READARRAY:
         case AST_RESTORE:
         case AST_BRANCH:
         case AST_RETURN:
@@ -586,6 +669,10 @@ static ast_type_t ast_get_type( const ast_node_t* node_type, const ast_data_t* n
         case AST_END:
         case AST_TRON:
         case AST_TROFF:
+        case AST_ON:
+        case AST_SELECT:
+        case AST_CASE:
+        case AST_ENDSELECT:
         default:
             return AST_TYPE_NONE;
         }
@@ -688,6 +775,16 @@ static int create_node( parser_context_t* ctx, ast_node_t type )
     }
 
 
+static bool case_value_used( parser_context_t* ctx, int value_list, int value )
+    {
+    for( int list = value_list; list >= 0; list = ctx->node_data[ list ].list_node.next )
+        {
+        if( ctx->node_data[ ctx->node_data[ list ].list_node.item ].integer.value == value ) return true;
+        }
+    return false;
+    }
+
+
 static int parse( parser_context_t* ctx, ast_node_t in_type )
     {
     #define node ctx->node_data[ index ]
@@ -758,24 +855,32 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 token_t* next_token = peek_token( ctx );
                 rewind_token( ctx );
 
-                     if( token->identifier == ctx->keyword_DIM ) node.line.statement = parse( ctx, AST_DIM );
-                else if( token->identifier == ctx->keyword_DATA ) node.line.statement = parse( ctx, AST_DATA );
-                else if( token->identifier == ctx->keyword_READ ) node.line.statement = parse( ctx, AST_READ );
-                else if( token->identifier == ctx->keyword_RESTORE ) node.line.statement = parse( ctx, AST_RESTORE );
-                else if( token->identifier == ctx->keyword_GOTO ) node.line.statement = parse( ctx, AST_BRANCH );
-                else if( token->identifier == ctx->keyword_GOSUB ) node.line.statement = parse( ctx, AST_BRANCH );
-                else if( token->identifier == ctx->keyword_RETURN ) node.line.statement = parse( ctx, AST_RETURN );
-                else if( token->identifier == ctx->keyword_FOR ) node.line.statement = parse( ctx, AST_LOOP );
-                else if( token->identifier == ctx->keyword_NEXT ) node.line.statement = parse( ctx, AST_NEXT );
-                else if( token->identifier== ctx->keyword_IF ) node.line.statement = parse( ctx, AST_CONDITION );
-                else if( token->identifier== ctx->keyword_END ) node.line.statement = parse( ctx, AST_END );
-                else if( token->identifier== ctx->keyword_STOP ) node.line.statement = parse( ctx, AST_END );
-                else if( token->identifier== ctx->keyword_TRON ) node.line.statement = parse( ctx, AST_TRON );
-                else if( token->identifier== ctx->keyword_TROFF ) node.line.statement = parse( ctx, AST_TROFF );
-                else if( next_token->type == TOKEN_SYMBOL && next_token->symbol == '=' ) node.line.statement = parse( ctx, AST_ASSIGNMENT );
-                else if( var_dimensions( ctx, token->identifier ) > 0 ) node.line.statement = parse( ctx, AST_ASSIGNMENT );
-                else node.line.statement = parse( ctx, AST_PROCCALL );
+                // Child nodes are parsed into locals, as parsing may grow node_data and move the node being assigned to
+                int statement = -1;
+                     if( token->identifier == ctx->keyword_DIM ) statement = parse( ctx, AST_DIM );
+                else if( token->identifier == ctx->keyword_DATA ) statement = parse( ctx, AST_DATA );
+                else if( token->identifier == ctx->keyword_READ && next_token->type == TOKEN_IDENTIFIER && next_token->identifier == ctx->keyword_ARRAY ) statement = parse( ctx, AST_READARRAY );
+                else if( token->identifier == ctx->keyword_READ ) statement = parse( ctx, AST_READ );
+                else if( token->identifier == ctx->keyword_RESTORE ) statement = parse( ctx, AST_RESTORE );
+                else if( token->identifier == ctx->keyword_GOTO ) statement = parse( ctx, AST_BRANCH );
+                else if( token->identifier == ctx->keyword_GOSUB ) statement = parse( ctx, AST_BRANCH );
+                else if( token->identifier == ctx->keyword_RETURN ) statement = parse( ctx, AST_RETURN );
+                else if( token->identifier == ctx->keyword_FOR ) statement = parse( ctx, AST_LOOP );
+                else if( token->identifier == ctx->keyword_NEXT ) statement = parse( ctx, AST_NEXT );
+                else if( token->identifier== ctx->keyword_IF ) statement = parse( ctx, AST_CONDITION );
+                else if( token->identifier == ctx->keyword_ON ) statement = parse( ctx, AST_ON );
+                else if( token->identifier == ctx->keyword_SELECT ) statement = parse( ctx, AST_SELECT );
+                else if( token->identifier == ctx->keyword_CASE ) statement = parse( ctx, AST_CASE );
+                else if( token->identifier == ctx->keyword_END && next_token->type == TOKEN_IDENTIFIER && next_token->identifier == ctx->keyword_SELECT ) statement = parse( ctx, AST_ENDSELECT );
+                else if( token->identifier== ctx->keyword_END ) statement = parse( ctx, AST_END );
+                else if( token->identifier== ctx->keyword_STOP ) statement = parse( ctx, AST_END );
+                else if( token->identifier== ctx->keyword_TRON ) statement = parse( ctx, AST_TRON );
+                else if( token->identifier== ctx->keyword_TROFF ) statement = parse( ctx, AST_TROFF );
+                else if( next_token->type == TOKEN_SYMBOL && next_token->symbol == '=' ) statement = parse( ctx, AST_ASSIGNMENT );
+                else if( var_dimensions( ctx, token->identifier ) > 0 ) statement = parse( ctx, AST_ASSIGNMENT );
+                else statement = parse( ctx, AST_PROCCALL );
                 if( compile_error.state ) return index;
+                node.line.statement = statement;
                 }
         
             initial_token = get_token( ctx );
@@ -786,6 +891,16 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
         case AST_FUNCCALL:
             {
             token_t* initial_token = get_token( ctx );
+            u32 name = initial_token->identifier;
+            if( in_type == AST_PROCCALL )
+                {
+                u32 joined = two_word_command( ctx, name );
+                if( joined ) 
+                    {
+                    name = joined;
+                    get_token( ctx );
+                    }
+                }
             node.proccall.arg_list = -1;
             int list_tail = -1;
             int arg_count = 0;
@@ -826,30 +941,34 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                     }
                 }
 
-            // find the right host function
-            for( int i = 0; i < ctx->host_funcs.func_count; ++i )
+            // find the right built-in or host function
+            for( int table = 0; table < 2; ++table )
                 {
-                if( ctx->host_funcs.funcs[ i ].arg_count == arg_count && ctx->host_funcs.funcs[ i ].identifier == initial_token->identifier )
+                host_funcs_t* funcs = table == 0 ? &ctx->builtin_funcs : &ctx->host_funcs;
+                for( int i = 0; i < funcs->func_count; ++i )
                     {
-                    int arg_index = 0;
-                    int list = node.proccall.arg_list;
-                    while( list >= 0 )
+                    if( funcs->funcs[ i ].arg_count == arg_count && funcs->funcs[ i ].identifier == name )
                         {
-                        int arg = ctx->node_data[ list ].list_node.item;
-                        if( ast_get_type( ctx, arg ) != ctx->host_funcs.arg_types[ ctx->host_funcs.funcs[ i ].arg_start + arg_index ] )
+                        int arg_index = 0;
+                        int list = node.proccall.arg_list;
+                        while( list >= 0 )
                             {
-                            goto prototype_no_match; // try next function
-                            }
-
-                        list = ctx->node_data[ list ].list_node.next;
-                        ++arg_index;
-                        }       
-
-                    node.proccall.id = (u32)( COMPILE_OPCOUNT + i );
-                    node.proccall.type = ctx->host_funcs.funcs[ i ].ret_type;               
-                    return index;
+                            int arg = ctx->node_data[ list ].list_node.item;
+                            if( ast_get_type( ctx, arg ) != funcs->arg_types[ funcs->funcs[ i ].arg_start + arg_index ] )
+                                {
+                                goto prototype_no_match; // try next function
+                                }
+
+                            list = ctx->node_data[ list ].list_node.next;
+                            ++arg_index;
+                            }       
+
+                        node.proccall.id = table == 0 ? (u32) builtin_funcs[ i ].op : (u32)( COMPILE_OPCOUNT + i );
+                        node.proccall.type = funcs->funcs[ i ].ret_type;               
+                        return index;
+                        }
+                    prototype_no_match: ;
                     }
-                prototype_no_match: ;
                 }
 
             parser_error( "Unknown command", initial_token->pos );
@@ -996,7 +1115,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 if( list_tail >= 0 ) ctx->node_data[ list_tail ].list_node.next = list_next;
                 else node.read.var_list = list_next;
 
-                ctx->node_data[ list_next ].list_node.item = parse( ctx, AST_VARIABLE ); if( compile_error.state ) return index;
+                int item = parse( ctx, AST_VARIABLE ); if( compile_error.state ) return index;
+                ctx->node_data[ list_next ].list_node.item = item;
                 ctx->node_data[ list_next ].list_node.next = -1;
                 list_tail = list_next;
 
@@ -1010,6 +1130,62 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 }
             } break;
 
+        case AST_READARRAY:
+            {
+            token_t* token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_READ )
+                {
+                parser_error( "'READ' expected", token->pos ); 
+                return index;
+                }
+
+            token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_ARRAY )
+                {
+                parser_error( "'ARRAY' expected", token->pos ); 
+                return index;
+                }
+
+            token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || var_dimensions( ctx, token->identifier ) == 0 )
+                {
+                parser_error( "Array expected", token->pos ); 
+                return index;
+                }
+            node.readarray.var_index = map_var( ctx, token->identifier );
+            if( ctx->vars[ node.readarray.var_index ].type == AST_TYPE_NONE )
+                {
+                ctx->vars[ node.readarray.var_index ].type = AST_TYPE_INTEGER;
+                }
+
+            token = get_token( ctx );
+            if( token->type != TOKEN_SYMBOL || token->symbol != '(' )
+                {
+                parser_error( "'(' expected", token->pos ); 
+                return index;
+                }
+            token = get_token( ctx );
+            if( token->type != TOKEN_SYMBOL || token->symbol != ')' )
+                {
+                parser_error( "')' expected", token->pos ); 
+                return index;
+                }
+            token = get_token( ctx );
+            if( token->type != TOKEN_SYMBOL || token->symbol != ',' )
+                {
+                parser_error( "',' expected", token->pos ); 
+                return index;
+                }
+
+            int count = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;
+            node.readarray.count = count;
+            if( ast_get_type( ctx, node.readarray.count ) != AST_TYPE_INTEGER )
+                {
+                parser_error( "Integer expression expected", token->pos ); 
+                return index;
+                }
+            } break;
+
         case AST_RESTORE:
             {
             token_t* token = get_token( ctx );
@@ -1080,7 +1256,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
 
             int var_index = map_var( ctx, peek_token( ctx )->identifier );
 
-            node.loop.assignment = parse( ctx, AST_ASSIGNMENT ); if( compile_error.state ) return index;
+            int assignment = parse( ctx, AST_ASSIGNMENT ); if( compile_error.state ) return index;
+            node.loop.assignment = assignment;
 
             token = get_token( ctx );
             if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_TO )
@@ -1102,6 +1279,10 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 rewind_token( ctx );
                 }
             
+            node.loop.limit = limit;
+            node.loop.step = step;
+            node.loop.next = -1;
+
             if( ctx->loop_stack_count >= ctx->loop_stack_capacity )
                 {
                 ctx->loop_stack_capacity *= 2;
@@ -1140,6 +1321,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 return index;
                 }
 
+            ctx->node_data[ loop->target ].loop.next = index;
+
             {
             int assign_var = create_node( ctx, AST_VARIABLE );
             int assignment = create_node( ctx, AST_ASSIGNMENT );
@@ -1217,7 +1400,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 return index;
                 }
 
-            node.condition.expression = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;
+            int expression = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;
+            node.condition.expression = expression;
             if( ast_get_type( ctx, node.condition.expression ) != AST_TYPE_BOOL )
                 {
                 parser_error( "Boolean expression expected", token->pos ); 
@@ -1232,7 +1416,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 }
 
             rewind_token( ctx );
-            node.condition.branch = parse( ctx, AST_BRANCH ); if( compile_error.state ) return index;
+            int branch = parse( ctx, AST_BRANCH ); if( compile_error.state ) return index;
+            node.condition.branch = branch;
             } break;
 
         case AST_ASSIGNMENT:
@@ -1263,7 +1448,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                     return index;
                     }
 
-                ctx->node_data[ assign_var ].variable.offset_a = parse( ctx, AST_EXPRESSION );
+                int offset_a = parse( ctx, AST_EXPRESSION );
+                ctx->node_data[ assign_var ].variable.offset_a = offset_a;
 
                 if( var_dim > 1 )
                     {
@@ -1274,7 +1460,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                         return index;
                         }
 
-                    ctx->node_data[ assign_var ].variable.offset_b = parse( ctx, AST_EXPRESSION );
+                    int offset_b = parse( ctx, AST_EXPRESSION );
+                    ctx->node_data[ assign_var ].variable.offset_b = offset_b;
                     }
 
                 token = get_token( ctx );
@@ -1292,7 +1479,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 return index;
                 }
 
-            node.assignment.expression = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;          
+            int expression = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;          
+            node.assignment.expression = expression;
             ast_type_t type = ast_get_type( ctx, node.assignment.expression );
             if( type != ctx->vars[ var_index ].type && ctx->vars[ var_index ].type != AST_TYPE_NONE )
                 {
@@ -1309,7 +1497,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
             // =  <>  <  <=  >  >=
             // SimpleExpression 
             {
-            node.expression.primary = parse( ctx, AST_SIMPLEEXP ); if( compile_error.state ) return index;
+            int primary = parse( ctx, AST_SIMPLEEXP ); if( compile_error.state ) return index;
+            node.expression.primary = primary;
             node.expression.simpleexp_list = -1;
             int list_tail = -1;
             ast_type_t type = ast_get_type( ctx, node.expression.primary );
@@ -1375,7 +1564,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
             // + - OR XOR
             // Term
             {
-            node.simpleexp.primary = parse( ctx, AST_TERM ); if( compile_error.state ) return index;
+            int primary = parse( ctx, AST_TERM ); if( compile_error.state ) return index;
+            node.simpleexp.primary = primary;
             node.simpleexp.term_list = -1;
             int list_tail = -1;
             ast_type_t type = ast_get_type( ctx, node.simpleexp.primary );
@@ -1424,7 +1614,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
             //  *  /  MOD  AND 
             // Factor
             {
-            node.term.primary = parse( ctx, AST_FACTOR ); if( compile_error.state ) return index;
+            int primary = parse( ctx, AST_FACTOR ); if( compile_error.state ) return index;
+            node.term.primary = primary;
             node.term.factor_list = -1;
             int list_tail = -1;
             ast_type_t type = ast_get_type( ctx, node.term.primary );
@@ -1473,7 +1664,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
             token_t* token = get_token( ctx );
             if( token->type == TOKEN_SYMBOL && token->symbol == '(' )
                 {
-                node.factor.primary = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;
+                int primary = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;
+                node.factor.primary = primary;
                 token = get_token( ctx );
                 if( token->type != TOKEN_SYMBOL || token->symbol != ')' )
                     {
@@ -1484,32 +1676,38 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
             else if( ( token->type == TOKEN_SYMBOL && token->symbol == '-' ) || ( token->type == TOKEN_IDENTIFIER && token->identifier == ctx->keyword_NOT ) )
                 {
                 rewind_token( ctx );
-                node.factor.primary = parse( ctx, AST_UNARYEXP ); if( compile_error.state ) return index;
+                int primary = parse( ctx, AST_UNARYEXP ); if( compile_error.state ) return index;
+                node.factor.primary = primary;
                 }
             else if( token->type == TOKEN_INT )
                 {
                 rewind_token( ctx );
-                node.factor.primary = parse( ctx, AST_INTEGER ); if( compile_error.state ) return index;
+                int primary = parse( ctx, AST_INTEGER ); if( compile_error.state ) return index;
+                node.factor.primary = primary;
                 }
             else if( token->type == TOKEN_FLOAT )
                 {
                 rewind_token( ctx );
-                node.factor.primary = parse( ctx, AST_FLOAT ); if( compile_error.state ) return index;
+                int primary = parse( ctx, AST_FLOAT ); if( compile_error.state ) return index;
+                node.factor.primary = primary;
                 }
             else if( token->type == TOKEN_STRING )
                 {
                 rewind_token( ctx );
-                node.factor.primary = parse( ctx, AST_STRING ); if( compile_error.state ) return index;
+                int primary = parse( ctx, AST_STRING ); if( compile_error.state ) return index;
+                node.factor.primary = primary;
                 }
             else if( token->type == TOKEN_IDENTIFIER && peek_token( ctx )->type == TOKEN_SYMBOL && peek_token( ctx )->symbol == '(' && var_dimensions( ctx, token->identifier ) == 0 ) 
                 {
                 rewind_token( ctx );
-                node.factor.primary = parse( ctx, AST_FUNCCALL ); if( compile_error.state ) return index;
+                int primary = parse( ctx, AST_FUNCCALL ); if( compile_error.state ) return index;
+                node.factor.primary = primary;
                 }
             else if( token->type == TOKEN_IDENTIFIER )
                 {
                 rewind_token( ctx );
-                node.factor.primary = parse( ctx, AST_VARIABLE ); if( compile_error.state ) return index;
+                int primary = parse( ctx, AST_VARIABLE ); if( compile_error.state ) return index;
+                node.factor.primary = primary;
                 }
             else
                 {
@@ -1524,12 +1722,14 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
             if( token->type == TOKEN_SYMBOL && token->symbol == '-' ) 
                 {
                 node.unaryexp.op = ast_unaryexp_t::OP_NEG;
-                node.unaryexp.factor = parse( ctx, AST_FACTOR ); if( compile_error.state ) return index;
+                int factor = parse( ctx, AST_FACTOR ); if( compile_error.state ) return index;
+                node.unaryexp.factor = factor;
                 }
             else if ( token->type == TOKEN_IDENTIFIER && token->identifier == ctx->keyword_NOT ) 
                 {
                 node.unaryexp.op = ast_unaryexp_t::OP_NOT;
-                node.unaryexp.factor = parse( ctx, AST_FACTOR ); if( compile_error.state ) return index;
+                int factor = parse( ctx, AST_FACTOR ); if( compile_error.state ) return index;
+                node.unaryexp.factor = factor;
                 }
             else
                 {
@@ -1593,7 +1793,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                     return index;
                     }
 
-                node.variable.offset_a = parse( ctx, AST_EXPRESSION );
+                int offset_a = parse( ctx, AST_EXPRESSION );
+                node.variable.offset_a = offset_a;
 
                 if( var_dim > 1 )
                     {
@@ -1604,7 +1805,8 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                         return index;
                         }
 
-                    node.variable.offset_b = parse( ctx, AST_EXPRESSION );
+                    int offset_b = parse( ctx, AST_EXPRESSION );
+                    node.variable.offset_b = offset_b;
                     }
 
                 token = get_token( ctx );
@@ -1651,6 +1853,218 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
                 }
             } break;
 
+        case AST_ON:
+            {
+            token_t* token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_ON )
+                {
+                parser_error( "'ON' expected", token->pos ); 
+                return index;
+                }
+
+            int expression = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;
+            node.on.expression = expression;
+            if( ast_get_type( ctx, node.on.expression ) != AST_TYPE_INTEGER )
+                {
+                parser_error( "Integer expression expected", token->pos ); 
+                return index;
+                }
+
+            token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || ( token->identifier != ctx->keyword_GOTO && token->identifier != ctx->keyword_GOSUB ) )
+                {
+                parser_error( "'GOTO' or 'GOSUB' expected", token->pos ); 
+                return index;
+                }
+
+            node.on.gosub = token->identifier == ctx->keyword_GOSUB;
+            node.on.branch_list = -1;
+            node.on.count = 0;
+            int list_tail = -1;
+            while( true )
+                {
+                int branch = create_node( ctx, AST_BRANCH );
+                token = get_token( ctx );
+                if( token->type != TOKEN_INT )
+                    {
+                    parser_error( "Line number expected", token->pos ); 
+                    return index;
+                    }
+                ctx->node_data[ branch ].branch.type = node.on.gosub ? ast_branch_t::BRANCH_SUB : ast_branch_t::BRANCH_JUMP;
+                ctx->node_data[ branch ].branch.target = token->int_val;
+
+                int list_next = parse( ctx, AST_LIST_NODE ); if( compile_error.state ) return index;
+                if( list_tail >= 0 ) ctx->node_data[ list_tail ].list_node.next = list_next;
+                else node.on.branch_list = list_next;
+
+                ctx->node_data[ list_next ].list_node.item = branch;
+                ctx->node_data[ list_next ].list_node.next = -1;
+                list_tail = list_next;
+                ++node.on.count;
+
+                if( peek_token( ctx )->type == TOKEN_NEWLINE ) break;
+                token = get_token( ctx );
+                if( token->type != TOKEN_SYMBOL || token->symbol != ',' )
+                    {
+                    parser_error( "',' or newline expected", token->pos ); 
+                    return index;
+                    }
+                }
+            } break;
+
+        case AST_SELECT:
+            {
+            token_t* token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_SELECT )
+                {
+                parser_error( "'SELECT' expected", token->pos ); 
+                return index;
+                }
+
+            token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_CASE )
+                {
+                parser_error( "'CASE' expected", token->pos ); 
+                return index;
+                }
+
+            int expression = parse( ctx, AST_EXPRESSION ); if( compile_error.state ) return index;
+            node.select.expression = expression;
+            if( ast_get_type( ctx, node.select.expression ) != AST_TYPE_INTEGER )
+                {
+                parser_error( "Integer expression expected", token->pos ); 
+                return index;
+                }
+
+            node.select.case_list = -1;
+            node.select.else_case = -1;
+            node.select.end = -1;
+            node.select.end_target = -1;
+            node.select.min = 0;
+            node.select.max = -1;
+
+            if( ctx->select_stack_count >= ctx->select_stack_capacity )
+                {
+                ctx->select_stack_capacity *= 2;
+                ctx->select_stack = (int*) realloc( ctx->select_stack, sizeof( *ctx->select_stack ) * ctx->select_stack_capacity );
+                assert( ctx->select_stack );
+                }
+            ctx->select_stack[ ctx->select_stack_count++ ] = index;
+            } break;
+
+        case AST_CASE:
+            {
+            token_t* token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_CASE )
+                {
+                parser_error( "'CASE' expected", token->pos ); 
+                return index;
+                }
+
+            if( ctx->select_stack_count <= 0 )
+                {
+                parser_error( "'CASE' without matching 'SELECT'", token->pos ); 
+                return index;
+                }
+            int select = ctx->select_stack[ ctx->select_stack_count - 1 ];
+            if( ctx->node_data[ select ].select.else_case >= 0 )
+                {
+                parser_error( "'CASE' after 'CASE ELSE'", token->pos ); 
+                return index;
+                }
+
+            node.case_.select = select;
+            node.case_.value_list = -1;
+            node.case_.target = -1;
+
+            token = peek_token( ctx );
+            if( token->type == TOKEN_IDENTIFIER && token->identifier == ctx->keyword_ELSE )
+                {
+                get_token( ctx );
+                ctx->node_data[ select ].select.else_case = index;
+                }
+            else
+                {
+                while( true )
+                    {
+                    token = get_token( ctx );
+                    bool negative = token->type == TOKEN_SYMBOL && token->symbol == '-';
+                    if( negative ) token = get_token( ctx );
+                    if( token->type != TOKEN_INT )
+                        {
+                        parser_error( "Integer expected", token->pos ); 
+                        return index;
+                        }
+                    int value = negative ? -token->int_val : token->int_val;
+
+                    bool used = case_value_used( ctx, node.case_.value_list, value );
+                    for( int list = ctx->node_data[ select ].select.case_list; list >= 0 && !used; list = ctx->node_data[ list ].list_node.next )
+                        used = case_value_used( ctx, ctx->node_data[ ctx->node_data[ list ].list_node.item ].case_.value_list, value );
+                    if( used )
+                        {
+                        parser_error( "Duplicate 'CASE' value", token->pos ); 
+                        return index;
+                        }
+
+                    ast_select_t* data = &ctx->node_data[ select ].select;
+                    if( data->max < data->min ) { data->min = value; data->max = value; }
+                    else if( value < data->min ) data->min = value;
+                    else if( value > data->max ) data->max = value;
+                    if( (long long) data->max - (long long) data->min >= 1024 )
+                        {
+                        parser_error( "'CASE' values too far apart", token->pos ); 
+                        return index;
+                        }
+
+                    int integer = create_node( ctx, AST_INTEGER );
+                    ctx->node_data[ integer ].integer.value = value;
+                    int list_next = parse( ctx, AST_LIST_NODE ); if( compile_error.state ) return index;
+                    ctx->node_data[ list_next ].list_node.item = integer;
+                    ctx->node_data[ list_next ].list_node.next = node.case_.value_list;
+                    node.case_.value_list = list_next;
+
+                    if( peek_token( ctx )->type == TOKEN_NEWLINE ) break;
+                    token = get_token( ctx );
+                    if( token->type != TOKEN_SYMBOL || token->symbol != ',' )
+                        {
+                        parser_error( "',' or newline expected", token->pos ); 
+                        return index;
+                        }
+                    }
+                }
+
+            int list_next = parse( ctx, AST_LIST_NODE ); if( compile_error.state ) return index;
+            ctx->node_data[ list_next ].list_node.item = index;
+            ctx->node_data[ list_next ].list_node.next = ctx->node_data[ select ].select.case_list;
+            ctx->node_data[ select ].select.case_list = list_next;
+            } break;
+
+        case AST_ENDSELECT:
+            {
+            token_t* token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_END )
+                {
+                parser_error( "'END' expected", token->pos ); 
+                return index;
+                }
+
+            token = get_token( ctx );
+            if( token->type != TOKEN_IDENTIFIER || token->identifier != ctx->keyword_SELECT )
+                {
+                parser_error( "'SELECT' expected", token->pos ); 
+                return index;
+                }
+
+            if( ctx->select_stack_count <= 0 )
+                {
+                parser_error( "'END SELECT' without matching 'SELECT'", token->pos ); 
+                return index;
+                }
+
+            node.endselect.select = ctx->select_stack[ --ctx->select_stack_count ];
+            ctx->node_data[ node.endselect.select ].select.end = index;
+            } break;
+
         case AST_LIST_NODE:
             break;
         }   
@@ -1660,6 +2074,19 @@ static int parse( parser_context_t* ctx, ast_node_t in_type )
     }
 
 
+static int add_jump_target( parser_context_t* ctx, int node_index )
+    {
+    if( ctx->jump_targets_count >= ctx->jump_targets_capacity )
+        {
+        ctx->jump_targets_capacity *= 2;
+        ctx->jump_targets = (int*) realloc( ctx->jump_targets, sizeof( *ctx->jump_targets ) * ctx->jump_targets_capacity );
+        assert( ctx->jump_targets );
+        }
+    ctx->jump_targets[ ctx->jump_targets_count ] = node_index;
+    return ctx->jump_targets_count++;
+    }
+
+
 static void resolve_targets( parser_context_t* ctx )
     {
     for( int i = 0; i < ctx->node_count; ++i )
@@ -1668,15 +2095,7 @@ static void resolve_targets( parser_context_t* ctx )
             {
             if( ctx->node_data[ i ].branch.type == ast_branch_t::BRANCH_LOOP )
                 {
-                int target = ctx->node_data[ i ].branch.target;
-                ctx->node_data[ i ].branch.target = ctx->jump_targets_count;
-                if( ctx->jump_targets_count >= ctx->jump_targets_capacity )
-                    {
-                    ctx->jump_targets_capacity *= 2;
-                    ctx->jump_targets = (int*) realloc( ctx->jump_targets, sizeof( *ctx->jump_targets ) * ctx->jump_targets_capacity );
-                    assert( ctx->jump_targets );
-                    }
-                ctx->jump_targets[ ctx->jump_targets_count++ ] = target;
+                ctx->node_data[ i ].branch.target = add_jump_target( ctx, ctx->node_data[ i ].branch.target );
                 goto next_node;
                 }
             else
@@ -1685,14 +2104,7 @@ static void resolve_targets( parser_context_t* ctx )
                     {
                     if( ctx->line_map[ j ].line_number == ctx->node_data[ i ].branch.target )
                         {
-                        ctx->node_data[ i ].branch.target = ctx->jump_targets_count;
-                        if( ctx->jump_targets_count >= ctx->jump_targets_capacity )
-                            {
-                            ctx->jump_targets_capacity *= 2;
-                            ctx->jump_targets = (int*) realloc( ctx->jump_targets, sizeof( *ctx->jump_targets ) * ctx->jump_targets_capacity );
-                            assert( ctx->jump_targets );
-                            }
-                        ctx->jump_targets[ ctx->jump_targets_count++ ] = ctx->line_map[ j ].node_index;
+                        ctx->node_data[ i ].branch.target = add_jump_target( ctx, ctx->line_map[ j ].node_index );
                         goto next_node;
                         }
                     }
@@ -1701,6 +2113,14 @@ static void resolve_targets( parser_context_t* ctx )
             return;
         next_node: ;
             }
+        else if( ctx->node_type[ i ] == AST_SELECT )
+            {
+            ctx->node_data[ i ].select.end_target = add_jump_target( ctx, ctx->node_data[ i ].select.end );
+            }
+        else if( ctx->node_type[ i ] == AST_CASE )
+            {
+            ctx->node_data[ i ].case_.target = add_jump_target( ctx, i );
+            }
         else if( ctx->node_type[ i ] == AST_RESTORE )
             {
             int line = ctx->node_data[ i ].restore.index;
@@ -1720,55 +2140,398 @@ static void resolve_targets( parser_context_t* ctx )
     }
 
 
-
-static u32 upper_power_of_two( u32 v )
+// DATA is stored as runs of same-typed values, each a type and a count followed by the untagged values, so 
+// that READ only checks the type once per run, and READ ARRAY can copy a whole run at a time. Runs are split 
+// at the first value of each RESTORE target line, and RESTORE indices are turned into offsets to the run.
+static u32* pack_data( parser_context_t* ctx, int* size )
     {
-    --v;
-    v |= v >> 1;
-    v |= v >> 2;
-    v |= v >> 4;
-    v |= v >> 8;
-    v |= v >> 16;
-    ++v;
-    v += ( v == 0 );
-    return v;
-    }
-
+    int* run_offsets = (int*) malloc( sizeof( *run_offsets ) * ( ctx->data_count + 1 ) );
+    assert( run_offsets );
+    for( int i = 0; i < ctx->data_count; ++i ) run_offsets[ i ] = -1;
+    for( int i = 0; i < ctx->node_count; ++i )
+        {
+        if( ctx->node_type[ i ] == AST_RESTORE ) run_offsets[ ctx->node_data[ i ].restore.index ] = 0;
+        }
 
-static void parse_host_signatures( host_funcs_t* host_funcs, char const** host_func_signatures, int host_func_count, strpool_t* pool )
-    {
-    struct local
+    u32* data = (u32*) malloc( sizeof( *data ) * ( ctx->data_count * 3 + 1 ) );
+    assert( data );
+    int count = 0;
+    int run = -1;
+    for( int i = 0; i < ctx->data_count; ++i )
         {
-        static char const* skip_nonalnum( char const* str )
+        if( run < 0 || run_offsets[ i ] >= 0 || data[ run ] != ctx->data[ i ].type )
             {
-            if( !str ) return 0;
-            while( *str && !isalnum( *str ) ) ++str;
-            return *str ? str : 0;
+            run = count;
+            data[ count++ ] = ctx->data[ i ].type;
+            data[ count++ ] = 0;
+            if( run_offsets[ i ] >= 0 ) run_offsets[ i ] = run;
             }
+        data[ count++ ] = ctx->data[ i ].value;
+        ++data[ run + 1 ];
+        }
 
-        static char const* skip_identifier( char const* str )
-            {
-            if( !str ) return 0;
-            while( *str && ( isalnum( *str ) || *str == '_' || *str == '$' ) ) ++str;
-            return *str ? str : 0;
-            }
+    for( int i = 0; i < ctx->node_count; ++i )
+        {
+        if( ctx->node_type[ i ] == AST_RESTORE ) ctx->node_data[ i ].restore.index = run_offsets[ ctx->node_data[ i ].restore.index ];
+        }
 
-        static bool is_identifier( char const* str, char const* identifier )
-            {
-            if( !str ) return false;
-            char const* end = skip_identifier( str );
-            int length = (int)( end - str );
-            if( length != (int) strlen( identifier ) ) return false;
-            return strnicmp( str, identifier, (size_t) length ) == 0;
-            }
+    free( run_offsets );
+    *size = (int)( count * sizeof( *data ) );
+    return data;
+    }
 
-        static u32 get_identifier( char const* str, strpool_t* pool )
-            {
-            if( !str ) return false;
-            char const* end = skip_identifier( str );
-            int length = (int)( end - str );
-            return (u32) strpool_inject( pool, str, length );
-            }
+
+// Range analysis, used to find array subscripts which can be proven to always be in bounds, 
+// so that they can be emitted without a runtime range check. Only integer expressions made
+// up of constants and FOR loop variables are considered.
+
+struct range_analysis_t
+    {
+    int* node_line;
+
+    struct loop_t
+        {
+        int node;
+        int var_index;
+        int first_line;
+        int last_line;
+        bool valid;
+        int min;
+        int max;
+        };
+    loop_t* loops;
+    int loop_count;
+    };
+
+
+static bool range_of( parser_context_t* ctx, range_analysis_t* ra, int index, int line, long long* min, long long* max )
+    {
+    #define node ctx->node_data[ index ]
+
+    switch( ctx->node_type[ index ] )
+        {
+        case AST_INTEGER:
+            {
+            *min = node.integer.value;
+            *max = node.integer.value;
+            } break;
+
+        case AST_VARIABLE:
+            {
+            if( node.variable.offset_a >= 0 ) return false;
+
+            // innermost loop first, as a loop variable might be reused in nested loops
+            for( int i = ra->loop_count - 1; i >= 0; --i )
+                {
+                range_analysis_t::loop_t* loop = &ra->loops[ i ];
+                if( loop->valid && loop->var_index == node.variable.index && line > loop->first_line && line <= loop->last_line )
+                    {
+                    *min = loop->min;
+                    *max = loop->max;
+                    return true;
+                    }
+                }
+            } return false;
+
+        case AST_EXPRESSION:
+            {
+            if( node.expression.simpleexp_list >= 0 ) return false;
+            if( !range_of( ctx, ra, node.expression.primary, line, min, max ) ) return false;
+            } break;
+
+        case AST_SIMPLEEXP:
+            {
+            if( !range_of( ctx, ra, node.simpleexp.primary, line, min, max ) ) return false;
+            int list = node.simpleexp.term_list;
+            while( list >= 0 )
+                {
+                int term = ctx->node_data[ list ].list_node.item;
+                long long a, b;
+                if( !range_of( ctx, ra, term, line, &a, &b ) ) return false;
+                switch( ctx->node_data[ term ].term.op )
+                    {
+                    case ast_term_t::OP_ADD: *min += a; *max += b; break;
+                    case ast_term_t::OP_SUB: *min -= b; *max -= a; break;
+                    case ast_term_t::OP_OR:
+                    case ast_term_t::OP_XOR:
+                    default: return false;
+                    }
+                if( *min < INT_MIN || *max > INT_MAX ) return false;
+                list = ctx->node_data[ list ].list_node.next;
+                }
+            } break;
+
+        case AST_TERM:
+            {
+            if( !range_of( ctx, ra, node.term.primary, line, min, max ) ) return false;
+            int list = node.term.factor_list;
+            while( list >= 0 )
+                {
+                int factor = ctx->node_data[ list ].list_node.item;
+                long long a, b;
+                if( !range_of( ctx, ra, factor, line, &a, &b ) ) return false;
+                switch( ctx->node_data[ factor ].factor.op )
+                    {
+                    case ast_factor_t::OP_MUL:
+                    case ast_factor_t::OP_DIV:
+                        {
+                        if( ctx->node_data[ factor ].factor.op == ast_factor_t::OP_DIV && a <= 0 ) return false;
+                        bool mul = ctx->node_data[ factor ].factor.op == ast_factor_t::OP_MUL;
+                        long long c[ 4 ] = { mul ? *min * a : *min / a, mul ? *min * b : *min / b, mul ? *max * a : *max / a, mul ? *max * b : *max / b };
+                        *min = c[ 0 ];
+                        *max = c[ 0 ];
+                        for( int i = 1; i < 4; ++i )
+                            {
+                            if( c[ i ] < *min ) *min = c[ i ];
+                            if( c[ i ] > *max ) *max = c[ i ];
+                            }
+                        } break;
+
+                    case ast_factor_t::OP_MOD:
+                        {
+                        if( a <= 0 ) return false;
+                        if( *min >= 0 && *max < a ) break;
+                        if( *min < -( b - 1 ) || *min >= 0 ) *min = *min >= 0 ? 0 : -( b - 1 );
+                        *max = *max < 0 ? 0 : *max > b - 1 ? b - 1 : *max;
+                        } break;
+
+                    case ast_factor_t::OP_AND:
+                        {
+                        if( a < 0 && *min < 0 ) return false;
+                        if( a >= 0 && ( *min < 0 || b < *max ) ) *max = b;
+                        *min = 0;
+                        } break;
+
+                    default: return false;
+                    }
+                if( *min < INT_MIN || *max > INT_MAX ) return false;
+                list = ctx->node_data[ list ].list_node.next;
+                }
+            } break;
+
+        case AST_FACTOR:
+            {
+            if( !range_of( ctx, ra, node.factor.primary, line, min, max ) ) return false;
+            } break;
+
+        case AST_UNARYEXP:
+            {
+            long long a, b;
+            if( !range_of( ctx, ra, node.unaryexp.factor, line, &a, &b ) ) return false;
+            switch( node.unaryexp.op )
+                {
+                case ast_unaryexp_t::OP_NEG: *min = -b; *max = -a; break;
+                case ast_unaryexp_t::OP_NOT: *min = -b - 1; *max = -a - 1; break;
+                default: return false;
+                }
+            } break;
+
+        default:
+            return false;
+        }
+
+    return *min >= INT_MIN && *max <= INT_MAX;
+    #undef node
+    }
+
+
+static bool assigns_var( parser_context_t* ctx, int index, int var_index )
+    {
+    if( ctx->node_type[ index ] == AST_ASSIGNMENT )
+        {
+        int variable = ctx->node_data[ index ].assignment.variable;
+        return ctx->node_data[ variable ].variable.index == var_index;
+        }
+    else if( ctx->node_type[ index ] == AST_READ )
+        {
+        int list = ctx->node_data[ index ].read.var_list;
+        while( list >= 0 )
+            {
+            int variable = ctx->node_data[ list ].list_node.item;
+            if( ctx->node_data[ variable ].variable.index == var_index ) return true;
+            list = ctx->node_data[ list ].list_node.next;
+            }
+        }
+    else if( ctx->node_type[ index ] == AST_READARRAY )
+        {
+        return ctx->node_data[ index ].readarray.var_index == var_index;
+        }
+    return false;
+    }
+
+
+static bool jumps_into( range_analysis_t::loop_t const* loop, int from_line, int to_line )
+    {
+    bool from_inside = from_line > loop->first_line && from_line <= loop->last_line;
+    return !from_inside && to_line > loop->first_line && to_line <= loop->last_line;
+    }
+
+
+static void analyze_subscripts( parser_context_t* ctx )
+    {
+    range_analysis_t ra;
+
+    // map each node to the index of the line it is part of
+    ra.node_line = (int*) malloc( sizeof( *ra.node_line ) * ctx->node_count );
+    assert( ra.node_line );
+    int line = -1;
+    int loop_count = 0;
+    for( int i = 0; i < ctx->node_count; ++i )
+        {
+        while( line + 1 < ctx->line_map_count && ctx->line_map[ line + 1 ].node_index <= i ) ++line;
+        ra.node_line[ i ] = line;
+        if( ctx->node_type[ i ] == AST_LOOP ) ++loop_count;
+        }
+
+    // loops are stored in source order, so enclosing loops come before the loops nested inside them
+    ra.loop_count = 0;
+    ra.loops = (range_analysis_t::loop_t*) malloc( sizeof( *ra.loops ) * ( loop_count + 1 ) );
+    assert( ra.loops );
+    for( int i = 0; i < ctx->node_count; ++i )
+        {
+        if( ctx->node_type[ i ] != AST_LOOP ) continue;
+        range_analysis_t::loop_t* loop = &ra.loops[ ra.loop_count++ ];
+        int assignment = ctx->node_data[ i ].loop.assignment;
+        loop->node = i;
+        loop->var_index = ctx->node_data[ ctx->node_data[ assignment ].assignment.variable ].variable.index;
+        loop->first_line = ra.node_line[ i ];
+        loop->last_line = ctx->node_data[ i ].loop.next >= 0 ? ra.node_line[ ctx->node_data[ i ].loop.next ] : loop->first_line;
+        loop->valid = false;
+        loop->min = 0;
+        loop->max = 0;
+        }
+
+    // A loop variable is known to stay within [ start, max( start, limit ) ] for the lines following the FOR, 
+    // up to and including the NEXT, if the step is positive, nothing else in the loop assigns to the variable, 
+    // there are no jumps into the loop from outside of it, and no subroutine called from within the loop can 
+    // modify the variable.
+    for( int i = 0; i < ra.loop_count; ++i )
+        {
+        range_analysis_t::loop_t* loop = &ra.loops[ i ];
+        ast_loop_t* data = &ctx->node_data[ loop->node ].loop;
+        if( data->next < 0 || ctx->vars[ loop->var_index ].type != AST_TYPE_INTEGER ) continue;
+        
+        long long start_min, start_max, limit_min, limit_max;
+        long long step_min = 1;
+        long long step_max = 1;
+        int start = ctx->node_data[ data->assignment ].assignment.expression;
+        if( !range_of( ctx, &ra, start, loop->first_line, &start_min, &start_max ) ) continue;
+        if( !range_of( ctx, &ra, data->limit, loop->first_line, &limit_min, &limit_max ) ) continue;
+        if( data->step >= 0 && !range_of( ctx, &ra, data->step, loop->first_line, &step_min, &step_max ) ) continue;
+        if( step_min < 1 || limit_max + step_max > INT_MAX ) continue;
+
+        int increment = ctx->node_data[ data->next ].next.assignment;
+        bool modified_inside = false;
+        bool modified_outside = false;
+        bool calls_sub = false;
+        bool jumped_into = false;
+        for( int j = 0; j < ctx->node_count; ++j )
+            {
+            bool inside = ra.node_line[ j ] > loop->first_line && ra.node_line[ j ] <= loop->last_line;
+            if( j != increment && j != data->assignment && assigns_var( ctx, j, loop->var_index ) )
+                {
+                if( inside ) modified_inside = true;
+                else modified_outside = true;
+                }
+            if( ctx->node_type[ j ] == AST_BRANCH )
+                {
+                int target = ra.node_line[ ctx->jump_targets[ ctx->node_data[ j ].branch.target ] ];
+                if( jumps_into( loop, ra.node_line[ j ], target ) ) jumped_into = true;
+                if( inside && ctx->node_data[ j ].branch.type == ast_branch_t::BRANCH_SUB ) calls_sub = true;
+                }
+            else if( ctx->node_type[ j ] == AST_SELECT )
+                {
+                // the table jump goes to any of the CASE lines, and to END SELECT when nothing matches
+                int end = ra.node_line[ ctx->node_data[ j ].select.end ];
+                if( jumps_into( loop, ra.node_line[ j ], end ) ) jumped_into = true;
+                }
+            else if( ctx->node_type[ j ] == AST_CASE )
+                {
+                // entered from the SELECT line, and left for END SELECT at the end of the previous case
+                int select = ctx->node_data[ j ].case_.select;
+                int end = ra.node_line[ ctx->node_data[ select ].select.end ];
+                if( jumps_into( loop, ra.node_line[ select ], ra.node_line[ j ] ) ) jumped_into = true;
+                if( jumps_into( loop, ra.node_line[ j ], end ) ) jumped_into = true;
+                }
+            }
+        if( modified_inside || jumped_into || ( calls_sub && modified_outside ) ) continue;
+
+        loop->min = (int) start_min;
+        loop->max = (int)( start_max > limit_max ? start_max : limit_max );
+        loop->valid = true;
+        }
+
+    for( int i = 0; i < ctx->node_count; ++i )
+        {
+        if( ctx->node_type[ i ] != AST_VARIABLE ) continue;
+        ast_variable_t* variable = &ctx->node_data[ i ].variable;
+        variable->in_bounds = false;
+        if( variable->offset_a < 0 ) continue;
+
+        ast_var_t* var = &ctx->vars[ variable->index ];
+        long long min, max;
+        if( !range_of( ctx, &ra, variable->offset_a, ra.node_line[ i ], &min, &max ) || min < 0 || max > var->dim_a ) continue;
+        if( variable->offset_b >= 0 )
+            {
+            if( !range_of( ctx, &ra, variable->offset_b, ra.node_line[ i ], &min, &max ) || min < 0 || max > var->dim_b ) continue;
+            }
+        variable->in_bounds = true;
+        }
+
+    free( ra.loops );
+    free( ra.node_line );
+    }
+
+
+
+static u32 upper_power_of_two( u32 v )
+    {
+    --v;
+    v |= v >> 1;
+    v |= v >> 2;
+    v |= v >> 4;
+    v |= v >> 8;
+    v |= v >> 16;
+    ++v;
+    v += ( v == 0 );
+    return v;
+    }
+
+
+static void parse_host_signatures( host_funcs_t* host_funcs, char const** host_func_signatures, int host_func_count, strpool_t* pool )
+    {
+    struct local
+        {
+        static char const* skip_nonalnum( char const* str )
+            {
+            if( !str ) return 0;
+            while( *str && !isalnum( *str ) ) ++str;
+            return *str ? str : 0;
+            }
+
+        static char const* skip_identifier( char const* str )
+            {
+            if( !str ) return 0;
+            while( *str && ( isalnum( *str ) || *str == '_' || *str == '$' ) ) ++str;
+            return *str ? str : 0;
+            }
+
+        static bool is_identifier( char const* str, char const* identifier )
+            {
+            if( !str ) return false;
+            char const* end = skip_identifier( str );
+            int length = (int)( end - str );
+            if( length != (int) strlen( identifier ) ) return false;
+            return strnicmp( str, identifier, (size_t) length ) == 0;
+            }
+
+        static u32 get_identifier( char const* str, strpool_t* pool )
+            {
+            if( !str ) return false;
+            char const* end = skip_identifier( str );
+            int length = (int)( end - str );
+            return (u32) strpool_inject( pool, str, length );
+            }
 
         static ast_type_t get_type( char const* str )
             {
@@ -1906,11 +2669,22 @@ static ast_t parse( token_t* tokens, int length, char const** host_func_signatur
     ctx.keyword_STOP    = MAKE_KEYWORD( "STOP" );
     ctx.keyword_TRON    = MAKE_KEYWORD( "TRON" );
     ctx.keyword_TROFF   = MAKE_KEYWORD( "TROFF" );
+    ctx.keyword_ON      = MAKE_KEYWORD( "ON" );
+    ctx.keyword_SELECT  = MAKE_KEYWORD( "SELECT" );
+    ctx.keyword_CASE    = MAKE_KEYWORD( "CASE" );
+    ctx.keyword_ELSE    = MAKE_KEYWORD( "ELSE" );
+    ctx.keyword_ARRAY   = MAKE_KEYWORD( "ARRAY" );
     #undef MAKE_KEYWORD
 
     parse_host_signatures( &ctx.host_funcs, host_func_signatures, host_func_count, identifier_pool );
     if( compile_error.state ) return ast;
 
+    char const* builtin_signatures[ sizeof( builtin_funcs ) / sizeof( *builtin_funcs ) ];
+    int builtin_count = (int)( sizeof( builtin_funcs ) / sizeof( *builtin_funcs ) );
+    for( int i = 0; i < builtin_count; ++i ) builtin_signatures[ i ] = builtin_funcs[ i ].signature;
+    parse_host_signatures( &ctx.builtin_funcs, builtin_signatures, builtin_count, identifier_pool );
+    assert( !compile_error.state );
+
     ctx.tokens = tokens;
     ctx.pos = 0;
 
@@ -1947,6 +2721,11 @@ static ast_t parse( token_t* tokens, int length, char const** host_func_signatur
     ctx.loop_stack = (parser_context_t::loop_stack_t*) malloc( sizeof( *ctx.loop_stack ) * ctx.loop_stack_capacity );
     assert( ctx.loop_stack );
 
+    ctx.select_stack_capacity = 16;
+    ctx.select_stack_count = 0;
+    ctx.select_stack = (int*) malloc( sizeof( *ctx.select_stack ) * ctx.select_stack_capacity );
+    assert( ctx.select_stack );
+
     ctx.data_capacity = (int) upper_power_of_two( (u32) ( length / 20.0f ) + 1 );
     ctx.data_count = 0;
     ctx.data = (parser_context_t::data_t*) malloc( sizeof( *ctx.data ) * ctx.data_capacity );
@@ -1958,18 +2737,27 @@ static ast_t parse( token_t* tokens, int length, char const** host_func_signatur
 
     parse( &ctx, AST_PROGRAM );
 
+    if( !compile_error.state && ctx.select_stack_count > 0 ) 
+        parser_error( "'SELECT' without matching 'END SELECT'", ctx.node_pos[ ctx.select_stack[ ctx.select_stack_count - 1 ] ] );
     if( !compile_error.state ) resolve_targets( &ctx );
+    if( !compile_error.state ) analyze_subscripts( &ctx );
+
+    int data_size = 0;
+    u32* data = compile_error.state ? 0 : pack_data( &ctx, &data_size );
+    free( ctx.data );
     
     free( ctx.host_funcs.funcs );
     free( ctx.host_funcs.arg_types );
+    free( ctx.builtin_funcs.funcs );
+    free( ctx.builtin_funcs.arg_types );
     free( ctx.vars_identifiers );
     free( ctx.loop_stack );
+    free( ctx.select_stack );
     free( ctx.line_map );
     free( ctx.data_lines );
     
     if( compile_error.state ) 
         {
-        free( ctx.data );
         free( ctx.vars );
         free( ctx.node_type );
         free( ctx.node_data );
@@ -1985,8 +2773,8 @@ static ast_t parse( token_t* tokens, int length, char const** host_func_signatur
     ast.jump_targets_count = ctx.jump_targets_count;
     ast.var_size = ctx.var_size;
     ast.vars = ctx.vars;
-    ast.data = ctx.data;
-    ast.data_size = (int)( sizeof( *ctx.data ) * ctx.data_count );
+    ast.data = data;
+    ast.data_size = data_size;
     return ast;
     }
 
@@ -2019,6 +2807,7 @@ struct emitter_context_t
     int* jump_targets;
     
     int* jump_sites;
+    int* jump_bases;
     int jump_sites_count;
     int jump_sites_capacity;
     };
@@ -2058,6 +2847,100 @@ static void emit_val( emitter_context_t* ctx, float value, int index )
     }
 
 
+static void emit( emitter_context_t* ctx, int const index );
+
+
+// Emits a placeholder for the offset to a jump target, to be filled in by patch_jumps. The offset is
+// relative to base, which is the op following the operand for JMP/JNZ/JSR, and the JTAB op itself 
+// for the entries of a jump table.
+static void emit_jump_site( emitter_context_t* ctx, int target, int base, int index )
+    {
+    if( ctx->jump_sites_count >= ctx->jump_sites_capacity )
+        {
+        ctx->jump_sites_capacity *= 2;
+        ctx->jump_sites = (int*) realloc( ctx->jump_sites, sizeof( *ctx->jump_sites ) * ctx->jump_sites_capacity );
+        assert( ctx->jump_sites );
+        ctx->jump_bases = (int*) realloc( ctx->jump_bases, sizeof( *ctx->jump_bases ) * ctx->jump_sites_capacity );
+        assert( ctx->jump_bases );
+        }
+
+    ctx->jump_sites[ ctx->jump_sites_count ] = ctx->count;
+    ctx->jump_bases[ ctx->jump_sites_count ] = base;
+    ++ctx->jump_sites_count;
+    emit_val( ctx, target, index );
+    }
+
+
+static void emit_jump_targets( emitter_context_t* ctx, int index )
+    {
+    for( int i = 0; i < ctx->ast.jump_targets_count; ++i )
+        {
+        if( ctx->ast.jump_targets[ i ] == index )
+            {
+            assert( ctx->jump_targets[ i ] == -1 );
+            ctx->jump_targets[ i ] = ctx->count;
+            }
+        }
+    }
+
+
+// Leaves the offset into the array on the stack. If the subscript could not be proven to be in range, an 
+// INDEX op is added as well, turning the offset into a range checked globals index, and true is returned
+static bool emit_subscript( emitter_context_t* ctx, int variable, int index, bool force_check )
+    {
+    ast_variable_t* var_node = &ctx->ast.node_data[ variable ].variable;
+    ast_var_t* var = &ctx->ast.vars[ var_node->index ];
+
+    emit( ctx, var_node->offset_a );
+
+    if( var_node->offset_b >= 0 )
+        {
+        emit( ctx, var_node->offset_b );
+        emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+        emit_val( ctx, (u32) var->dim_a + 1, index );
+        emit_val( ctx, ctx->opcode[ COMPILE_OP_MUL ], index );
+        emit_val( ctx, ctx->opcode[ COMPILE_OP_ADD ], index );
+        }
+
+    if( var_node->in_bounds && !force_check ) return false;
+
+    int max_subscript = var->dim_b > 0 ? ( var->dim_a + 1 ) * ( var->dim_b + 1 ) - 1 : var->dim_a;
+
+    emit_val( ctx, ctx->opcode[ COMPILE_OP_INDEX ], index );
+    emit_val( ctx, (u32) var->globals_index, index );
+    emit_val( ctx, (u32) max_subscript, index );
+    emit_val( ctx, (u32) ctx->ast.pos[ index ], index );
+    return true;
+    }
+
+
+// For string assignments of the form A$ = A$ + ..., where A$ is not an array, returns the list of terms 
+// following the leading A$, so they can be appended in place. Returns -1 for any other assignment.
+static int append_terms( emitter_context_t* ctx, int assignment )
+    {
+    ast_data_t* data = ctx->ast.node_data;
+    int variable = data[ assignment ].assignment.variable;
+    int expression = data[ assignment ].assignment.expression;
+    if( data[ variable ].variable.offset_a >= 0 ) return -1;
+    if( ctx->ast.node_type[ expression ] != AST_EXPRESSION || data[ expression ].expression.simpleexp_list >= 0 ) return -1;
+
+    int simpleexp = data[ expression ].expression.primary;
+    int term = data[ simpleexp ].simpleexp.primary;
+    if( data[ simpleexp ].simpleexp.term_list < 0 || data[ term ].term.factor_list >= 0 ) return -1;
+
+    int factor = data[ term ].term.primary;
+    int first = data[ factor ].factor.primary;
+    if( ctx->ast.node_type[ first ] != AST_VARIABLE || data[ first ].variable.offset_a >= 0 ) return -1;
+    if( data[ first ].variable.index != data[ variable ].variable.index ) return -1;
+
+    for( int list = data[ simpleexp ].simpleexp.term_list; list >= 0; list = data[ list ].list_node.next )
+        {
+        if( data[ data[ list ].list_node.item ].term.op != ast_term_t::OP_ADD ) return -1;
+        }
+    return data[ simpleexp ].simpleexp.term_list;
+    }
+
+
 static void emit( emitter_context_t* ctx, int const index )
     {
     #define node ctx->ast.node_data[ index ]
@@ -2077,14 +2960,7 @@ static void emit( emitter_context_t* ctx, int const index )
 
         case AST_LINE:
             {
-            for( int i = 0; i < ctx->ast.jump_targets_count; ++i )
-                {
-                if( ctx->ast.jump_targets[ i ] == index )
-                    {
-                    assert( ctx->jump_targets[ i ] == -1 );
-                    ctx->jump_targets[ i ] = ctx->count;
-                    }
-                }
+            emit_jump_targets( ctx, index );
     
             if( node.line.statement >= 0 )
                 emit( ctx, node.line.statement );
@@ -2100,7 +2976,10 @@ static void emit( emitter_context_t* ctx, int const index )
                 emit( ctx, arg );
                 list = ctx->ast.node_data[ list ].list_node.next;
                 }       
-            emit_val( ctx, node.proccall.id, index );
+            if( node.proccall.id < COMPILE_OPCOUNT ) 
+                emit_val( ctx, ctx->opcode[ node.proccall.id ], index );
+            else
+                emit_val( ctx, node.proccall.id, index );
             } break;
 
         case AST_READ:
@@ -2113,37 +2992,15 @@ static void emit( emitter_context_t* ctx, int const index )
                 ast_var_t* var = &ctx->ast.vars[ ctx->ast.node_data[ var_index ].variable.index ];
                 emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
                 emit_val( ctx, ctx->ast.pos[ index ], index );
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                emit_val( ctx, var->globals_index, index );
 
                 if( ctx->ast.node_data[ var_index ].variable.offset_a >= 0 )
                     {
-                    emit( ctx, ctx->ast.node_data[ var_index ].variable.offset_a );
-
-                    int dim_a = ctx->ast.vars[ ctx->ast.node_data[ var_index ].variable.index ].dim_a;
-                    int dim_b = ctx->ast.vars[ ctx->ast.node_data[ var_index ].variable.index ].dim_b;
-
-                    if( ctx->ast.node_data[ var_index ].variable.offset_b >= 0 )
-                        {
-                        emit( ctx, ctx->ast.node_data[ var_index ].variable.offset_b );
-                        emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                        emit_val( ctx, (u32) dim_a + 1, index );
-                        emit_val( ctx, ctx->opcode[ COMPILE_OP_MUL ], index );
-                        emit_val( ctx, ctx->opcode[ COMPILE_OP_ADD ], index );
-                        }
-            
-                    int min_subscript = 0;
-                    int max_subscript = dim_b > 0 ? ( dim_a + 1 ) * ( dim_b + 1 ) - 1 : dim_a;
-
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                    emit_val( ctx, (u32) min_subscript, index );
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                    emit_val( ctx, (u32) max_subscript, index );
+                    emit_subscript( ctx, var_index, index, true );
+                    }
+                else
+                    {
                     emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                    emit_val( ctx, (u32) ctx->ast.pos[ index ], index );
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_RTSS ], index );
-
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_ADD ], index );
+                    emit_val( ctx, var->globals_index, index );
                     }
                 
                 switch( var->type )
@@ -2160,6 +3017,27 @@ static void emit( emitter_context_t* ctx, int const index )
                 }       
             } break;
 
+        case AST_READARRAY:
+            {
+            ast_var_t* var = &ctx->ast.vars[ node.readarray.var_index ];
+            if( var->type != AST_TYPE_BOOL && var->type != AST_TYPE_INTEGER && var->type != AST_TYPE_FLOAT && var->type != AST_TYPE_STRING ) 
+                {
+                emitter_error( "Invalid type", ctx->ast.pos[ index ] ); 
+                return;
+                }
+            int size = var->dim_b > 0 ? ( var->dim_a + 1 ) * ( var->dim_b + 1 ) : var->dim_a + 1;
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+            emit_val( ctx, ctx->ast.pos[ index ], index );
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+            emit_val( ctx, (u32) var->type, index );
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+            emit_val( ctx, var->globals_index, index );
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+            emit_val( ctx, size, index );
+            emit( ctx, node.readarray.count );
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_READA ], index );
+            } break;
+
         case AST_RESTORE:
             {
             emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
@@ -2169,16 +3047,8 @@ static void emit( emitter_context_t* ctx, int const index )
 
         case AST_BRANCH:
             {
-            if( ctx->jump_sites_count >= ctx->jump_sites_capacity )
-                {
-                ctx->jump_sites_capacity *= 2;
-                ctx->jump_sites = (int*) realloc( ctx->jump_sites, sizeof( *ctx->jump_sites ) * ctx->jump_sites_capacity );
-                assert( ctx->jump_sites );
-                }
-
             emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-            ctx->jump_sites[ ctx->jump_sites_count++ ] = ctx->count;
-            emit_val( ctx, node.branch.target, index );
+            emit_jump_site( ctx, node.branch.target, ctx->count + 1, index );
             switch( node.branch.type )
                 {
                 case ast_branch_t::BRANCH_JUMP: emit_val( ctx, ctx->opcode[ COMPILE_OP_JMP ], index ); break;
@@ -2197,14 +3067,7 @@ static void emit( emitter_context_t* ctx, int const index )
         case AST_LOOP:
             {
             emit( ctx, node.loop.assignment );
-            for( int i = 0; i < ctx->ast.jump_targets_count; ++i )
-                {
-                if( ctx->ast.jump_targets[ i ] == index )
-                    {
-                    assert( ctx->jump_targets[ i ] == -1 );
-                    ctx->jump_targets[ i ] = ctx->count;
-                    }
-                }
+            emit_jump_targets( ctx, index );
             } break;
 
         case AST_NEXT:
@@ -2221,51 +3084,57 @@ static void emit( emitter_context_t* ctx, int const index )
 
         case AST_ASSIGNMENT:
             {
-            emit( ctx, node.assignment.expression );
-            emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-            emit_val( ctx, ctx->ast.vars[ ctx->ast.node_data[ node.assignment.variable ].variable.index ].globals_index, index );
-
-            if( ctx->ast.node_data[ node.assignment.variable ].variable.offset_a >= 0 )
+            if( ast_get_type( ctx, node.assignment.expression ) == AST_TYPE_STRING )
                 {
-                emit( ctx, ctx->ast.node_data[ node.assignment.variable ].variable.offset_a );
-
-                int dim_a = ctx->ast.vars[ ctx->ast.node_data[ node.assignment.variable ].variable.index ].dim_a;
-                int dim_b = ctx->ast.vars[ ctx->ast.node_data[ node.assignment.variable ].variable.index ].dim_b;
-
-                if( ctx->ast.node_data[ node.assignment.variable ].variable.offset_b >= 0 )
+                int list = append_terms( ctx, index );
+                if( list >= 0 )
                     {
-                    emit( ctx, ctx->ast.node_data[ node.assignment.variable ].variable.offset_b );
+                    // The whole tail is evaluated before appending, in case it refers to the variable itself
+                    emit( ctx, ctx->ast.node_data[ list ].list_node.item );
+                    for( list = ctx->ast.node_data[ list ].list_node.next; list >= 0; list = ctx->ast.node_data[ list ].list_node.next )
+                        {
+                        emit( ctx, ctx->ast.node_data[ list ].list_node.item );
+                        emit_val( ctx, ctx->opcode[ COMPILE_OP_CATC ], index );
+                        }
                     emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                    emit_val( ctx, (u32) dim_a + 1, index );
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_MUL ], index );
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_ADD ], index );
+                    emit_val( ctx, ctx->ast.vars[ ctx->ast.node_data[ node.assignment.variable ].variable.index ].globals_index, index );
+                    emit_val( ctx, ctx->opcode[ COMPILE_OP_APPENDC ], index );
+                    break;
                     }
-            
-                int min_subscript = 0;
-                int max_subscript = dim_b > 0 ? ( dim_a + 1 ) * ( dim_b + 1 ) - 1 : dim_a;
-
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                emit_val( ctx, (u32) min_subscript, index );
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                emit_val( ctx, (u32) max_subscript, index );
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                emit_val( ctx, (u32) ctx->ast.pos[ index ], index );
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_RTSS ], index );
-
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_ADD ], index );
                 }
 
+            emit( ctx, node.assignment.expression );
+
+            compile_op_t store = COMPILE_OP_STORE;
+            compile_op_t store_array = COMPILE_OP_STOREA;
             ast_type_t type = ast_get_type( ctx, node.assignment.expression );
             switch( type )
                 {
                 case AST_TYPE_INTEGER:
                 case AST_TYPE_FLOAT:
-                case AST_TYPE_BOOL:     emit_val( ctx, ctx->opcode[ COMPILE_OP_STORE ], index ); break;
-                case AST_TYPE_STRING:   emit_val( ctx, ctx->opcode[ COMPILE_OP_STOREC ], index ); break;
+                case AST_TYPE_BOOL:     break;
+                case AST_TYPE_STRING:   store = COMPILE_OP_STOREC; store_array = COMPILE_OP_STOREAC; break;
                 case AST_TYPE_NONE:
                 default: emitter_error( "Invalid type", ctx->ast.pos[ index ] ); return;                
                 }
 
+            int globals_index = ctx->ast.vars[ ctx->ast.node_data[ node.assignment.variable ].variable.index ].globals_index;
+            if( ctx->ast.node_data[ node.assignment.variable ].variable.offset_a < 0 )
+                {
+                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+                emit_val( ctx, globals_index, index );
+                emit_val( ctx, ctx->opcode[ store ], index );
+                }
+            else if( emit_subscript( ctx, node.assignment.variable, index, false ) )
+                {
+                emit_val( ctx, ctx->opcode[ store ], index );
+                }
+            else
+                {
+                emit_val( ctx, ctx->opcode[ store_array ], index );
+                emit_val( ctx, globals_index, index );
+                }
+
             } break;
 
         case AST_EXPRESSION:
@@ -2523,49 +3392,35 @@ static void emit( emitter_context_t* ctx, int const index )
 
         case AST_VARIABLE:
             {
-            emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-            emit_val( ctx, (u32) ctx->ast.vars[ node.variable.index ].globals_index, index );
-
-            if( node.variable.offset_a >= 0 )
-                {
-                emit( ctx, node.variable.offset_a );
-
-                int dim_a = ctx->ast.vars[ node.variable.index ].dim_a;
-                int dim_b = ctx->ast.vars[ node.variable.index ].dim_b;
-
-                if( node.variable.offset_b >= 0 )
-                    {
-                    emit( ctx, node.variable.offset_b );
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                    emit_val( ctx, (u32) dim_a + 1, index );
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_MUL ], index );
-                    emit_val( ctx, ctx->opcode[ COMPILE_OP_ADD ], index );
-                    }
-            
-                int min_subscript = 0;
-                int max_subscript = dim_b > 0 ? ( dim_a + 1 ) * ( dim_b + 1 ) - 1: dim_a;
-
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                emit_val( ctx, (u32) min_subscript, index );
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                emit_val( ctx, (u32) max_subscript, index );
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
-                emit_val( ctx, (u32) ctx->ast.pos[ index ], index );
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_RTSS ], index );
-
-                emit_val( ctx, ctx->opcode[ COMPILE_OP_ADD ], index );
-                }
-
+            compile_op_t load = COMPILE_OP_LOAD;
+            compile_op_t load_array = COMPILE_OP_LOADA;
             ast_type_t type = ctx->ast.vars[ node.variable.index ].type;
             switch( type )
                 {
                 case AST_TYPE_INTEGER:
                 case AST_TYPE_FLOAT:
-                case AST_TYPE_BOOL:     emit_val( ctx, ctx->opcode[ COMPILE_OP_LOAD ],  index ); break;
-                case AST_TYPE_STRING:   emit_val( ctx, ctx->opcode[ COMPILE_OP_LOADC ], index ); break;
+                case AST_TYPE_BOOL:     break;
+                case AST_TYPE_STRING:   load = COMPILE_OP_LOADC; load_array = COMPILE_OP_LOADAC; break;
                 case AST_TYPE_NONE:
                 default: emitter_error( "Invalid variable type", ctx->ast.pos[ index ] ); return;               
                 }
+
+            u32 globals_index = (u32) ctx->ast.vars[ node.variable.index ].globals_index;
+            if( node.variable.offset_a < 0 )
+                {
+                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+                emit_val( ctx, globals_index, index );
+                emit_val( ctx, ctx->opcode[ load ], index );
+                }
+            else if( emit_subscript( ctx, index, index, false ) )
+                {
+                emit_val( ctx, ctx->opcode[ load ], index );
+                }
+            else
+                {
+                emit_val( ctx, ctx->opcode[ load_array ], index );
+                emit_val( ctx, globals_index, index );
+                }
             } break;    
 
         case AST_END:
@@ -2583,6 +3438,80 @@ static void emit( emitter_context_t* ctx, int const index )
             emit_val( ctx, ctx->opcode[ COMPILE_OP_TROFF ], index );
             } break;
 
+        // JTAB is followed by the entry count, the value of the first entry, one offset per entry and a 
+        // default offset, all relative to the JTAB op. For ON GOSUB, the entries lead to a JSR followed 
+        // by a jump past the table, so that RETURN resumes after the ON statement.
+        case AST_ON:
+            {
+            emit( ctx, node.on.expression );
+            int count = node.on.count;
+            int jtab = ctx->count;
+            int after = jtab + 4 + count + ( node.on.gosub ? count * 6 : 0 );
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_JTAB ], index );
+            emit_val( ctx, count, index );
+            emit_val( ctx, 1, index );
+            int entry = 0;
+            for( int list = node.on.branch_list; list >= 0; list = ctx->ast.node_data[ list ].list_node.next )
+                {
+                int branch = ctx->ast.node_data[ list ].list_node.item;
+                if( node.on.gosub ) emit_val( ctx, 4 + count + entry * 6, branch );
+                else emit_jump_site( ctx, ctx->ast.node_data[ branch ].branch.target, jtab, branch );
+                ++entry;
+                }
+            emit_val( ctx, after - jtab, index );
+
+            if( !node.on.gosub ) break;
+            for( int list = node.on.branch_list; list >= 0; list = ctx->ast.node_data[ list ].list_node.next )
+                {
+                int branch = ctx->ast.node_data[ list ].list_node.item;
+                emit( ctx, branch );
+                emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], branch );
+                emit_val( ctx, after - ( ctx->count + 1 ), branch );
+                emit_val( ctx, ctx->opcode[ COMPILE_OP_JMP ], branch );
+                }
+            } break;
+
+        case AST_SELECT:
+            {
+            emit( ctx, node.select.expression );
+            int min = node.select.min;
+            int count = node.select.max >= min ? node.select.max - min + 1 : 0;
+            int fallback = node.select.else_case >= 0 ? ctx->ast.node_data[ node.select.else_case ].case_.target : node.select.end_target;
+
+            int* entries = (int*) malloc( sizeof( *entries ) * ( count + 1 ) );
+            assert( entries );
+            for( int i = 0; i < count; ++i ) entries[ i ] = fallback;
+            for( int list = node.select.case_list; list >= 0; list = ctx->ast.node_data[ list ].list_node.next )
+                {
+                ast_case_t* case_ = &ctx->ast.node_data[ ctx->ast.node_data[ list ].list_node.item ].case_;
+                for( int value = case_->value_list; value >= 0; value = ctx->ast.node_data[ value ].list_node.next )
+                    entries[ ctx->ast.node_data[ ctx->ast.node_data[ value ].list_node.item ].integer.value - min ] = case_->target;
+                }
+
+            int jtab = ctx->count;
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_JTAB ], index );
+            emit_val( ctx, count, index );
+            emit_val( ctx, min, index );
+            for( int i = 0; i < count; ++i ) emit_jump_site( ctx, entries[ i ], jtab, index );
+            emit_jump_site( ctx, fallback, jtab, index );
+            free( entries );
+            } break;
+
+        case AST_CASE:
+            {
+            // the previous case ends here
+            int end_target = ctx->ast.node_data[ node.case_.select ].select.end_target;
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_PUSH ], index );
+            emit_jump_site( ctx, end_target, ctx->count + 1, index );
+            emit_val( ctx, ctx->opcode[ COMPILE_OP_JMP ], index );
+            emit_jump_targets( ctx, index );
+            } break;
+
+        case AST_ENDSELECT:
+            {
+            emit_jump_targets( ctx, index );
+            } break;
+
         case AST_LIST_NODE:
         case AST_DIM:
         case AST_DATA:
@@ -2604,7 +3533,7 @@ static void patch_jumps( emitter_context_t* ctx )
             emitter_error( "Could not resolve jump target", ctx->ast.pos[ ctx->ast.jump_targets[ *jump_site ] ] );
             return;
             }
-        *jump_site = (u32)( jump_target - ctx->jump_sites[ i ] - 1 );
+        *jump_site = (u32)( jump_target - ctx->jump_bases[ i ] );
         }
     }
 
@@ -2641,11 +3570,14 @@ static emitted_t emit( ast_t ast, u32* opcodes )
     ctx.jump_sites_count = 0;
     ctx.jump_sites = (int*) malloc( sizeof( *ctx.jump_sites ) * ctx.jump_sites_capacity );
     assert( ctx.jump_sites );
+    ctx.jump_bases = (int*) malloc( sizeof( *ctx.jump_bases ) * ctx.jump_sites_capacity );
+    assert( ctx.jump_bases );
 
     emit( &ctx, 0 );
 
     if( !compile_error.state ) patch_jumps( &ctx );
     free( ctx.jump_sites );
+    free( ctx.jump_bases );
     free( ctx.jump_targets );
 
     if( compile_error.state )
@@ -2666,6 +3598,866 @@ static emitted_t emit( ast_t ast, u32* opcodes )
 //////// EMITTER END ////////
 
 
+//////// C EMITTER BEGIN ////////
+
+
+// Alternative backend, which translates the AST into C code instead of bytecode. The generated code 
+// runs against the same vm_context_t as the interpreter (value stack, string pool, DATA pointer and 
+// pause state), so host functions behave identically. Pure integer/float/bool expressions become 
+// plain C expressions on a static globals array, while anything involving strings or host calls 
+// is evaluated on the VM stack, so that no C locals are live when a host call pauses the program. 
+// Every jump target, return point and host call site gets a resume id, and aot_run dispatches on
+// the saved id when it is re-entered.
+
+struct c_emitter_context_t
+    {
+    ast_t ast;
+    char const** host_func_signatures;
+
+    char* text;
+    int length;
+    int capacity;
+
+    int resume_count;
+    };
+
+
+static void c_print( c_emitter_context_t* ctx, char const* format, ... )
+    {
+    va_list args;
+    va_start( args, format );
+    int length = vsnprintf( NULL, 0, format, args );
+    va_end( args );
+    assert( length >= 0 );
+
+    if( ctx->length + length + 1 > ctx->capacity )
+        {
+        while( ctx->length + length + 1 > ctx->capacity ) ctx->capacity *= 2;
+        ctx->text = (char*) realloc( ctx->text, (size_t) ctx->capacity );
+        assert( ctx->text );
+        }
+
+    va_start( args, format );
+    vsnprintf( ctx->text + ctx->length, (size_t)( length + 1 ), format, args );
+    va_end( args );
+    ctx->length += length;
+    }
+
+
+static ast_type_t ast_get_type( const c_emitter_context_t* ctx, int index )
+    {
+    return ast_get_type( ctx->ast.node_type, ctx->ast.node_data, ctx->ast.vars, index );
+    }
+
+
+struct c_op_t { char const* pre; char const* mid; char const* post; };
+
+
+// Operand texts are always primary expressions (literals, globals or fully parenthesized), so the 
+// operators can be emitted without regard to C precedence
+static bool c_binary_op( ast_type_t type, ast_node_t list_type, int op, c_op_t* out )
+    {
+    static c_op_t const compare_int[] = { { "( ", " == ", " )" }, { "( ", " != ", " )" }, { "( ", " <= ", " )" }, 
+        { "( ", " >= ", " )" }, { "( ", " < ", " )" }, { "( ", " > ", " )" }, };
+    static c_op_t const compare_float[] = { { "( fabsf( ", " - ", " ) < FLT_EPSILON )" }, 
+        { "( fabsf( ", " - ", " ) >= FLT_EPSILON )" }, { "( ", " <= ", " )" }, { "( ", " >= ", " )" }, 
+        { "( ", " < ", " )" }, { "( ", " > ", " )" }, };
+    static c_op_t const term_int[] = { { "(int)( (u32)", " + (u32)", " )" }, { "(int)( (u32)", " - (u32)", " )" },
+        { "( ", " | ", " )" }, { "( ", " ^ ", " )" }, };
+    static c_op_t const term_float[] = { { "( ", " + ", " )" }, { "( ", " - ", " )" }, };
+    static c_op_t const term_bool[] = { { "( ( ", " != 0 ) | ( ", " != 0 ) )" }, { "( ( ", " != 0 ) ^ ( ", " != 0 ) )" }, };
+    static c_op_t const factor_int[] = { { "(int)( (u32)", " * (u32)", " )" }, { "( ", " / ", " )" }, 
+        { "( ", " % ", " )" }, { "( ", " & ", " )" }, };
+    static c_op_t const factor_float[] = { { "( ", " * ", " )" }, { "( ", " / ", " )" }, { "fmodf( ", ", ", " )" }, };
+    static c_op_t const factor_bool = { "( ( ", " != 0 ) & ( ", " != 0 ) )" };
+
+    switch( list_type )
+        {
+        case AST_SIMPLEEXP:
+            {
+            if( op < ast_simpleexp_t::OP_EQ || op > ast_simpleexp_t::OP_GT ) return false;
+            if( type == AST_TYPE_INTEGER ) { *out = compare_int[ op ]; return true; }
+            if( type == AST_TYPE_FLOAT ) { *out = compare_float[ op ]; return true; }
+            } break;
+
+        case AST_TERM:
+            {
+            if( type == AST_TYPE_INTEGER && op >= ast_term_t::OP_ADD && op <= ast_term_t::OP_XOR ) { *out = term_int[ op ]; return true; }
+            if( type == AST_TYPE_FLOAT && op >= ast_term_t::OP_ADD && op <= ast_term_t::OP_SUB ) { *out = term_float[ op ]; return true; }
+            if( type == AST_TYPE_BOOL && op >= ast_term_t::OP_OR && op <= ast_term_t::OP_XOR ) { *out = term_bool[ op - ast_term_t::OP_OR ]; return true; }
+            } break;
+
+        case AST_FACTOR:
+            {
+            if( type == AST_TYPE_INTEGER && op >= ast_factor_t::OP_MUL && op <= ast_factor_t::OP_AND ) { *out = factor_int[ op ]; return true; }
+            if( type == AST_TYPE_FLOAT && op >= ast_factor_t::OP_MUL && op <= ast_factor_t::OP_MOD ) { *out = factor_float[ op ]; return true; }
+            if( type == AST_TYPE_BOOL && op == ast_factor_t::OP_AND ) { *out = factor_bool; return true; }
+            } break;
+
+        default:
+            break;
+        }
+
+    return false;
+    }
+
+
+static bool c_unary_op( ast_type_t type, int op, c_op_t* out )
+    {
+    c_op_t const neg_int = { "(int)( 0u - (u32)", "", " )" };
+    c_op_t const not_int = { "( ~", "", " )" };
+    c_op_t const not_bool = { "( ", "", " == 0 )" };
+    c_op_t const neg_float = { "( -", "", " )" };
+
+    if( type == AST_TYPE_INTEGER && op == ast_unaryexp_t::OP_NEG ) { *out = neg_int; return true; }
+    if( type == AST_TYPE_INTEGER && op == ast_unaryexp_t::OP_NOT ) { *out = not_int; return true; }
+    if( type == AST_TYPE_BOOL && op == ast_unaryexp_t::OP_NOT ) { *out = not_bool; return true; }
+    if( type == AST_TYPE_FLOAT && op == ast_unaryexp_t::OP_NEG ) { *out = neg_float; return true; }
+    return false;
+    }
+
+
+static int c_list_op( c_emitter_context_t* ctx, ast_node_t list_type, int item )
+    {
+    switch( list_type )
+        {
+        case AST_SIMPLEEXP: return ctx->ast.node_data[ item ].simpleexp.op;
+        case AST_TERM: return ctx->ast.node_data[ item ].term.op;
+        case AST_FACTOR: return ctx->ast.node_data[ item ].factor.op;
+        default: return -1;
+        }
+    }
+
+
+static char const* c_string_op( ast_node_t list_type, int op )
+    {
+    static char const* compare[] = { "VM_OP_EQC", "VM_OP_NEC", "VM_OP_LEC", "VM_OP_GEC", "VM_OP_LTC", "VM_OP_GTC", };
+    if( list_type == AST_SIMPLEEXP && op >= ast_simpleexp_t::OP_EQ && op <= ast_simpleexp_t::OP_GT ) return compare[ op ];
+    if( list_type == AST_TERM && op == ast_term_t::OP_ADD ) return "VM_OP_CATC";
+    return NULL;
+    }
+
+
+// Pure expressions have no host calls and no strings, and can be emitted as a single C expression
+static bool c_is_pure( c_emitter_context_t* ctx, int index )
+    {
+    #define node ctx->ast.node_data[ index ]
+
+    int primary = -1;
+    int list = -1;
+    switch( ctx->ast.node_type[ index ] )
+        {
+        case AST_INTEGER:
+        case AST_FLOAT:
+            return true;
+
+        case AST_VARIABLE:
+            {
+            if( ctx->ast.vars[ node.variable.index ].type == AST_TYPE_STRING ) return false;
+            if( node.variable.offset_a >= 0 && !c_is_pure( ctx, node.variable.offset_a ) ) return false;
+            if( node.variable.offset_b >= 0 && !c_is_pure( ctx, node.variable.offset_b ) ) return false;
+            } return true;
+
+        case AST_EXPRESSION: primary = node.expression.primary; list = node.expression.simpleexp_list; break;
+        case AST_SIMPLEEXP: primary = node.simpleexp.primary; list = node.simpleexp.term_list; break;
+        case AST_TERM: primary = node.term.primary; list = node.term.factor_list; break;
+        case AST_FACTOR: primary = node.factor.primary; break;
+        case AST_UNARYEXP: primary = node.unaryexp.factor; break;
+
+        default:
+            return false;
+        }
+
+    if( ast_get_type( ctx, primary ) == AST_TYPE_STRING || !c_is_pure( ctx, primary ) ) return false;
+    while( list >= 0 )
+        {
+        if( !c_is_pure( ctx, ctx->ast.node_data[ list ].list_node.item ) ) return false;
+        list = ctx->ast.node_data[ list ].list_node.next;
+        }
+    return true;
+
+    #undef node
+    }
+
+
+static int c_max_subscript( ast_var_t const* var )
+    {
+    return var->dim_b > 0 ? ( var->dim_a + 1 ) * ( var->dim_b + 1 ) - 1 : var->dim_a;
+    }
+
+
+static void c_value( c_emitter_context_t* ctx, int index );
+static void c_push( c_emitter_context_t* ctx, int index );
+
+
+// If the subscript of an array variable is not pure, it is evaluated onto the VM stack ahead of 
+// the statement using it, and c_slot will pop it from there
+static bool c_push_subscript( c_emitter_context_t* ctx, int variable )
+    {
+    ast_variable_t const* var_node = &ctx->ast.node_data[ variable ].variable;
+    if( var_node->offset_a < 0 ) return false;
+    if( c_is_pure( ctx, var_node->offset_a ) && ( var_node->offset_b < 0 || c_is_pure( ctx, var_node->offset_b ) ) ) return false;
+
+    c_push( ctx, var_node->offset_a );
+    if( var_node->offset_b >= 0 )
+        {
+        c_push( ctx, var_node->offset_b );
+        c_print( ctx, "    { int b = aot_popi( ctx ); int a = aot_popi( ctx ); aot_pushi( ctx, (int)( (u32)a + (u32)b * %uu ) ); }\n",
+            (u32) ctx->ast.vars[ var_node->index ].dim_a + 1 );
+        }
+    return true;
+    }
+
+
+static void c_slot( c_emitter_context_t* ctx, int variable, int pos, bool pushed, bool force_check )
+    {
+    ast_variable_t const* var_node = &ctx->ast.node_data[ variable ].variable;
+    ast_var_t const* var = &ctx->ast.vars[ var_node->index ];
+    if( var_node->offset_a < 0 ) 
+        { 
+        c_print( ctx, "%d", var->globals_index ); 
+        return; 
+        }
+
+    bool checked = pushed || force_check || !var_node->in_bounds;
+    c_print( ctx, checked ? "%d + aot_index( " : "%d + ( ", var->globals_index );
+    if( pushed )
+        {
+        c_print( ctx, "aot_popi( ctx )" );
+        }
+    else if( var_node->offset_b >= 0 )
+        {
+        c_print( ctx, "(int)( (u32)" );
+        c_value( ctx, var_node->offset_a );
+        c_print( ctx, " + (u32)" );
+        c_value( ctx, var_node->offset_b );
+        c_print( ctx, " * %uu )", (u32) var->dim_a + 1 );
+        }
+    else
+        {
+        c_value( ctx, var_node->offset_a );
+        }
+    if( checked ) c_print( ctx, ", %d, %d )", c_max_subscript( var ), pos );
+    else c_print( ctx, " )" );
+    }
+
+
+static void c_value( c_emitter_context_t* ctx, int index )
+    {
+    #define node ctx->ast.node_data[ index ]
+
+    ast_node_t list_type = AST_SIMPLEEXP;
+    int primary = -1;
+    int list = -1;
+    switch( ctx->ast.node_type[ index ] )
+        {
+        case AST_INTEGER:
+            {
+            c_print( ctx, "%d", node.integer.value );
+            } return;
+
+        case AST_FLOAT:
+            {
+            char str[ 64 ];
+            snprintf( str, sizeof( str ), "%.9g", node.float_.value );
+            c_print( ctx, strpbrk( str, ".e" ) ? "%sf" : "%s.0f", str );
+            } return;
+
+        case AST_VARIABLE:
+            {
+            c_print( ctx, "aot_globals[ " );
+            c_slot( ctx, index, ctx->ast.pos[ index ], false, false );
+            c_print( ctx, ctx->ast.vars[ node.variable.index ].type == AST_TYPE_FLOAT ? " ].f" : " ].i" );
+            } return;
+
+        case AST_FACTOR:
+            {
+            c_value( ctx, node.factor.primary );
+            } return;
+
+        case AST_UNARYEXP:
+            {
+            c_op_t op;
+            if( !c_unary_op( ast_get_type( ctx, node.unaryexp.factor ), node.unaryexp.op, &op ) ) 
+                { 
+                emitter_error( "Invalid operation", ctx->ast.pos[ index ] ); 
+                return; 
+                }
+            c_print( ctx, "%s", op.pre );
+            c_value( ctx, node.unaryexp.factor );
+            c_print( ctx, "%s", op.post );
+            } return;
+
+        case AST_EXPRESSION: list_type = AST_SIMPLEEXP; primary = node.expression.primary; list = node.expression.simpleexp_list; break;
+        case AST_SIMPLEEXP: list_type = AST_TERM; primary = node.simpleexp.primary; list = node.simpleexp.term_list; break;
+        case AST_TERM: list_type = AST_FACTOR; primary = node.term.primary; list = node.term.factor_list; break;
+
+        default:
+            emitter_error( "Invalid expression", ctx->ast.pos[ index ] ); 
+            return;
+        }
+
+    // Left associative, so all the operator prefixes are emitted before the primary, innermost last
+    ast_type_t type = ast_get_type( ctx, primary );
+    int count = 0;
+    for( int i = list; i >= 0; i = ctx->ast.node_data[ i ].list_node.next ) ++count;
+    for( int n = count - 1; n >= 0; --n )
+        {
+        int item = list;
+        for( int i = 0; i < n; ++i ) item = ctx->ast.node_data[ item ].list_node.next;
+        c_op_t op;
+        if( !c_binary_op( type, list_type, c_list_op( ctx, list_type, ctx->ast.node_data[ item ].list_node.item ), &op ) )
+            {
+            emitter_error( "Invalid operation", ctx->ast.pos[ index ] ); 
+            return;
+            }
+        c_print( ctx, "%s", op.pre );
+        }
+    c_value( ctx, primary );
+    while( list >= 0 )
+        {
+        int item = ctx->ast.node_data[ list ].list_node.item;
+        c_op_t op;
+        c_binary_op( type, list_type, c_list_op( ctx, list_type, item ), &op );
+        c_print( ctx, "%s", op.mid );
+        c_value( ctx, item );
+        c_print( ctx, "%s", op.post );
+        list = ctx->ast.node_data[ list ].list_node.next;
+        }
+
+    #undef node
+    }
+
+
+static void c_call( c_emitter_context_t* ctx, int index )
+    {
+    int list = ctx->ast.node_data[ index ].proccall.arg_list;
+    while( list >= 0 )
+        {
+        c_push( ctx, ctx->ast.node_data[ list ].list_node.item );
+        list = ctx->ast.node_data[ list ].list_node.next;
+        }
+
+    u32 id = ctx->ast.node_data[ index ].proccall.id;
+    if( id < COMPILE_OPCOUNT )
+        {
+        for( int i = 0; i < (int)( sizeof( builtin_funcs ) / sizeof( *builtin_funcs ) ); ++i )
+            {
+            if( builtin_funcs[ i ].op == (compile_op_t) id ) 
+                c_print( ctx, "    ctx->optable[ %s ]( ctx ); // %s\n", builtin_funcs[ i ].vm_op, builtin_funcs[ i ].signature );
+            }
+        return;
+        }
+
+    int func = (int) id - COMPILE_OPCOUNT;
+    c_print( ctx, "    AOT_CALL( %d, %d ) // %s\n", func, ctx->resume_count++, ctx->host_func_signatures[ func ] );
+    }
+
+
+static void c_push( c_emitter_context_t* ctx, int index )
+    {
+    #define node ctx->ast.node_data[ index ]
+
+    ast_type_t type = ast_get_type( ctx, index );
+    if( c_is_pure( ctx, index ) )
+        {
+        c_print( ctx, type == AST_TYPE_FLOAT ? "    aot_pushf( ctx, " : "    aot_pushi( ctx, " );
+        c_value( ctx, index );
+        c_print( ctx, " );\n" );
+        return;
+        }
+
+    ast_node_t list_type = AST_SIMPLEEXP;
+    int primary = -1;
+    int list = -1;
+    switch( ctx->ast.node_type[ index ] )
+        {
+        case AST_STRING:
+            {
+            c_print( ctx, "    aot_pushc( ctx, %uu );\n", node.string.handle );
+            } return;
+
+        case AST_VARIABLE:
+            {
+            bool pushed = c_push_subscript( ctx, index );
+            c_print( ctx, type == AST_TYPE_STRING ? "    aot_pushc( ctx, aot_globals[ " : "    aot_push( ctx, aot_globals[ " );
+            c_slot( ctx, index, ctx->ast.pos[ index ], pushed, false );
+            c_print( ctx, " ].u );\n" );
+            } return;
+
+        case AST_FUNCCALL:
+            {
+            c_call( ctx, index );
+            } return;
+
+        case AST_FACTOR:
+            {
+            c_push( ctx, node.factor.primary );
+            } return;
+
+        case AST_UNARYEXP:
+            {
+            ast_type_t operand_type = ast_get_type( ctx, node.unaryexp.factor );
+            c_op_t op;
+            if( !c_unary_op( operand_type, node.unaryexp.op, &op ) ) 
+                { 
+                emitter_error( "Invalid operation", ctx->ast.pos[ index ] ); 
+                return; 
+                }
+            c_push( ctx, node.unaryexp.factor );
+            if( operand_type == AST_TYPE_FLOAT )
+                c_print( ctx, "    { float a = aot_popf( ctx ); aot_pushf( ctx, %sa%s ); }\n", op.pre, op.post );
+            else
+                c_print( ctx, "    { int a = aot_popi( ctx ); aot_pushi( ctx, %sa%s ); }\n", op.pre, op.post );
+            } return;
+
+        case AST_EXPRESSION: list_type = AST_SIMPLEEXP; primary = node.expression.primary; list = node.expression.simpleexp_list; break;
+        case AST_SIMPLEEXP: list_type = AST_TERM; primary = node.simpleexp.primary; list = node.simpleexp.term_list; break;
+        case AST_TERM: list_type = AST_FACTOR; primary = node.term.primary; list = node.term.factor_list; break;
+
+        default:
+            emitter_error( "Invalid expression", ctx->ast.pos[ index ] ); 
+            return;
+        }
+
+    ast_type_t operand_type = ast_get_type( ctx, primary );
+    c_push( ctx, primary );
+    while( list >= 0 )
+        {
+        int item = ctx->ast.node_data[ list ].list_node.item;
+        int op_index = c_list_op( ctx, list_type, item );
+        c_push( ctx, item );
+        if( operand_type == AST_TYPE_STRING )
+            {
+            char const* op = c_string_op( list_type, op_index );
+            if( !op )
+                {
+                emitter_error( "Invalid operation", ctx->ast.pos[ index ] ); 
+                return;
+                }
+            c_print( ctx, "    ctx->optable[ %s ]( ctx );\n", op );
+            }
+        else
+            {
+            c_op_t op;
+            if( !c_binary_op( operand_type, list_type, op_index, &op ) )
+                {
+                emitter_error( "Invalid operation", ctx->ast.pos[ index ] ); 
+                return;
+                }
+            bool float_result = operand_type == AST_TYPE_FLOAT && list_type != AST_SIMPLEEXP;
+            if( operand_type == AST_TYPE_FLOAT )
+                c_print( ctx, "    { float b = aot_popf( ctx ); float a = aot_popf( ctx ); %s( ctx, %sa%sb%s ); }\n", 
+                    float_result ? "aot_pushf" : "aot_pushi", op.pre, op.mid, op.post );
+            else
+                c_print( ctx, "    { int b = aot_popi( ctx ); int a = aot_popi( ctx ); aot_pushi( ctx, %sa%sb%s ); }\n", 
+                    op.pre, op.mid, op.post );
+            }
+        list = ctx->ast.node_data[ list ].list_node.next;
+        }
+
+    #undef node
+    }
+
+
+static void c_jump( c_emitter_context_t* ctx, int branch )
+    {
+    c_print( ctx, "AOT_JUMP( %d )\n", ctx->ast.node_data[ branch ].branch.target + 1 );
+    }
+
+
+static void c_labels( c_emitter_context_t* ctx, int index )
+    {
+    for( int i = 0; i < ctx->ast.jump_targets_count; ++i )
+        if( ctx->ast.jump_targets[ i ] == index ) c_print( ctx, "AOT_LABEL( %d )\n", i + 1 );
+    }
+
+
+static void c_statement( c_emitter_context_t* ctx, int index )
+    {
+    #define node ctx->ast.node_data[ index ]
+
+    switch( ctx->ast.node_type[ index ] )
+        {
+        case AST_PROGRAM:
+            {
+            int list = node.program.line_list;
+            while( list >= 0 )
+                {
+                c_statement( ctx, ctx->ast.node_data[ list ].list_node.item );
+                if( compile_error.state ) return;
+                list = ctx->ast.node_data[ list ].list_node.next;
+                }       
+            } break;
+
+        case AST_LINE:
+            {
+            c_print( ctx, "\n// %d\n", node.line.number );
+            c_labels( ctx, index );
+            if( node.line.statement >= 0 )
+                c_statement( ctx, node.line.statement );
+            } break;
+
+        case AST_PROCCALL:
+            {
+            c_call( ctx, index );
+            } break;
+
+        case AST_READ:
+            {
+            static char const* read_ops[] = { "VM_OP_READB", "VM_OP_READ", "VM_OP_READF", "VM_OP_READC" };
+            int list = node.read.var_list;
+            while( list >= 0 )
+                {
+                int variable = ctx->ast.node_data[ list ].list_node.item;
+                ast_type_t type = ctx->ast.vars[ ctx->ast.node_data[ variable ].variable.index ].type;
+                if( type != AST_TYPE_BOOL && type != AST_TYPE_INTEGER && type != AST_TYPE_FLOAT && type != AST_TYPE_STRING ) 
+                    {
+                    emitter_error( "Invalid type", ctx->ast.pos[ index ] ); 
+                    return;
+                    }
+
+                // READ is done by the VM op, into globals slot 0 of the VM context, and then moved 
+                bool pushed = c_push_subscript( ctx, variable );
+                c_print( ctx, "    { u32 slot = " );
+                c_slot( ctx, variable, ctx->ast.pos[ index ], pushed, true );
+                c_print( ctx, "; ctx->globals[ 0 ] = aot_globals[ slot ].u; aot_pushi( ctx, %d ); aot_push( ctx, 0 ); "
+                    "ctx->optable[ %s ]( ctx ); aot_globals[ slot ].u = ctx->globals[ 0 ]; }\n", 
+                    ctx->ast.pos[ index ], read_ops[ type - AST_TYPE_BOOL ] );
+                list = ctx->ast.node_data[ list ].list_node.next;
+                }       
+            } break;
+
+        case AST_READARRAY:
+            {
+            ast_var_t* var = &ctx->ast.vars[ node.readarray.var_index ];
+            if( var->type != AST_TYPE_BOOL && var->type != AST_TYPE_INTEGER && var->type != AST_TYPE_FLOAT && var->type != AST_TYPE_STRING ) 
+                {
+                emitter_error( "Invalid type", ctx->ast.pos[ index ] ); 
+                return;
+                }
+
+            // READA is run by the VM op, with the globals of the VM context pointing at the static ones
+            c_print( ctx, "    aot_pushi( ctx, %d ); aot_pushi( ctx, %d ); aot_pushi( ctx, %d ); aot_pushi( ctx, %d );\n", 
+                ctx->ast.pos[ index ], (int) var->type, var->globals_index, c_max_subscript( var ) + 1 );
+            c_push( ctx, node.readarray.count );
+            c_print( ctx, "    { u32* globals = ctx->globals; ctx->globals = &aot_globals[ 0 ].u; ctx->optable[ VM_OP_READA ]( ctx ); "
+                "ctx->globals = globals; }\n" );
+            } break;
+
+        case AST_RESTORE:
+            {
+            c_print( ctx, "    aot_pushi( ctx, %d ); ctx->optable[ VM_OP_RSTO ]( ctx );\n", node.restore.index );
+            } break;
+
+        case AST_BRANCH:
+            {
+            switch( node.branch.type )
+                {
+                case ast_branch_t::BRANCH_JUMP: 
+                    {
+                    c_print( ctx, "    " );
+                    c_jump( ctx, index );
+                    } break;
+
+                case ast_branch_t::BRANCH_SUB:  
+                    {
+                    int resume = ctx->resume_count++;
+                    c_print( ctx, "    aot_push( ctx, %d ); ", resume );
+                    c_jump( ctx, index );
+                    c_print( ctx, "AOT_LABEL( %d )\n", resume );
+                    } break;
+
+                case ast_branch_t::BRANCH_COND: 
+                case ast_branch_t::BRANCH_LOOP: 
+                    {
+                    c_print( ctx, "    if( aot_popi( ctx ) ) " );
+                    c_jump( ctx, index );
+                    } break;
+
+                default: emitter_error( "Invalid branch type", ctx->ast.pos[ index ] ); return;
+                }
+            } break;
+
+        case AST_RETURN:
+            {
+            c_print( ctx, "    AOT_RETURN()\n" );
+            } break;
+
+        case AST_LOOP:
+            {
+            c_statement( ctx, node.loop.assignment );
+            c_labels( ctx, index );
+            } break;
+
+        case AST_NEXT:
+            {
+            c_statement( ctx, node.next.assignment );
+            c_statement( ctx, node.next.condition );
+            } break;
+
+        case AST_CONDITION:
+            {
+            if( c_is_pure( ctx, node.condition.expression ) )
+                {
+                c_print( ctx, "    if( " );
+                c_value( ctx, node.condition.expression );
+                c_print( ctx, " ) " );
+                c_jump( ctx, node.condition.branch );
+                }
+            else
+                {
+                c_push( ctx, node.condition.expression );
+                c_statement( ctx, node.condition.branch );
+                }
+            } break;
+
+        case AST_ASSIGNMENT:
+            {
+            int variable = node.assignment.variable;
+            int expression = node.assignment.expression;
+            ast_type_t type = ast_get_type( ctx, expression );
+            if( type == AST_TYPE_STRING )
+                {
+                c_push( ctx, expression );
+                bool pushed = c_push_subscript( ctx, variable );
+                c_print( ctx, "    aot_storec( ctx, &aot_globals[ " );
+                c_slot( ctx, variable, ctx->ast.pos[ index ], pushed, false );
+                c_print( ctx, " ].u );\n" );
+                }
+            else if( c_is_pure( ctx, expression ) && !c_push_subscript( ctx, variable ) )
+                {
+                c_print( ctx, "    aot_globals[ " );
+                c_slot( ctx, variable, ctx->ast.pos[ index ], false, false );
+                c_print( ctx, type == AST_TYPE_FLOAT ? " ].f = " : " ].i = " );
+                c_value( ctx, expression );
+                c_print( ctx, ";\n" );
+                }
+            else
+                {
+                c_push( ctx, expression );
+                bool pushed = c_push_subscript( ctx, variable );
+                c_print( ctx, "    { u32 slot = " );
+                c_slot( ctx, variable, ctx->ast.pos[ index ], pushed, false );
+                c_print( ctx, "; aot_globals[ slot ].u = aot_pop( ctx ); }\n" );
+                }
+            } break;
+
+        case AST_END:
+            {
+            c_print( ctx, "    AOT_END()\n" );
+            } break;
+
+        case AST_TRON:
+            {
+            c_print( ctx, "    ctx->tracing = true;\n" );
+            } break;
+
+        case AST_TROFF:
+            {
+            c_print( ctx, "    ctx->tracing = false;\n" );
+            } break;
+
+        case AST_ON:
+        case AST_SELECT:
+            {
+            int expression = ctx->ast.node_type[ index ] == AST_ON ? node.on.expression : node.select.expression;
+            if( c_is_pure( ctx, expression ) )
+                {
+                c_print( ctx, "    switch( " );
+                c_value( ctx, expression );
+                c_print( ctx, " )\n        {\n" );
+                }
+            else
+                {
+                c_push( ctx, expression );
+                c_print( ctx, "    switch( aot_popi( ctx ) )\n        {\n" );
+                }
+
+            if( ctx->ast.node_type[ index ] == AST_ON )
+                {
+                int resume = node.on.gosub ? ctx->resume_count++ : 0;
+                int value = 1;
+                for( int list = node.on.branch_list; list >= 0; list = ctx->ast.node_data[ list ].list_node.next )
+                    {
+                    c_print( ctx, "        case %d: ", value++ );
+                    if( node.on.gosub ) c_print( ctx, "aot_push( ctx, %d ); ", resume );
+                    c_jump( ctx, ctx->ast.node_data[ list ].list_node.item );
+                    }
+                c_print( ctx, "        }\n" );
+                if( node.on.gosub ) c_print( ctx, "AOT_LABEL( %d )\n", resume );
+                }
+            else
+                {
+                for( int list = node.select.case_list; list >= 0; list = ctx->ast.node_data[ list ].list_node.next )
+                    {
+                    ast_case_t* case_ = &ctx->ast.node_data[ ctx->ast.node_data[ list ].list_node.item ].case_;
+                    for( int value = case_->value_list; value >= 0; value = ctx->ast.node_data[ value ].list_node.next )
+                        c_print( ctx, "        case %d: AOT_JUMP( %d )\n", ctx->ast.node_data[ ctx->ast.node_data[ value ].list_node.item ].integer.value, case_->target + 1 );
+                    }
+                int fallback = node.select.else_case >= 0 ? ctx->ast.node_data[ node.select.else_case ].case_.target : node.select.end_target;
+                c_print( ctx, "        default: AOT_JUMP( %d )\n        }\n", fallback + 1 );
+                }
+            } break;
+
+        case AST_CASE:
+            {
+            c_print( ctx, "    AOT_JUMP( %d )\n", ctx->ast.node_data[ node.case_.select ].select.end_target + 1 );
+            c_labels( ctx, index );
+            } break;
+
+        case AST_ENDSELECT:
+            {
+            c_labels( ctx, index );
+            } break;
+
+        case AST_LIST_NODE:
+        case AST_DIM:
+        case AST_DATA:
+            break;
+
+        default: 
+            emitter_error( "Invalid statement", ctx->ast.pos[ index ] ); 
+            break;
+        }
+
+    #undef node
+    }
+
+
+static char const* c_preamble =
+    "// Generated by REBASIC - do not edit. Build with REBASIC_AOT defined, to have main.cpp include it.\n"
+    "\n"
+    "#include <float.h>\n"
+    "#include <math.h>\n"
+    "\n"
+    "union aot_value_t { int i; float f; u32 u; };\n"
+    "\n"
+    "static aot_value_t aot_globals[ AOT_GLOBALS_COUNT ];\n"
+    "static int aot_resume = 0;\n"
+    "static bool aot_is_halted = false;\n"
+    "\n"
+    "static void aot_push( vm_context_t* ctx, u32 value ) { *ctx->sp++ = value; }\n"
+    "static u32 aot_pop( vm_context_t* ctx ) { return *--ctx->sp; }\n"
+    "static void aot_pushi( vm_context_t* ctx, int value ) { *ctx->sp++ = (u32) value; }\n"
+    "static int aot_popi( vm_context_t* ctx ) { return (int) *--ctx->sp; }\n"
+    "static void aot_pushf( vm_context_t* ctx, float value ) { aot_value_t v; v.f = value; *ctx->sp++ = v.u; }\n"
+    "static float aot_popf( vm_context_t* ctx ) { aot_value_t v; v.u = *--ctx->sp; return v.f; }\n"
+    "\n"
+    "static void aot_pushc( vm_context_t* ctx, u32 value )\n"
+    "    {\n"
+    "    *ctx->sp++ = value;\n"
+    "    strpool_incref( &ctx->string_pool, value );\n"
+    "    }\n"
+    "\n"
+    "static void aot_storec( vm_context_t* ctx, u32* slot )\n"
+    "    {\n"
+    "    u32 value = *--ctx->sp;\n"
+    "    if( *slot != 0 )\n"
+    "        {\n"
+    "        if( strpool_decref( &ctx->string_pool, *slot ) == 0 ) strpool_discard( &ctx->string_pool, *slot );\n"
+    "        }\n"
+    "    *slot = vm_string_promote( ctx, value );\n"
+    "    }\n"
+    "\n"
+    "static int aot_index( int index, int max, int pos )\n"
+    "    {\n"
+    "    if( index < 0 || index > max )\n"
+    "        {\n"
+    "        printf( \"\\nRUNTIME ERROR: Subscript out of range [ %d <= %d <= %d ] at %d\\n\\n\", 0, index, max, pos );\n"
+    "        if( index > max ) index = max;\n"
+    "        if( index < 0 ) index = 0;\n"
+    "        }\n"
+    "    return index;\n"
+    "    }\n"
+    "\n"
+    "#define AOT_LABEL( id ) aot_r##id: ;\n"
+    "#define AOT_JUMP( id ) { if( --budget <= 0 ) { aot_resume = id; return op_count; } goto aot_r##id; }\n"
+    "#define AOT_CALL( host, id ) { functions::host_functions[ host ].func( ctx ); \\\n"
+    "    if( ctx->is_paused ) { aot_resume = id; return 0; } } aot_r##id: ;\n"
+    "#define AOT_RETURN() { aot_resume = (int) aot_pop( ctx ); goto aot_dispatch; }\n"
+    "#define AOT_END() { aot_is_halted = true; return 0; }\n"
+    "\n"
+    "\n"
+    "static bool aot_halted( vm_context_t* ctx )\n"
+    "    {\n"
+    "    (void) ctx;\n"
+    "    return aot_is_halted;\n"
+    "    }\n"
+    "\n"
+    "\n"
+    "// Runs until the program pauses or ends (returning 0), or until op_count jumps have been made\n"
+    "static int aot_run( vm_context_t* ctx, int op_count )\n"
+    "    {\n"
+    "    if( aot_is_halted || ctx->is_paused ) return 0;\n"
+    "    int budget = op_count;\n"
+    "\n"
+    "aot_dispatch:\n"
+    "    switch( aot_resume )\n"
+    "        {\n";
+
+
+static char* c_emit( ast_t ast, char const** host_func_signatures, char const* strings, int string_count )
+    {
+    c_emitter_context_t ctx;
+    ctx.ast = ast;
+    ctx.host_func_signatures = host_func_signatures;
+    ctx.length = 0;
+    ctx.capacity = 64 * 1024;
+    ctx.text = (char*) malloc( (size_t) ctx.capacity );
+    assert( ctx.text );
+    ctx.text[ 0 ] = '\0';
+    ctx.resume_count = ast.jump_targets_count + 1; // 0 is program start, followed by one id per jump target
+
+    c_statement( &ctx, 0 );
+    if( compile_error.state )
+        {
+        free( ctx.text );
+        return NULL;
+        }
+    char* body = ctx.text;
+    int body_length = ctx.length;
+
+    ctx.length = 0;
+    ctx.capacity = body_length + 64 * 1024;
+    ctx.text = (char*) malloc( (size_t) ctx.capacity );
+    assert( ctx.text );
+
+    c_print( &ctx, "#define AOT_GLOBALS_COUNT %d\n", ast.var_size > 0 ? ast.var_size : 1 );
+    c_print( &ctx, "%s", c_preamble );
+    for( int i = 0; i < ctx.resume_count; ++i ) c_print( &ctx, "        case %d: goto aot_r%d;\n", i, i );
+    c_print( &ctx, "        }\n\nAOT_LABEL( 0 )\n" );
+    c_print( &ctx, "%.*s", body_length, body );
+    c_print( &ctx, "\n    AOT_END()\n    }\n\n\n" );
+    free( body );
+
+    // String table and DATA, in the form expected by vm_init
+    c_print( &ctx, "static int const aot_string_count = %d;\nstatic char const aot_strings[] = \n    \"", string_count );
+    char const* str = strings;
+    for( int i = 0; i < string_count; ++i )
+        {
+        for( ; *str; ++str )
+            {
+            if( *str >= ' ' && *str <= '~' && *str != '"' && *str != '\\' && *str != '?' ) c_print( &ctx, "%c", *str );
+            else c_print( &ctx, "\\%03o", (unsigned char) *str );
+            }
+        ++str;
+        c_print( &ctx, i < string_count - 1 ? "\\0\"\n    \"" : "" );
+        }
+    c_print( &ctx, "\";\n\n" );
+
+    int data_count = ast.data_size / (int) sizeof( u32 );
+    c_print( &ctx, "static int const aot_data_size = %d;\nstatic u32 const aot_data[] = \n    {", ast.data_size );
+    for( int i = 0; i < data_count; ++i ) c_print( &ctx, i % 8 ? " %uu," : "\n    %uu,", ( (u32*) ast.data )[ i ] );
+    c_print( &ctx, data_count > 0 ? "\n    };\n" : " 0 };\n" );
+
+    return ctx.text;
+    }
+
+
+//////// C EMITTER END ////////
+
+
 
 compile_bytecode_t compile( char const* sourcecode, int length, compile_opcode_map_t* opcode_map, int opcode_count,
     char const** host_func_signatures, int host_func_count, int* error_pos, char error_msg[ 256 ] )
@@ -2787,4 +4579,69 @@ cleanup:
     }
 
 
+char* compile_to_c( char const* sourcecode, int length, char const** host_func_signatures, int host_func_count, 
+    int* error_pos, char error_msg[ 256 ] )
+    {
+    char* text = 0;
+
+    strpool_config_t config_identifier = strpool_default_config;
+    config_identifier.counter_bits = 0;
+    config_identifier.ignore_case = true;
+    strpool_t identifier_pool;
+    strpool_init( &identifier_pool, &config_identifier );
+
+    strpool_config_t config_str = strpool_default_config;
+    config_str.counter_bits = 0;
+    strpool_t string_pool;
+    strpool_init( &string_pool, &config_str );
+
+    compile_error_clear();
+
+    ast_t ast;
+    char* strings = 0;
+    int string_count = 0;
+
+    token_t* tokens = lex( sourcecode, length, &identifier_pool, &string_pool );
+    if( compile_error.state ) 
+        {
+        assert( !tokens );
+        if( error_pos ) *error_pos = compile_error.pos;
+        if( error_msg ) strcpy( error_msg, compile_error.message );
+        goto cleanup;
+        }
+
+    ast = parse( tokens, length, host_func_signatures, host_func_count, &identifier_pool );
+    free( tokens );
+    if( compile_error.state ) 
+        {
+        if( error_pos ) *error_pos = compile_error.pos;
+        if( error_msg ) strcpy( error_msg, compile_error.message );
+        goto cleanup;
+        }
+
+    strings = strpool_collate( &string_pool, &string_count );
+    text = c_emit( ast, host_func_signatures, strings, string_count );
+    strpool_free_collated( &string_pool, strings );
+    free( ast.vars );
+    free( ast.jump_targets );
+    free( ast.pos );
+    free( ast.node_data );
+    free( ast.node_type );
+    free( ast.data );
+    if( compile_error.state ) 
+        {
+        assert( !text );
+        if( error_pos ) *error_pos = compile_error.pos;
+        if( error_msg ) strcpy( error_msg, compile_error.message );
+        goto cleanup;
+        }
+
+cleanup:
+    strpool_term( &string_pool );
+    strpool_term( &identifier_pool );
+
+    return text;
+    }
+
+
 #endif /* COMPILE_IMPLEMENTATION */
\ No newline at end of file
@@ -0,0 +1,530 @@
+
+#ifndef crtcheck_h
+#define crtcheck_h
+
+// Checks the CPU version of the CRT effect (crtemu_cpu.h) against the shader version (crtemu.h). A test pattern is run
+// through both for a number of frames, and some of the frames are compared. The shader version can't be run without a
+// window and a GL context, so the reference frames are made by a port of its shaders to the CPU, which follows the
+// shaders step by step in double precision, with the 8-bit intermediate textures and the texture filtering and wrap
+// modes of the GL version.
+//
+// The frames are rendered at 640x480, the size the final pass of the software CRT effect renders at in main.cpp (the
+// window size divided by SOFTWARE_CRT_DIVISOR). The CPU version passes if every compared frame is within the tolerance
+// below. The two versions differ in their noise, which the CPU version takes from a table, and by the rounding of the
+// 8-bit intermediate images and of the single precision math.
+
+#define CRTCHECK_MIN_PSNR 40.0 // peak signal to noise ratio over all channels, in dB
+#define CRTCHECK_MAX_DIFF 12 // largest difference in any channel of any pixel, out of 255
+
+// Renders the reference frames, and writes them to the folder as binary PPM files named crtcheck_NN.ppm, where NN is
+// the frame number. Returns the number of files written, or -1 if one could not be written.
+int crtcheck_reference( char const* folder );
+
+// Renders the same frames with crtemu_cpu, compares them to the reference frames in the folder and prints the results.
+// Returns the number of frames outside of the tolerance, or -1 if a reference frame could not be loaded.
+int crtcheck_compare( char const* folder );
+
+#endif /* crtcheck_h */
+
+#ifdef CRTCHECK_IMPLEMENTATION
+#undef CRTCHECK_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "libs/crtemu_cpu.h"
+#include "libs/crt_frame.h"
+#include "libs/stb_image.h"
+
+// Size of the test pattern, which is that of the default screen with its border, and of the rendered frames
+#define CRTCHECK_INPUT_WIDTH 384
+#define CRTCHECK_INPUT_HEIGHT 288
+#define CRTCHECK_WIDTH 640
+#define CRTCHECK_HEIGHT 480
+
+// Frames rendered, and which of them are compared. The first few frames build up the phosphor persistence.
+#define CRTCHECK_FRAME_COUNT 12
+static int const crtcheck_frames[] = { 4, 8, 12 };
+#define CRTCHECK_COMPARE_COUNT (int)( sizeof( crtcheck_frames ) / sizeof( *crtcheck_frames ) )
+
+#define CRTCHECK_BORDER 0x1c1c1c
+
+
+// Time of a frame, as the main loop advances it at 60 frames per second, a few seconds in
+static unsigned long long crtcheck_time_us( int frame )
+    {
+    return 5000000ull + (unsigned long long) frame * 16667ull;
+    }
+
+
+// Test pattern: text-like blocks of white, blue and green on a dark background, and a red block moving across the
+// bottom, which leaves a trail in the phosphor persistence
+static void crtcheck_pattern( CRTEMU_CPU_U32* pixels, int frame )
+    {
+    for( int y = 0; y < CRTCHECK_INPUT_HEIGHT; ++y )
+        {
+        for( int x = 0; x < CRTCHECK_INPUT_WIDTH; ++x )
+            {
+            CRTEMU_CPU_U32 color = ( ( x * 7 + y * 3 ) & 0x40 ) ? 0xc04020 : ( ( x ^ y ) & 16 ) ? 0x00a000 : 0x101010;
+            if( ( x / 8 + y / 8 + frame ) % 3 == 0 ) color = 0xffffff;
+            int block_x = 32 + ( frame * 24 ) % 300;
+            if( y > 220 && y < 240 && x >= block_x && x < block_x + 16 ) color = 0x0000ff;
+            pixels[ y * CRTCHECK_INPUT_WIDTH + x ] = color;
+            }
+        }
+    }
+
+
+// Texture with four channels in the range 0-1, bottom row first as in GL
+typedef struct crtcheck_texture_t
+    {
+    int width;
+    int height;
+    double* texels;
+    } crtcheck_texture_t;
+
+
+static void crtcheck_texture_create( crtcheck_texture_t* texture, int width, int height )
+    {
+    texture->width = width;
+    texture->height = height;
+    texture->texels = (double*) calloc( (size_t)( width * height * 4 ), sizeof( double ) );
+    }
+
+
+// Loads xbgr or abgr pixels into a texture, the first row of the pixels going to the bottom row of the texture, as
+// glTexImage2D does
+static void crtcheck_texture_load( crtcheck_texture_t* texture, CRTEMU_CPU_U32 const* pixels, int alpha )
+    {
+    for( int i = 0; i < texture->width * texture->height; ++i )
+        {
+        for( int k = 0; k < 4; ++k )
+            texture->texels[ i * 4 + k ] = k == 3 && !alpha ? 1.0 : (double)( ( pixels[ i ] >> ( k * 8 ) ) & 0xff ) / 255.0;
+        }
+    }
+
+
+// Rounds a texture to 8 bits per channel, as rendering to an RGB8 texture does
+static void crtcheck_texture_quantize( crtcheck_texture_t* texture )
+    {
+    for( int i = 0; i < texture->width * texture->height * 4; ++i )
+        {
+        double v = texture->texels[ i ];
+        v = v < 0.0 ? 0.0 : v > 1.0 ? 1.0 : v;
+        texture->texels[ i ] = floor( v * 255.0 + 0.5 ) / 255.0;
+        }
+    }
+
+
+// Bilinear sample, as texture2D with linear filtering. Along an axis which doesn't repeat, texels outside the texture
+// are black, as with GL_CLAMP_TO_BORDER and a black border color.
+static void crtcheck_texture_sample( crtcheck_texture_t const* texture, double u, double v, int repeat_x, int repeat_y,
+    double out[ 4 ] )
+    {
+    double x = u * texture->width - 0.5;
+    double y = v * texture->height - 0.5;
+    int x0 = (int) floor( x );
+    int y0 = (int) floor( y );
+    double fx = x - x0;
+    double fy = y - y0;
+    for( int k = 0; k < 4; ++k ) out[ k ] = 0.0;
+    for( int i = 0; i < 4; ++i )
+        {
+        int tx = x0 + ( i & 1 );
+        int ty = y0 + ( i >> 1 );
+        if( repeat_x )
+            tx = ( ( tx % texture->width ) + texture->width ) % texture->width;
+        else if( tx < 0 || tx >= texture->width )
+            continue;
+        if( repeat_y )
+            ty = ( ( ty % texture->height ) + texture->height ) % texture->height;
+        else if( ty < 0 || ty >= texture->height )
+            continue;
+        double weight = ( ( i & 1 ) ? fx : 1.0 - fx ) * ( ( i >> 1 ) ? fy : 1.0 - fy );
+        double const* texel = texture->texels + ( ty * texture->width + tx ) * 4;
+        for( int k = 0; k < 4; ++k ) out[ k ] += texel[ k ] * weight;
+        }
+    }
+
+
+// One pass of the blur shader, with the step between taps in texture coordinates
+static void crtcheck_blur_pass( crtcheck_texture_t* out, crtcheck_texture_t const* in, double step_u, double step_v,
+    int repeat_x, int repeat_y )
+    {
+    static double const weights[ 5 ] = { 0.2270270270, 0.1945945946, 0.1216216216, 0.0540540541, 0.0162162162 };
+    for( int y = 0; y < in->height; ++y )
+        {
+        for( int x = 0; x < in->width; ++x )
+            {
+            double u = ( x + 0.5 ) / in->width;
+            double v = ( y + 0.5 ) / in->height;
+            double sum[ 4 ] = { 0.0, 0.0, 0.0, 0.0 };
+            for( int i = -4; i <= 4; ++i )
+                {
+                double texel[ 4 ];
+                crtcheck_texture_sample( in, u + i * step_u, v + i * step_v, repeat_x, repeat_y, texel );
+                for( int k = 0; k < 4; ++k ) sum[ k ] += texel[ k ] * weights[ i < 0 ? -i : i ];
+                }
+            for( int k = 0; k < 4; ++k ) out->texels[ ( y * in->width + x ) * 4 + k ] = sum[ k ];
+            }
+        }
+    crtcheck_texture_quantize( out );
+    }
+
+
+// The textures of crtemu_t. Those the crt shader samples are set to GL_CLAMP_TO_BORDER by the first present, and the
+// others keep the default of GL_REPEAT.
+typedef struct crtcheck_shader_t
+    {
+    crtcheck_texture_t backbuffer;
+    crtcheck_texture_t accumulate_a; // clamped
+    crtcheck_texture_t accumulate_b;
+    crtcheck_texture_t blur_a; // clamped
+    crtcheck_texture_t blur_b;
+    crtcheck_texture_t frame; // clamped
+    } crtcheck_shader_t;
+
+
+// crtemu_internal_blur: horizontally from the source into blur_b, then vertically from blur_b into the target
+static void crtcheck_blur( crtcheck_shader_t* shader, crtcheck_texture_t* target, crtcheck_texture_t const* source,
+    int source_repeats, double radius )
+    {
+    crtcheck_blur_pass( &shader->blur_b, source, radius / source->width, 0.0, source_repeats, source_repeats );
+    crtcheck_blur_pass( target, &shader->blur_b, 0.0, radius / source->height, 1, 1 );
+    }
+
+
+static double crtcheck_clamp( double v, double low, double high )
+    {
+    return v < low ? low : v > high ? high : v;
+    }
+
+
+// The tsample function of the crt shader, for one channel
+static double crtcheck_tsample( crtcheck_texture_t const* texture, double x, double y, int channel )
+    {
+    double texel[ 4 ];
+    crtcheck_texture_sample( texture, x * 1.025 - 0.0125, 1.0 - ( y * 0.92 + 0.04 ), 0, 0, texel );
+    return pow( fabs( texel[ channel ] ), 2.2 ) * 1.25;
+    }
+
+
+static double crtcheck_rand( double x, double y )
+    {
+    double v = sin( x * 12.9898 + y * 78.233 ) * 43758.5453;
+    return v - floor( v );
+    }
+
+
+// The main function of the crt shader, for the fragment at x, y (from the bottom) of the window
+static CRTEMU_CPU_U32 crtcheck_fragment( crtcheck_shader_t const* shader, double time, double frag_x, double frag_y,
+    double uv_x, double uv_y, int window_width, int window_height )
+    {
+    // Curve
+    double cx = ( uv_x - 0.5 ) * 2.0 * 1.1;
+    double cy = ( uv_y - 0.5 ) * 2.0 * 1.1;
+    cx *= 1.0 + pow( fabs( cy ) / 5.0, 2.0 );
+    cy *= 1.0 + pow( fabs( cx ) / 4.0, 2.0 );
+    cx = ( cx / 2.0 + 0.5 ) * 0.92 + 0.04;
+    cy = ( cy / 2.0 + 0.5 ) * 0.92 + 0.04;
+    double curved_x = cx * 0.6 + uv_x * 0.4;
+    double curved_y = cy * 0.6 + uv_y * 0.4;
+    double scuv_x = curved_x * 0.96 + 0.02 + 0.003;
+    double scuv_y = curved_y * 0.96 + 0.02 - 0.001;
+
+    // Main color, bleed
+    double x = sin( 0.1 * time + curved_y * 13.0 ) * sin( 0.23 * time + curved_y * 19.0 )
+        * sin( 0.3 + 0.11 * time + curved_y * 23.0 ) * 0.0012;
+    x += sin( frag_y * 1.5 ) / window_width * 0.25;
+    double col[ 3 ];
+    col[ 0 ] = crtcheck_tsample( &shader->accumulate_a, x + scuv_x + 0.0009, scuv_y + 0.0009, 0 ) + 0.02;
+    col[ 1 ] = crtcheck_tsample( &shader->accumulate_a, x + scuv_x, scuv_y - 0.0011, 1 ) + 0.02;
+    col[ 2 ] = crtcheck_tsample( &shader->accumulate_a, x + scuv_x - 0.0015, scuv_y, 2 ) + 0.02;
+    double i = crtcheck_clamp( col[ 0 ] * 0.299 + col[ 1 ] * 0.587 + col[ 2 ] * 0.114, 0.0, 1.0 );
+    i = 1.0 - i * i;
+    i = ( 1.0 - i ) * 0.85 + 0.15;
+
+    // Ghosting
+    double const wobble = 0.007 * 0.35;
+    double ghost_x[ 3 ] =
+        {
+        ( x - 0.014 ) * 0.85 + wobble * sin( 1.0 / 7.0 + 15.0 * curved_y + 0.9 * time ) + scuv_x + 0.001,
+        ( x - 0.019 ) * 0.85 + wobble * cos( 1.0 / 9.0 + 15.0 * curved_y + 0.5 * time ) + scuv_x,
+        ( x - 0.017 ) * 0.85 + wobble * sin( 2.0 / 3.0 + 15.0 * curved_y + 0.7 * time ) + scuv_x - 0.002,
+        };
+    double ghost_y[ 3 ] =
+        {
+        -0.027 * 0.85 + wobble * sin( 2.0 / 7.0 + 10.0 * curved_y + 1.37 * time ) + scuv_y + 0.001,
+        -0.020 * 0.85 + wobble * sin( 2.0 / 9.0 + 10.0 * curved_y + 1.5 * time ) + scuv_y - 0.002,
+        -0.003 * 0.85 + wobble * cos( 2.0 / 3.0 + 10.0 * curved_y + 1.63 * time ) + scuv_y,
+        };
+    double const luminance[ 3 ] = { 0.299, 0.587, 0.114 };
+    for( int ghost = 0; ghost < 3; ++ghost )
+        {
+        for( int k = 0; k < 3; ++k )
+            {
+            double s = crtcheck_tsample( &shader->blur_a, ghost_x[ ghost ], ghost_y[ ghost ], k ) * ( k == ghost ? 0.5 : 0.25 );
+            col[ k ] += 0.15 * ( 1.0 - luminance[ ghost ] ) * pow( crtcheck_clamp( 3.0 * s, 0.0, 1.0 ), 2.0 ) * i;
+            }
+        }
+
+    // Level adjustment, vignette, scanlines, shadow mask and tone map
+    double vig = 0.1 + 16.0 * curved_x * curved_y * ( 1.0 - curved_x ) * ( 1.0 - curved_y );
+    vig = 1.3 * pow( vig, 0.5 );
+    double scans = pow( crtcheck_clamp( 0.35 + 0.18 * sin( 6.0 * time + curved_y * window_height * 1.5 ), 0.0, 1.0 ), 0.9 );
+    double mask = 1.0 - 0.23 * crtcheck_clamp( fmod( frag_x, 3.0 ) / 2.0, 0.0, 1.0 );
+    double const level[ 3 ] = { 0.95, 1.05, 0.95 };
+    for( int k = 0; k < 3; ++k )
+        {
+        double c = col[ k ] * level[ k ];
+        c = crtcheck_clamp( c * 1.3 + 0.75 * c * c + 1.25 * pow( c, 5.0 ), 0.0, 10.0 );
+        c = c * vig * scans * mask;
+        c = c - 0.004 > 0.0 ? c - 0.004 : 0.0;
+        col[ k ] = ( c * ( 6.2 * c + 0.5 ) ) / ( c * ( 6.2 * c + 1.7 ) + 0.06 );
+        }
+
+    // Noise, flicker, and clamp to the curved screen
+    double seed_x = curved_x * window_width;
+    double seed_y = curved_y * window_height;
+    for( int k = 0; k < 3; ++k )
+        {
+        double t = time * ( k + 1 );
+        col[ k ] -= 0.015 * pow( crtcheck_rand( seed_x + t, seed_y + t ), 1.5 );
+        col[ k ] *= 1.0 - 0.004 * ( sin( 50.0 * time + curved_y * 2.0 ) * 0.5 + 0.5 );
+        if( curved_x < 0.0 || curved_x > 1.0 || curved_y < 0.0 || curved_y > 1.0 ) col[ k ] = 0.0;
+        }
+
+    // Frame
+    double f[ 4 ];
+    crtcheck_texture_sample( &shader->frame, uv_x * ( 1.0 - 0.038 ) + 0.019, uv_y * ( 1.0 - 0.036 ) + 0.018 - 0.005, 0, 0, f );
+    double fvig = crtcheck_clamp( 512.0 * uv_x * uv_y * ( 1.0 - uv_x ) * ( 1.0 - uv_y ), 0.2, 0.8 );
+    CRTEMU_CPU_U32 pixel = 0;
+    for( int k = 0; k < 3; ++k )
+        {
+        double frame = pow( f[ k ] * 0.5 + 0.25, 1.4 ) * fvig;
+        double c = ( col[ k ] > 0.0 ? col[ k ] : 0.0 ) * ( 1.0 - f[ 3 ] * f[ 3 ] ) + frame * f[ 3 ] * f[ 3 ];
+        pixel |= (CRTEMU_CPU_U32)( crtcheck_clamp( c, 0.0, 1.0 ) * 255.0 + 0.5 ) << ( k * 8 );
+        }
+    return pixel;
+    }
+
+
+// crtemu_present, into a bitmap the size of the window with the top row first
+static void crtcheck_shader_present( crtcheck_shader_t* shader, unsigned long long time_us,
+    CRTEMU_CPU_U32 const* pixels_xbgr, CRTEMU_CPU_U32 border_xbgr, CRTEMU_CPU_U32* output, int window_width,
+    int window_height )
+    {
+    int const width = shader->backbuffer.width;
+    int const height = shader->backbuffer.height;
+    crtcheck_texture_load( &shader->backbuffer, pixels_xbgr, 0 );
+
+    // Blur the previous accumulation buffer, and update the accumulation buffer
+    crtcheck_blur( shader, &shader->blur_a, &shader->accumulate_b, 1, 1.0 );
+    for( int i = 0; i < width * height * 4; ++i )
+        {
+        double a = shader->backbuffer.texels[ i ];
+        double b = shader->blur_a.texels[ i ] * 0.96;
+        shader->accumulate_a.texels[ i ] = a > b ? a : b;
+        }
+    crtcheck_texture_quantize( &shader->accumulate_a );
+
+    // Store a copy of the accumulation buffer, and blend accumulation and backbuffer
+    memcpy( shader->accumulate_b.texels, shader->accumulate_a.texels, sizeof( double ) * (size_t)( width * height * 4 ) );
+    for( int i = 0; i < width * height * 4; ++i )
+        {
+        double a = shader->backbuffer.texels[ i ];
+        double b = shader->accumulate_b.texels[ i ] * 0.32;
+        shader->accumulate_a.texels[ i ] = a > b ? a : b;
+        }
+    crtcheck_texture_quantize( &shader->accumulate_a );
+
+    // Slight blur of the backbuffer, and a fully blurred version of it
+    crtcheck_blur( shader, &shader->accumulate_a, &shader->accumulate_a, 0, 0.17 );
+    crtcheck_blur( shader, &shader->blur_a, &shader->accumulate_a, 0, 1.0 );
+
+    // The screen is fitted to the window, and the rest cleared to the border color
+    double hscale = window_width / (double) width;
+    double vscale = window_height / (double) height;
+    double pixel_scale = hscale < vscale ? hscale : vscale;
+    double hborder = ( window_width - pixel_scale * width ) / 2.0;
+    double vborder = ( window_height - pixel_scale * height ) / 2.0;
+    double time = 1.5 * ( time_us / 1000000.0 );
+    for( int y = 0; y < window_height; ++y )
+        {
+        for( int x = 0; x < window_width; ++x )
+            {
+            double frag_x = x + 0.5;
+            double frag_y = window_height - y - 0.5;
+            CRTEMU_CPU_U32* out = output + y * window_width + x;
+            if( frag_x < hborder || frag_x >= hborder + pixel_scale * width || frag_y < vborder ||
+                frag_y >= vborder + pixel_scale * height )
+                {
+                *out = border_xbgr & 0xffffff;
+                continue;
+                }
+            double uv_x = ( frag_x - hborder ) / ( pixel_scale * width );
+            double uv_y = ( frag_y - vborder ) / ( pixel_scale * height );
+            *out = crtcheck_fragment( shader, time, frag_x, frag_y, uv_x, uv_y, window_width, window_height );
+            }
+        }
+    }
+
+
+// The crtemu_cpu_t and crtcheck_shader_t both render into bitmaps in memory, but only one of them is used at a time
+typedef struct crtcheck_renderer_t
+    {
+    crtemu_cpu_t* crtemu;
+    crtcheck_shader_t shader;
+    CRTEMU_CPU_U32* pixels;
+    CRTEMU_CPU_U32* output;
+    } crtcheck_renderer_t;
+
+
+static void crtcheck_renderer_create( crtcheck_renderer_t* renderer, int shader )
+    {
+    memset( renderer, 0, sizeof( *renderer ) );
+    renderer->pixels = (CRTEMU_CPU_U32*) malloc( sizeof( CRTEMU_CPU_U32 ) * CRTCHECK_INPUT_WIDTH * CRTCHECK_INPUT_HEIGHT );
+    renderer->output = (CRTEMU_CPU_U32*) malloc( sizeof( CRTEMU_CPU_U32 ) * CRTCHECK_WIDTH * CRTCHECK_HEIGHT );
+    CRTEMU_CPU_U32* frame = (CRTEMU_CPU_U32*) malloc( sizeof( CRTEMU_CPU_U32 ) * CRT_FRAME_WIDTH * CRT_FRAME_HEIGHT );
+    crt_frame( frame );
+    if( shader )
+        {
+        crtcheck_texture_create( &renderer->shader.backbuffer, CRTCHECK_INPUT_WIDTH, CRTCHECK_INPUT_HEIGHT );
+        crtcheck_texture_create( &renderer->shader.accumulate_a, CRTCHECK_INPUT_WIDTH, CRTCHECK_INPUT_HEIGHT );
+        crtcheck_texture_create( &renderer->shader.accumulate_b, CRTCHECK_INPUT_WIDTH, CRTCHECK_INPUT_HEIGHT );
+        crtcheck_texture_create( &renderer->shader.blur_a, CRTCHECK_INPUT_WIDTH, CRTCHECK_INPUT_HEIGHT );
+        crtcheck_texture_create( &renderer->shader.blur_b, CRTCHECK_INPUT_WIDTH, CRTCHECK_INPUT_HEIGHT );
+        crtcheck_texture_create( &renderer->shader.frame, CRT_FRAME_WIDTH, CRT_FRAME_HEIGHT );
+        crtcheck_texture_load( &renderer->shader.frame, frame, 1 );
+        }
+    else
+        {
+        renderer->crtemu = crtemu_cpu_create( NULL, 4 );
+        crtemu_cpu_frame( renderer->crtemu, frame, CRT_FRAME_WIDTH, CRT_FRAME_HEIGHT );
+        }
+    free( frame );
+    }
+
+
+static void crtcheck_renderer_destroy( crtcheck_renderer_t* renderer )
+    {
+    if( renderer->crtemu ) crtemu_cpu_destroy( renderer->crtemu );
+    free( renderer->shader.backbuffer.texels );
+    free( renderer->shader.accumulate_a.texels );
+    free( renderer->shader.accumulate_b.texels );
+    free( renderer->shader.blur_a.texels );
+    free( renderer->shader.blur_b.texels );
+    free( renderer->shader.frame.texels );
+    free( renderer->pixels );
+    free( renderer->output );
+    }
+
+
+// Renders the test pattern for the given frame into renderer->output
+static void crtcheck_renderer_frame( crtcheck_renderer_t* renderer, int frame )
+    {
+    crtcheck_pattern( renderer->pixels, frame );
+    if( renderer->crtemu )
+        crtemu_cpu_present( renderer->crtemu, crtcheck_time_us( frame ), renderer->pixels, CRTCHECK_INPUT_WIDTH,
+            CRTCHECK_INPUT_HEIGHT, CRTCHECK_BORDER, renderer->output, CRTCHECK_WIDTH, CRTCHECK_HEIGHT );
+    else
+        crtcheck_shader_present( &renderer->shader, crtcheck_time_us( frame ), renderer->pixels, CRTCHECK_BORDER,
+            renderer->output, CRTCHECK_WIDTH, CRTCHECK_HEIGHT );
+    }
+
+
+static void crtcheck_filename( char* filename, size_t size, char const* folder, int frame )
+    {
+    snprintf( filename, size, "%s/crtcheck_%02d.ppm", folder, frame );
+    }
+
+
+int crtcheck_reference( char const* folder )
+    {
+    crtcheck_renderer_t renderer;
+    crtcheck_renderer_create( &renderer, 1 );
+    int written = 0;
+    int compare = 0;
+    for( int frame = 1; frame <= CRTCHECK_FRAME_COUNT && written >= 0; ++frame )
+        {
+        crtcheck_renderer_frame( &renderer, frame );
+        if( compare >= CRTCHECK_COMPARE_COUNT || crtcheck_frames[ compare ] != frame ) continue;
+        ++compare;
+
+        char filename[ 1024 ];
+        crtcheck_filename( filename, sizeof( filename ), folder, frame );
+        FILE* file = fopen( filename, "wb" );
+        if( !file )
+            {
+            written = -1;
+            break;
+            }
+        fprintf( file, "P6\n%d %d\n255\n", CRTCHECK_WIDTH, CRTCHECK_HEIGHT );
+        for( int i = 0; i < CRTCHECK_WIDTH * CRTCHECK_HEIGHT; ++i )
+            {
+            unsigned char rgb[ 3 ] = { (unsigned char)( renderer.output[ i ] ), (unsigned char)( renderer.output[ i ] >> 8 ),
+                (unsigned char)( renderer.output[ i ] >> 16 ) };
+            fwrite( rgb, 1, sizeof( rgb ), file );
+            }
+        written = ferror( file ) == 0 ? written + 1 : -1;
+        fclose( file );
+        }
+    crtcheck_renderer_destroy( &renderer );
+    return written;
+    }
+
+
+int crtcheck_compare( char const* folder )
+    {
+    crtcheck_renderer_t renderer;
+    crtcheck_renderer_create( &renderer, 0 );
+    int failed = 0;
+    int compare = 0;
+    for( int frame = 1; frame <= CRTCHECK_FRAME_COUNT && failed >= 0; ++frame )
+        {
+        crtcheck_renderer_frame( &renderer, frame );
+        if( compare >= CRTCHECK_COMPARE_COUNT || crtcheck_frames[ compare ] != frame ) continue;
+        ++compare;
+
+        char filename[ 1024 ];
+        crtcheck_filename( filename, sizeof( filename ), folder, frame );
+        int w, h, c;
+        stbi_uc* reference = stbi_load( filename, &w, &h, &c, 3 );
+        if( !reference || w != CRTCHECK_WIDTH || h != CRTCHECK_HEIGHT )
+            {
+            printf( "Failed to load %s\n", filename );
+            if( reference ) stbi_image_free( reference );
+            failed = -1;
+            break;
+            }
+
+        double squared_error = 0.0;
+        int max_diff = 0;
+        for( int i = 0; i < CRTCHECK_WIDTH * CRTCHECK_HEIGHT; ++i )
+            {
+            for( int k = 0; k < 3; ++k )
+                {
+                int diff = (int)( ( renderer.output[ i ] >> ( k * 8 ) ) & 0xff ) - (int) reference[ i * 3 + k ];
+                squared_error += (double)( diff * diff );
+                max_diff = diff > max_diff ? diff : -diff > max_diff ? -diff : max_diff;
+                }
+            }
+        stbi_image_free( reference );
+
+        double mse = squared_error / ( CRTCHECK_WIDTH * CRTCHECK_HEIGHT * 3.0 );
+        double psnr = mse > 0.0 ? 10.0 * log10( 255.0 * 255.0 / mse ) : 99.0;
+        int pass = psnr >= CRTCHECK_MIN_PSNR && max_diff <= CRTCHECK_MAX_DIFF;
+        printf( "Frame %2d: PSNR %.2f dB, max diff %d - %s\n", frame, psnr, max_diff, pass ? "ok" : "FAILED" );
+        if( !pass ) ++failed;
+        }
+    crtcheck_renderer_destroy( &renderer );
+    if( failed >= 0 )
+        printf( "%d of %d frames within tolerance (PSNR >= %.1f dB, max diff <= %d)\n", CRTCHECK_COMPARE_COUNT - failed,
+            CRTCHECK_COMPARE_COUNT, CRTCHECK_MIN_PSNR, CRTCHECK_MAX_DIFF );
+    return failed;
+    }
+
+
+#endif /* CRTCHECK_IMPLEMENTATION */
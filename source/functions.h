@@ -34,6 +34,11 @@ int xtext( int x ) { return system_xtext( system, x ); }
 int ytext( int y ) { return system_ytext( system, y ); }
 int xgraphic( int x ) { return system_xgraphic( system, x ); }
 int ygraphic( int y ) { return system_ygraphic( system, y ); }
+void screen( int width, int height, int colors ) { system_screen( system, width, height, colors ); }
+void screen_swap() { system_screen_swap( system ); }
+void screen_copy( int from_page, int to_page ) { system_screen_copy( system, from_page, to_page ); }
+void screen_logic( int page ) { system_screen_logic( system, page ); }
+void screen_display( int page ) { system_screen_display( system, page ); }
 
 void loadsprite( int data_index, char const* filename ) { system_load_sprite( system, data_index, filename ); }
 void sprite( int spr_index, int x, int y, int data_index ) { system_sprite( system, spr_index, x, y, data_index ); }
@@ -66,23 +71,21 @@ void update() { system_update( system ); }
 void priority_on() { system_priority_on( system ); }
 void priority_off() { system_priority_off( system ); }
 int detect( int spr_index ) { return system_detect( system, spr_index ); }
+int collide( int spr_index ) { return system_collide( system, spr_index ); }
+int collide_pair( int spr_a, int spr_b ) { return system_collide_pair( system, spr_a, spr_b ); }
 void synchro_on() { system_synchro_on( system ); }
 void synchro_off() { system_synchro_off( system ); }
 void synchro() { system_synchro( system ); }
-
-char const* str( int a )
-    {
-    static char temp[ 256 ];
-    ::snprintf( temp, 255, "%d", a ); 
-    return temp; 
-    }
-
-char const* strf( float a )
-    {
-    static char temp[ 256 ];
-    ::snprintf( temp, 255, "%f", a ); 
-    return temp; 
-    }
+void map( int columns, int rows, int tile_width, int tile_height ) { system_map( system, columns, rows, tile_width, tile_height ); }
+void tile( int x, int y, int data_index ) { system_tile( system, x, y, data_index ); }
+void scroll( int x, int y ) { system_scroll( system, x, y ); }
+void cls() { system_cls( system ); }
+void plot( int x, int y ) { system_plot( system, x, y ); }
+void plot_color( int x, int y, int color ) { system_plot_color( system, x, y, color ); }
+void draw( int x1, int y1, int x2, int y2 ) { system_draw( system, x1, y1, x2, y2 ); }
+void box( int x1, int y1, int x2, int y2 ) { system_box( system, x1, y1, x2, y2 ); }
+void bar( int x1, int y1, int x2, int y2 ) { system_bar( system, x1, y1, x2, y2 ); }
+void circle( int x, int y, int r ) { system_circle( system, x, y, r ); }
 
 char const* strb( bool a )
     {
@@ -141,6 +144,7 @@ void stopsong() { system_stopsong( system ); }
 void loadpalette( char const* filename ) { system_load_palette( system, filename ); }
 void say( char const* text ) { system_say( system, text ); }
 void waitvbl() { system_waitvbl( system ); }
+int strstats( int stat ) { return system_strstats( system, stat ); }
 void loadsound( int data_index, char const* filename ) { system_load_sound( system, data_index, filename ); }
 void playsound( int sound_index, int data_index ) { system_play_sound( system, sound_index, data_index ); }
 
@@ -178,6 +182,11 @@ static struct { char const* signature; vm_func_t func; } host_functions[] =
     { "Func Integer YTEXT( Integer )", vm_func< int, ytext, int > },
     { "Func Integer XGRAPHIC( Integer )", vm_func< int, xgraphic, int > },
     { "Func Integer YGRAPHIC( Integer )", vm_func< int, ygraphic, int > },
+    { "Proc SCREEN( Integer, Integer, Integer )", vm_proc< screen, int, int, int > },
+    { "Proc SCREEN_SWAP()", vm_proc< screen_swap > },
+    { "Proc SCREEN_COPY( Integer, Integer )", vm_proc< screen_copy, int, int > },
+    { "Proc SCREEN_LOGIC( Integer )", vm_proc< screen_logic, int > },
+    { "Proc SCREEN_DISPLAY( Integer )", vm_proc< screen_display, int > },
     
     { "Proc LOADSPRITE( Integer, String )", vm_proc< loadsprite, int, char const* > },
     { "Proc SPRITE( Integer, Integer, Integer, Integer )", vm_proc< sprite, int, int, int, int > },
@@ -210,11 +219,22 @@ static struct { char const* signature; vm_func_t func; } host_functions[] =
     { "Proc PRIORITY_ON()", vm_proc< priority_on > },
     { "Proc PRIORITY_OFF()", vm_proc< priority_off > },
     { "Func Integer DETECT( Integer )", vm_func< int, detect, int > },
+    { "Func Integer COLLIDE( Integer )", vm_func< int, collide, int > },
+    { "Func Integer COLLIDE( Integer, Integer )", vm_func< int, collide_pair, int, int > },
     { "Proc SYNCHRO_ON()", vm_proc< synchro_on > },
     { "Proc SYNCHRO_OFF()", vm_proc< synchro_off > },
     { "Proc SYNCHRO()", vm_proc< synchro > },
-    { "Func String STR( Integer )", vm_func< char const*, str, int > },
-    { "Func String STR( Real )", vm_func< char const*, strf, float > },
+    { "Proc MAP( Integer, Integer, Integer, Integer )", vm_proc< map, int, int, int, int > },
+    { "Proc TILE( Integer, Integer, Integer )", vm_proc< tile, int, int, int > },
+    { "Proc SCROLL( Integer, Integer )", vm_proc< scroll, int, int > },
+    { "Proc CLS()", vm_proc< cls > },
+    { "Proc PLOT( Integer, Integer )", vm_proc< plot, int, int > },
+    { "Proc PLOT( Integer, Integer, Integer )", vm_proc< plot_color, int, int, int > },
+    { "Proc DRAW( Integer, Integer, Integer, Integer )", vm_proc< draw, int, int, int, int > },
+    { "Proc LINE( Integer, Integer, Integer, Integer )", vm_proc< draw, int, int, int, int > },
+    { "Proc BOX( Integer, Integer, Integer, Integer )", vm_proc< box, int, int, int, int > },
+    { "Proc BAR( Integer, Integer, Integer, Integer )", vm_proc< bar, int, int, int, int > },
+    { "Proc CIRCLE( Integer, Integer, Integer )", vm_proc< circle, int, int, int > },
     { "Func String STR( Bool )", vm_func< char const*, strb, bool > },
     { "Func Real RND( Integer )", vm_func< float, rnd, float > },
     { "Func Integer INT( Real )", vm_func< int, intf, float > },
@@ -233,6 +253,7 @@ static struct { char const* signature; vm_func_t func; } host_functions[] =
     { "Proc STOPSONG()", vm_proc< stopsong > },
     { "Proc LOADPALETTE( String )", vm_proc< loadpalette, char const* > },
     { "Proc WAITVBL()", vm_proc< waitvbl > },
+    { "Func Integer STRSTATS( Integer )", vm_func< int, strstats, int > },
     { "Proc SAY( String )", vm_proc< say, char const* > },
     { "Proc LOADSOUND( Integer, String )", vm_proc< loadsound, int, char const* > },
     { "Proc PLAYSOUND( Integer, Integer )", vm_proc< playsound, int, int > },
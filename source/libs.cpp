@@ -25,6 +25,9 @@
 #define THREAD_IMPLEMENTATION
 #include "libs/thread.h"
 
+#define CRTEMU_CPU_IMPLEMENTATION
+#include "libs/crtemu_cpu.h"
+
 #define PALETTIZE_IMPLEMENTATION
 #include "libs/palettize.h"
 
@@ -55,3 +58,9 @@
 
 #define SYSTEM_MPLEMENTATION
 #include "system.h"
+
+#define RECORD_IMPLEMENTATION
+#include "record.h"
+
+#define CRTCHECK_IMPLEMENTATION
+#include "crtcheck.h"
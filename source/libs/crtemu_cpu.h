@@ -0,0 +1,1480 @@
+/*
+------------------------------------------------------------------------------
+          Licensing information can be found at the end of the file.
+------------------------------------------------------------------------------
+
+crtemu_cpu.h - v0.1 - Cathode ray tube emulation for C/C++, rendered on the CPU.
+
+Do this:
+    #define CRTEMU_CPU_IMPLEMENTATION
+before you include this file in *one* C/C++ file to create the implementation.
+
+Dependencies:
+    thread.h, which must have its implementation defined in one C/C++ file as well
+*/
+
+
+#ifndef crtemu_cpu_h
+#define crtemu_cpu_h
+
+#ifndef CRTEMU_CPU_U32
+    #define CRTEMU_CPU_U32 unsigned int
+#endif
+#ifndef CRTEMU_CPU_U64
+    #define CRTEMU_CPU_U64 unsigned long long
+#endif
+
+typedef struct crtemu_cpu_t crtemu_cpu_t;
+
+crtemu_cpu_t* crtemu_cpu_create( void* memctx, int thread_count );
+
+void crtemu_cpu_destroy( crtemu_cpu_t* crtemu );
+
+void crtemu_cpu_frame( crtemu_cpu_t* crtemu, CRTEMU_CPU_U32 const* frame_abgr, int frame_width, int frame_height );
+
+void crtemu_cpu_render_divisor( crtemu_cpu_t* crtemu, int divisor );
+
+void crtemu_cpu_present( crtemu_cpu_t* crtemu, CRTEMU_CPU_U64 time_us, CRTEMU_CPU_U32 const* pixels_xbgr, int width,
+    int height, CRTEMU_CPU_U32 border_xbgr, CRTEMU_CPU_U32* output_xbgr, int output_width, int output_height );
+
+#endif /* crtemu_cpu_h */
+
+
+/**
+
+crtemu_cpu.h
+============
+
+Software version of the CRT effect in crtemu.h, for hosts which have no OpenGL, or no GPU at all. It goes through the
+same steps as the shaders of crtemu.h - phosphor persistence, blur, color separation, ghosting, curvature, vignette,
+scanlines, shadow mask, noise, flicker and the frame overlay - but renders into a bitmap in memory instead of to the
+window, and the result can be passed on to `app_present` or written to an image file.
+
+The persistence and blur passes run at the resolution of the input bitmap, and the final pass at the resolution of the
+output bitmap, or a fraction of it set with `crtemu_cpu_render_divisor`. Each pass is split into bands of rows, which
+are shared between the calling thread and the worker threads, and the inner loops use SSE2 where it is available. The
+scalar code does the same operations in the same order as the SSE2 code, so the output is the same with or without
+SSE2, as long as the compiler does float math in single precision and without fused multiply-add, and it is the same
+regardless of the thread count.
+
+Where the shader relies on the GPU, this version differs slightly:
+
+* Intermediate images are kept at 8 bits per channel like the RGB8 textures of the shader version, but gamma curves
+  are looked up in tables, and sines and the power curve of the scanlines are computed with polynomials.
+* The noise comes from a tiled table of random values at a random offset each frame, rather than the `rand` function
+  of the shader, whose results depend on the float precision of the GPU.
+
+
+crtemu_cpu_create
+-----------------
+
+    crtemu_cpu_t* crtemu_cpu_create( void* memctx, int thread_count )
+
+Creates a new instance, which renders on the calling thread and `thread_count - 1` worker threads. `memctx` is passed
+on to the CRTEMU_CPU_MALLOC and CRTEMU_CPU_FREE macros.
+
+
+crtemu_cpu_destroy
+------------------
+
+    void crtemu_cpu_destroy( crtemu_cpu_t* crtemu )
+
+Stops the worker threads and releases all memory used by the instance.
+
+
+crtemu_cpu_frame
+----------------
+
+    void crtemu_cpu_frame( crtemu_cpu_t* crtemu, CRTEMU_CPU_U32 const* frame_abgr, int frame_width, int frame_height )
+
+Sets the image of the monitor casing, which is drawn on top of the screen according to its alpha channel, as with
+`crtemu_frame`. The image is copied. Pass NULL to not draw a frame.
+
+
+crtemu_cpu_render_divisor
+-------------------------
+
+    void crtemu_cpu_render_divisor( crtemu_cpu_t* crtemu, int divisor )
+
+Renders the final pass at the output resolution divided by `divisor`, and scales the result up to the output with
+bilinear filtering. The default is 1, which renders at the output resolution. The scanlines are worked out for the
+reduced resolution, so the image looks as the shader version does in a viewport of that size, scaled up. A divisor of
+2 makes the final pass, which is most of the work, four times cheaper.
+
+
+crtemu_cpu_present
+------------------
+
+    void crtemu_cpu_present( crtemu_cpu_t* crtemu, CRTEMU_CPU_U64 time_us, CRTEMU_CPU_U32 const* pixels_xbgr, int width,
+        int height, CRTEMU_CPU_U32 border_xbgr, CRTEMU_CPU_U32* output_xbgr, int output_width, int output_height )
+
+Adds the bitmap `pixels_xbgr` to the phosphor persistence, and renders the CRT image of it into `output_xbgr`. The
+screen is scaled to fit the output bitmap, keeping its aspect ratio, and the area around it is filled with
+`border_xbgr`. `time_us` is the time since start, which animates scanlines, ghosting, noise and flicker.
+
+*/
+
+
+/*
+----------------------
+    IMPLEMENTATION
+----------------------
+*/
+
+#ifdef CRTEMU_CPU_IMPLEMENTATION
+#undef CRTEMU_CPU_IMPLEMENTATION
+
+#define _CRT_NONSTDC_NO_DEPRECATE
+#define _CRT_SECURE_NO_WARNINGS
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "thread.h"
+
+#ifndef CRTEMU_CPU_MALLOC
+    #include <stdlib.h>
+    #if defined(__cplusplus)
+        #define CRTEMU_CPU_MALLOC( ctx, size ) ( ::malloc( size ) )
+        #define CRTEMU_CPU_FREE( ctx, ptr ) ( ::free( ptr ) )
+    #else
+        #define CRTEMU_CPU_MALLOC( ctx, size ) ( malloc( size ) )
+        #define CRTEMU_CPU_FREE( ctx, ptr ) ( free( ptr ) )
+    #endif
+#endif
+
+#if defined( _M_X64 ) || defined( _M_AMD64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 ) || defined( __SSE2__ )
+    #define CRTEMU_CPU_SSE2
+    #include <emmintrin.h>
+#endif
+
+
+// Intermediate images have a border of black texels, one wide at the top and left and two wide at the bottom and
+// right, so that bilinear samples outside the image need no special cases
+#define CRTEMU_CPU_PAD_BEFORE 1
+#define CRTEMU_CPU_PAD_AFTER 2
+
+#define CRTEMU_CPU_ROWS_PER_JOB 8
+#define CRTEMU_CPU_NOISE_SIZE 128
+
+// Per pixel values for the final pass, worked out for a whole row before the samples are taken
+enum
+    {
+    CRTEMU_CPU_ROW_MAIN_X, CRTEMU_CPU_ROW_MAIN_Y,
+    CRTEMU_CPU_ROW_GHOST_R_X, CRTEMU_CPU_ROW_GHOST_R_Y,
+    CRTEMU_CPU_ROW_GHOST_G_X, CRTEMU_CPU_ROW_GHOST_G_Y,
+    CRTEMU_CPU_ROW_GHOST_B_X, CRTEMU_CPU_ROW_GHOST_B_Y,
+    CRTEMU_CPU_ROW_PRE, // vignette, scanline and shadow mask, applied before tone mapping
+    CRTEMU_CPU_ROW_POST, // flicker, and zero outside of the curved screen, applied after noise
+    CRTEMU_CPU_ROW_RED, CRTEMU_CPU_ROW_GREEN, CRTEMU_CPU_ROW_BLUE,
+    CRTEMU_CPU_ROW_GHOST_RED, CRTEMU_CPU_ROW_GHOST_GREEN, CRTEMU_CPU_ROW_GHOST_BLUE,
+    CRTEMU_CPU_ROW_COUNT,
+    };
+
+
+typedef struct crtemu_cpu_worker_t
+    {
+    crtemu_cpu_t* crtemu;
+    thread_ptr_t thread;
+    thread_signal_t start;
+    float* row; // CRTEMU_CPU_ROW_COUNT arrays of output_width values
+    } crtemu_cpu_worker_t;
+
+
+typedef void (*crtemu_cpu_job_t)( crtemu_cpu_t* crtemu, int index, float* row );
+
+
+struct crtemu_cpu_t
+    {
+    void* memctx;
+
+    // Images at input resolution, all padded
+    int width;
+    int height;
+    int stride;
+    CRTEMU_CPU_U32* images;
+    CRTEMU_CPU_U32 const* pixels;
+    CRTEMU_CPU_U32* accumulate_a; // the screen with persistence and slight blur, which is displayed
+    CRTEMU_CPU_U32* accumulate_b; // persistence carried over to the next frame
+    CRTEMU_CPU_U32* blur_a; // fully blurred accumulate_a, for the ghosting
+    CRTEMU_CPU_U32* temp_a;
+    CRTEMU_CPU_U32* temp_b;
+
+    // Frame image, and the output sized overlay made from it: the frame color premultiplied by its coverage in rgb,
+    // and the coverage of the screen in the top byte
+    CRTEMU_CPU_U32* frame;
+    int frame_width;
+    int frame_height;
+    CRTEMU_CPU_U32* overlay;
+    int overlay_valid;
+
+    // Output of the final pass, and the area of it which the screen covers. With a divisor above 1, the final pass
+    // renders into image, each row of which is scaled up to the width of target into wide as soon as it is done, and
+    // the rows of wide are then blended to make the rows of target.
+    CRTEMU_CPU_U32* output;
+    int output_width;
+    int output_height;
+    int divisor;
+    CRTEMU_CPU_U32* image;
+    CRTEMU_CPU_U32* wide;
+    CRTEMU_CPU_U32* target;
+    int target_width;
+    int target_height;
+    int* scale_positions; // position in image of each target column and then each target row, in 1/256 texels
+    float screen_x;
+    float screen_y;
+    float screen_width;
+    float screen_height;
+    CRTEMU_CPU_U32 border;
+
+    float time;
+    float gamma[ 256 ]; // pow( v / 255, 2.2 ) * 1.25, as in the tsample function of the shader
+    float ghost_strong[ 256 ]; // pow( clamp( 3.0 * gamma * 0.5, 0.0, 1.0 ), 2.0 ), for the ghost's own channel
+    float ghost_weak[ 256 ]; // pow( clamp( 3.0 * gamma * 0.25, 0.0, 1.0 ), 2.0 ), for the other two
+    unsigned char noise[ CRTEMU_CPU_NOISE_SIZE ][ 3 ][ CRTEMU_CPU_NOISE_SIZE * 2 ]; // rows repeated, for 4 at a time
+    int noise_x;
+    int noise_y;
+    unsigned int random_state;
+
+    // Work is handed out as jobs of a few rows each, to the calling thread and the workers
+    crtemu_cpu_job_t job;
+    int job_count;
+    thread_atomic_int_t next_job;
+    crtemu_cpu_worker_t* workers;
+    int worker_count;
+    thread_atomic_int_t busy_workers;
+    thread_atomic_int_t exit;
+    thread_signal_t done;
+    float* row;
+    };
+
+
+static unsigned int crtemu_cpu_internal_random( crtemu_cpu_t* crtemu )
+    {
+    crtemu->random_state = crtemu->random_state * 1664525u + 1013904223u;
+    return crtemu->random_state >> 8;
+    }
+
+
+static void crtemu_cpu_internal_jobs( crtemu_cpu_t* crtemu, float* row )
+    {
+    for( int index = thread_atomic_int_inc( &crtemu->next_job ); index < crtemu->job_count;
+        index = thread_atomic_int_inc( &crtemu->next_job ) )
+        {
+        crtemu->job( crtemu, index, row );
+        }
+    }
+
+
+static int crtemu_cpu_internal_worker( void* user_data )
+    {
+    crtemu_cpu_worker_t* worker = (crtemu_cpu_worker_t*) user_data;
+    crtemu_cpu_t* crtemu = worker->crtemu;
+    for( ; ; )
+        {
+        thread_signal_wait( &worker->start, THREAD_SIGNAL_WAIT_INFINITE );
+        if( thread_atomic_int_load( &crtemu->exit ) ) break;
+        crtemu_cpu_internal_jobs( crtemu, worker->row );
+        if( thread_atomic_int_dec( &crtemu->busy_workers ) == 1 )
+            thread_signal_raise( &crtemu->done );
+        }
+    return 0;
+    }
+
+
+// Runs count jobs on all threads, and returns when they are all done
+static void crtemu_cpu_internal_run( crtemu_cpu_t* crtemu, crtemu_cpu_job_t job, int count )
+    {
+    crtemu->job = job;
+    crtemu->job_count = count;
+    thread_atomic_int_store( &crtemu->next_job, 0 );
+    if( crtemu->worker_count > 0 && count > 1 )
+        {
+        thread_atomic_int_store( &crtemu->busy_workers, crtemu->worker_count );
+        for( int i = 0; i < crtemu->worker_count; ++i )
+            thread_signal_raise( &crtemu->workers[ i ].start );
+        crtemu_cpu_internal_jobs( crtemu, crtemu->row );
+        thread_signal_wait( &crtemu->done, THREAD_SIGNAL_WAIT_INFINITE );
+        }
+    else
+        {
+        crtemu_cpu_internal_jobs( crtemu, crtemu->row );
+        }
+    }
+
+
+crtemu_cpu_t* crtemu_cpu_create( void* memctx, int thread_count )
+    {
+    crtemu_cpu_t* crtemu = (crtemu_cpu_t*) CRTEMU_CPU_MALLOC( memctx, sizeof( crtemu_cpu_t ) );
+    memset( crtemu, 0, sizeof( *crtemu ) );
+    crtemu->memctx = memctx;
+    crtemu->random_state = 0x5eed;
+    crtemu->divisor = 1;
+
+    for( int i = 0; i < 256; ++i )
+        {
+        crtemu->gamma[ i ] = powf( (float) i / 255.0f, 2.2f ) * 1.25f;
+        float strong = crtemu->gamma[ i ] * 1.5f;
+        float weak = crtemu->gamma[ i ] * 0.75f;
+        crtemu->ghost_strong[ i ] = strong > 1.0f ? 1.0f : strong * strong;
+        crtemu->ghost_weak[ i ] = weak > 1.0f ? 1.0f : weak * weak;
+        }
+
+    // Noise is subtracted as 0.015 * pow( random, 1.5 ) per channel, stored scaled to 0-255
+    for( int y = 0; y < CRTEMU_CPU_NOISE_SIZE; ++y )
+        for( int i = 0; i < 3; ++i )
+            for( int x = 0; x < CRTEMU_CPU_NOISE_SIZE; ++x )
+                {
+                float value = powf( (float)( crtemu_cpu_internal_random( crtemu ) & 0xffff ) / 65535.0f, 1.5f );
+                crtemu->noise[ y ][ i ][ x ] = (unsigned char)( value * 255.0f + 0.5f );
+                crtemu->noise[ y ][ i ][ x + CRTEMU_CPU_NOISE_SIZE ] = crtemu->noise[ y ][ i ][ x ];
+                }
+
+    thread_signal_init( &crtemu->done );
+    thread_atomic_int_store( &crtemu->exit, 0 );
+    crtemu->worker_count = thread_count > 1 ? thread_count - 1 : 0;
+    if( crtemu->worker_count > 0 )
+        {
+        crtemu->workers = (crtemu_cpu_worker_t*) CRTEMU_CPU_MALLOC( memctx, sizeof( crtemu_cpu_worker_t ) * (size_t) crtemu->worker_count );
+        memset( crtemu->workers, 0, sizeof( crtemu_cpu_worker_t ) * (size_t) crtemu->worker_count );
+        for( int i = 0; i < crtemu->worker_count; ++i )
+            {
+            crtemu_cpu_worker_t* worker = &crtemu->workers[ i ];
+            worker->crtemu = crtemu;
+            thread_signal_init( &worker->start );
+            worker->thread = thread_create( crtemu_cpu_internal_worker, worker, "crtemu_cpu", THREAD_STACK_SIZE_DEFAULT );
+            }
+        }
+
+    return crtemu;
+    }
+
+
+void crtemu_cpu_destroy( crtemu_cpu_t* crtemu )
+    {
+    thread_atomic_int_store( &crtemu->exit, 1 );
+    for( int i = 0; i < crtemu->worker_count; ++i )
+        {
+        crtemu_cpu_worker_t* worker = &crtemu->workers[ i ];
+        thread_signal_raise( &worker->start );
+        thread_join( worker->thread );
+        thread_destroy( worker->thread );
+        thread_signal_term( &worker->start );
+        if( worker->row ) CRTEMU_CPU_FREE( crtemu->memctx, worker->row );
+        }
+    if( crtemu->workers ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->workers );
+    thread_signal_term( &crtemu->done );
+
+    if( crtemu->row ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->row );
+    if( crtemu->images ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->images );
+    if( crtemu->frame ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->frame );
+    if( crtemu->overlay ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->overlay );
+    if( crtemu->image ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->image );
+    if( crtemu->wide ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->wide );
+    if( crtemu->scale_positions ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->scale_positions );
+    CRTEMU_CPU_FREE( crtemu->memctx, crtemu );
+    }
+
+
+void crtemu_cpu_frame( crtemu_cpu_t* crtemu, CRTEMU_CPU_U32 const* frame_abgr, int frame_width, int frame_height )
+    {
+    if( crtemu->frame ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->frame );
+    crtemu->frame = 0;
+    if( frame_abgr )
+        {
+        size_t size = sizeof( CRTEMU_CPU_U32 ) * (size_t)( frame_width * frame_height );
+        crtemu->frame = (CRTEMU_CPU_U32*) CRTEMU_CPU_MALLOC( crtemu->memctx, size );
+        memcpy( crtemu->frame, frame_abgr, size );
+        crtemu->frame_width = frame_width;
+        crtemu->frame_height = frame_height;
+        }
+    crtemu->overlay_valid = 0;
+    }
+
+
+void crtemu_cpu_render_divisor( crtemu_cpu_t* crtemu, int divisor )
+    {
+    crtemu->divisor = divisor > 1 ? divisor : 1;
+    crtemu->target_width = 0; // sizes are worked out again on the next present
+    crtemu->target_height = 0;
+    }
+
+
+// Weights are 16-bit fractions, and each weighted texel is kept with 8 bits of fraction until the sum is rounded.
+// This is what the SSE2 versions do in 16-bit lanes, so both give the same result.
+static void crtemu_cpu_internal_weigh( CRTEMU_CPU_U32 pixel, unsigned int weight, unsigned int sums[ 3 ] )
+    {
+    sums[ 0 ] += ( ( ( pixel       ) & 0xff ) * weight ) >> 8;
+    sums[ 1 ] += ( ( ( pixel >>  8 ) & 0xff ) * weight ) >> 8;
+    sums[ 2 ] += ( ( ( pixel >> 16 ) & 0xff ) * weight ) >> 8;
+    }
+
+
+static CRTEMU_CPU_U32 crtemu_cpu_internal_round( unsigned int const sums[ 3 ] )
+    {
+    unsigned int r = ( sums[ 0 ] + 128 ) >> 8;
+    unsigned int g = ( sums[ 1 ] + 128 ) >> 8;
+    unsigned int b = ( sums[ 2 ] + 128 ) >> 8;
+    return ( ( b > 255 ? 255 : b ) << 16 ) | ( ( g > 255 ? 255 : g ) << 8 ) | ( r > 255 ? 255 : r );
+    }
+
+
+// One texel of a gaussian blur along a row, weights[ 0 ] being the center and weights[ i ] the texels i steps to either
+// side. At the ends, the row either wraps around, like a texture set to GL_REPEAT, or is black, like
+// GL_CLAMP_TO_BORDER.
+static CRTEMU_CPU_U32 crtemu_cpu_internal_blur_texel( CRTEMU_CPU_U32 const* in, int width, int x,
+    unsigned short const* weights, int radius, int wrap )
+    {
+    unsigned int sums[ 3 ] = { 0, 0, 0 };
+    for( int i = -radius; i <= radius; ++i )
+        {
+        int s = x + i;
+        if( s < 0 || s >= width )
+            {
+            if( !wrap ) continue;
+            s = ( s + width ) % width;
+            }
+        crtemu_cpu_internal_weigh( in[ s ], weights[ i < 0 ? -i : i ], sums );
+        }
+    return crtemu_cpu_internal_round( sums );
+    }
+
+
+static void crtemu_cpu_internal_blur_row( CRTEMU_CPU_U32* out, CRTEMU_CPU_U32 const* in, int width,
+    unsigned short const* weights, int radius, int wrap )
+    {
+    int x = 0;
+    for( ; x < radius && x < width; ++x )
+        out[ x ] = crtemu_cpu_internal_blur_texel( in, width, x, weights, radius, wrap );
+    #ifdef CRTEMU_CPU_SSE2
+        __m128i zero = _mm_setzero_si128();
+        for( ; x + 2 <= width - radius; x += 2 )
+            {
+            __m128i sum = _mm_setzero_si128();
+            for( int i = -radius; i <= radius; ++i )
+                {
+                __m128i pixels = _mm_unpacklo_epi8( zero, _mm_loadl_epi64( (__m128i const*)( in + x + i ) ) );
+                sum = _mm_add_epi16( sum, _mm_mulhi_epu16( pixels, _mm_set1_epi16( (short) weights[ i < 0 ? -i : i ] ) ) );
+                }
+            sum = _mm_srli_epi16( _mm_add_epi16( sum, _mm_set1_epi16( 128 ) ), 8 );
+            _mm_storel_epi64( (__m128i*)( out + x ), _mm_packus_epi16( sum, zero ) );
+            }
+    #endif
+    for( ; x < width; ++x )
+        out[ x ] = crtemu_cpu_internal_blur_texel( in, width, x, weights, radius, wrap );
+    }
+
+
+// Gaussian blur down the columns, for output row y. Rows outside the image wrap around or are black, as for rows.
+static void crtemu_cpu_internal_blur_column( CRTEMU_CPU_U32* out, CRTEMU_CPU_U32 const* in, int stride, int width,
+    int height, int y, unsigned short const* weights, int radius, int wrap )
+    {
+    CRTEMU_CPU_U32 const* rows[ 9 ];
+    int count = 0;
+    unsigned short row_weights[ 9 ];
+    for( int i = -radius; i <= radius; ++i )
+        {
+        int s = y + i;
+        if( s < 0 || s >= height )
+            {
+            if( !wrap ) continue;
+            s = ( s + height ) % height;
+            }
+        rows[ count ] = in + s * stride;
+        row_weights[ count ] = weights[ i < 0 ? -i : i ];
+        ++count;
+        }
+
+    int x = 0;
+    #ifdef CRTEMU_CPU_SSE2
+        __m128i zero = _mm_setzero_si128();
+        for( ; x + 2 <= width; x += 2 )
+            {
+            __m128i sum = _mm_setzero_si128();
+            for( int i = 0; i < count; ++i )
+                {
+                __m128i pixels = _mm_unpacklo_epi8( zero, _mm_loadl_epi64( (__m128i const*)( rows[ i ] + x ) ) );
+                sum = _mm_add_epi16( sum, _mm_mulhi_epu16( pixels, _mm_set1_epi16( (short) row_weights[ i ] ) ) );
+                }
+            sum = _mm_srli_epi16( _mm_add_epi16( sum, _mm_set1_epi16( 128 ) ), 8 );
+            _mm_storel_epi64( (__m128i*)( out + x ), _mm_packus_epi16( sum, zero ) );
+            }
+    #endif
+    for( ; x < width; ++x )
+        {
+        unsigned int sums[ 3 ] = { 0, 0, 0 };
+        for( int i = 0; i < count; ++i )
+            crtemu_cpu_internal_weigh( rows[ i ][ x ], row_weights[ i ], sums );
+        out[ x ] = crtemu_cpu_internal_round( sums );
+        }
+    }
+
+
+// Each channel scaled by a 16-bit fraction, and rounded
+static CRTEMU_CPU_U32 crtemu_cpu_internal_scale( CRTEMU_CPU_U32 pixel, unsigned int scale )
+    {
+    unsigned int sums[ 3 ] = { 0, 0, 0 };
+    crtemu_cpu_internal_weigh( pixel, scale, sums );
+    return crtemu_cpu_internal_round( sums );
+    }
+
+
+static CRTEMU_CPU_U32 crtemu_cpu_internal_max( CRTEMU_CPU_U32 a, CRTEMU_CPU_U32 b )
+    {
+    CRTEMU_CPU_U32 r = ( a & 0xff ) > ( b & 0xff ) ? ( a & 0xff ) : ( b & 0xff );
+    CRTEMU_CPU_U32 g = ( a & 0xff00 ) > ( b & 0xff00 ) ? ( a & 0xff00 ) : ( b & 0xff00 );
+    CRTEMU_CPU_U32 bl = ( a & 0xff0000 ) > ( b & 0xff0000 ) ? ( a & 0xff0000 ) : ( b & 0xff0000 );
+    return bl | g | r;
+    }
+
+
+// The 9-tap kernel of the blur shader. When it is run with a radius of 0.17 texels instead of 1, all its taps fall
+// within one texel of the center, and with linear filtering it works out as a 3-tap kernel.
+static unsigned short const crtemu_cpu_internal_blur_weights[ 5 ] = { 14879, 12753, 7971, 3542, 1063 };
+static unsigned short const crtemu_cpu_internal_slight_blur_weights[ 2 ] = { 50721, 7407 };
+
+#define CRTEMU_CPU_PERSIST_SCALE 62915 // 0.96
+#define CRTEMU_CPU_BLEND_SCALE 20972 // 0.32
+
+
+// Rows of the previous accumulation, blurred horizontally
+static void crtemu_cpu_internal_job_persist_rows( crtemu_cpu_t* crtemu, int index, float* row )
+    {
+    (void) row;
+    int end = ( index + 1 ) * CRTEMU_CPU_ROWS_PER_JOB;
+    for( int y = index * CRTEMU_CPU_ROWS_PER_JOB; y < end && y < crtemu->height; ++y )
+        crtemu_cpu_internal_blur_row( crtemu->temp_a + y * crtemu->stride, crtemu->accumulate_b + y * crtemu->stride,
+            crtemu->width, crtemu_cpu_internal_blur_weights, 4, 1 );
+    }
+
+
+// Finishes blurring the previous accumulation, and adds the new frame to it. Then the slight blur of the result is
+// started.
+static void crtemu_cpu_internal_job_accumulate( crtemu_cpu_t* crtemu, int index, float* row )
+    {
+    (void) row;
+    int end = ( index + 1 ) * CRTEMU_CPU_ROWS_PER_JOB;
+    for( int y = index * CRTEMU_CPU_ROWS_PER_JOB; y < end && y < crtemu->height; ++y )
+        {
+        CRTEMU_CPU_U32* blurred = crtemu->blur_a + y * crtemu->stride;
+        crtemu_cpu_internal_blur_column( blurred, crtemu->temp_a, crtemu->stride, crtemu->width, crtemu->height, y,
+            crtemu_cpu_internal_blur_weights, 4, 1 );
+
+        CRTEMU_CPU_U32 const* pixels = crtemu->pixels + y * crtemu->width;
+        CRTEMU_CPU_U32* accumulate_a = crtemu->accumulate_a + y * crtemu->stride;
+        CRTEMU_CPU_U32* accumulate_b = crtemu->accumulate_b + y * crtemu->stride;
+        for( int x = 0; x < crtemu->width; ++x )
+            {
+            CRTEMU_CPU_U32 pixel = pixels[ x ] & 0xffffff;
+            CRTEMU_CPU_U32 persist = crtemu_cpu_internal_max( pixel, crtemu_cpu_internal_scale( blurred[ x ], CRTEMU_CPU_PERSIST_SCALE ) );
+            accumulate_b[ x ] = persist;
+            accumulate_a[ x ] = crtemu_cpu_internal_max( pixel, crtemu_cpu_internal_scale( persist, CRTEMU_CPU_BLEND_SCALE ) );
+            }
+
+        crtemu_cpu_internal_blur_row( crtemu->temp_b + y * crtemu->stride, accumulate_a, crtemu->width,
+            crtemu_cpu_internal_slight_blur_weights, 1, 0 );
+        }
+    }
+
+
+// Finishes the slight blur, which gives the image to display, and starts the full blur of it for the ghosting
+static void crtemu_cpu_internal_job_slight_blur( crtemu_cpu_t* crtemu, int index, float* row )
+    {
+    (void) row;
+    int end = ( index + 1 ) * CRTEMU_CPU_ROWS_PER_JOB;
+    for( int y = index * CRTEMU_CPU_ROWS_PER_JOB; y < end && y < crtemu->height; ++y )
+        {
+        CRTEMU_CPU_U32* accumulate_a = crtemu->accumulate_a + y * crtemu->stride;
+        crtemu_cpu_internal_blur_column( accumulate_a, crtemu->temp_b, crtemu->stride, crtemu->width, crtemu->height,
+            y, crtemu_cpu_internal_slight_blur_weights, 1, 1 );
+        crtemu_cpu_internal_blur_row( crtemu->temp_a + y * crtemu->stride, accumulate_a, crtemu->width,
+            crtemu_cpu_internal_blur_weights, 4, 0 );
+        }
+    }
+
+
+static void crtemu_cpu_internal_job_ghost_blur( crtemu_cpu_t* crtemu, int index, float* row )
+    {
+    (void) row;
+    int end = ( index + 1 ) * CRTEMU_CPU_ROWS_PER_JOB;
+    for( int y = index * CRTEMU_CPU_ROWS_PER_JOB; y < end && y < crtemu->height; ++y )
+        crtemu_cpu_internal_blur_column( crtemu->blur_a + y * crtemu->stride, crtemu->temp_a, crtemu->stride,
+            crtemu->width, crtemu->height, y, crtemu_cpu_internal_blur_weights, 4, 1 );
+    }
+
+
+// Bilinear sample of an image with 8 bits per channel, at texel coordinates x, y. Red and blue are interpolated
+// together in 16-bit fields, and so are green and alpha, first vertically and then horizontally, rounding down after
+// each step as the SSE2 version does.
+static CRTEMU_CPU_U32 crtemu_cpu_internal_sample( CRTEMU_CPU_U32 const* image, int stride, int width, int height,
+    float x, float y )
+    {
+    x = x < -1.0f ? -1.0f : x > (float) width ? (float) width : x;
+    y = y < -1.0f ? -1.0f : y > (float) height ? (float) height : y;
+    int ix = (int)( x + 1.0f );
+    int iy = (int)( y + 1.0f );
+    unsigned int fx = (unsigned int)( ( x + 1.0f - (float) ix ) * 256.0f );
+    unsigned int fy = (unsigned int)( ( y + 1.0f - (float) iy ) * 256.0f );
+    CRTEMU_CPU_U32 const* p = image + ( iy - 1 ) * stride + ix - 1;
+    CRTEMU_CPU_U32 t00 = p[ 0 ], t01 = p[ 1 ], t10 = p[ stride ], t11 = p[ stride + 1 ];
+
+    CRTEMU_CPU_U32 rb0 = ( ( ( t00 & 0xff00ff ) * ( 256 - fy ) + ( t10 & 0xff00ff ) * fy ) >> 8 ) & 0xff00ff;
+    CRTEMU_CPU_U32 rb1 = ( ( ( t01 & 0xff00ff ) * ( 256 - fy ) + ( t11 & 0xff00ff ) * fy ) >> 8 ) & 0xff00ff;
+    CRTEMU_CPU_U32 rb = ( ( rb0 * ( 256 - fx ) + rb1 * fx ) >> 8 ) & 0xff00ff;
+    CRTEMU_CPU_U32 ga0 = ( ( ( ( t00 >> 8 ) & 0xff00ff ) * ( 256 - fy ) + ( ( t10 >> 8 ) & 0xff00ff ) * fy ) >> 8 ) & 0xff00ff;
+    CRTEMU_CPU_U32 ga1 = ( ( ( ( t01 >> 8 ) & 0xff00ff ) * ( 256 - fy ) + ( ( t11 >> 8 ) & 0xff00ff ) * fy ) >> 8 ) & 0xff00ff;
+    CRTEMU_CPU_U32 ga = ( ( ga0 * ( 256 - fx ) + ga1 * fx ) >> 8 ) & 0xff00ff;
+    return rb | ( ga << 8 );
+    }
+
+
+#ifdef CRTEMU_CPU_SSE2
+
+// Bilinear sample as crtemu_cpu_internal_sample, with all channels interpolated together in 16-bit lanes. The weights
+// are 256 - fy in all lanes of weight_top, fy in all lanes of weight_bottom, and 256 - fx and fx in the low and high
+// half of weight_x.
+static CRTEMU_CPU_U32 crtemu_cpu_internal_sample_sse2( CRTEMU_CPU_U32 const* p, int stride, __m128i weight_top,
+    __m128i weight_bottom, __m128i weight_x )
+    {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i top = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i const*) p ), zero );
+    __m128i bottom = _mm_unpacklo_epi8( _mm_loadl_epi64( (__m128i const*)( p + stride ) ), zero );
+    __m128i v = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( top, weight_top ), _mm_mullo_epi16( bottom, weight_bottom ) ), 8 );
+    v = _mm_mullo_epi16( v, weight_x );
+    v = _mm_srli_epi16( _mm_add_epi16( v, _mm_srli_si128( v, 8 ) ), 8 );
+    return (CRTEMU_CPU_U32) _mm_cvtsi128_si32( _mm_packus_epi16( v, v ) );
+    }
+
+
+// Bilinear samples at four texel positions
+static void crtemu_cpu_internal_sample4( CRTEMU_CPU_U32 const* image, int stride, int width, int height, __m128 x,
+    __m128 y, CRTEMU_CPU_U32 out[ 4 ] )
+    {
+    __m128 const one = _mm_set1_ps( 1.0f );
+    x = _mm_add_ps( _mm_min_ps( _mm_max_ps( x, _mm_set1_ps( -1.0f ) ), _mm_set1_ps( (float) width ) ), one );
+    y = _mm_add_ps( _mm_min_ps( _mm_max_ps( y, _mm_set1_ps( -1.0f ) ), _mm_set1_ps( (float) height ) ), one );
+    __m128i ix = _mm_cvttps_epi32( x );
+    __m128i iy = _mm_cvttps_epi32( y );
+    __m128i fx = _mm_cvttps_epi32( _mm_mul_ps( _mm_sub_ps( x, _mm_cvtepi32_ps( ix ) ), _mm_set1_ps( 256.0f ) ) );
+    __m128i fy = _mm_cvttps_epi32( _mm_mul_ps( _mm_sub_ps( y, _mm_cvtepi32_ps( iy ) ), _mm_set1_ps( 256.0f ) ) );
+    int ixs[ 4 ], iys[ 4 ];
+    _mm_storeu_si128( (__m128i*) ixs, ix );
+    _mm_storeu_si128( (__m128i*) iys, iy );
+
+    // Weights as 16-bit values, in pairs for each of the four samples, ready to be broadcast
+    __m128i const full = _mm_set1_epi32( 256 );
+    __m128i wx = _mm_packs_epi32( _mm_sub_epi32( full, fx ), fx );
+    __m128i wt = _mm_packs_epi32( _mm_sub_epi32( full, fy ), _mm_sub_epi32( full, fy ) );
+    __m128i wb = _mm_packs_epi32( fy, fy );
+    wt = _mm_unpacklo_epi16( wt, wt );
+    wb = _mm_unpacklo_epi16( wb, wb );
+
+    #define CRTEMU_CPU_SAMPLE( i ) \
+        out[ i ] = crtemu_cpu_internal_sample_sse2( image + ( iys[ i ] - 1 ) * stride + ixs[ i ] - 1, stride, \
+            _mm_shuffle_epi32( wt, i * 0x55 ), _mm_shuffle_epi32( wb, i * 0x55 ), \
+            _mm_shufflehi_epi16( _mm_shufflelo_epi16( wx, i * 0x55 ), i * 0x55 ) );
+    CRTEMU_CPU_SAMPLE( 0 )
+    CRTEMU_CPU_SAMPLE( 1 )
+    CRTEMU_CPU_SAMPLE( 2 )
+    CRTEMU_CPU_SAMPLE( 3 )
+    #undef CRTEMU_CPU_SAMPLE
+    }
+
+#endif /* CRTEMU_CPU_SSE2 */
+
+
+// Builds the frame overlay for the current output size
+static void crtemu_cpu_internal_job_overlay( crtemu_cpu_t* crtemu, int index, float* row )
+    {
+    (void) row;
+    int end = ( index + 1 ) * CRTEMU_CPU_ROWS_PER_JOB;
+    for( int y = index * CRTEMU_CPU_ROWS_PER_JOB; y < end && y < crtemu->output_height; ++y )
+        {
+        CRTEMU_CPU_U32* overlay = crtemu->overlay + y * crtemu->output_width;
+        float uv_y = ( (float)( crtemu->output_height - y ) - 0.5f - crtemu->screen_y ) / crtemu->screen_height;
+        for( int x = 0; x < crtemu->output_width; ++x )
+            {
+            float uv_x = ( (float) x + 0.5f - crtemu->screen_x ) / crtemu->screen_width;
+            if( !crtemu->frame )
+                {
+                overlay[ x ] = 0xff000000;
+                continue;
+                }
+
+            // f = texture2D( frametexture, uv * ( 1.0 + 2.0 * fscale ) - fscale - vec2( -0.0, 0.005 ) )
+            float fx = ( uv_x * 0.962f + 0.019f ) * (float) crtemu->frame_width - 0.5f;
+            float fy = ( uv_y * 0.964f + 0.013f ) * (float) crtemu->frame_height - 0.5f;
+            CRTEMU_CPU_U32 f = 0;
+            if( fx > -1.0f && fy > -1.0f && fx < (float) crtemu->frame_width && fy < (float) crtemu->frame_height )
+                {
+                int ix = (int)( fx + 1.0f ) - 1;
+                int iy = (int)( fy + 1.0f ) - 1;
+                float wx = fx - (float) ix;
+                float wy = fy - (float) iy;
+                float c[ 4 ] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for( int j = 0; j < 4; ++j )
+                    {
+                    int sx = ix + ( j & 1 );
+                    int sy = iy + ( j >> 1 );
+                    if( sx < 0 || sy < 0 || sx >= crtemu->frame_width || sy >= crtemu->frame_height ) continue;
+                    CRTEMU_CPU_U32 t = crtemu->frame[ sx + sy * crtemu->frame_width ];
+                    float w = ( ( j & 1 ) ? wx : 1.0f - wx ) * ( ( j >> 1 ) ? wy : 1.0f - wy );
+                    for( int k = 0; k < 4; ++k ) c[ k ] += (float)( ( t >> ( k * 8 ) ) & 0xff ) / 255.0f * w;
+                    }
+                float fvig = 512.0f * uv_x * uv_y * ( 1.0f - uv_x ) * ( 1.0f - uv_y );
+                fvig = fvig < 0.2f ? 0.2f : fvig > 0.8f ? 0.8f : fvig;
+                float a = c[ 3 ] * c[ 3 ];
+                for( int k = 0; k < 3; ++k )
+                    {
+                    float v = powf( c[ k ] * 0.5f + 0.25f, 1.4f ) * fvig * a;
+                    f |= (CRTEMU_CPU_U32)( ( v > 1.0f ? 1.0f : v ) * 255.0f + 0.5f ) << ( k * 8 );
+                    }
+                f |= (CRTEMU_CPU_U32)( ( 1.0f - a ) * 255.0f + 0.5f ) << 24;
+                }
+            else
+                {
+                f = 0xff000000;
+                }
+            overlay[ x ] = f;
+            }
+        }
+    }
+
+
+// Rounds to the nearest integer, and halfway cases to the even one, which is what _mm_cvtps_epi32 does
+static float crtemu_cpu_internal_nearest( float x )
+    {
+    float f = floorf( x );
+    float d = x - f;
+    if( d > 0.5f || ( d == 0.5f && fmodf( f, 2.0f ) != 0.0f ) ) f += 1.0f;
+    return f;
+    }
+
+
+// Sine for the range of arguments used here, reduced to -pi/2 to pi/2 and approximated by a polynomial. The scalar and
+// SSE2 versions do the same operations in the same order, so they give the same results.
+static float crtemu_cpu_internal_sin1( float x )
+    {
+    float q = crtemu_cpu_internal_nearest( x * 0.15915494f );
+    x = x - q * 6.28125f;
+    x = x - q * 0.0019353072f;
+    if( x > 1.5707964f ) x = 3.1415927f - x;
+    else if( x < 0.0f - 1.5707964f ) x = ( 0.0f - 3.1415927f ) - x;
+    float x2 = x * x;
+    float p = 2.7557319e-6f;
+    p = p * x2 + -1.9841270e-4f;
+    p = p * x2 + 8.3333333e-3f;
+    p = p * x2 + -1.6666667e-1f;
+    p = p * x2 + 1.0f;
+    return p * x;
+    }
+
+
+// pow( 0.35 + 0.18 * s, 0.9 ) as a polynomial of s, which is within 0.00001 for all s from -1 to 1
+static float crtemu_cpu_internal_scans1( float s )
+    {
+    float scans = -0.00027434199f;
+    scans = scans * s + 0.00098094868f;
+    scans = scans * s + -0.0046167466f;
+    scans = scans * s + 0.17990384f;
+    scans = scans * s + 0.3887418f;
+    return scans;
+    }
+
+
+#ifdef CRTEMU_CPU_SSE2
+
+static __m128 crtemu_cpu_internal_sin( __m128 x )
+    {
+    __m128 q = _mm_cvtepi32_ps( _mm_cvtps_epi32( _mm_mul_ps( x, _mm_set1_ps( 0.15915494f ) ) ) );
+    x = _mm_sub_ps( x, _mm_mul_ps( q, _mm_set1_ps( 6.28125f ) ) );
+    x = _mm_sub_ps( x, _mm_mul_ps( q, _mm_set1_ps( 0.0019353072f ) ) );
+    __m128 half_pi = _mm_set1_ps( 1.5707964f );
+    __m128 pi = _mm_set1_ps( 3.1415927f );
+    __m128 above = _mm_cmpgt_ps( x, half_pi );
+    __m128 below = _mm_cmplt_ps( x, _mm_sub_ps( _mm_setzero_ps(), half_pi ) );
+    x = _mm_or_ps( _mm_andnot_ps( _mm_or_ps( above, below ), x ),
+        _mm_or_ps( _mm_and_ps( above, _mm_sub_ps( pi, x ) ), _mm_and_ps( below, _mm_sub_ps( _mm_sub_ps( _mm_setzero_ps(), pi ), x ) ) ) );
+    __m128 x2 = _mm_mul_ps( x, x );
+    __m128 p = _mm_set1_ps( 2.7557319e-6f );
+    p = _mm_add_ps( _mm_mul_ps( p, x2 ), _mm_set1_ps( -1.9841270e-4f ) );
+    p = _mm_add_ps( _mm_mul_ps( p, x2 ), _mm_set1_ps( 8.3333333e-3f ) );
+    p = _mm_add_ps( _mm_mul_ps( p, x2 ), _mm_set1_ps( -1.6666667e-1f ) );
+    p = _mm_add_ps( _mm_mul_ps( p, x2 ), _mm_set1_ps( 1.0f ) );
+    return _mm_mul_ps( p, x );
+    }
+
+
+#endif /* CRTEMU_CPU_SSE2 */
+
+
+// Sample positions and scale factors for one row of the final pass, from x0 to x1. These follow the main function of
+// the crt shader in crtemu.h, up to where the samples are taken. The scalar loop does the same operations as the SSE2
+// loop in the same order, and handles the pixels the SSE2 loop leaves over.
+static void crtemu_cpu_internal_row_setup( crtemu_cpu_t* crtemu, float* row, int y, int x0, int x1 )
+    {
+    float const t = crtemu->time;
+    float const w = (float) crtemu->width;
+    float const h = (float) crtemu->height;
+    float const frag_y = (float)( crtemu->output_height - y ) - 0.5f;
+    float const uv_y = ( frag_y - crtemu->screen_y ) / crtemu->screen_height;
+    float const inv_screen_width = 1.0f / crtemu->screen_width;
+    float const o = sinf( frag_y * 1.5f ) / (float) crtemu->output_width;
+    float const wobble = 0.007f * 0.35f;
+    float const scans_scale = (float) crtemu->output_height * 1.5f;
+    int const n = crtemu->output_width;
+
+    // Shadow mask for pixels at a multiple of 3, one after and two after
+    static float const masks[ 3 ] = { 1.0f - 0.23f * 0.25f, 1.0f - 0.23f * 0.75f, 1.0f - 0.23f * 1.0f };
+
+    // The wobble of the ghosts is sin( a + phase ) for a = 15 * curved_uv.y or 10 * curved_uv.y, which is worked out as
+    // sin( a ) * cos( phase ) + cos( a ) * sin( phase ) to share the sines between the three ghosts. wobble_sin is what
+    // sin( a ) is multiplied by, and wobble_cos what cos( a ) is multiplied by.
+    float const phases[ 6 ] = { 1.0f / 7.0f + 0.9f * t, 2.0f / 7.0f + 1.37f * t, 1.0f / 9.0f + 0.5f * t + 1.5707964f,
+        2.0f / 9.0f + 1.5f * t, 2.0f / 3.0f + 0.7f * t, 2.0f / 3.0f + 1.63f * t + 1.5707964f };
+    float wobble_sin[ 6 ], wobble_cos[ 6 ];
+    for( int i = 0; i < 6; ++i )
+        {
+        wobble_sin[ i ] = wobble * cosf( phases[ i ] );
+        wobble_cos[ i ] = wobble * sinf( phases[ i ] );
+        }
+
+    int x = x0;
+    #ifdef CRTEMU_CPU_SSE2
+        __m128 const one = _mm_set1_ps( 1.0f );
+        __m128 const zero = _mm_setzero_ps();
+        __m128 const vt = _mm_set1_ps( t );
+        __m128 const c_y = _mm_set1_ps( ( uv_y - 0.5f ) * 2.2f );
+        __m128 const lanes = _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f );
+        __m128 const mask_lanes[ 3 ] =
+            {
+            _mm_set_ps( masks[ 0 ], masks[ 2 ], masks[ 1 ], masks[ 0 ] ),
+            _mm_set_ps( masks[ 1 ], masks[ 0 ], masks[ 2 ], masks[ 1 ] ),
+            _mm_set_ps( masks[ 2 ], masks[ 1 ], masks[ 0 ], masks[ 2 ] ),
+            };
+
+        for( ; x + 4 <= x1; x += 4 )
+            {
+            // Curve
+            __m128 uv_x = _mm_mul_ps( _mm_sub_ps( _mm_add_ps( _mm_set1_ps( (float) x ), lanes ), _mm_set1_ps( crtemu->screen_x ) ),
+                _mm_set1_ps( inv_screen_width ) );
+            __m128 cx = _mm_mul_ps( _mm_sub_ps( uv_x, _mm_set1_ps( 0.5f ) ), _mm_set1_ps( 2.2f ) );
+            __m128 cy = c_y;
+            __m128 ty = _mm_mul_ps( cy, _mm_set1_ps( 0.2f ) );
+            cx = _mm_mul_ps( cx, _mm_add_ps( one, _mm_mul_ps( ty, ty ) ) );
+            __m128 tx = _mm_mul_ps( cx, _mm_set1_ps( 0.25f ) );
+            cy = _mm_mul_ps( cy, _mm_add_ps( one, _mm_mul_ps( tx, tx ) ) );
+            __m128 cuv_x = _mm_add_ps( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( cx, _mm_set1_ps( 0.46f ) ), _mm_set1_ps( 0.5f ) ), _mm_set1_ps( 0.6f ) ),
+                _mm_mul_ps( uv_x, _mm_set1_ps( 0.4f ) ) );
+            __m128 cuv_y = _mm_add_ps( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( cy, _mm_set1_ps( 0.46f ) ), _mm_set1_ps( 0.5f ) ), _mm_set1_ps( 0.6f ) ),
+                _mm_set1_ps( uv_y * 0.4f ) );
+            __m128 scuv_x = _mm_add_ps( _mm_mul_ps( cuv_x, _mm_set1_ps( 0.96f ) ), _mm_set1_ps( 0.023f ) );
+            __m128 scuv_y = _mm_add_ps( _mm_mul_ps( cuv_y, _mm_set1_ps( 0.96f ) ), _mm_set1_ps( 0.019f ) );
+
+            // Bleed
+            __m128 bx = _mm_mul_ps( _mm_mul_ps(
+                crtemu_cpu_internal_sin( _mm_add_ps( _mm_set1_ps( 0.1f * t ), _mm_mul_ps( cuv_y, _mm_set1_ps( 13.0f ) ) ) ),
+                crtemu_cpu_internal_sin( _mm_add_ps( _mm_set1_ps( 0.23f * t ), _mm_mul_ps( cuv_y, _mm_set1_ps( 19.0f ) ) ) ) ),
+                crtemu_cpu_internal_sin( _mm_add_ps( _mm_set1_ps( 0.3f + 0.11f * t ), _mm_mul_ps( cuv_y, _mm_set1_ps( 23.0f ) ) ) ) );
+            bx = _mm_add_ps( _mm_mul_ps( bx, _mm_set1_ps( 0.0012f ) ), _mm_set1_ps( o * 0.25f ) );
+
+            // Texel positions, as in tsample: tc * vec2( 1.025, 0.92 ) + vec2( -0.0125, 0.04 ), flipped vertically
+            #define CRTEMU_CPU_TEXEL_X( u ) _mm_sub_ps( _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( (u), _mm_set1_ps( 1.025f ) ), _mm_set1_ps( 0.0125f ) ), _mm_set1_ps( w ) ), _mm_set1_ps( 0.5f ) )
+            #define CRTEMU_CPU_TEXEL_Y( v ) _mm_sub_ps( _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( 0.96f ), _mm_mul_ps( (v), _mm_set1_ps( 0.92f ) ) ), _mm_set1_ps( h ) ), _mm_set1_ps( 0.5f ) )
+            __m128 sx = _mm_add_ps( scuv_x, bx );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_MAIN_X * n + x, CRTEMU_CPU_TEXEL_X( sx ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_MAIN_Y * n + x, CRTEMU_CPU_TEXEL_Y( scuv_y ) );
+
+            // Ghosting
+            __m128 gx = _mm_add_ps( scuv_x, _mm_mul_ps( bx, _mm_set1_ps( 0.85f ) ) );
+            __m128 a15 = _mm_mul_ps( cuv_y, _mm_set1_ps( 15.0f ) );
+            __m128 a10 = _mm_mul_ps( cuv_y, _mm_set1_ps( 10.0f ) );
+            __m128 sin15 = crtemu_cpu_internal_sin( a15 );
+            __m128 cos15 = crtemu_cpu_internal_sin( _mm_add_ps( a15, _mm_set1_ps( 1.5707964f ) ) );
+            __m128 sin10 = crtemu_cpu_internal_sin( a10 );
+            __m128 cos10 = crtemu_cpu_internal_sin( _mm_add_ps( a10, _mm_set1_ps( 1.5707964f ) ) );
+            #define CRTEMU_CPU_WOBBLE( i, s, c ) _mm_add_ps( _mm_mul_ps( (s), _mm_set1_ps( wobble_sin[ i ] ) ), _mm_mul_ps( (c), _mm_set1_ps( wobble_cos[ i ] ) ) )
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_GHOST_R_X * n + x, CRTEMU_CPU_TEXEL_X( _mm_add_ps( _mm_add_ps( gx, _mm_set1_ps( -0.014f * 0.85f + 0.001f ) ),
+                CRTEMU_CPU_WOBBLE( 0, sin15, cos15 ) ) ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_GHOST_R_Y * n + x, CRTEMU_CPU_TEXEL_Y( _mm_add_ps( _mm_add_ps( scuv_y, _mm_set1_ps( -0.027f * 0.85f + 0.001f ) ),
+                CRTEMU_CPU_WOBBLE( 1, sin10, cos10 ) ) ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_GHOST_G_X * n + x, CRTEMU_CPU_TEXEL_X( _mm_add_ps( _mm_add_ps( gx, _mm_set1_ps( -0.019f * 0.85f ) ),
+                CRTEMU_CPU_WOBBLE( 2, sin15, cos15 ) ) ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_GHOST_G_Y * n + x, CRTEMU_CPU_TEXEL_Y( _mm_add_ps( _mm_add_ps( scuv_y, _mm_set1_ps( -0.020f * 0.85f - 0.002f ) ),
+                CRTEMU_CPU_WOBBLE( 3, sin10, cos10 ) ) ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_GHOST_B_X * n + x, CRTEMU_CPU_TEXEL_X( _mm_add_ps( _mm_add_ps( gx, _mm_set1_ps( -0.017f * 0.85f - 0.002f ) ),
+                CRTEMU_CPU_WOBBLE( 4, sin15, cos15 ) ) ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_GHOST_B_Y * n + x, CRTEMU_CPU_TEXEL_Y( _mm_add_ps( _mm_add_ps( scuv_y, _mm_set1_ps( -0.003f * 0.85f ) ),
+                CRTEMU_CPU_WOBBLE( 5, sin10, cos10 ) ) ) );
+            #undef CRTEMU_CPU_WOBBLE
+            #undef CRTEMU_CPU_TEXEL_X
+            #undef CRTEMU_CPU_TEXEL_Y
+
+            // Vignette, scanlines and shadow mask
+            __m128 vig = _mm_mul_ps( _mm_mul_ps( cuv_x, cuv_y ), _mm_mul_ps( _mm_sub_ps( one, cuv_x ), _mm_sub_ps( one, cuv_y ) ) );
+            vig = _mm_mul_ps( _mm_set1_ps( 1.3f ), _mm_sqrt_ps( _mm_max_ps( zero, _mm_add_ps( _mm_set1_ps( 0.1f ), _mm_mul_ps( vig, _mm_set1_ps( 16.0f ) ) ) ) ) );
+            __m128 s = crtemu_cpu_internal_sin( _mm_add_ps( _mm_mul_ps( vt, _mm_set1_ps( 6.0f ) ), _mm_mul_ps( cuv_y, _mm_set1_ps( scans_scale ) ) ) );
+            __m128 scans = _mm_set1_ps( -0.00027434199f );
+            scans = _mm_add_ps( _mm_mul_ps( scans, s ), _mm_set1_ps( 0.00098094868f ) );
+            scans = _mm_add_ps( _mm_mul_ps( scans, s ), _mm_set1_ps( -0.0046167466f ) );
+            scans = _mm_add_ps( _mm_mul_ps( scans, s ), _mm_set1_ps( 0.17990384f ) );
+            scans = _mm_add_ps( _mm_mul_ps( scans, s ), _mm_set1_ps( 0.3887418f ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_PRE * n + x, _mm_mul_ps( _mm_mul_ps( vig, scans ), mask_lanes[ x % 3 ] ) );
+
+            // Flicker, and clamp to the curved screen
+            __m128 flicker = _mm_sub_ps( one, _mm_mul_ps( _mm_set1_ps( 0.002f ), _mm_add_ps( one,
+                crtemu_cpu_internal_sin( _mm_add_ps( _mm_mul_ps( vt, _mm_set1_ps( 50.0f ) ), _mm_add_ps( cuv_y, cuv_y ) ) ) ) ) );
+            __m128 inside = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( cuv_x, zero ), _mm_cmple_ps( cuv_x, one ) ),
+                _mm_and_ps( _mm_cmpge_ps( cuv_y, zero ), _mm_cmple_ps( cuv_y, one ) ) );
+            _mm_storeu_ps( row + CRTEMU_CPU_ROW_POST * n + x, _mm_and_ps( inside, flicker ) );
+            }
+    #endif
+
+    for( ; x < x1; ++x )
+        {
+        float uv_x = ( ( (float) x + 0.5f ) - crtemu->screen_x ) * inv_screen_width;
+        float cx = ( uv_x - 0.5f ) * 2.2f;
+        float cy = ( uv_y - 0.5f ) * 2.2f;
+        float ty = cy * 0.2f;
+        cx = cx * ( 1.0f + ty * ty );
+        float tx = cx * 0.25f;
+        cy = cy * ( 1.0f + tx * tx );
+        float cuv_x = ( cx * 0.46f + 0.5f ) * 0.6f + uv_x * 0.4f;
+        float cuv_y = ( cy * 0.46f + 0.5f ) * 0.6f + uv_y * 0.4f;
+        float scuv_x = cuv_x * 0.96f + 0.023f;
+        float scuv_y = cuv_y * 0.96f + 0.019f;
+
+        float bx = crtemu_cpu_internal_sin1( 0.1f * t + cuv_y * 13.0f ) * crtemu_cpu_internal_sin1( 0.23f * t + cuv_y * 19.0f )
+            * crtemu_cpu_internal_sin1( ( 0.3f + 0.11f * t ) + cuv_y * 23.0f );
+        bx = bx * 0.0012f + o * 0.25f;
+
+        #define CRTEMU_CPU_TEXEL_X( u ) ( ( (u) * 1.025f - 0.0125f ) * w - 0.5f )
+        #define CRTEMU_CPU_TEXEL_Y( v ) ( ( 0.96f - (v) * 0.92f ) * h - 0.5f )
+        row[ CRTEMU_CPU_ROW_MAIN_X * n + x ] = CRTEMU_CPU_TEXEL_X( scuv_x + bx );
+        row[ CRTEMU_CPU_ROW_MAIN_Y * n + x ] = CRTEMU_CPU_TEXEL_Y( scuv_y );
+
+        float gx = scuv_x + bx * 0.85f;
+        float a15 = cuv_y * 15.0f;
+        float a10 = cuv_y * 10.0f;
+        float sin15 = crtemu_cpu_internal_sin1( a15 );
+        float cos15 = crtemu_cpu_internal_sin1( a15 + 1.5707964f );
+        float sin10 = crtemu_cpu_internal_sin1( a10 );
+        float cos10 = crtemu_cpu_internal_sin1( a10 + 1.5707964f );
+        #define CRTEMU_CPU_WOBBLE( i, s, c ) ( (s) * wobble_sin[ i ] + (c) * wobble_cos[ i ] )
+        row[ CRTEMU_CPU_ROW_GHOST_R_X * n + x ] = CRTEMU_CPU_TEXEL_X( ( gx + ( -0.014f * 0.85f + 0.001f ) ) + CRTEMU_CPU_WOBBLE( 0, sin15, cos15 ) );
+        row[ CRTEMU_CPU_ROW_GHOST_R_Y * n + x ] = CRTEMU_CPU_TEXEL_Y( ( scuv_y + ( -0.027f * 0.85f + 0.001f ) ) + CRTEMU_CPU_WOBBLE( 1, sin10, cos10 ) );
+        row[ CRTEMU_CPU_ROW_GHOST_G_X * n + x ] = CRTEMU_CPU_TEXEL_X( ( gx + ( -0.019f * 0.85f ) ) + CRTEMU_CPU_WOBBLE( 2, sin15, cos15 ) );
+        row[ CRTEMU_CPU_ROW_GHOST_G_Y * n + x ] = CRTEMU_CPU_TEXEL_Y( ( scuv_y + ( -0.020f * 0.85f - 0.002f ) ) + CRTEMU_CPU_WOBBLE( 3, sin10, cos10 ) );
+        row[ CRTEMU_CPU_ROW_GHOST_B_X * n + x ] = CRTEMU_CPU_TEXEL_X( ( gx + ( -0.017f * 0.85f - 0.002f ) ) + CRTEMU_CPU_WOBBLE( 4, sin15, cos15 ) );
+        row[ CRTEMU_CPU_ROW_GHOST_B_Y * n + x ] = CRTEMU_CPU_TEXEL_Y( ( scuv_y + ( -0.003f * 0.85f ) ) + CRTEMU_CPU_WOBBLE( 5, sin10, cos10 ) );
+        #undef CRTEMU_CPU_WOBBLE
+        #undef CRTEMU_CPU_TEXEL_X
+        #undef CRTEMU_CPU_TEXEL_Y
+
+        float vig = ( cuv_x * cuv_y ) * ( ( 1.0f - cuv_x ) * ( 1.0f - cuv_y ) );
+        vig = 0.1f + vig * 16.0f;
+        vig = 1.3f * sqrtf( 0.0f > vig ? 0.0f : vig );
+        float scans = crtemu_cpu_internal_scans1( crtemu_cpu_internal_sin1( t * 6.0f + cuv_y * scans_scale ) );
+        row[ CRTEMU_CPU_ROW_PRE * n + x ] = ( vig * scans ) * masks[ x % 3 ];
+
+        float flicker = 1.0f - 0.002f * ( 1.0f + crtemu_cpu_internal_sin1( t * 50.0f + ( cuv_y + cuv_y ) ) );
+        int inside = cuv_x >= 0.0f && cuv_x <= 1.0f && cuv_y >= 0.0f && cuv_y <= 1.0f;
+        row[ CRTEMU_CPU_ROW_POST * n + x ] = inside ? flicker : 0.0f;
+        }
+    }
+
+
+// Stores the gamma corrected main color of a pixel, and the three ghost images added up without their dependency on
+// intensity, which is applied in crtemu_cpu_internal_row_shade
+static void crtemu_cpu_internal_store_samples( crtemu_cpu_t* crtemu, float* row, int x, CRTEMU_CPU_U32 r,
+    CRTEMU_CPU_U32 g, CRTEMU_CPU_U32 b, CRTEMU_CPU_U32 gr, CRTEMU_CPU_U32 gg, CRTEMU_CPU_U32 gb )
+    {
+    int const n = crtemu->output_width;
+    float const* gamma = crtemu->gamma;
+    float const* strong = crtemu->ghost_strong;
+    float const* weak = crtemu->ghost_weak;
+
+    // 0.15 * ( 1.0 - luminance weight ) for the red, green and blue ghost
+    float const strength_r = 0.15f * ( 1.0f - 0.299f );
+    float const strength_g = 0.15f * ( 1.0f - 0.587f );
+    float const strength_b = 0.15f * ( 1.0f - 0.114f );
+
+    row[ CRTEMU_CPU_ROW_RED * n + x ] = gamma[ r & 0xff ] + 0.02f;
+    row[ CRTEMU_CPU_ROW_GREEN * n + x ] = gamma[ ( g >> 8 ) & 0xff ] + 0.02f;
+    row[ CRTEMU_CPU_ROW_BLUE * n + x ] = gamma[ ( b >> 16 ) & 0xff ] + 0.02f;
+    row[ CRTEMU_CPU_ROW_GHOST_RED * n + x ] = strength_r * strong[ gr & 0xff ]
+        + strength_g * weak[ gg & 0xff ] + strength_b * weak[ gb & 0xff ];
+    row[ CRTEMU_CPU_ROW_GHOST_GREEN * n + x ] = strength_r * weak[ ( gr >> 8 ) & 0xff ]
+        + strength_g * strong[ ( gg >> 8 ) & 0xff ] + strength_b * weak[ ( gb >> 8 ) & 0xff ];
+    row[ CRTEMU_CPU_ROW_GHOST_BLUE * n + x ] = strength_r * weak[ ( gr >> 16 ) & 0xff ]
+        + strength_g * weak[ ( gg >> 16 ) & 0xff ] + strength_b * strong[ ( gb >> 16 ) & 0xff ];
+    }
+
+
+// Offsets of the red, green and blue samples of the main color, in texels
+#define CRTEMU_CPU_RED_X( crtemu ) ( 0.0009f * 1.025f * (float) (crtemu)->width )
+#define CRTEMU_CPU_RED_Y( crtemu ) ( -0.0009f * 0.92f * (float) (crtemu)->height )
+#define CRTEMU_CPU_GREEN_Y( crtemu ) ( 0.0011f * 0.92f * (float) (crtemu)->height )
+#define CRTEMU_CPU_BLUE_X( crtemu ) ( -0.0015f * 1.025f * (float) (crtemu)->width )
+
+
+// Takes the samples for one pixel of the final pass. Outside of the curved screen, there is nothing to sample.
+static void crtemu_cpu_internal_pixel_samples( crtemu_cpu_t* crtemu, float* row, int x )
+    {
+    int const n = crtemu->output_width;
+    if( row[ CRTEMU_CPU_ROW_POST * n + x ] == 0.0f )
+        {
+        for( int i = CRTEMU_CPU_ROW_RED; i <= CRTEMU_CPU_ROW_GHOST_BLUE; ++i ) row[ i * n + x ] = 0.0f;
+        return;
+        }
+
+    int const stride = crtemu->stride;
+    int const width = crtemu->width;
+    int const height = crtemu->height;
+    float mx = row[ CRTEMU_CPU_ROW_MAIN_X * n + x ];
+    float my = row[ CRTEMU_CPU_ROW_MAIN_Y * n + x ];
+    crtemu_cpu_internal_store_samples( crtemu, row, x,
+        crtemu_cpu_internal_sample( crtemu->accumulate_a, stride, width, height, mx + CRTEMU_CPU_RED_X( crtemu ), my + CRTEMU_CPU_RED_Y( crtemu ) ),
+        crtemu_cpu_internal_sample( crtemu->accumulate_a, stride, width, height, mx, my + CRTEMU_CPU_GREEN_Y( crtemu ) ),
+        crtemu_cpu_internal_sample( crtemu->accumulate_a, stride, width, height, mx + CRTEMU_CPU_BLUE_X( crtemu ), my ),
+        crtemu_cpu_internal_sample( crtemu->blur_a, stride, width, height,
+            row[ CRTEMU_CPU_ROW_GHOST_R_X * n + x ], row[ CRTEMU_CPU_ROW_GHOST_R_Y * n + x ] ),
+        crtemu_cpu_internal_sample( crtemu->blur_a, stride, width, height,
+            row[ CRTEMU_CPU_ROW_GHOST_G_X * n + x ], row[ CRTEMU_CPU_ROW_GHOST_G_Y * n + x ] ),
+        crtemu_cpu_internal_sample( crtemu->blur_a, stride, width, height,
+            row[ CRTEMU_CPU_ROW_GHOST_B_X * n + x ], row[ CRTEMU_CPU_ROW_GHOST_B_Y * n + x ] ) );
+    }
+
+
+// Takes the samples for one row of the final pass
+static void crtemu_cpu_internal_row_sample( crtemu_cpu_t* crtemu, float* row, int x0, int x1 )
+    {
+    int x = x0;
+    #ifdef CRTEMU_CPU_SSE2
+        int const n = crtemu->output_width;
+        int const stride = crtemu->stride;
+        int const width = crtemu->width;
+        int const height = crtemu->height;
+        __m128 const red_x = _mm_set1_ps( CRTEMU_CPU_RED_X( crtemu ) );
+        __m128 const red_y = _mm_set1_ps( CRTEMU_CPU_RED_Y( crtemu ) );
+        __m128 const green_y = _mm_set1_ps( CRTEMU_CPU_GREEN_Y( crtemu ) );
+        __m128 const blue_x = _mm_set1_ps( CRTEMU_CPU_BLUE_X( crtemu ) );
+        for( ; x + 4 <= x1; x += 4 )
+            {
+            __m128 post = _mm_loadu_ps( row + CRTEMU_CPU_ROW_POST * n + x );
+            if( _mm_movemask_ps( _mm_cmpneq_ps( post, _mm_setzero_ps() ) ) != 0xf )
+                {
+                for( int i = 0; i < 4; ++i ) crtemu_cpu_internal_pixel_samples( crtemu, row, x + i );
+                continue;
+                }
+
+            CRTEMU_CPU_U32 r[ 4 ], g[ 4 ], b[ 4 ], gr[ 4 ], gg[ 4 ], gb[ 4 ];
+            __m128 mx = _mm_loadu_ps( row + CRTEMU_CPU_ROW_MAIN_X * n + x );
+            __m128 my = _mm_loadu_ps( row + CRTEMU_CPU_ROW_MAIN_Y * n + x );
+            crtemu_cpu_internal_sample4( crtemu->accumulate_a, stride, width, height, _mm_add_ps( mx, red_x ), _mm_add_ps( my, red_y ), r );
+            crtemu_cpu_internal_sample4( crtemu->accumulate_a, stride, width, height, mx, _mm_add_ps( my, green_y ), g );
+            crtemu_cpu_internal_sample4( crtemu->accumulate_a, stride, width, height, _mm_add_ps( mx, blue_x ), my, b );
+            crtemu_cpu_internal_sample4( crtemu->blur_a, stride, width, height,
+                _mm_loadu_ps( row + CRTEMU_CPU_ROW_GHOST_R_X * n + x ), _mm_loadu_ps( row + CRTEMU_CPU_ROW_GHOST_R_Y * n + x ), gr );
+            crtemu_cpu_internal_sample4( crtemu->blur_a, stride, width, height,
+                _mm_loadu_ps( row + CRTEMU_CPU_ROW_GHOST_G_X * n + x ), _mm_loadu_ps( row + CRTEMU_CPU_ROW_GHOST_G_Y * n + x ), gg );
+            crtemu_cpu_internal_sample4( crtemu->blur_a, stride, width, height,
+                _mm_loadu_ps( row + CRTEMU_CPU_ROW_GHOST_B_X * n + x ), _mm_loadu_ps( row + CRTEMU_CPU_ROW_GHOST_B_Y * n + x ), gb );
+            for( int i = 0; i < 4; ++i )
+                crtemu_cpu_internal_store_samples( crtemu, row, x + i, r[ i ], g[ i ], b[ i ], gr[ i ], gg[ i ], gb[ i ] );
+            }
+    #endif
+    for( ; x < x1; ++x )
+        crtemu_cpu_internal_pixel_samples( crtemu, row, x );
+    }
+
+
+// Color adjustments of the final pass for one channel, from level adjustment up to the noise, with the values in the
+// range 0-255 for the noise and the result. This is the same sequence of operations as the SSE2 loop.
+static float crtemu_cpu_internal_shade( float c, float scale, float pre, float noise )
+    {
+    c = c * scale;
+    float c2 = c * c;
+    c = ( c * 1.3f + c2 * 0.75f ) + ( ( c2 * c2 ) * c ) * 1.25f;
+    c = c > 0.0f ? c : 0.0f;
+    c = c < 10.0f ? c : 10.0f;
+    c = c * pre - 0.004f;
+    c = c > 0.0f ? c : 0.0f;
+    c = ( c * ( c * 6.2f + 0.5f ) ) / ( c * ( c * 6.2f + 1.7f ) + 0.06f );
+    return c * 255.0f - noise * 0.015f;
+    }
+
+
+// Finishes the pixels of one row of the final pass, from the samples
+static void crtemu_cpu_internal_row_shade( crtemu_cpu_t* crtemu, float const* row, int y, CRTEMU_CPU_U32* out,
+    int x0, int x1 )
+    {
+    int const n = crtemu->output_width;
+    CRTEMU_CPU_U32 const* overlay = crtemu->overlay + y * n;
+    unsigned char const (*noise)[ CRTEMU_CPU_NOISE_SIZE * 2 ] =
+        crtemu->noise[ ( y + crtemu->noise_y ) & ( CRTEMU_CPU_NOISE_SIZE - 1 ) ];
+    int noise_x = crtemu->noise_x - x0;
+
+    int x = x0;
+    #ifdef CRTEMU_CPU_SSE2
+        __m128 const zero = _mm_setzero_ps();
+        __m128 const one = _mm_set1_ps( 1.0f );
+        __m128i const zeroi = _mm_setzero_si128();
+        __m128i const mask = _mm_set1_epi32( 0xff );
+        for( ; x + 4 <= x1; x += 4 )
+            {
+            __m128 r = _mm_loadu_ps( row + CRTEMU_CPU_ROW_RED * n + x );
+            __m128 g = _mm_loadu_ps( row + CRTEMU_CPU_ROW_GREEN * n + x );
+            __m128 b = _mm_loadu_ps( row + CRTEMU_CPU_ROW_BLUE * n + x );
+            __m128 i = _mm_add_ps( _mm_add_ps( _mm_mul_ps( r, _mm_set1_ps( 0.299f ) ), _mm_mul_ps( g, _mm_set1_ps( 0.587f ) ) ),
+                _mm_mul_ps( b, _mm_set1_ps( 0.114f ) ) );
+            i = _mm_min_ps( _mm_max_ps( i, zero ), one );
+            i = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( i, i ), _mm_set1_ps( 0.85f ) ), _mm_set1_ps( 0.15f ) );
+            __m128 pre = _mm_loadu_ps( row + CRTEMU_CPU_ROW_PRE * n + x );
+            __m128 post = _mm_loadu_ps( row + CRTEMU_CPU_ROW_POST * n + x );
+            __m128i ov = _mm_loadu_si128( (__m128i const*)( overlay + x ) );
+            __m128 cover = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( ov, 24 ) ), _mm_set1_ps( 1.0f / 255.0f ) );
+            int const noise_offset = ( x + noise_x ) & ( CRTEMU_CPU_NOISE_SIZE - 1 );
+
+            __m128i result = zeroi;
+            for( int k = 0; k < 3; ++k )
+                {
+                __m128 c = k == 0 ? r : k == 1 ? g : b;
+                c = _mm_add_ps( c, _mm_mul_ps( _mm_loadu_ps( row + ( CRTEMU_CPU_ROW_GHOST_RED + k ) * n + x ), i ) );
+
+                // Level adjustment (curves)
+                c = _mm_mul_ps( c, _mm_set1_ps( k == 1 ? 1.05f : 0.95f ) );
+                __m128 c2 = _mm_mul_ps( c, c );
+                c = _mm_add_ps( _mm_add_ps( _mm_mul_ps( c, _mm_set1_ps( 1.3f ) ), _mm_mul_ps( c2, _mm_set1_ps( 0.75f ) ) ),
+                    _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( c2, c2 ), c ), _mm_set1_ps( 1.25f ) ) );
+                c = _mm_min_ps( _mm_max_ps( c, zero ), _mm_set1_ps( 10.0f ) );
+
+                // Vignette, scanlines and shadow mask, then tone map
+                c = _mm_max_ps( _mm_sub_ps( _mm_mul_ps( c, pre ), _mm_set1_ps( 0.004f ) ), zero );
+                c = _mm_div_ps( _mm_mul_ps( c, _mm_add_ps( _mm_mul_ps( c, _mm_set1_ps( 6.2f ) ), _mm_set1_ps( 0.5f ) ) ),
+                    _mm_add_ps( _mm_mul_ps( c, _mm_add_ps( _mm_mul_ps( c, _mm_set1_ps( 6.2f ) ), _mm_set1_ps( 1.7f ) ) ), _mm_set1_ps( 0.06f ) ) );
+
+                // Noise and flicker
+                int noise_bytes;
+                memcpy( &noise_bytes, noise[ k ] + noise_offset, sizeof( noise_bytes ) );
+                __m128 nz = _mm_cvtepi32_ps( _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( noise_bytes ), zeroi ), zeroi ) );
+                c = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( c, _mm_set1_ps( 255.0f ) ), _mm_mul_ps( nz, _mm_set1_ps( 0.015f ) ) ), post );
+
+                // Frame
+                c = _mm_add_ps( _mm_mul_ps( _mm_max_ps( c, zero ), cover ), _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( ov, k * 8 ), mask ) ) );
+                __m128i v = _mm_cvtps_epi32( _mm_min_ps( c, _mm_set1_ps( 255.0f ) ) );
+                result = _mm_or_si128( result, _mm_slli_epi32( v, k * 8 ) );
+                }
+            _mm_storeu_si128( (__m128i*)( out + x ), result );
+            }
+    #endif
+
+    for( ; x < x1; ++x )
+        {
+        float r = row[ CRTEMU_CPU_ROW_RED * n + x ];
+        float g = row[ CRTEMU_CPU_ROW_GREEN * n + x ];
+        float b = row[ CRTEMU_CPU_ROW_BLUE * n + x ];
+        float i = r * 0.299f + g * 0.587f + b * 0.114f;
+        i = i > 0.0f ? i : 0.0f;
+        i = i < 1.0f ? i : 1.0f;
+        i = i * i * 0.85f + 0.15f;
+        float pre = row[ CRTEMU_CPU_ROW_PRE * n + x ];
+        float post = row[ CRTEMU_CPU_ROW_POST * n + x ];
+        CRTEMU_CPU_U32 ov = overlay[ x ];
+        float cover = (float)( ov >> 24 ) * ( 1.0f / 255.0f );
+        int noise_offset = ( x + noise_x ) & ( CRTEMU_CPU_NOISE_SIZE - 1 );
+
+        CRTEMU_CPU_U32 result = 0;
+        for( int k = 0; k < 3; ++k )
+            {
+            float c = k == 0 ? r : k == 1 ? g : b;
+            c = c + row[ ( CRTEMU_CPU_ROW_GHOST_RED + k ) * n + x ] * i;
+            c = crtemu_cpu_internal_shade( c, k == 1 ? 1.05f : 0.95f, pre, noise[ k ][ noise_offset ] ) * post;
+            c = ( c > 0.0f ? c : 0.0f ) * cover + (float)( ( ov >> ( k * 8 ) ) & 0xff );
+            result |= (CRTEMU_CPU_U32) crtemu_cpu_internal_nearest( c < 255.0f ? c : 255.0f ) << ( k * 8 );
+            }
+        out[ x ] = result;
+        }
+    }
+
+
+// Blend of two pixels by a weight from 0 to 256, with red and blue interpolated together in 16-bit fields
+static CRTEMU_CPU_U32 crtemu_cpu_internal_lerp( CRTEMU_CPU_U32 a, CRTEMU_CPU_U32 b, unsigned int weight )
+    {
+    CRTEMU_CPU_U32 rb = ( ( ( a & 0xff00ff ) * ( 256 - weight ) + ( b & 0xff00ff ) * weight ) >> 8 ) & 0xff00ff;
+    CRTEMU_CPU_U32 g = ( ( ( a & 0x00ff00 ) * ( 256 - weight ) + ( b & 0x00ff00 ) * weight ) >> 8 ) & 0x00ff00;
+    return rb | g;
+    }
+
+
+// Scales one row of the final pass up to the width of the output
+static void crtemu_cpu_internal_scale_row( CRTEMU_CPU_U32* out, CRTEMU_CPU_U32 const* in, int const* columns, int count )
+    {
+    for( int x = 0; x < count; ++x )
+        {
+        CRTEMU_CPU_U32 const* p = in + ( columns[ x ] >> 8 );
+        unsigned int weight = (unsigned int)( columns[ x ] & 0xff );
+        out[ x ] = weight ? crtemu_cpu_internal_lerp( p[ 0 ], p[ 1 ], weight ) : p[ 0 ];
+        }
+    }
+
+
+// Makes the rows of the output from the horizontally scaled rows of the final pass, for a few rows of the output
+static void crtemu_cpu_internal_job_scale( crtemu_cpu_t* crtemu, int index, float* row )
+    {
+    (void) row;
+    int const width = crtemu->target_width;
+    int const* rows = crtemu->scale_positions + width;
+    int end = ( index + 1 ) * CRTEMU_CPU_ROWS_PER_JOB;
+    for( int y = index * CRTEMU_CPU_ROWS_PER_JOB; y < end && y < crtemu->target_height; ++y )
+        {
+        CRTEMU_CPU_U32 const* top = crtemu->wide + ( rows[ y ] >> 8 ) * width;
+        CRTEMU_CPU_U32 const* bottom = top + width;
+        unsigned int weight = (unsigned int)( rows[ y ] & 0xff );
+        CRTEMU_CPU_U32* out = crtemu->target + y * width;
+        if( !weight )
+            {
+            memcpy( out, top, sizeof( CRTEMU_CPU_U32 ) * (size_t) width );
+            continue;
+            }
+
+        int x = 0;
+        #ifdef CRTEMU_CPU_SSE2
+            __m128i const zero = _mm_setzero_si128();
+            __m128i const weight_top = _mm_set1_epi16( (short)( 256 - weight ) );
+            __m128i const weight_bottom = _mm_set1_epi16( (short) weight );
+            for( ; x + 4 <= width; x += 4 )
+                {
+                __m128i t = _mm_loadu_si128( (__m128i const*)( top + x ) );
+                __m128i b = _mm_loadu_si128( (__m128i const*)( bottom + x ) );
+                __m128i lo = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( t, zero ), weight_top ),
+                    _mm_mullo_epi16( _mm_unpacklo_epi8( b, zero ), weight_bottom ) ), 8 );
+                __m128i hi = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( t, zero ), weight_top ),
+                    _mm_mullo_epi16( _mm_unpackhi_epi8( b, zero ), weight_bottom ) ), 8 );
+                _mm_storeu_si128( (__m128i*)( out + x ), _mm_packus_epi16( lo, hi ) );
+                }
+        #endif
+        for( ; x < width; ++x )
+            out[ x ] = crtemu_cpu_internal_lerp( top[ x ], bottom[ x ], weight );
+        }
+    }
+
+
+// Position in the image of the centers of output pixels, for the columns or the rows of the output, clamped to the
+// first and last texel
+static void crtemu_cpu_internal_scale_positions( int* positions, int count, int size, int divisor )
+    {
+    for( int i = 0; i < count; ++i )
+        {
+        int position = ( ( 2 * i + 1 ) * 128 ) / divisor - 128;
+        positions[ i ] = position < 0 ? 0 : position >= ( size - 1 ) * 256 ? ( size - 1 ) * 256 : position;
+        }
+    }
+
+
+// Final pass, for a few rows of the output
+static void crtemu_cpu_internal_job_present( crtemu_cpu_t* crtemu, int index, float* row )
+    {
+    int const n = crtemu->output_width;
+    int x0 = (int) ceilf( crtemu->screen_x - 0.5f );
+    int x1 = (int) ceilf( crtemu->screen_x + crtemu->screen_width - 0.5f );
+    x0 = x0 < 0 ? 0 : x0;
+    x1 = x1 > n ? n : x1;
+    float const y0 = crtemu->screen_y;
+    float const y1 = crtemu->screen_y + crtemu->screen_height;
+
+    int end = ( index + 1 ) * CRTEMU_CPU_ROWS_PER_JOB;
+    for( int y = index * CRTEMU_CPU_ROWS_PER_JOB; y < end && y < crtemu->output_height; ++y )
+        {
+        CRTEMU_CPU_U32* out = crtemu->output + y * n;
+        float frag_y = (float)( crtemu->output_height - y ) - 0.5f;
+        if( frag_y < y0 || frag_y >= y1 || x0 >= x1 )
+            {
+            for( int x = 0; x < n; ++x ) out[ x ] = crtemu->border;
+            }
+        else
+            {
+            for( int x = 0; x < x0; ++x ) out[ x ] = crtemu->border;
+            for( int x = x1; x < n; ++x ) out[ x ] = crtemu->border;
+            crtemu_cpu_internal_row_setup( crtemu, row, y, x0, x1 );
+            crtemu_cpu_internal_row_sample( crtemu, row, x0, x1 );
+            crtemu_cpu_internal_row_shade( crtemu, row, y, out, x0, x1 );
+            }
+
+        if( crtemu->divisor > 1 )
+            crtemu_cpu_internal_scale_row( crtemu->wide + y * crtemu->target_width, out, crtemu->scale_positions,
+                crtemu->target_width );
+        }
+    }
+
+
+// First texel of one of the intermediate images, inside its padding
+static CRTEMU_CPU_U32* crtemu_cpu_internal_image( crtemu_cpu_t* crtemu, int index )
+    {
+    int rows = crtemu->height + CRTEMU_CPU_PAD_BEFORE + CRTEMU_CPU_PAD_AFTER;
+    return crtemu->images + rows * crtemu->stride * index + CRTEMU_CPU_PAD_BEFORE * crtemu->stride + CRTEMU_CPU_PAD_BEFORE;
+    }
+
+
+void crtemu_cpu_present( crtemu_cpu_t* crtemu, CRTEMU_CPU_U64 time_us, CRTEMU_CPU_U32 const* pixels_xbgr, int width,
+    int height, CRTEMU_CPU_U32 border_xbgr, CRTEMU_CPU_U32* output_xbgr, int output_width, int output_height )
+    {
+    // All the intermediate images are in one block, and start out black, as the textures of the shader version do
+    if( width != crtemu->width || height != crtemu->height )
+        {
+        if( crtemu->images ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->images );
+        crtemu->width = width;
+        crtemu->height = height;
+        crtemu->stride = width + CRTEMU_CPU_PAD_BEFORE + CRTEMU_CPU_PAD_AFTER;
+        size_t size = sizeof( CRTEMU_CPU_U32 ) * (size_t)( crtemu->stride * ( height + CRTEMU_CPU_PAD_BEFORE + CRTEMU_CPU_PAD_AFTER ) * 5 );
+        crtemu->images = (CRTEMU_CPU_U32*) CRTEMU_CPU_MALLOC( crtemu->memctx, size );
+        memset( crtemu->images, 0, size );
+        crtemu->accumulate_a = crtemu_cpu_internal_image( crtemu, 0 );
+        crtemu->accumulate_b = crtemu_cpu_internal_image( crtemu, 1 );
+        crtemu->blur_a = crtemu_cpu_internal_image( crtemu, 2 );
+        crtemu->temp_a = crtemu_cpu_internal_image( crtemu, 3 );
+        crtemu->temp_b = crtemu_cpu_internal_image( crtemu, 4 );
+        crtemu->overlay_valid = 0;
+        }
+
+    // With a divisor, the final pass renders at reduced size, and is scaled up to the output afterwards
+    int const divisor = crtemu->divisor;
+    int const render_width = ( output_width + divisor - 1 ) / divisor;
+    int const render_height = ( output_height + divisor - 1 ) / divisor;
+
+    // Fit the screen in the output, as the shader version fits it in the viewport
+    float hscale = (float) render_width / (float) width;
+    float vscale = (float) render_height / (float) height;
+    float pixel_scale = hscale < vscale ? hscale : vscale;
+    crtemu->screen_width = pixel_scale * (float) width;
+    crtemu->screen_height = pixel_scale * (float) height;
+    crtemu->screen_x = ( (float) render_width - crtemu->screen_width ) / 2.0f;
+    crtemu->screen_y = ( (float) render_height - crtemu->screen_height ) / 2.0f;
+
+    if( output_width != crtemu->target_width || output_height != crtemu->target_height )
+        {
+        crtemu->target_width = output_width;
+        crtemu->target_height = output_height;
+        if( crtemu->image ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->image );
+        if( crtemu->wide ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->wide );
+        if( crtemu->scale_positions ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->scale_positions );
+        crtemu->image = 0;
+        crtemu->wide = 0;
+        crtemu->scale_positions = 0;
+        if( divisor > 1 )
+            {
+            crtemu->image = (CRTEMU_CPU_U32*) CRTEMU_CPU_MALLOC( crtemu->memctx, sizeof( CRTEMU_CPU_U32 ) * (size_t)( render_width * render_height ) );
+            crtemu->wide = (CRTEMU_CPU_U32*) CRTEMU_CPU_MALLOC( crtemu->memctx, sizeof( CRTEMU_CPU_U32 ) * (size_t)( output_width * render_height ) );
+            crtemu->scale_positions = (int*) CRTEMU_CPU_MALLOC( crtemu->memctx, sizeof( int ) * (size_t)( output_width + output_height ) );
+            crtemu_cpu_internal_scale_positions( crtemu->scale_positions, output_width, render_width, divisor );
+            crtemu_cpu_internal_scale_positions( crtemu->scale_positions + output_width, output_height, render_height, divisor );
+            }
+        }
+
+    if( render_width != crtemu->output_width || render_height != crtemu->output_height )
+        {
+        crtemu->output_width = render_width;
+        crtemu->output_height = render_height;
+        size_t row_size = sizeof( float ) * (size_t)( CRTEMU_CPU_ROW_COUNT * render_width );
+        if( crtemu->row ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->row );
+        crtemu->row = (float*) CRTEMU_CPU_MALLOC( crtemu->memctx, row_size );
+        for( int i = 0; i < crtemu->worker_count; ++i )
+            {
+            if( crtemu->workers[ i ].row ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->workers[ i ].row );
+            crtemu->workers[ i ].row = (float*) CRTEMU_CPU_MALLOC( crtemu->memctx, row_size );
+            }
+        if( crtemu->overlay ) CRTEMU_CPU_FREE( crtemu->memctx, crtemu->overlay );
+        crtemu->overlay = (CRTEMU_CPU_U32*) CRTEMU_CPU_MALLOC( crtemu->memctx, sizeof( CRTEMU_CPU_U32 ) * (size_t)( render_width * render_height ) );
+        crtemu->overlay_valid = 0;
+        }
+
+    int output_jobs = ( render_height + CRTEMU_CPU_ROWS_PER_JOB - 1 ) / CRTEMU_CPU_ROWS_PER_JOB;
+    if( !crtemu->overlay_valid )
+        {
+        crtemu_cpu_internal_run( crtemu, crtemu_cpu_internal_job_overlay, output_jobs );
+        crtemu->overlay_valid = 1;
+        }
+
+    // Phosphor persistence and blur, at the resolution of the input
+    crtemu->pixels = pixels_xbgr;
+    int jobs = ( height + CRTEMU_CPU_ROWS_PER_JOB - 1 ) / CRTEMU_CPU_ROWS_PER_JOB;
+    crtemu_cpu_internal_run( crtemu, crtemu_cpu_internal_job_persist_rows, jobs );
+    crtemu_cpu_internal_run( crtemu, crtemu_cpu_internal_job_accumulate, jobs );
+    crtemu_cpu_internal_run( crtemu, crtemu_cpu_internal_job_slight_blur, jobs );
+    crtemu_cpu_internal_run( crtemu, crtemu_cpu_internal_job_ghost_blur, jobs );
+
+    // CRT effect, at the resolution of the output
+    crtemu->time = 1.5f * (float)( ( (double) time_us ) / 1000000.0 );
+    crtemu->noise_x = (int)( crtemu_cpu_internal_random( crtemu ) % CRTEMU_CPU_NOISE_SIZE );
+    crtemu->noise_y = (int)( crtemu_cpu_internal_random( crtemu ) % CRTEMU_CPU_NOISE_SIZE );
+    crtemu->border = border_xbgr & 0xffffff;
+    crtemu->output = divisor > 1 ? crtemu->image : output_xbgr;
+    crtemu_cpu_internal_run( crtemu, crtemu_cpu_internal_job_present, output_jobs );
+    if( divisor > 1 )
+        {
+        crtemu->target = output_xbgr;
+        crtemu_cpu_internal_run( crtemu, crtemu_cpu_internal_job_scale, ( output_height + CRTEMU_CPU_ROWS_PER_JOB - 1 ) / CRTEMU_CPU_ROWS_PER_JOB );
+        crtemu->target = 0;
+        }
+    crtemu->pixels = 0;
+    crtemu->output = 0;
+    }
+
+
+#endif /* CRTEMU_CPU_IMPLEMENTATION */
+
+/*
+------------------------------------------------------------------------------
+
+This software is available under 2 licenses - you may choose the one you like.
+
+------------------------------------------------------------------------------
+
+ALTERNATIVE A - MIT License
+
+Copyright (c) 2016 Mattias Gustavsson
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+------------------------------------------------------------------------------
+
+ALTERNATIVE B - Public Domain (www.unlicense.org)
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+------------------------------------------------------------------------------
+*/
@@ -40,6 +40,19 @@ void strpool_init( strpool_t* pool, strpool_config_t const* config );
 void strpool_term( strpool_t* pool );
 
 void strpool_defrag( strpool_t* pool );
+int strpool_defrag_step( strpool_t* pool );
+
+typedef struct strpool_stats_t
+    {
+    int string_count;
+    int bytes_used;
+    int bytes_free;
+    int block_count;
+    STRPOOL_U32 inject_count;
+    STRPOOL_U32 discard_count;
+    } strpool_stats_t;
+
+void strpool_stats( strpool_t const* pool, strpool_stats_t* stats );
 
 STRPOOL_U64 strpool_inject( strpool_t* pool, char const* string, int length );
 void strpool_discard( strpool_t* pool, STRPOOL_U64 handle );
@@ -245,6 +258,30 @@ blocks will be deallocated, making the memory used by the pool as little as it c
 All string handles remain valid after a call to `strpool_defrag`.
 
 
+strpool_defrag_step
+-------------------
+
+    int strpool_defrag_step( strpool_t* pool )
+
+Performs a small, bounded amount of defragmentation, suitable for calling regularly (for example once per frame). It
+picks the block (other than the one currently being filled) which has the least amount of string data in it, and if
+less than half of that block is in use, moves its strings into free space elsewhere in the pool and deallocates the
+block. At most one block worth of string data is copied per call. Returns 1 if a block was released, or 0 if there was
+nothing worth doing. All string handles remain valid after a call to `strpool_defrag_step`, but just like with
+`strpool_defrag`, any `char const*` previously returned by `strpool_cstr` may no longer be valid.
+
+
+strpool_stats
+-------------
+
+    void strpool_stats( strpool_t const* pool, strpool_stats_t* stats )
+
+Fills in `stats` with the number of strings currently stored in the pool, the number of bytes of block memory in use
+by them and the number of bytes allocated but not in use, the number of allocated blocks, and the total number of
+strings that have been added and discarded since the pool was initialized. The last two counters wrap around, so to
+get a rate, take the difference between two calls.
+
+
 strpool_inject
 --------------
 
@@ -399,6 +436,9 @@ struct strpool_t
     int block_capacity;
     int block_count;
     int current_block;
+
+    STRPOOL_U32 inject_count;
+    STRPOOL_U32 discard_count;
     };
 
 
@@ -583,6 +623,8 @@ void strpool_init( strpool_t* pool, strpool_config_t const* config )
     pool->block_count = 0;
     pool->handle_count = 0;
     pool->entry_count = 0;
+    pool->inject_count = 0;
+    pool->discard_count = 0;
     
     pool->hash_table = (strpool_internal_hash_slot_t*) STRPOOL_MALLOC( pool->memctx, 
         pool->hash_capacity * sizeof( *pool->hash_table ) );
@@ -937,6 +979,80 @@ static char* strpool_internal_get_data_storage( strpool_t* pool, int size, int*
     }
     
 
+int strpool_defrag_step( strpool_t* pool )
+    {
+    if( pool->block_count < 2 ) return 0;
+
+    // Sum up the string data stored in each block
+    int* used = (int*) STRPOOL_MALLOC( pool->memctx, pool->block_count * sizeof( int ) );
+    STRPOOL_ASSERT( used );
+    STRPOOL_MEMSET( used, 0, pool->block_count * sizeof( int ) );
+    for( int i = 0; i < pool->entry_count; ++i )
+        {
+        strpool_internal_entry_t* entry = &pool->entries[ i ];
+        for( int j = 0; j < pool->block_count; ++j )
+            {
+            if( entry->data >= pool->blocks[ j ].data && entry->data < pool->blocks[ j ].tail )
+                {
+                used[ j ] += entry->size;
+                break;
+                }
+            }
+        }
+
+    // Pick the emptiest block, but only if it is less than half full
+    int block = -1;
+    for( int i = 0; i < pool->block_count; ++i )
+        {
+        if( i == pool->current_block || used[ i ] >= pool->blocks[ i ].capacity / 2 ) continue;
+        if( block < 0 || used[ i ] < used[ block ] ) block = i;
+        }
+    STRPOOL_FREE( pool->memctx, used );
+    if( block < 0 ) return 0;
+
+    // Move all strings out of the block. Its free list is cleared first, so none of its space is handed out again
+    char* data = pool->blocks[ block ].data;
+    char* tail = pool->blocks[ block ].tail;
+    pool->blocks[ block ].free_list = -1;
+    for( int i = 0; i < pool->entry_count; ++i )
+        {
+        strpool_internal_entry_t* entry = &pool->entries[ i ];
+        if( entry->data >= data && entry->data < tail )
+            {
+            int size = entry->length + 1 + (int) ( 2 * sizeof( STRPOOL_U32 ) );
+            char* new_data = strpool_internal_get_data_storage( pool, size, &size );
+            STRPOOL_ASSERT( new_data < data || new_data >= tail );
+            STRPOOL_MEMCPY( new_data, entry->data, entry->length + 1 + 2 * sizeof( STRPOOL_U32 ) );
+            entry->data = new_data;
+            entry->size = size;
+            }
+        }
+
+    // Release the block, and close the gap in the block list
+    STRPOOL_FREE( pool->memctx, data );
+    for( int i = block; i < pool->block_count - 1; ++i ) pool->blocks[ i ] = pool->blocks[ i + 1 ];
+    --pool->block_count;
+    if( pool->current_block > block ) --pool->current_block;
+    return 1;
+    }
+
+
+void strpool_stats( strpool_t const* pool, strpool_stats_t* stats )
+    {
+    int bytes_used = 0;
+    for( int i = 0; i < pool->entry_count; ++i ) bytes_used += pool->entries[ i ].size;
+    int bytes_total = 0;
+    for( int i = 0; i < pool->block_count; ++i ) bytes_total += pool->blocks[ i ].capacity;
+
+    stats->string_count = pool->entry_count;
+    stats->bytes_used = bytes_used;
+    stats->bytes_free = bytes_total - bytes_used;
+    stats->block_count = pool->block_count;
+    stats->inject_count = pool->inject_count;
+    stats->discard_count = pool->discard_count;
+    }
+
+
 STRPOOL_U64 strpool_inject( strpool_t* pool, char const* string, int length )
     {
     if( !string || length < 0 ) return 0;
@@ -1054,6 +1170,7 @@ STRPOOL_U64 strpool_inject( strpool_t* pool, char const* string, int length )
     data += sizeof( STRPOOL_U32 );
     STRPOOL_MEMCPY( data, string, (size_t) length ); 
     data[ length ] = 0; // Ensure trailing zero
+    ++pool->inject_count;
 
     return strpool_internal_make_handle( handle_index, pool->handles[ handle_index ].counter, pool->index_mask, 
         pool->counter_shift, pool->counter_mask );
@@ -1144,6 +1261,7 @@ void strpool_discard( strpool_t* pool, STRPOOL_U64 handle )
             pool->handles[ pool->entries[ entry_index ].handle_index ].entry_index = entry_index;
             }
         --pool->entry_count;
+        ++pool->discard_count;
         }       
 
     }
@@ -1239,6 +1357,7 @@ void strpool_free_collated( strpool_t const* pool, char* collated_ptr )
 
 /*
 revision history:
+    1.5     added incremental defrag and stats
     1.4     fixed find_in_blocks substring bug, removed realloc, added docs
     1.3     fixed typo in mask bit shift
     1.2     made it possible to override standard library functions
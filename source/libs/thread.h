@@ -3,7 +3,7 @@
           Licensing information can be found at the end of the file.
 ------------------------------------------------------------------------------
 
-thread.h - v0.2 - Cross platform threading functions for C/C++.
+thread.h - v0.3 - Cross platform threading functions for C/C++.
 
 Do this:
     #define THREAD_IMPLEMENTATION
@@ -1029,7 +1029,7 @@ void thread_atomic_int_store( thread_atomic_int_t* atomic, int desired )
     #elif defined( __linux__ ) || defined( __APPLE__ ) || defined( __ANDROID__ )
 
         __sync_lock_test_and_set( &atomic->i, desired );
-        __sync_lock_release( &atomic->i );
+        __sync_synchronize();
     
     #else 
         #error Unknown platform.
@@ -1110,7 +1110,7 @@ int thread_atomic_int_swap( thread_atomic_int_t* atomic, int desired )
     #elif defined( __linux__ ) || defined( __APPLE__ ) || defined( __ANDROID__ )
 
         int old = (int)__sync_lock_test_and_set( &atomic->i, desired );
-        __sync_lock_release( &atomic->i );
+        __sync_synchronize();
         return old;
     
     #else 
@@ -1166,7 +1166,7 @@ void thread_atomic_ptr_store( thread_atomic_ptr_t* atomic, void* desired )
     #elif defined( __linux__ ) || defined( __APPLE__ ) || defined( __ANDROID__ )
 
         __sync_lock_test_and_set( &atomic->ptr, desired );
-        __sync_lock_release( &atomic->ptr );
+        __sync_synchronize();
     
     #else 
         #error Unknown platform.
@@ -1188,7 +1188,7 @@ void* thread_atomic_ptr_swap( thread_atomic_ptr_t* atomic, void* desired )
     #elif defined( __linux__ ) || defined( __APPLE__ ) || defined( __ANDROID__ )
 
         void* old = __sync_lock_test_and_set( &atomic->ptr, desired );
-        __sync_lock_release( &atomic->ptr );
+        __sync_synchronize();
         return old;
     
     #else 
@@ -1422,6 +1422,7 @@ int thread_queue_count( thread_queue_t* queue )
 
 /*
 revision history:
+    0.3     atomic store and swap with gcc/clang no longer leave the value at zero
     0.2     first publicly released version 
 */
 
@@ -7,6 +7,7 @@
 
 #include "libs/app.h"
 #include "libs/crtemu.h"
+#include "libs/crtemu_cpu.h"
 #include "libs/crt_frame.h"
 #include "libs/frametimer.h"
 
@@ -14,6 +15,13 @@
 #include "vm.h"
 #include "system.h"
 #include "functions.h"
+#include "record.h"
+#include "crtcheck.h"
+
+#ifdef REBASIC_AOT
+    // Native build of a single program, translated with "REBASIC -c filename.bas aot_program.h"
+    #include "aot_program.h"
+#endif
 
 
 static int pos_to_line( int pos, char const* str )  
@@ -57,9 +65,16 @@ compile_opcode_map_t opcodes[ COMPILE_OPCOUNT ] =
     { COMPILE_OP_NOT, VM_OP_NOT }, { COMPILE_OP_ORB, VM_OP_ORB }, { COMPILE_OP_XORB, VM_OP_XORB },
     { COMPILE_OP_ANDB, VM_OP_ANDB }, { COMPILE_OP_NOTB, VM_OP_NOTB }, { COMPILE_OP_ADDF, VM_OP_ADDF },
     { COMPILE_OP_SUBF, VM_OP_SUBF }, { COMPILE_OP_MULF, VM_OP_MULF }, { COMPILE_OP_DIVF, VM_OP_DIVF },
-    { COMPILE_OP_MODF, VM_OP_MODF }, { COMPILE_OP_NEGF, VM_OP_NEGF }, { COMPILE_OP_CATC, VM_OP_CATC },
+    { COMPILE_OP_MODF, VM_OP_MODF }, { COMPILE_OP_NEGF, VM_OP_NEGF }, { COMPILE_OP_CATC, VM_OP_CATC }, { COMPILE_OP_APPENDC, VM_OP_APPENDC },
+    { COMPILE_OP_LEN, VM_OP_LEN }, { COMPILE_OP_LEFT, VM_OP_LEFT }, { COMPILE_OP_RIGHT, VM_OP_RIGHT },
+    { COMPILE_OP_MID, VM_OP_MID }, { COMPILE_OP_INSTR, VM_OP_INSTR }, { COMPILE_OP_CHR, VM_OP_CHR },
+    { COMPILE_OP_ASC, VM_OP_ASC }, { COMPILE_OP_UPPER, VM_OP_UPPER }, { COMPILE_OP_VAL, VM_OP_VAL },
+    { COMPILE_OP_STR, VM_OP_STR }, { COMPILE_OP_STRF, VM_OP_STRF },
     { COMPILE_OP_READ, VM_OP_READ }, { COMPILE_OP_READF, VM_OP_READF }, { COMPILE_OP_READC, VM_OP_READC },
-    { COMPILE_OP_READB, VM_OP_READB }, { COMPILE_OP_RSTO, VM_OP_RSTO }, { COMPILE_OP_RTSS, VM_OP_RTSS },
+    { COMPILE_OP_READB, VM_OP_READB }, { COMPILE_OP_RSTO, VM_OP_RSTO }, { COMPILE_OP_READA, VM_OP_READA },
+    { COMPILE_OP_INDEX, VM_OP_INDEX }, { COMPILE_OP_LOADA, VM_OP_LOADA }, { COMPILE_OP_STOREA, VM_OP_STOREA },
+    { COMPILE_OP_LOADAC, VM_OP_LOADAC }, { COMPILE_OP_STOREAC, VM_OP_STOREAC },
+    { COMPILE_OP_JTAB, VM_OP_JTAB },
     };
 
 
@@ -83,6 +98,77 @@ char* load_source( char const* filename )
     }
 
 
+int translate_to_c( char const* source_filename, char const* output_filename )
+    {
+    int const host_func_count = sizeof( functions::host_functions ) / sizeof( *functions::host_functions );
+    char const* host_func_signatures[ host_func_count ];
+    for( int i = 0; i < host_func_count; ++i ) host_func_signatures[ i ] = functions::host_functions[ i ].signature;
+
+    char* source = load_source( source_filename );
+    if( !source )
+        {
+        printf( "Couldn't find the file:%s\n\n", source_filename );
+        return 1;
+        }
+
+    char error_msg[ 256 ] = "Unknown error.";
+    int error_pos = 0;
+    char* text = compile_to_c( source, (int) strlen( source ), host_func_signatures, host_func_count, &error_pos, error_msg );
+    if( !text )
+        {
+        printf( "Compile error at (%d): %s\n", pos_to_line( error_pos, source ), error_msg );
+        free( source );
+        return 1;
+        }
+    free( source );
+
+    FILE* fp = fopen( output_filename, "w" );
+    if( !fp ) 
+        {
+        printf( "Couldn't write the file:%s\n\n", output_filename );
+        free( text );
+        return 1;
+        }
+    fputs( text, fp );
+    fclose( fp );
+    free( text );
+    return 0;
+    }
+
+
+static int run_program( vm_context_t* ctx, int op_count )
+    {
+    #ifdef REBASIC_AOT
+        return aot_run( ctx, op_count );
+    #else
+        return vm_run( ctx, op_count );
+    #endif
+    }
+
+
+static bool program_halted( vm_context_t* ctx )
+    {
+    #ifdef REBASIC_AOT
+        return aot_halted( ctx );
+    #else
+        return vm_halted( ctx );
+    #endif
+    }
+
+
+static int render_thread_count = 1; // threads composing the screen, set with -threads on the command line
+static int software_crt = 0; // render the CRT effect on the CPU rather than with OpenGL, set with -softcrt
+static char const* record_filename = NULL; // file to record the screen to, set with -record
+static int bench_frames = 0; // frames to run unthrottled before printing the time spent, set with -bench
+
+// Size of the image rendered by the CPU version of the CRT effect, and the threads used for it. The final pass of the
+// effect runs at the size divided by SOFTWARE_CRT_DIVISOR, and is scaled up to the full size.
+#define SOFTWARE_CRT_WIDTH 1280
+#define SOFTWARE_CRT_HEIGHT 960
+#define SOFTWARE_CRT_DIVISOR 2
+#define SOFTWARE_CRT_THREADS 4
+
+
 void sound_callback( APP_S16* sample_pairs, int sample_pairs_count, void* user_data )
     {
     system_t* system = (system_t*) user_data;
@@ -102,6 +188,17 @@ int app_proc( app_t* app, void* user_data )
         host_funcs[ i ] = functions::host_functions[ i ].func;
         }
 
+    vm_context_t ctx;
+
+#ifdef REBASIC_AOT
+    // Set up VM for the translated program, which only uses it for the stack, string pool, DATA and pausing
+    (void) user_data;
+    char* source = NULL;
+    u32 aot_code[] = { VM_OP_HALT };
+    vm_init( &ctx, aot_code, sizeof( aot_code ), aot_code, sizeof( aot_code ), (void*) aot_data, aot_data_size, 
+        /* stack size */ 1024 * 1024, /* scratch global for READ */ sizeof( u32 ), host_funcs, host_func_count, 
+        aot_strings, aot_string_count, NULL, NULL );
+#else
     // Load source code
     char const* source_filename = (char const*) user_data;
     char* source = load_source( source_filename );
@@ -124,8 +221,6 @@ int app_proc( app_t* app, void* user_data )
         }
 
     // Set up VM
-    vm_context_t ctx;
-
     vm_init( &ctx, byte_code.code, byte_code.code_size, byte_code.map, byte_code.map_size, byte_code.data, 
         byte_code.data_size, /* stack size */ 1024 * 1024, byte_code.globals_size, host_funcs, host_func_count, 
         byte_code.strings, byte_code.string_count, trace_callback, source );
@@ -134,23 +229,35 @@ int app_proc( app_t* app, void* user_data )
     free( byte_code.map );
     free( byte_code.data );
     free( byte_code.strings );
+#endif
 
 
-    // Init app
-    crtemu_t* crtemu = crtemu_create( NULL );
+    // Init app. The CRT effect is rendered on the CPU if the OpenGL version isn't supported, or -softcrt was given.
+    crtemu_t* crtemu = software_crt ? NULL : crtemu_create( NULL );
+    crtemu_cpu_t* crtemu_cpu = crtemu ? NULL : crtemu_cpu_create( NULL, SOFTWARE_CRT_THREADS );
+    if( crtemu_cpu ) crtemu_cpu_render_divisor( crtemu_cpu, SOFTWARE_CRT_DIVISOR );
+    APP_U32* crt_xbgr = crtemu_cpu ? (APP_U32*) malloc( sizeof( APP_U32 ) * SOFTWARE_CRT_WIDTH * SOFTWARE_CRT_HEIGHT ) : NULL;
     CRTEMU_U64 crt_time_us = 0;
 
     CRT_FRAME_U32* frame = (CRT_FRAME_U32*) malloc( sizeof( CRT_FRAME_U32 ) * CRT_FRAME_WIDTH * CRT_FRAME_HEIGHT );
     crt_frame( frame );
-    crtemu_frame( crtemu, frame, CRT_FRAME_WIDTH, CRT_FRAME_HEIGHT );
+    if( crtemu )
+        crtemu_frame( crtemu, frame, CRT_FRAME_WIDTH, CRT_FRAME_HEIGHT );
+    else
+        crtemu_cpu_frame( crtemu_cpu, frame, CRT_FRAME_WIDTH, CRT_FRAME_HEIGHT );
     free( frame );
 
     //app_screenmode( app, APP_SCREENMODE_WINDOW );
-    app_interpolation( app, APP_INTERPOLATION_NONE );
+    app_interpolation( app, crtemu ? APP_INTERPOLATION_NONE : APP_INTERPOLATION_LINEAR );
 
     // Setup system
     int const SOUND_BUFFER_SIZE = 735 * 3; // Three frames worth of sound buffering
     system_t* system = system_create( &ctx, SOUND_BUFFER_SIZE );
+    system_render_threads( system, render_thread_count );
+
+    // Start recording, if requested
+    record_t* record = record_filename ? record_create( record_filename ) : NULL;
+    if( record ) system_capture( system, true );
 
     // Start sound playback
     app_sound( app, SOUND_BUFFER_SIZE * 2, sound_callback, system );
@@ -159,10 +266,16 @@ int app_proc( app_t* app, void* user_data )
     frametimer_lock_rate( frametimer, 60 );
     APP_U64 prev_time = app_time_count( app );       
 
+    // Time spent running the VM and rendering the screen, printed at exit when benchmarking
+    int frame_count = 0;
+    APP_U64 vm_time = 0;
+    APP_U64 render_time = 0;
+
     // Main loop
-    while( app_yield( app ) != APP_STATE_EXIT_REQUESTED && !vm_halted( &ctx ) )
+    while( app_yield( app ) != APP_STATE_EXIT_REQUESTED && !program_halted( &ctx ) && 
+        ( bench_frames == 0 || frame_count < bench_frames ) )
         {
-        frametimer_update( frametimer );
+        if( bench_frames == 0 ) frametimer_update( frametimer );
 
         // Read input and accumulate in buffer
         char input_buffer[ 256 ] = "";
@@ -178,9 +291,9 @@ int app_proc( app_t* app, void* user_data )
                 }
             }
 
-        // Update  system
+        // Update  system. Benchmarks always advance one 60th of a second, so they run the same way every time.
         APP_U64 time = app_time_count( app );
-        APP_U64 delta_time_us = ( time - prev_time ) / ( app_time_freq( app ) / 1000000 );
+        APP_U64 delta_time_us = bench_frames ? 16667 : ( time - prev_time ) / ( app_time_freq( app ) / 1000000 );
         prev_time = time;
         system_update( system, delta_time_us, input_buffer );
 
@@ -189,29 +302,62 @@ int app_proc( app_t* app, void* user_data )
         APP_U64 vmstart = app_time_count( app );
         APP_U64 vmend = vmstart + app_time_freq( app ) / ( 1000 / 8 ); // Run VM for 8 ms
         while( app_time_count( app ) < vmend )
-            if( vm_run( &ctx, 256 ) < 256 ) // Run VM for 256 instructions
+            if( run_program( &ctx, 256 ) < 256 ) // Run VM for 256 instructions
                 break; // break if it ran less than 256 instructions (i.e. it was paused)
 
         // Render screen
+        APP_U64 render_start = app_time_count( app );
         int screen_width = 0;
         int screen_height = 0;
         APP_U32* screen_xbgr = system_render_screen( system, &screen_width, &screen_height );
+        vm_time += render_start - vmstart;
+        render_time += app_time_count( app ) - render_start;
+        ++frame_count;
+
+        // Queue the composed screen for recording. This only copies it, and the disk is written on another thread.
+        if( record )
+            {
+            int capture_width = 0;
+            int capture_height = 0;
+            uint16_t const* capture_palette = NULL;
+            uint8_t const* capture = system_final_screen( system, &capture_width, &capture_height, &capture_palette );
+            record_frame( record, capture, capture_width, capture_height, capture_palette );
+            }
 
         // Present
         crt_time_us += delta_time_us;
-        crtemu_present( crtemu, crt_time_us, screen_xbgr, screen_width, screen_height, 0xffffff, 0x1c1c1c );
-        app_present( app, NULL, 1, 1, 0xffffff, 0x000000 );
+        if( crtemu )
+            {
+            crtemu_present( crtemu, crt_time_us, screen_xbgr, screen_width, screen_height, 0xffffff, 0x1c1c1c );
+            app_present( app, NULL, 1, 1, 0xffffff, 0x000000 );
+            }
+        else
+            {
+            crtemu_cpu_present( crtemu_cpu, crt_time_us, screen_xbgr, screen_width, screen_height, 0x1c1c1c, crt_xbgr,
+                SOFTWARE_CRT_WIDTH, SOFTWARE_CRT_HEIGHT );
+            app_present( app, crt_xbgr, SOFTWARE_CRT_WIDTH, SOFTWARE_CRT_HEIGHT, 0xffffff, 0x000000 );
+            }
         //app_present( app, screen_xbgr, screen_width, screen_height, 0xffffff, 0x1c1c1c );
         }
 
+    if( bench_frames )
+        {
+        double ms = 1000.0 / (double) app_time_freq( app );
+        printf( "%d frames: VM %.3f ms in total, render %.3f ms per frame\n", frame_count, (double) vm_time * ms, 
+            (double) render_time * ms / ( frame_count ? frame_count : 1 ) );
+        }
+
     app_sound( app, 0, NULL, NULL );
+    if( record ) record_destroy( record );
     system_destroy( system );
     frametimer_destroy( frametimer );
 
     vm_term( &ctx );    
     free( source );
 
-    crtemu_destroy( crtemu );
+    if( crtemu ) crtemu_destroy( crtemu );
+    if( crtemu_cpu ) crtemu_cpu_destroy( crtemu_cpu );
+    free( crt_xbgr );
     return 0;
     }
 
@@ -236,13 +382,78 @@ int main( int argc, char** argv )
 //        _CrtSetBreakAlloc( 0 );
     #endif
 
-    if( argc != 2 )
-        {
-        printf( "USAGE:\n\n\tREBASIC filename.bas\n\n");
-        return 1;
-        }
+    #ifdef REBASIC_AOT
+        return app_run( app_proc, NULL, NULL, NULL, NULL );
+    #else
+        if( argc == 4 && strcmp( argv[ 1 ], "-c" ) == 0 )
+            return translate_to_c( argv[ 2 ], argv[ 3 ] );
 
-    return app_run( app_proc, argv[ 1 ], NULL, NULL, NULL );
+        #ifdef VM_JIT
+            // Compare the JIT against the interpreter on random programs: REBASIC -jitfuzz [iterations] [seed]
+            if( argc >= 2 && strcmp( argv[ 1 ], "-jitfuzz" ) == 0 )
+                {
+                int iterations = argc >= 3 ? atoi( argv[ 2 ] ) : 1000;
+                unsigned int seed = argc >= 4 ? (unsigned int) atoi( argv[ 3 ] ) : 1U;
+                int mismatches = vm_jit_fuzz( iterations, seed );
+                printf( "JIT fuzz: %d programs, %d mismatches\n", iterations, mismatches );
+                return mismatches == 0 ? 0 : 1;
+                }
+        #endif
+
+        // Convert a recording made with -record to PNG files
+        if( argc == 4 && strcmp( argv[ 1 ], "-export" ) == 0 )
+            {
+            int frame_count = record_export_png( argv[ 2 ], argv[ 3 ] );
+            if( frame_count < 0 )
+                {
+                printf( "Failed to export %s\n", argv[ 2 ] );
+                return 1;
+                }
+            printf( "Exported %d frames\n", frame_count );
+            return 0;
+            }
+
+        // Write the reference frames of the CRT effect, or check the CPU version of it against them
+        if( argc == 3 && strcmp( argv[ 1 ], "-crtreference" ) == 0 )
+            {
+            int frame_count = crtcheck_reference( argv[ 2 ] );
+            if( frame_count < 0 )
+                {
+                printf( "Failed to write reference frames to %s\n", argv[ 2 ] );
+                return 1;
+                }
+            printf( "Wrote %d reference frames\n", frame_count );
+            return 0;
+            }
+        if( argc == 3 && strcmp( argv[ 1 ], "-crtcheck" ) == 0 )
+            return crtcheck_compare( argv[ 2 ] ) == 0 ? 0 : 1;
+
+        // Options go before the filename
+        int arg = 1;
+        for( ; arg < argc - 1; ++arg )
+            {
+            if( strcmp( argv[ arg ], "-threads" ) == 0 && arg + 2 < argc )
+                render_thread_count = atoi( argv[ ++arg ] );
+            else if( strcmp( argv[ arg ], "-softcrt" ) == 0 )
+                software_crt = 1;
+            else if( strcmp( argv[ arg ], "-record" ) == 0 && arg + 2 < argc )
+                record_filename = argv[ ++arg ];
+            else if( strcmp( argv[ arg ], "-bench" ) == 0 && arg + 2 < argc )
+                bench_frames = atoi( argv[ ++arg ] );
+            else
+                break;
+            }
+
+        if( arg != argc - 1 )
+            {
+            printf( "USAGE:\n\n\tREBASIC [-threads count] [-softcrt] [-record output.rec] [-bench frames] filename.bas\n"
+                "\tREBASIC -c filename.bas output.h\n\tREBASIC -export input.rec output_prefix\n"
+                "\tREBASIC -crtreference folder\n\tREBASIC -crtcheck folder\n\n");
+            return 1;
+            }
+
+        return app_run( app_proc, argv[ arg ], NULL, NULL, NULL );
+    #endif
     }
    
 
@@ -0,0 +1,510 @@
+
+#ifndef record_h
+#define record_h
+
+#include <stdint.h>
+
+// Records the composed screen, a frame at a time, to a file. Frames are queued by the thread calling record_frame,
+// and a writer thread delta-encodes each one against the previous frame, compresses it and writes it out, so the
+// caller never waits for the disk.
+
+typedef struct record_t record_t;
+
+record_t* record_create( char const* filename ); // returns NULL if the file can't be created
+void record_destroy( record_t* record ); // writes out all queued frames before closing the file
+
+// Queues a frame of 8-bit palette indices, and the palette (in the format of system_t::palette) they index. If the
+// queue is full, the frame is dropped rather than waiting for the writer, and false is returned.
+bool record_frame( record_t* record, uint8_t const* pixels, int width, int height, uint16_t const* palette );
+int record_dropped_frames( record_t* record );
+
+// Decodes a recording into a sequence of PNG files, named by prefix followed by a five digit frame number. Returns the
+// number of frames exported, or -1 if the recording could not be read.
+int record_export_png( char const* filename, char const* prefix );
+
+#endif /* record_h */
+
+#ifdef RECORD_IMPLEMENTATION
+#undef RECORD_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libs/thread.h"
+
+// Frames queued for the writer thread. One slot is always left empty, to tell a full queue from an empty one.
+#define RECORD_QUEUE_SIZE 16
+
+// A recording starts with the magic bytes, followed by the frames. Each frame is a header of four little-endian 32-bit
+// values: width, height, flags and the size of the encoded pixels. The palette follows, as 256 little-endian 16-bit
+// values, if RECORD_FLAG_PALETTE is set, and then the encoded pixels. Pixels are XORed with the previous frame, or
+// with zeros for the first frame and whenever the size changes, and then run-length encoded.
+static char const record_magic[ 8 ] = { 'R', 'E', 'B', 'R', 'E', 'C', '\0', '\1' };
+
+#define RECORD_FLAG_PALETTE 1
+
+struct record_t
+    {
+    FILE* file;
+
+    // Only the thread calling record_frame writes to slots between head and tail, and only the writer thread reads the
+    // ones between tail and head, so there is no locking
+    struct slot_t
+        {
+        uint8_t* pixels;
+        size_t capacity;
+        int width;
+        int height;
+        uint16_t palette[ 256 ];
+        } slots[ RECORD_QUEUE_SIZE ];
+    thread_atomic_int_t head; // next slot to fill
+    thread_atomic_int_t tail; // next slot to write out
+    thread_atomic_int_t exit;
+    thread_signal_t signal; // raised when a frame is queued, or on exit
+    thread_ptr_t thread;
+    int dropped;
+
+    // The previous frame, and buffers for encoding, used by the writer thread only
+    int width;
+    int height;
+    uint16_t palette[ 256 ];
+    uint8_t* previous;
+    uint8_t* delta;
+    uint8_t* encoded;
+    };
+
+
+static void record_u32( uint8_t* out, uint32_t value )
+    {
+    out[ 0 ] = (uint8_t)( value );
+    out[ 1 ] = (uint8_t)( value >> 8 );
+    out[ 2 ] = (uint8_t)( value >> 16 );
+    out[ 3 ] = (uint8_t)( value >> 24 );
+    }
+
+
+static uint32_t record_read_u32( uint8_t const* in )
+    {
+    return (uint32_t) in[ 0 ] | ( (uint32_t) in[ 1 ] << 8 ) | ( (uint32_t) in[ 2 ] << 16 ) | ( (uint32_t) in[ 3 ] << 24 );
+    }
+
+
+// Most bytes of a delta are zero, in long runs. A control byte below 0x80 is followed by that many plus one literal
+// bytes. From 0x80, it is followed by a byte repeated ( control & 0x7f ) + 3 times, and if the count is 0x7f, by a
+// variable length count of further repeats, seven bits per byte with the top bit set on all but the last.
+static size_t record_rle_bound( size_t count )
+    {
+    return count + count / 128 + 16;
+    }
+
+
+static size_t record_rle_literals( uint8_t* out, uint8_t const* in, size_t count )
+    {
+    size_t size = 0;
+    while( count > 0 )
+        {
+        size_t n = count < 128 ? count : 128;
+        out[ size++ ] = (uint8_t)( n - 1 );
+        memcpy( out + size, in, n );
+        size += n;
+        in += n;
+        count -= n;
+        }
+    return size;
+    }
+
+
+static size_t record_rle_encode( uint8_t* out, uint8_t const* in, size_t count )
+    {
+    size_t size = 0;
+    size_t literals = 0; // start of the bytes not yet written out
+    size_t i = 0;
+    while( i < count )
+        {
+        size_t run = 1;
+        while( i + run < count && in[ i + run ] == in[ i ] ) ++run;
+        if( run >= 3 )
+            {
+            size += record_rle_literals( out + size, in + literals, i - literals );
+            size_t extra = run - 3;
+            out[ size++ ] = (uint8_t)( 0x80 | ( extra < 0x7f ? extra : 0x7f ) );
+            out[ size++ ] = in[ i ];
+            if( extra >= 0x7f )
+                {
+                extra -= 0x7f;
+                while( extra >= 0x80 )
+                    {
+                    out[ size++ ] = (uint8_t)( 0x80 | ( extra & 0x7f ) );
+                    extra >>= 7;
+                    }
+                out[ size++ ] = (uint8_t) extra;
+                }
+            literals = i + run;
+            }
+        i += run;
+        }
+    size += record_rle_literals( out + size, in + literals, count - literals );
+    return size;
+    }
+
+
+// Returns false if the data does not decode to exactly count bytes
+static bool record_rle_decode( uint8_t* out, size_t count, uint8_t const* in, size_t size )
+    {
+    size_t pos = 0;
+    size_t i = 0;
+    while( i < size )
+        {
+        uint8_t control = in[ i++ ];
+        if( control < 0x80 )
+            {
+            size_t n = (size_t) control + 1;
+            if( n > size - i || n > count - pos ) return false;
+            memcpy( out + pos, in + i, n );
+            i += n;
+            pos += n;
+            }
+        else
+            {
+            if( i >= size ) return false;
+            uint8_t value = in[ i++ ];
+            size_t n = (size_t)( control & 0x7f ) + 3;
+            if( ( control & 0x7f ) == 0x7f )
+                {
+                size_t extra = 0;
+                for( int shift = 0; ; shift += 7 )
+                    {
+                    if( i >= size || shift > 28 ) return false;
+                    uint8_t b = in[ i++ ];
+                    extra |= (size_t)( b & 0x7f ) << shift;
+                    if( !( b & 0x80 ) ) break;
+                    }
+                n += extra;
+                }
+            if( n > count - pos ) return false;
+            memset( out + pos, value, n );
+            pos += n;
+            }
+        }
+    return pos == count;
+    }
+
+
+static void record_write_frame( record_t* record, record_t::slot_t const* slot )
+    {
+    size_t const count = (size_t) slot->width * slot->height;
+    bool palette = memcmp( record->palette, slot->palette, sizeof( record->palette ) ) != 0;
+    if( slot->width != record->width || slot->height != record->height )
+        {
+        record->width = slot->width;
+        record->height = slot->height;
+        free( record->previous );
+        free( record->delta );
+        free( record->encoded );
+        record->previous = (uint8_t*) malloc( count );
+        record->delta = (uint8_t*) malloc( count );
+        record->encoded = (uint8_t*) malloc( record_rle_bound( count ) );
+        memset( record->previous, 0, count );
+        palette = true;
+        }
+
+    for( size_t i = 0; i < count; ++i )
+        {
+        record->delta[ i ] = (uint8_t)( slot->pixels[ i ] ^ record->previous[ i ] );
+        record->previous[ i ] = slot->pixels[ i ];
+        }
+    size_t size = record_rle_encode( record->encoded, record->delta, count );
+
+    uint8_t header[ 16 + 256 * 2 ];
+    record_u32( header, (uint32_t) slot->width );
+    record_u32( header + 4, (uint32_t) slot->height );
+    record_u32( header + 8, palette ? (uint32_t) RECORD_FLAG_PALETTE : 0u );
+    record_u32( header + 12, (uint32_t) size );
+    size_t header_size = 16;
+    if( palette )
+        {
+        memcpy( record->palette, slot->palette, sizeof( record->palette ) );
+        for( int i = 0; i < 256; ++i )
+            {
+            header[ header_size++ ] = (uint8_t)( slot->palette[ i ] );
+            header[ header_size++ ] = (uint8_t)( slot->palette[ i ] >> 8 );
+            }
+        }
+    fwrite( header, 1, header_size, record->file );
+    fwrite( record->encoded, 1, size, record->file );
+    }
+
+
+static int record_writer( void* user_data )
+    {
+    record_t* record = (record_t*) user_data;
+    for( ; ; )
+        {
+        int tail = thread_atomic_int_load( &record->tail );
+        if( tail == thread_atomic_int_load( &record->head ) )
+            {
+            // Queued frames are all written out before exiting
+            if( thread_atomic_int_load( &record->exit ) ) break;
+            thread_signal_wait( &record->signal, THREAD_SIGNAL_WAIT_INFINITE );
+            continue;
+            }
+        record_write_frame( record, &record->slots[ tail ] );
+        thread_atomic_int_store( &record->tail, ( tail + 1 ) % RECORD_QUEUE_SIZE );
+        }
+    return 0;
+    }
+
+
+record_t* record_create( char const* filename )
+    {
+    FILE* file = fopen( filename, "wb" );
+    if( !file ) return NULL;
+    fwrite( record_magic, 1, sizeof( record_magic ), file );
+
+    record_t* record = (record_t*) malloc( sizeof( record_t ) );
+    memset( record, 0, sizeof( *record ) );
+    record->file = file;
+    thread_atomic_int_store( &record->head, 0 );
+    thread_atomic_int_store( &record->tail, 0 );
+    thread_atomic_int_store( &record->exit, 0 );
+    thread_signal_init( &record->signal );
+    record->thread = thread_create( record_writer, record, NULL, THREAD_STACK_SIZE_DEFAULT );
+    return record;
+    }
+
+
+void record_destroy( record_t* record )
+    {
+    thread_atomic_int_store( &record->exit, 1 );
+    thread_signal_raise( &record->signal );
+    thread_join( record->thread );
+    thread_destroy( record->thread );
+    thread_signal_term( &record->signal );
+    fclose( record->file );
+
+    for( int i = 0; i < RECORD_QUEUE_SIZE; ++i )
+        free( record->slots[ i ].pixels );
+    free( record->previous );
+    free( record->delta );
+    free( record->encoded );
+    free( record );
+    }
+
+
+bool record_frame( record_t* record, uint8_t const* pixels, int width, int height, uint16_t const* palette )
+    {
+    int head = thread_atomic_int_load( &record->head );
+    int next = ( head + 1 ) % RECORD_QUEUE_SIZE;
+    if( next == thread_atomic_int_load( &record->tail ) )
+        {
+        ++record->dropped;
+        return false;
+        }
+
+    record_t::slot_t* slot = &record->slots[ head ];
+    size_t const count = (size_t) width * height;
+    if( slot->capacity < count )
+        {
+        free( slot->pixels );
+        slot->pixels = (uint8_t*) malloc( count );
+        slot->capacity = count;
+        }
+    memcpy( slot->pixels, pixels, count );
+    memcpy( slot->palette, palette, sizeof( slot->palette ) );
+    slot->width = width;
+    slot->height = height;
+
+    thread_atomic_int_store( &record->head, next );
+    thread_signal_raise( &record->signal );
+    return true;
+    }
+
+
+int record_dropped_frames( record_t* record )
+    {
+    return record->dropped;
+    }
+
+
+static uint32_t record_crc32( uint32_t crc, uint8_t const* data, size_t size )
+    {
+    static uint32_t table[ 256 ];
+    if( !table[ 1 ] )
+        {
+        for( uint32_t i = 0; i < 256; ++i )
+            {
+            uint32_t c = i;
+            for( int j = 0; j < 8; ++j ) c = ( c & 1 ) ? 0xedb88320u ^ ( c >> 1 ) : c >> 1;
+            table[ i ] = c;
+            }
+        }
+    crc = ~crc;
+    for( size_t i = 0; i < size; ++i ) crc = table[ ( crc ^ data[ i ] ) & 0xff ] ^ ( crc >> 8 );
+    return ~crc;
+    }
+
+
+static void record_png_chunk( FILE* file, char const* type, uint8_t const* data, size_t size )
+    {
+    uint8_t header[ 8 ];
+    header[ 0 ] = (uint8_t)( size >> 24 );
+    header[ 1 ] = (uint8_t)( size >> 16 );
+    header[ 2 ] = (uint8_t)( size >> 8 );
+    header[ 3 ] = (uint8_t)( size );
+    memcpy( header + 4, type, 4 );
+    uint32_t crc = record_crc32( record_crc32( 0, header + 4, 4 ), data, size );
+    uint8_t footer[ 4 ] = { (uint8_t)( crc >> 24 ), (uint8_t)( crc >> 16 ), (uint8_t)( crc >> 8 ), (uint8_t)( crc ) };
+    fwrite( header, 1, sizeof( header ), file );
+    if( size > 0 ) fwrite( data, 1, size, file ); // IEND has no data, and passes a null pointer for it
+    fwrite( footer, 1, sizeof( footer ), file );
+    }
+
+
+// Writes an 8-bit palettized PNG. The image data is stored in uncompressed deflate blocks, which keeps the writer
+// small, and the exported images are meant for further processing anyway.
+static bool record_write_png( char const* filename, uint8_t const* pixels, int width, int height, uint16_t const* palette )
+    {
+    FILE* file = fopen( filename, "wb" );
+    if( !file ) return false;
+
+    static uint8_t const signature[ 8 ] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite( signature, 1, sizeof( signature ), file );
+
+    uint8_t ihdr[ 13 ] = { 0 };
+    ihdr[ 0 ] = (uint8_t)( width >> 24 ); ihdr[ 1 ] = (uint8_t)( width >> 16 );
+    ihdr[ 2 ] = (uint8_t)( width >> 8 ); ihdr[ 3 ] = (uint8_t)( width );
+    ihdr[ 4 ] = (uint8_t)( height >> 24 ); ihdr[ 5 ] = (uint8_t)( height >> 16 );
+    ihdr[ 6 ] = (uint8_t)( height >> 8 ); ihdr[ 7 ] = (uint8_t)( height );
+    ihdr[ 8 ] = 8; // bit depth
+    ihdr[ 9 ] = 3; // palette color
+    record_png_chunk( file, "IHDR", ihdr, sizeof( ihdr ) );
+
+    // Same conversion as system_render_screen
+    uint8_t plte[ 256 * 3 ];
+    for( int i = 0; i < 256; ++i )
+        {
+        plte[ i * 3 + 0 ] = (uint8_t)( ( ( palette[ i ] >> 8 ) & 0x7 ) * 36 );
+        plte[ i * 3 + 1 ] = (uint8_t)( ( ( palette[ i ] >> 4 ) & 0x7 ) * 36 );
+        plte[ i * 3 + 2 ] = (uint8_t)( ( palette[ i ] & 0x7 ) * 36 );
+        }
+    record_png_chunk( file, "PLTE", plte, sizeof( plte ) );
+
+    // Rows are each preceded by a filter type byte of zero
+    size_t const raw_size = (size_t)( width + 1 ) * height;
+    size_t const block_count = ( raw_size + 65534 ) / 65535;
+    uint8_t* idat = (uint8_t*) malloc( 2 + raw_size + block_count * 5 + 4 );
+    size_t size = 0;
+    idat[ size++ ] = 0x78; // zlib header, deflate with 32k window
+    idat[ size++ ] = 0x01;
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+    size_t block_left = 0;
+    size_t raw_pos = 0;
+    for( int y = 0; y < height; ++y )
+        {
+        for( int x = -1; x < width; ++x )
+            {
+            if( block_left == 0 )
+                {
+                block_left = raw_size - raw_pos < 65535 ? raw_size - raw_pos : 65535;
+                idat[ size++ ] = raw_pos + block_left == raw_size ? 1 : 0; // final block flag
+                idat[ size++ ] = (uint8_t)( block_left );
+                idat[ size++ ] = (uint8_t)( block_left >> 8 );
+                idat[ size++ ] = (uint8_t)( ~block_left );
+                idat[ size++ ] = (uint8_t)( ~block_left >> 8 );
+                }
+            uint8_t value = x < 0 ? 0 : pixels[ y * width + x ];
+            idat[ size++ ] = value;
+            adler_a = ( adler_a + value ) % 65521;
+            adler_b = ( adler_b + adler_a ) % 65521;
+            --block_left;
+            ++raw_pos;
+            }
+        }
+    uint32_t adler = ( adler_b << 16 ) | adler_a;
+    idat[ size++ ] = (uint8_t)( adler >> 24 );
+    idat[ size++ ] = (uint8_t)( adler >> 16 );
+    idat[ size++ ] = (uint8_t)( adler >> 8 );
+    idat[ size++ ] = (uint8_t)( adler );
+    record_png_chunk( file, "IDAT", idat, size );
+    free( idat );
+
+    record_png_chunk( file, "IEND", NULL, 0 );
+    bool ok = ferror( file ) == 0;
+    fclose( file );
+    return ok;
+    }
+
+
+int record_export_png( char const* filename, char const* prefix )
+    {
+    FILE* file = fopen( filename, "rb" );
+    if( !file ) return -1;
+    char magic[ sizeof( record_magic ) ];
+    if( fread( magic, 1, sizeof( magic ), file ) != sizeof( magic ) || memcmp( magic, record_magic, sizeof( magic ) ) != 0 )
+        {
+        fclose( file );
+        return -1;
+        }
+
+    int width = 0;
+    int height = 0;
+    uint16_t palette[ 256 ] = { 0 };
+    uint8_t* pixels = NULL;
+    uint8_t* delta = NULL;
+    uint8_t* encoded = NULL;
+    size_t encoded_capacity = 0;
+    int frame_count = 0;
+    for( ; ; )
+        {
+        uint8_t header[ 16 ];
+        if( fread( header, 1, sizeof( header ), file ) != sizeof( header ) ) break;
+        uint32_t frame_width = record_read_u32( header );
+        uint32_t frame_height = record_read_u32( header + 4 );
+        uint32_t flags = record_read_u32( header + 8 );
+        uint32_t size = record_read_u32( header + 12 );
+        if( frame_width < 1 || frame_width > 4096 || frame_height < 1 || frame_height > 4096 ) { frame_count = -1; break; }
+
+        if( (int) frame_width != width || (int) frame_height != height )
+            {
+            width = (int) frame_width;
+            height = (int) frame_height;
+            free( pixels );
+            free( delta );
+            pixels = (uint8_t*) malloc( (size_t) width * height );
+            delta = (uint8_t*) malloc( (size_t) width * height );
+            memset( pixels, 0, (size_t) width * height );
+            }
+        if( flags & RECORD_FLAG_PALETTE )
+            {
+            uint8_t data[ 256 * 2 ];
+            if( fread( data, 1, sizeof( data ), file ) != sizeof( data ) ) { frame_count = -1; break; }
+            for( int i = 0; i < 256; ++i ) palette[ i ] = (uint16_t)( data[ i * 2 ] | ( data[ i * 2 + 1 ] << 8 ) );
+            }
+        if( size > encoded_capacity )
+            {
+            free( encoded );
+            encoded = (uint8_t*) malloc( size );
+            encoded_capacity = size;
+            }
+        if( fread( encoded, 1, size, file ) != size ) { frame_count = -1; break; }
+        size_t const count = (size_t) width * height;
+        if( !record_rle_decode( delta, count, encoded, size ) ) { frame_count = -1; break; }
+        for( size_t i = 0; i < count; ++i ) pixels[ i ] ^= delta[ i ];
+
+        char png_filename[ 1024 ];
+        snprintf( png_filename, sizeof( png_filename ), "%s%05d.png", prefix, frame_count );
+        if( !record_write_png( png_filename, pixels, width, height, palette ) ) { frame_count = -1; break; }
+        ++frame_count;
+        }
+
+    free( pixels );
+    free( delta );
+    free( encoded );
+    fclose( file );
+    return frame_count;
+    }
+
+
+#endif /* RECORD_IMPLEMENTATION */
@@ -11,10 +11,23 @@ void system_destroy( system_t* system );
 
 void system_update( system_t* system, uint64_t delta_time_us, char const* input_buffer );
 uint32_t* system_render_screen( system_t* system, int* width, int* height );
+void system_render_threads( system_t* system, int thread_count ); // 1 (the default) renders on the calling thread only
+void system_capture( system_t* system, bool enable ); // keep a copy of each composed screen, for system_final_screen
+uint8_t const* system_final_screen( system_t* system, int* width, int* height, uint16_t const** palette ); // NULL unless capturing
 void system_render_samples( system_t* system, int16_t* sample_pairs, int sample_pairs_count );
 
 void system_input_mode( system_t* system );
 void system_waitvbl( system_t* system );
+int system_strstats( system_t* system, int stat ); // 0=Strings  // 1=Bytes used  // 2=Bytes free  // 3=Injects/s  // 4=Discards/s
+
+void system_screen( system_t* system, int width, int height, int colors ); // width and height in multiples of 8, colors a power of 2 up to 256
+
+// Screen pages, numbered from 1. Drawing and text go to the logic page, and the display page is shown. Both are page 1 
+// until changed, and the other pages are cleared when first used.
+void system_screen_swap( system_t* system ); // exchanges logic and display pages, or starts drawing to page 2 if they were the same
+void system_screen_copy( system_t* system, int from_page, int to_page );
+void system_screen_logic( system_t* system, int page );
+void system_screen_display( system_t* system, int page );
 
 void system_cdown( system_t* system );
 void system_cup( system_t* system );
@@ -74,7 +87,8 @@ void system_update( system_t* system );
 int system_xsprite( system_t* system, int spr_index );
 int system_ysprite( system_t* system, int spr_index );
 
-// COLLIDE 
+int system_collide( system_t* system, int spr_index ); // the first sprite overlapping it, pixel for pixel, or 0
+int system_collide_pair( system_t* system, int spr_a, int spr_b ); // 1 if the two sprites overlap, pixel for pixel
 // LIMIT SPRITE 
 // ZONE 
 // SET ZONE
@@ -90,6 +104,21 @@ void system_off( system_t* system );
 void system_freeze( system_t* system );
 void system_unfreeze( system_t* system );
 
+// Tilemap, drawn over the screen and under the cursor and sprites. It wraps around when scrolled.
+void system_map( system_t* system, int columns, int rows, int tile_width, int tile_height ); // 0 columns or rows removes it
+void system_tile( system_t* system, int x, int y, int data_index ); // sprite data to draw as the tile, 0 for none
+void system_scroll( system_t* system, int x, int y ); // pixel position of the map at the top left of the screen
+
+// Graphics, drawn on the screen in the pen color with the current writing mode. Shapes are clipped to the screen, and 
+// touch each pixel once, so XOR drawing them twice restores what was there.
+void system_cls( system_t* system );
+void system_plot( system_t* system, int x, int y );
+void system_plot_color( system_t* system, int x, int y, int color );
+void system_draw( system_t* system, int x1, int y1, int x2, int y2 );
+void system_box( system_t* system, int x1, int y1, int x2, int y2 );
+void system_bar( system_t* system, int x1, int y1, int x2, int y2 );
+void system_circle( system_t* system, int x, int y, int r );
+
 void system_say( system_t* system, char const* text );
 void system_loadsong( system_t* system, int index, char const* filename );
 void system_playsong( system_t* system, int index );
@@ -103,15 +132,51 @@ void system_play_sound( system_t* system, int sound_index, int data_index );
 #ifdef SYSTEM_MPLEMENTATION
 #undef SYSTEM_IMPLEMENTATION
 
+#include <math.h>
+
 #include "libs/dr_wav.h"
 #include "libs/file.h"
 #include "libs/mid.h"
 #include "libs/palettize.h"
 #include "libs/stb_image.h"
-#include "libs/sort.hpp"
 #include "libs/speech.hpp"
 #include "libs/thread.h"
 
+#if defined( _M_X64 ) || defined( __x86_64__ )
+    #define SYSTEM_SIMD
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define SYSTEM_TARGET( x )
+    #else
+        #define SYSTEM_TARGET( x ) __attribute__(( target( x ) ))
+    #endif
+#endif
+
+// The palette converted to XBGR. For modes with up to 32 colors, the first 32 entries are also split into byte planes 
+// which serve as lookup tables for the SIMD expansion
+struct system_palette_t
+    {
+    uint32_t xbgr[ 256 ];
+    uint8_t planes[ 4 ][ 32 ];
+    };
+
+// Expands count palette indices to XBGR pixels
+typedef void (*system_expand_func_t)( uint32_t* out, uint8_t const* pixels, int count, system_palette_t const* palette );
+
+// The screen is composed and converted in bands of rows, which are independent of each other and may be done on
+// different threads
+#define SYSTEM_BAND_HEIGHT 20
+
+// Hardware sprites. COLLIDE keeps a bit per sprite in a uint32_t, so there can't be more than 32.
+#define SYSTEM_SPRITE_COUNT 32
+
+// Cells along each side of the COLLIDE grid
+#define SYSTEM_COLLIDE_GRID 16
+
+// Screen pages for SCREEN_SWAP and SCREEN_COPY
+#define SYSTEM_SCREEN_PAGES 4
+
 struct system_t
     {
     vm_context_t* vm;
@@ -120,6 +185,12 @@ struct system_t
     uint64_t time_us;
     char input_str[ 256 ];
 
+    uint64_t strstats_time_us;
+    uint32_t strstats_injects;
+    uint32_t strstats_discards;
+    int strstats_inject_rate;
+    int strstats_discard_rate;
+
     bool show_cursor;
     int cursor_top;
     int cursor_base;
@@ -132,75 +203,191 @@ struct system_t
     bool text_underline;
     bool text_shaded;
 
-    uint16_t palette[ 32 ];
-    uint8_t screen[ 320 * 200 ]; // the screen, which we draw to  
-    uint8_t final_screen[ 320 * 200 ]; // final composite of screen with cursor and sprites rendered on top of the screen contents
-    uint32_t out_screen_xbgr[ 384 * 288 ]; // XBGR 32-bit de-palettized screen with borders added
-    uint8_t charmap[ 40 * 25 ];
+    // Text is drawn from the font a row at a time. Each glyph row is a byte with a bit set for every pen pixel, with 
+    // shading and underline already applied, so there is a table for each combination of those. Row bytes are turned
+    // into 8 pixel masks by looking up glyph_bytes.
+    uint8_t glyph_rows[ 4 ][ 256 ][ 8 ]; // [ shaded | underline * 2 ][ char ][ row ]
+    uint64_t glyph_bytes[ 256 ]; // 0xff in each byte whose bit is set
+
+    // The screen mode, set by system_screen. All the buffers are sized for it.
+    int screen_width;
+    int screen_height;
+    int screen_colors;
+    int color_mask; // screen_colors - 1, as pen, paper and pixels are kept within the palette 
+    int text_width; // screen size in 8x8 characters
+    int text_height;
+    int border_width; // border around the screen in out_screen_xbgr, on each side
+    int border_height;
+    int out_width;
+    int out_height;
+    int band_count;
+
+    uint16_t palette[ 256 ];
+    uint8_t* screen; // the screen, which we draw to  
+    uint8_t* band; // a band of rows of the screen with cursor and sprites on top, being composed
+    uint8_t* final_screen; // the whole composed screen, only kept while capturing
+    uint32_t* out_screen_xbgr; // XBGR 32-bit de-palettized screen with borders added
+    uint8_t* charmap;
+
+    // The screen and charmap are rings of rows, so scrolling the text up just moves the text row they start at, and 
+    // clears the row which comes round at the bottom. Rows are found with system_screen_row and system_charmap_row.
+    int scroll_row;
+
+    // Each page has its own screen and text. The logic page is the one in screen, charmap and scroll_row, so its 
+    // scroll_row here is out of date. The display page is composed by system_render_screen straight from its rows.
+    struct page_t
+        {
+        uint8_t* screen; // NULL until the page is first used
+        uint8_t* charmap;
+        int scroll_row;
+        } pages[ SYSTEM_SCREEN_PAGES ];
+    int logic_page;
+    int display_page;
+
+    // Only rows which have changed since the last frame are recomposed and converted by system_render_screen
+    uint8_t* dirty_rows; // rows of screen drawn to since the last frame
+    bool sprites_changed; // sprite data or draw order changed, so all sprites are redrawn
+    bool full_redraw; // set when the palette changes, as that affects every pixel
+    system_palette_t render_palette;
+    system_expand_func_t expand_pixels;
+
+    struct drawn_t
+        {
+        int x;
+        int y;
+        int height;
+        int data;
+        } drawn_cursor, drawn_sprites[ SYSTEM_SPRITE_COUNT ]; // what was drawn on top of the screen in the last frame
 
     bool frozen;
     bool ypos_priority;
+
+    // Grid over the screen for COLLIDE, with a bit set in each cell for every sprite whose bounding box touches it. It 
+    // is rebuilt when first needed after sprites have moved or changed.
+    uint32_t collide_grid[ SYSTEM_COLLIDE_GRID ][ SYSTEM_COLLIDE_GRID ];
+    bool collide_grid_valid;
     bool manual_sprite_update;
     bool manual_sprite_synchro;
     int sprite_synchro_count;   
 
-    struct sprite_t
+    // Sprite state is kept as an array per field, indexed by sprite, so the passes over the sprites each frame only 
+    // bring in the fields they use. The frames of anim and move scripts are allocated at the length of the script.
+    struct sprites_t
         {
-        int x;
-        int y;
-        int data;
+        int x[ SYSTEM_SPRITE_COUNT ];
+        int y[ SYSTEM_SPRITE_COUNT ];
+        int data[ SYSTEM_SPRITE_COUNT ];
 
-        int draw_x;
-        int draw_y;
-        int draw_data;
+        int draw_x[ SYSTEM_SPRITE_COUNT ];
+        int draw_y[ SYSTEM_SPRITE_COUNT ];
+        int draw_data[ SYSTEM_SPRITE_COUNT ];
 
-        struct anim_t
+        bool moving[ SYSTEM_SPRITE_COUNT ];
+        } sprites;
+
+    struct anim_t
+        {
+        struct frame_t
             {
-            struct frames_t
-                {
-                int data;
-                int delay;
-                } frames[ 256 ];
-            int frame_count;
-            int index;
-            int timer;
-            bool loop;
-            bool running;
-            } anim;
-
-        struct move_t
+            int data;
+            int delay;
+            }* frames[ SYSTEM_SPRITE_COUNT ];
+        int frame_count[ SYSTEM_SPRITE_COUNT ];
+        int index[ SYSTEM_SPRITE_COUNT ];
+        int timer[ SYSTEM_SPRITE_COUNT ];
+        bool loop[ SYSTEM_SPRITE_COUNT ];
+        bool running[ SYSTEM_SPRITE_COUNT ];
+        } anim;
+
+    struct move_t
+        {
+        struct frame_t
             {
-            struct frames_t
-                {
-                int speed;
-                int step;
-                int count;
-                } frames[ 256 ];
-            int frame_count;
-            int index;
-            int timer;
+            int speed;
+            int step;
             int count;
-            bool loop;            
-            bool pos_used;   
-            int pos_value;
-            } move_x, move_y;
-        bool moving;
-
-        } sprites[ 32 ];
+            }* frames[ SYSTEM_SPRITE_COUNT ];
+        int frame_count[ SYSTEM_SPRITE_COUNT ];
+        int index[ SYSTEM_SPRITE_COUNT ];
+        int timer[ SYSTEM_SPRITE_COUNT ];
+        int count[ SYSTEM_SPRITE_COUNT ];
+        bool loop[ SYSTEM_SPRITE_COUNT ];
+        bool pos_used[ SYSTEM_SPRITE_COUNT ];
+        int pos_value[ SYSTEM_SPRITE_COUNT ];
+        } move_x, move_y;
+
+    // The sprites with an anim or move script running, which are all system_update_sprites looks at. It is worked out 
+    // again after scripts are started or stopped, and sprites whose scripts end are dropped from it as they do.
+    uint8_t active_sprites[ SYSTEM_SPRITE_COUNT ];
+    int active_sprite_count;
+    bool active_sprites_valid;
 
     struct sprite_order_t
         {
         int index;
         int ypos;
-        } sprite_order[ sizeof( sprites ) / sizeof( *sprites ) ];
+        } sprite_order[ SYSTEM_SPRITE_COUNT ];
 
     struct sprite_data_t
         {
         uint8_t* pixels;
         int width;
         int height;
+
+        struct span_t
+            {
+            int start;
+            int length;
+            }* spans; // runs of opaque pixels, row by row, so drawing never tests pixels for transparency
+        int* row_spans; // index of the first span of each row, with an extra entry at the end
+
+        // Opaque pixels as bits, for collisions. Each row is mask_words 64-bit words, with bit n of word w for column
+        // w * 64 + n, and the bits past the width clear.
+        uint64_t* masks; 
+        int mask_words;
         } sprite_data[ 4096 ];
 
+    struct map_t
+        {
+        uint16_t* tiles; // sprite data index of each tile, 0 for none, row by row
+        int columns;
+        int rows;
+        int tile_width;
+        int tile_height;
+        int scroll_x; // kept within the size of the map, in pixels
+        int scroll_y;
+        } map;
+
+    // What to draw on top of the screen this frame, set up by system_render_screen before the bands are composed
+    struct render_frame_t
+        {
+        drawn_t cursor;
+        struct visible_t
+            {
+            sprite_data_t const* data;
+            int x;
+            int y;
+            int x0;
+            int x1;
+            } visible[ SYSTEM_SPRITE_COUNT ]; // clipped sprites, in draw order
+        int* bucket_counts;
+        uint8_t (*buckets)[ SYSTEM_SPRITE_COUNT ]; // visible sprites which might cover each band
+        } render_frame;
+
+    // Worker threads which take bands to compose and convert alongside the thread calling system_render_screen
+    struct render_worker_t
+        {
+        system_t* system;
+        thread_ptr_t thread;
+        thread_signal_t start;
+        uint8_t* band;
+        }* render_workers;
+    int render_worker_count;
+    thread_atomic_int_t render_next_band;
+    thread_atomic_int_t render_busy_workers;
+    thread_atomic_int_t render_exit;
+    thread_signal_t render_done;
+
     int sound_buffer_size;
     int16_t* mix_buffers;
 
@@ -239,6 +426,340 @@ extern unsigned short default_palette[ 32 ];
 extern unsigned char soundfont[ 1093878 ];
 
 
+// The start of pixel row y of the screen
+static uint8_t* system_screen_row( system_t* system, int y )
+    {
+    int row = y + system->scroll_row * 8;
+    if( row >= system->screen_height ) row -= system->screen_height;
+    return system->screen + row * system->screen_width;
+    }
+
+
+// The start of text row y of the charmap
+static uint8_t* system_charmap_row( system_t* system, int y )
+    {
+    int row = y + system->scroll_row;
+    if( row >= system->text_height ) row -= system->text_height;
+    return system->charmap + row * system->text_width;
+    }
+
+
+static void system_mark_dirty( system_t* system, int y, int height )
+    {
+    int y0 = y < 0 ? 0 : y;
+    int y1 = (int64_t) y + height > system->screen_height ? system->screen_height : y + height;
+    if( y1 > y0 ) memset( system->dirty_rows + y0, 1, (size_t)( y1 - y0 ) );
+    }
+
+
+// Marks rows y1 to y2 inclusive dirty, for ranges whose height may not fit in an int
+static void system_mark_dirty_rows( system_t* system, int y1, int y2 )
+    {
+    if( y1 < 0 ) y1 = 0;
+    if( y2 >= system->screen_height ) y2 = system->screen_height - 1;
+    if( y2 >= y1 ) memset( system->dirty_rows + y1, 1, (size_t)( y2 - y1 + 1 ) );
+    }
+
+
+// The start of pixel row y of the display page
+static uint8_t const* system_display_row( system_t* system, int y )
+    {
+    if( system->display_page == system->logic_page ) return system_screen_row( system, y );
+    system_t::page_t const* page = &system->pages[ system->display_page ];
+    int row = y + page->scroll_row * 8;
+    if( row >= system->screen_height ) row -= system->screen_height;
+    return page->screen + row * system->screen_width;
+    }
+
+
+static void system_expand_scalar( uint32_t* out, uint8_t const* pixels, int count, system_palette_t const* palette )
+    {
+    for( int i = 0; i < count; ++i ) out[ i ] = palette->xbgr[ pixels[ i ] & 31 ];
+    }
+
+
+static void system_expand_scalar_256( uint32_t* out, uint8_t const* pixels, int count, system_palette_t const* palette )
+    {
+    for( int i = 0; i < count; ++i ) out[ i ] = palette->xbgr[ pixels[ i ] ];
+    }
+
+
+#ifdef SYSTEM_SIMD
+
+// Looks up one byte of the output pixels for 16 indices, using pshufb on the low and high 16 entries of its plane
+#define SYSTEM_EXPAND_PLANE( shuffle, and_, andnot, or_, lo, hi, index, high ) \
+    or_( andnot( high, shuffle( lo, index ) ), and_( high, shuffle( hi, index ) ) )
+
+SYSTEM_TARGET( "ssse3" )
+static void system_expand_ssse3( uint32_t* out, uint8_t const* pixels, int count, system_palette_t const* palette )
+    {
+    __m128i lo[ 4 ];
+    __m128i hi[ 4 ];
+    for( int p = 0; p < 4; ++p )
+        {
+        lo[ p ] = _mm_loadu_si128( (__m128i const*) palette->planes[ p ] );
+        hi[ p ] = _mm_loadu_si128( (__m128i const*) ( palette->planes[ p ] + 16 ) );
+        }
+    __m128i mask = _mm_set1_epi8( 31 );
+    __m128i fifteen = _mm_set1_epi8( 15 );
+
+    int i = 0;
+    for( ; i + 16 <= count; i += 16 )
+        {
+        __m128i index = _mm_and_si128( _mm_loadu_si128( (__m128i const*)( pixels + i ) ), mask );
+        __m128i high = _mm_cmpgt_epi8( index, fifteen );
+        __m128i b[ 4 ];
+        for( int p = 0; p < 4; ++p )
+            b[ p ] = SYSTEM_EXPAND_PLANE( _mm_shuffle_epi8, _mm_and_si128, _mm_andnot_si128, _mm_or_si128, lo[ p ], hi[ p ], index, high );
+
+        // Interleave the byte planes back into 32-bit pixels
+        __m128i b01_lo = _mm_unpacklo_epi8( b[ 0 ], b[ 1 ] );
+        __m128i b01_hi = _mm_unpackhi_epi8( b[ 0 ], b[ 1 ] );
+        __m128i b23_lo = _mm_unpacklo_epi8( b[ 2 ], b[ 3 ] );
+        __m128i b23_hi = _mm_unpackhi_epi8( b[ 2 ], b[ 3 ] );
+        _mm_storeu_si128( (__m128i*)( out + i +  0 ), _mm_unpacklo_epi16( b01_lo, b23_lo ) );
+        _mm_storeu_si128( (__m128i*)( out + i +  4 ), _mm_unpackhi_epi16( b01_lo, b23_lo ) );
+        _mm_storeu_si128( (__m128i*)( out + i +  8 ), _mm_unpacklo_epi16( b01_hi, b23_hi ) );
+        _mm_storeu_si128( (__m128i*)( out + i + 12 ), _mm_unpackhi_epi16( b01_hi, b23_hi ) );
+        }
+    system_expand_scalar( out + i, pixels + i, count - i, palette );
+    }
+
+
+SYSTEM_TARGET( "avx2" )
+static void system_expand_avx2( uint32_t* out, uint8_t const* pixels, int count, system_palette_t const* palette )
+    {
+    // vpshufb looks up within each 128-bit lane, so both lanes get the same tables
+    __m256i lo[ 4 ];
+    __m256i hi[ 4 ];
+    for( int p = 0; p < 4; ++p )
+        {
+        lo[ p ] = _mm256_broadcastsi128_si256( _mm_loadu_si128( (__m128i const*) palette->planes[ p ] ) );
+        hi[ p ] = _mm256_broadcastsi128_si256( _mm_loadu_si128( (__m128i const*) ( palette->planes[ p ] + 16 ) ) );
+        }
+    __m256i mask = _mm256_set1_epi8( 31 );
+    __m256i fifteen = _mm256_set1_epi8( 15 );
+
+    int i = 0;
+    for( ; i + 32 <= count; i += 32 )
+        {
+        __m256i index = _mm256_and_si256( _mm256_loadu_si256( (__m256i const*)( pixels + i ) ), mask );
+        __m256i high = _mm256_cmpgt_epi8( index, fifteen );
+        __m256i b[ 4 ];
+        for( int p = 0; p < 4; ++p )
+            b[ p ] = SYSTEM_EXPAND_PLANE( _mm256_shuffle_epi8, _mm256_and_si256, _mm256_andnot_si256, _mm256_or_si256, lo[ p ], hi[ p ], index, high );
+
+        // Unpacking works within lanes, so this gives pixels 0-3 and 16-19 in q0, 4-7 and 20-23 in q1, and so on
+        __m256i b01_lo = _mm256_unpacklo_epi8( b[ 0 ], b[ 1 ] );
+        __m256i b01_hi = _mm256_unpackhi_epi8( b[ 0 ], b[ 1 ] );
+        __m256i b23_lo = _mm256_unpacklo_epi8( b[ 2 ], b[ 3 ] );
+        __m256i b23_hi = _mm256_unpackhi_epi8( b[ 2 ], b[ 3 ] );
+        __m256i q0 = _mm256_unpacklo_epi16( b01_lo, b23_lo );
+        __m256i q1 = _mm256_unpackhi_epi16( b01_lo, b23_lo );
+        __m256i q2 = _mm256_unpacklo_epi16( b01_hi, b23_hi );
+        __m256i q3 = _mm256_unpackhi_epi16( b01_hi, b23_hi );
+        _mm256_storeu_si256( (__m256i*)( out + i +  0 ), _mm256_permute2x128_si256( q0, q1, 0x20 ) );
+        _mm256_storeu_si256( (__m256i*)( out + i +  8 ), _mm256_permute2x128_si256( q2, q3, 0x20 ) );
+        _mm256_storeu_si256( (__m256i*)( out + i + 16 ), _mm256_permute2x128_si256( q0, q1, 0x31 ) );
+        _mm256_storeu_si256( (__m256i*)( out + i + 24 ), _mm256_permute2x128_si256( q2, q3, 0x31 ) );
+        }
+    system_expand_scalar( out + i, pixels + i, count - i, palette );
+    }
+
+
+// With more than 32 colors, the palette is too big for shuffles, so it is looked up with gathers instead
+SYSTEM_TARGET( "avx2" )
+static void system_expand_avx2_256( uint32_t* out, uint8_t const* pixels, int count, system_palette_t const* palette )
+    {
+    int i = 0;
+    for( ; i + 8 <= count; i += 8 )
+        {
+        __m256i index = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (__m128i const*)( pixels + i ) ) );
+        _mm256_storeu_si256( (__m256i*)( out + i ), _mm256_i32gather_epi32( (int const*) palette->xbgr, index, 4 ) );
+        }
+    system_expand_scalar_256( out + i, pixels + i, count - i, palette );
+    }
+
+#endif /* SYSTEM_SIMD */
+
+
+static system_expand_func_t system_select_expand( int colors )
+    {
+    #ifdef SYSTEM_SIMD
+        #ifdef _MSC_VER
+            int info[ 4 ];
+            __cpuid( info, 0 );
+            int max_leaf = info[ 0 ];
+            __cpuid( info, 1 );
+            bool ssse3 = ( info[ 2 ] & ( 1 << 9 ) ) != 0;
+            bool avx = ( info[ 2 ] & ( 1 << 27 ) ) && ( info[ 2 ] & ( 1 << 28 ) ) && ( _xgetbv( 0 ) & 6 ) == 6;
+            bool avx2 = false;
+            if( avx && max_leaf >= 7 )
+                {
+                __cpuidex( info, 7, 0 );
+                avx2 = ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+                }
+        #else
+            __builtin_cpu_init();
+            bool ssse3 = __builtin_cpu_supports( "ssse3" ) != 0;
+            bool avx2 = __builtin_cpu_supports( "avx2" ) != 0;
+        #endif
+        if( colors > 32 ) return avx2 ? system_expand_avx2_256 : system_expand_scalar_256;
+        if( avx2 ) return system_expand_avx2;
+        if( ssse3 ) return system_expand_ssse3;
+    #endif
+    return colors > 32 ? system_expand_scalar_256 : system_expand_scalar;
+    }
+
+
+// Builds the opaque spans of a sprite, after its pixels have been set up. Pixels which are non-zero in transparent, 
+// which is the same size as the sprite, are left out.
+static void system_compile_sprite( system_t::sprite_data_t* data, uint8_t const* transparent )
+    {
+    int count = 0;
+    for( int y = 0; y < data->height; ++y )
+        {
+        uint8_t const* row = transparent + y * data->width;
+        for( int x = 0; x < data->width; ++x )
+            if( !row[ x ] && ( x == 0 || row[ x - 1 ] ) ) ++count;
+        }
+
+    data->spans = (system_t::sprite_data_t::span_t*) malloc( sizeof( *data->spans ) * ( count > 0 ? count : 1 ) );
+    data->row_spans = (int*) malloc( sizeof( *data->row_spans ) * ( data->height + 1 ) );
+    int index = 0;
+    for( int y = 0; y < data->height; ++y )
+        {
+        data->row_spans[ y ] = index;
+        uint8_t const* row = transparent + y * data->width;
+        int x = 0;
+        while( x < data->width )
+            {
+            while( x < data->width && row[ x ] ) ++x;
+            int start = x;
+            while( x < data->width && !row[ x ] ) ++x;
+            if( x > start )
+                {
+                data->spans[ index ].start = start;
+                data->spans[ index ].length = x - start;
+                ++index;
+                }
+            }
+        }
+    data->row_spans[ data->height ] = index;
+
+    data->mask_words = ( data->width + 63 ) / 64;
+    data->masks = (uint64_t*) malloc( sizeof( *data->masks ) * ( data->mask_words * data->height > 0 ? data->mask_words * data->height : 1 ) );
+    memset( data->masks, 0, sizeof( *data->masks ) * data->mask_words * data->height );
+    for( int y = 0; y < data->height; ++y )
+        {
+        uint64_t* words = data->masks + y * data->mask_words;
+        for( int i = data->row_spans[ y ]; i < data->row_spans[ y + 1 ]; ++i )
+            for( int x = data->spans[ i ].start; x < data->spans[ i ].start + data->spans[ i ].length; ++x )
+                words[ x / 64 ] |= 1ull << ( x % 64 );
+        }
+    }
+
+
+static void system_free_sprite_data( system_t::sprite_data_t* data )
+    {
+    if( data->pixels ) free( data->pixels );
+    if( data->spans ) free( data->spans );
+    if( data->row_spans ) free( data->row_spans );
+    if( data->masks ) free( data->masks );
+    data->pixels = NULL;
+    data->spans = NULL;
+    data->row_spans = NULL;
+    data->masks = NULL;
+    data->mask_words = 0;
+    data->width = 0;
+    data->height = 0;
+    }
+
+
+// Draws one row of a sprite to out, which is where the sprite's left edge goes. Each span is clipped to the visible
+// columns x0 to x1 of the sprite, and then copied as a whole.
+static void system_blit_sprite_row( uint8_t* out, system_t::sprite_data_t const* data, int row, int x0, int x1 )
+    {
+    uint8_t const* pixels = data->pixels + row * data->width;
+    for( int i = data->row_spans[ row ]; i < data->row_spans[ row + 1 ]; ++i )
+        {
+        int start = data->spans[ i ].start;
+        int end = start + data->spans[ i ].length;
+        start = start < x0 ? x0 : start;
+        end = end > x1 ? x1 : end;
+        if( end > start ) memcpy( out + start, pixels + start, (size_t)( end - start ) );
+        }
+    }
+
+
+// Draws a sprite onto the screen, clipped to its edges
+static void system_blit_sprite( system_t* system, system_t::sprite_data_t const* data, int x, int y )
+    {
+    int y0 = y < 0 ? -y : 0;
+    int y1 = y + data->height > system->screen_height ? system->screen_height - y : data->height;
+    int x0 = x < 0 ? -x : 0;
+    int x1 = x + data->width > system->screen_width ? system->screen_width - x : data->width;
+    if( x0 >= x1 ) return;
+
+    for( int row = y0; row < y1; ++row )
+        system_blit_sprite_row( system_screen_row( system, y + row ) + x, data, row, x0, x1 );
+    }
+
+
+static void system_build_glyphs( system_t* system )
+    {
+    for( int i = 0; i < 256; ++i )
+        {
+        uint64_t bytes = 0;
+        for( int j = 0; j < 8; ++j )
+            if( i & ( 1 << j ) ) bytes |= 0xffull << ( j * 8 );
+        system->glyph_bytes[ i ] = bytes;
+        }
+
+    for( int attr = 0; attr < 4; ++attr )
+        {
+        bool shaded = ( attr & 1 ) != 0;
+        bool underline = ( attr & 2 ) != 0;
+        for( int c = 0; c < 256; ++c )
+            {
+            for( int iy = 0; iy < 8; ++iy )
+                {
+                uint8_t row = (uint8_t)( default_font[ c ] >> ( iy * 8 ) );
+                if( shaded ) row &= ( iy & 1 ) ? 0x55 : 0xaa;
+                if( underline && iy == 7 ) row = 0xff;
+                system->glyph_rows[ attr ][ c ][ iy ] = row;
+                }
+            }
+        }
+    }
+
+
+// Draws count characters of str as 8x8 glyphs along a row of text at out, one row of pixels at a time. There is a 
+// version for each write mode, so the mode is not tested per pixel, and the 8 pixels of a glyph row are done at once.
+template< int MODE > static void system_write_glyphs( uint8_t* out, int stride, uint8_t const* str, int count, 
+    uint8_t const (*glyphs)[ 8 ], uint64_t const* glyph_bytes, uint64_t pen, uint64_t paper )
+    {
+    for( int iy = 0; iy < 8; ++iy, out += stride )
+        {
+        for( int i = 0; i < count; ++i )
+            {
+            uint64_t mask = glyph_bytes[ glyphs[ str[ i ] ][ iy ] ];
+            uint64_t col = ( pen & mask ) | ( paper & ~mask );
+            uint64_t pixels;
+            if( MODE != 1 ) memcpy( &pixels, out + i * 8, sizeof( pixels ) );
+            switch( MODE )
+                {
+                case 1: pixels = col; break;
+                case 2: pixels |= col; break;
+                case 3: pixels ^= col; break;
+                case 4: pixels &= col; break;
+                }
+            memcpy( out + i * 8, &pixels, sizeof( pixels ) );
+            }
+        }
+    }
+
+
 int speech_thread( void* user_data )
     {
     system_t* system = (system_t*) user_data;
@@ -282,8 +803,11 @@ system_t* system_create( vm_context_t* vm, int sound_buffer_size )
     system->paper = 0;
     system->write_mode = 1;
     system->current_song = 0;
-    memcpy( system->palette, default_palette, sizeof( system->palette ) );
-    memset( system->charmap, ' ', sizeof( system->charmap ) );
+    system_build_glyphs( system );
+    thread_signal_init( &system->render_done );
+    system_screen( system, 320, 200, 32 );
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        system->sprite_order[ i ].index = SYSTEM_SPRITE_COUNT - i - 1;
     
     system->sound_buffer_size = sound_buffer_size;
     system->mix_buffers = (int16_t*) malloc( sizeof( int16_t ) * sound_buffer_size * 2 * 6 ); // 6 buffers (song, speech + 4 sounds)
@@ -301,6 +825,21 @@ system_t* system_create( vm_context_t* vm, int sound_buffer_size )
 
 void system_destroy( system_t* system )
     {
+    system_render_threads( system, 1 );
+    thread_signal_term( &system->render_done );
+    for( int i = 0; i < SYSTEM_SCREEN_PAGES; ++i )
+        {
+        free( system->pages[ i ].screen );
+        free( system->pages[ i ].charmap );
+        }
+    free( system->band );
+    free( system->out_screen_xbgr );
+    free( system->dirty_rows );
+    free( system->render_frame.bucket_counts );
+    free( system->render_frame.buckets );
+    free( system->final_screen );
+    free( system->map.tiles );
+
     thread_mutex_lock( &system->song_mutex );
     system->current_song = 0;
     for( int i = 0 ; i < sizeof( system->songs ) / sizeof( *system->songs ); ++i )
@@ -322,8 +861,14 @@ void system_destroy( system_t* system )
     free( system->mix_buffers );
 
     for( int i = 0; i < sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ); ++i )
-        if( system->sprite_data[ i ].pixels )
-            free( system->sprite_data[ i ].pixels );
+        system_free_sprite_data( &system->sprite_data[ i ] );
+
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        {
+        free( system->anim.frames[ i ] );
+        free( system->move_x.frames[ i ] );
+        free( system->move_y.frames[ i ] );
+        }
 
     for( int i = 0; i < sizeof( system->sound_data ) /  sizeof( *system->sound_data ); ++i )
         if( system->sound_data[ i ].sample_pairs )
@@ -333,138 +878,128 @@ void system_destroy( system_t* system )
     }
 
 
-void system_update_sprites( system_t* system )
+static bool system_sprite_active( system_t* system, int index )
     {
-    // Animate sprites
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+    if( system->anim.frame_count[ index ] && system->anim.running[ index ] ) return true;
+    return system->sprites.moving[ index ] && ( system->move_x.frame_count[ index ] || system->move_y.frame_count[ index ] );
+    }
+
+
+static void system_step_anim( system_t* system, int index )
+    {
+    system_t::anim_t* anim = &system->anim;
+    if( anim->frame_count[ index ] && anim->running[ index ] )
         {
-        system_t::sprite_t* spr = &system->sprites[ i ];
-        system_t::sprite_t::anim_t* anim = &spr->anim;
-        if( anim->frame_count && anim->running )
+        --anim->timer[ index ];
+        if( anim->timer[ index ] <= 0 )
             {
-            --anim->timer;
-            if( anim->timer <= 0 )
+            ++anim->index[ index ];
+            if( anim->index[ index ] >= anim->frame_count[ index ] )
                 {
-                ++anim->index;
-                if( anim->index >= anim->frame_count )
+                if( !anim->loop[ index ] ) 
                     {
-                    if( !anim->loop ) 
-                        {
-                        anim->frame_count = 0;
-                        continue;
-                        }
-                    anim->index = 0;
+                    anim->frame_count[ index ] = 0;
+                    return;
                     }
-                spr->data = anim->frames[ anim->index ].data;
-                if( !system->manual_sprite_update ) spr->draw_data = spr->data;
-                anim->timer = anim->frames[ anim->index ].delay;
+                anim->index[ index ] = 0;
                 }
+            system->sprites.data[ index ] = anim->frames[ index ][ anim->index[ index ] ].data;
+            if( !system->manual_sprite_update ) system->sprites.draw_data[ index ] = system->sprites.data[ index ];
+            anim->timer[ index ] = anim->frames[ index ][ anim->index[ index ] ].delay;
             }
         }
+    }
 
-    // Update X movement
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+
+// Steps one axis of a sprite's movement, which is the same for x and y. Returns true if pos has moved.
+static bool system_step_move( system_t::move_t* move, int index, int* pos )
+    {
+    if( !move->frame_count[ index ] ) return false;
+    --move->timer[ index ];
+    if( move->timer[ index ] > 0 ) return false;
+
+    system_t::move_t::frame_t const* frames = move->frames[ index ];
+    int prev_pos = *pos;
+    *pos += frames[ move->index[ index ] ].step;
+    if( move->pos_used[ index ] )
         {
-        system_t::sprite_t* spr = &system->sprites[ i ];
-        system_t::sprite_t::move_t* move_x = &spr->move_x;
-        if( move_x->frame_count && spr->moving )
+        int pos_value = move->pos_value[ index ];
+        if( ( prev_pos < pos_value && *pos >= pos_value ) || ( prev_pos > pos_value && *pos <= pos_value ) )
             {
-            --move_x->timer;
-            if( move_x->timer <= 0 )
+            if( !move->loop[ index ] ) 
                 {
-                int prev_x = spr->x;
-                spr->x += move_x->frames[ move_x->index ].step;
-                if( !system->manual_sprite_update ) spr->draw_x = spr->x;
-                if( move_x->pos_used )
-                    {
-                    if( ( prev_x < move_x->pos_value && spr->x >= move_x->pos_value ) || ( prev_x > move_x->pos_value && spr->x <= move_x->pos_value ) )
-                        {
-                        if( !move_x->loop ) 
-                            {
-                            move_x->frame_count = 0;
-                            continue;
-                            }
-                        move_x->index = 0;
-                        move_x->timer = move_x->frames[ move_x->index ].speed;
-                        move_x->count = move_x->frames[ move_x->index ].count;
-                        continue;
-                        }
-                    }
-                move_x->timer = move_x->frames[ move_x->index ].speed;
-                if( move_x->count )
-                    {
-                    --move_x->count;
-                    if( move_x->count <= 0 )
-                        {
-                        ++move_x->index;
-                        if( move_x->index >= move_x->frame_count )
-                            {
-                            if( !move_x->loop ) 
-                                {
-                                move_x->frame_count = 0;
-                                continue;
-                                }
-                            move_x->index = 0;
-                            }
-                        move_x->timer = move_x->frames[ move_x->index ].speed;
-                        move_x->count = move_x->frames[ move_x->index ].count;
-                        }
-                    }
+                move->frame_count[ index ] = 0;
+                return true;
                 }
+            move->index[ index ] = 0;
+            move->timer[ index ] = frames[ 0 ].speed;
+            move->count[ index ] = frames[ 0 ].count;
+            return true;
             }
         }
-    
-    // Update Y movement
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+    move->timer[ index ] = frames[ move->index[ index ] ].speed;
+    if( move->count[ index ] )
         {
-        system_t::sprite_t* spr = &system->sprites[ i ];
-        system_t::sprite_t::move_t* move_y = &spr->move_y;
-        if( move_y->frame_count && spr->moving )
+        --move->count[ index ];
+        if( move->count[ index ] <= 0 )
             {
-            --move_y->timer;
-            if( move_y->timer <= 0 )
+            ++move->index[ index ];
+            if( move->index[ index ] >= move->frame_count[ index ] )
                 {
-                int prev_y = spr->y;
-                spr->y += move_y->frames[ move_y->index ].step;
-                if( !system->manual_sprite_update ) spr->draw_y = spr->y;
-                if( move_y->pos_used )
+                if( !move->loop[ index ] ) 
                     {
-                    if( ( prev_y < move_y->pos_value && spr->y >= move_y->pos_value ) || ( prev_y > move_y->pos_value && spr->y <= move_y->pos_value ) )
-                        {
-                        if( !move_y->loop ) 
-                            {
-                            move_y->frame_count = 0;
-                            continue;
-                            }
-                        move_y->index = 0;
-                        move_y->timer = move_y->frames[ move_y->index ].speed;
-                        move_y->count = move_y->frames[ move_y->index ].count;
-                        continue;
-                        }
-                    }
-                move_y->timer = move_y->frames[ move_y->index ].speed;
-                if( move_y->count )
-                    {
-                    --move_y->count;
-                    if( move_y->count <= 0 )
-                        {
-                        ++move_y->index;
-                        if( move_y->index >= move_y->frame_count )
-                            {
-                            if( !move_y->loop ) 
-                                {
-                                move_y->frame_count = 0;
-                                continue;
-                                }
-                            move_y->index = 0;
-                            }
-                        move_y->timer = move_y->frames[ move_y->index ].speed;
-                        move_y->count = move_y->frames[ move_y->index ].count;
-                        }
+                    move->frame_count[ index ] = 0;
+                    return true;
                     }
+                move->index[ index ] = 0;
+                }
+            move->timer[ index ] = frames[ move->index[ index ] ].speed;
+            move->count[ index ] = frames[ move->index[ index ] ].count;
+            }
+        }
+    return true;
+    }
+
+
+void system_update_sprites( system_t* system )
+    {
+    if( !system->active_sprites_valid )
+        {
+        system->active_sprite_count = 0;
+        for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+            if( system_sprite_active( system, i ) ) system->active_sprites[ system->active_sprite_count++ ] = (uint8_t) i;
+        system->active_sprites_valid = true;
+        }
+    if( system->active_sprite_count == 0 ) return;
+    system->collide_grid_valid = false;
+
+    // Animate and move each sprite in one go, keeping the ones which still have a script running
+    system_t::sprites_t* spr = &system->sprites;
+    bool const manual_update = system->manual_sprite_update;
+    int const active_count = system->active_sprite_count;
+    int count = 0;
+    for( int i = 0; i < active_count; ++i )
+        {
+        int index = system->active_sprites[ i ];
+        system_step_anim( system, index );
+        if( spr->moving[ index ] )
+            {
+            int x = spr->x[ index ];
+            int y = spr->y[ index ];
+            if( system_step_move( &system->move_x, index, &x ) )
+                {
+                spr->x[ index ] = x;
+                if( !manual_update ) spr->draw_x[ index ] = x;
+                }
+            if( system_step_move( &system->move_y, index, &y ) )
+                {
+                spr->y[ index ] = y;
+                if( !manual_update ) spr->draw_y[ index ] = y;
                 }
             }
+        if( system_sprite_active( system, index ) ) system->active_sprites[ count++ ] = (uint8_t) index;
         }
+    system->active_sprite_count = count;
     }
 
 
@@ -472,6 +1007,19 @@ void system_update( system_t* system, uint64_t delta_time_us, char const* input_
     {
     system->time_us += delta_time_us;
 
+    // Sample string pool activity once per second, for STRSTATS
+    if( system->time_us - system->strstats_time_us >= 1000000 )
+        {
+        vm_string_stats_t stats;
+        vm_string_stats( system->vm, &stats );
+        uint64_t elapsed_us = system->time_us - system->strstats_time_us;
+        system->strstats_inject_rate = (int)( ( stats.injects - system->strstats_injects ) * 1000000ull / elapsed_us );
+        system->strstats_discard_rate = (int)( ( stats.discards - system->strstats_discards ) * 1000000ull / elapsed_us );
+        system->strstats_injects = stats.injects;
+        system->strstats_discards = stats.discards;
+        system->strstats_time_us = system->time_us;
+        }
+
     // Resume VM at vertical blank refresh (if waiting for vertical blank)
     if( system->wait_vbl )
         {
@@ -491,6 +1039,7 @@ void system_update( system_t* system, uint64_t delta_time_us, char const* input_
                 system_cdown( system );
                 system->input_mode = false;
                 ret_cast<char const*> r( system->vm, (char const*) system->input_str ); 
+                vm_string_release( system->vm, system->vm->sp[ -1 ] ); // The empty string returned by INPUT()
                 system->vm->sp[ -1 ] = r.operator u32();
                 strcpy( system->input_str, "" );
                 if( !system->wait_vbl )
@@ -503,7 +1052,7 @@ void system_update( system_t* system, uint64_t delta_time_us, char const* input_
                     system->input_str[ strlen( system->input_str ) - 1 ] = '\0'; 
                     if( system->cursor_x == 0 )
                         {
-                        system->cursor_x = 39;
+                        system->cursor_x = system->text_width - 1;
                         system->cursor_y --;
                         }
                     else
@@ -512,8 +1061,8 @@ void system_update( system_t* system, uint64_t delta_time_us, char const* input_
                         }
 
                     for( int iy = 0; iy < 8; ++iy ) 
-                        for( int ix = 0; ix < 8; ++ix ) 
-                            system->screen[ system->cursor_x * 8 + ix + ( system->cursor_y * 8 + iy ) * 320 ] = (uint8_t)( system->paper & 31 );
+                        memset( system_screen_row( system, system->cursor_y * 8 + iy ) + system->cursor_x * 8, system->paper, 8 );
+                    system_mark_dirty( system, system->cursor_y * 8, 8 );
                     }
                 }
             else if( strlen( system->input_str ) < 255 )
@@ -533,90 +1082,341 @@ void system_update( system_t* system, uint64_t delta_time_us, char const* input_
     }
 
 
-static int system_priority_compare_func( system_t::sprite_order_t const& a, system_t::sprite_order_t const& b ) 
+// Sprites with priority are drawn in order of y position, and sprites at the same y position in the same order as 
+// without priority, which is highest index first
+static bool system_priority_before( system_t::sprite_order_t const& a, system_t::sprite_order_t const& b ) 
+    {
+    return a.ypos < b.ypos || ( a.ypos == b.ypos && a.index > b.index );
+    }
+
+
+// Marks the rows under something drawn on top of the screen as dirty, if it is not the same as in the last frame
+static void system_update_drawn( system_t* system, system_t::drawn_t* drawn, system_t::drawn_t const* current )
+    {
+    if( drawn->x != current->x || drawn->y != current->y || drawn->height != current->height || drawn->data != current->data )
+        {
+        system_mark_dirty( system, drawn->y, drawn->height );
+        system_mark_dirty( system, current->y, current->height );
+        *drawn = *current;
+        }
+    }
+
+
+// Draws a row of a sprite which is not clipped 8 pixels at a time, using its opaque bits to select the pixels drawn. The 
+// bits are turned into byte masks by looking up glyph_bytes. The spans are used for any pixels left over.
+static void system_blend_sprite_row( uint8_t* out, system_t::sprite_data_t const* data, int row, uint64_t const* glyph_bytes )
+    {
+    uint8_t const* pixels = data->pixels + row * data->width;
+    uint64_t const* bits = data->masks + row * data->mask_words;
+    int const groups = data->width / 8;
+    for( int i = 0; i < groups; ++i )
+        {
+        uint64_t mask = glyph_bytes[ ( bits[ i / 8 ] >> ( i % 8 * 8 ) ) & 0xff ];
+        if( !mask ) continue;
+        uint64_t src;
+        uint64_t dst;
+        memcpy( &src, pixels + i * 8, sizeof( src ) );
+        memcpy( &dst, out + i * 8, sizeof( dst ) );
+        dst = ( dst & ~mask ) | ( src & mask );
+        memcpy( out + i * 8, &dst, sizeof( dst ) );
+        }
+    if( groups * 8 < data->width ) system_blit_sprite_row( out, data, row, groups * 8, data->width );
+    }
+
+
+// Draws the tiles of the map which cover row y of the screen into out, clipped to the tile size and the screen. Most 
+// tiles are fully on the screen, and are blended from their opaque bits, and the ones at the edges are drawn from spans.
+static void system_draw_map_row( system_t* system, uint8_t* out, int y )
+    {
+    system_t::map_t const* map = &system->map;
+    int const width = system->screen_width;
+    int const map_y = ( y + map->scroll_y ) % ( map->rows * map->tile_height );
+    int const tile_row = map_y % map->tile_height;
+    uint16_t const* tiles = map->tiles + ( map_y / map->tile_height ) * map->columns;
+    int column = map->scroll_x / map->tile_width;
+    for( int x = -( map->scroll_x % map->tile_width ); x < width; x += map->tile_width )
+        {
+        int data_index = tiles[ column ];
+        if( ++column == map->columns ) column = 0;
+        if( !data_index ) continue;
+        system_t::sprite_data_t const* data = &system->sprite_data[ data_index - 1 ];
+        if( !data->pixels || tile_row >= data->height ) continue;
+        int x0 = x < 0 ? -x : 0;
+        int x1 = data->width < map->tile_width ? data->width : map->tile_width;
+        x1 = x + x1 > width ? width - x : x1;
+        if( x0 == 0 && x1 == data->width )
+            system_blend_sprite_row( out + x, data, tile_row, system->glyph_bytes );
+        else if( x1 > x0 ) 
+            system_blit_sprite_row( out + x, data, tile_row, x0, x1 );
+        }
+    }
+
+
+// Composes the changed rows of a band in lines, with cursor and sprites on top of the screen contents, and converts them
+// straight into out_screen_xbgr. A band is small enough to stay in cache between composing and converting, so there is
+// no full size copy of the screen.
+static void system_render_band( system_t* system, int band, uint8_t* lines )
+    {
+    system_t::render_frame_t const* frame = &system->render_frame;
+    system_t::drawn_t const* cursor = &frame->cursor;
+    int const width = system->screen_width;
+    int const top = band * SYSTEM_BAND_HEIGHT;
+    int const bottom = top + SYSTEM_BAND_HEIGHT < system->screen_height ? top + SYSTEM_BAND_HEIGHT : system->screen_height;
+    bool dirty = false;
+    for( int y = top; y < bottom; ++y )
+        {
+        if( !system->dirty_rows[ y ] ) continue;
+        dirty = true;
+        memcpy( lines + ( y - top ) * width, system_display_row( system, y ), (size_t) width );
+        if( system->map.tiles )
+            system_draw_map_row( system, lines + ( y - top ) * width, y );
+        if( y >= cursor->y && y < cursor->y + cursor->height )
+            memset( lines + ( y - top ) * width + cursor->x, cursor->data, 8 );
+        }
+    if( !dirty ) return;
+
+    // Sprites are drawn a whole sprite at a time rather than a row at a time, which keeps reading their spans and 
+    // pixels sequential
+    for( int i = 0; i < frame->bucket_counts[ band ]; ++i )
+        {
+        system_t::render_frame_t::visible_t const* spr = &frame->visible[ frame->buckets[ band ][ i ] ];
+        int y0 = spr->y > top ? spr->y : top;
+        int y1 = spr->y + spr->data->height < bottom ? spr->y + spr->data->height : bottom;
+        for( int y = y0; y < y1; ++y )
+            if( system->dirty_rows[ y ] )
+                system_blit_sprite_row( lines + ( y - top ) * width + spr->x, spr->data, y - spr->y, spr->x0, spr->x1 );
+        }
+
+    for( int y = top; y < bottom; ++y )
+        {
+        if( !system->dirty_rows[ y ] ) continue;
+        system->expand_pixels( system->out_screen_xbgr + system->border_width + ( y + system->border_height ) * system->out_width, 
+            lines + ( y - top ) * width, width, &system->render_palette );
+        if( system->final_screen )
+            memcpy( system->final_screen + y * width, lines + ( y - top ) * width, (size_t) width );
+        }
+    }
+
+
+// Takes bands to render until there are none left
+static void system_render_bands( system_t* system, uint8_t* lines )
+    {
+    for( int band = thread_atomic_int_inc( &system->render_next_band ); band < system->band_count; 
+        band = thread_atomic_int_inc( &system->render_next_band ) )
+        {
+        system_render_band( system, band, lines );
+        }
+    }
+
+
+static int system_render_worker( void* user_data )
     {
-    if( a.ypos < b.ypos ) return -1;
-    else if( a.ypos > b.ypos ) return 1;
-    else return 0;
+    system_t::render_worker_t* worker = (system_t::render_worker_t*) user_data;
+    system_t* system = worker->system;
+    for( ; ; )
+        {
+        thread_signal_wait( &worker->start, THREAD_SIGNAL_WAIT_INFINITE );
+        if( thread_atomic_int_load( &system->render_exit ) ) break;
+        system_render_bands( system, worker->band );
+        if( thread_atomic_int_dec( &system->render_busy_workers ) == 1 ) 
+            thread_signal_raise( &system->render_done );
+        }
+    return 0;
     }
 
 
 uint32_t* system_render_screen( system_t* system, int* width, int* height )
     {
-    // Convert palette
-    APP_U32 palette[ 32 ] = { 0 };
-    for( int i = 0; i < 32; ++i )
+    // Convert palette, only when it has changed. That affects every pixel, including the border, so the whole frame
+    // is redrawn
+    system_palette_t* palette = &system->render_palette;
+    bool full_redraw = system->full_redraw;
+    if( full_redraw )
         {
-        unsigned short p = system->palette[ i ];
-        u32 b = ( p )      & 0x7u;
-        u32 g = ( p >> 4 ) & 0x7u;
-        u32 r = ( p >> 8 ) & 0x7u;
-        b = b * 36;
-        g = g * 36;
-        r = r * 36;
-        palette[ i ] = ( b << 16 ) | ( g << 8 ) | r;
+        for( int i = 0; i < 256; ++i )
+            {
+            unsigned short p = system->palette[ i ];
+            u32 b = ( p )      & 0x7u;
+            u32 g = ( p >> 4 ) & 0x7u;
+            u32 r = ( p >> 8 ) & 0x7u;
+            b = b * 36;
+            g = g * 36;
+            r = r * 36;
+            palette->xbgr[ i ] = ( b << 16 ) | ( g << 8 ) | r;
+            }
+        for( int i = 0; i < 32; ++i )
+            for( int j = 0; j < 4; ++j ) palette->planes[ j ][ i ] = (uint8_t)( palette->xbgr[ i ] >> ( j * 8 ) );
+        memset( system->dirty_rows, 1, (size_t) system->screen_height );
+        system->full_redraw = false;
         }
 
-    // Make a copy of the screen so we can draw cursor and sprites on top of it
-    memcpy( system->final_screen, system->screen, sizeof( system->screen ) );
-    
-    // Draw cursor
+    // Where the cursor is drawn, or was drawn last frame, the rows need recomposing if it has changed
+    system_t::drawn_t cursor = { 0, 0, 0, 0 };
     if( system->show_cursor && ( system->time_us % 1000000 ) < 500000 )
         {
-        for( int iy = 0; iy < 8; ++iy ) 
-            for( int ix = 0; ix < 8; ++ix )
-                if( iy + 1 >= system->cursor_top && iy + 1 <= system->cursor_base )
-                    system->final_screen[ system->cursor_x * 8 + ix + ( system->cursor_y * 8 + iy ) * 320 ] = (uint8_t)( system->pen & 31 );
+        cursor.x = system->cursor_x * 8;
+        cursor.y = system->cursor_y * 8 + system->cursor_top - 1;
+        cursor.height = system->cursor_base - system->cursor_top + 1;
+        cursor.data = system->pen;
+        }
+    system_update_drawn( system, &system->drawn_cursor, &cursor );
+
+    // Sort sprites. The order is kept from the last frame, and as sprites rarely pass each other, an insertion sort 
+    // of it is mostly a single pass
+    int const sprite_count = SYSTEM_SPRITE_COUNT;
+    if( system->ypos_priority ) 
+        {
+        for( int i = 0; i < sprite_count; ++i )
+            system->sprite_order[ i ].ypos = system->sprites.draw_y[ system->sprite_order[ i ].index ];
+        for( int i = 1; i < sprite_count; ++i )
+            {
+            system_t::sprite_order_t item = system->sprite_order[ i ];
+            int j = i;
+            for( ; j > 0 && system_priority_before( item, system->sprite_order[ j - 1 ] ); --j )
+                system->sprite_order[ j ] = system->sprite_order[ j - 1 ];
+            system->sprite_order[ j ] = item;
+            }
+        }
+    else
+        {
+        for( int i = 0; i < sprite_count; ++i )
+            {
+            system->sprite_order[ i ].index = sprite_count - i - 1;
+            system->sprite_order[ i ].ypos = system->sprites.draw_y[ sprite_count - i - 1 ];
+            }
+        }
+
+    // Same for sprites which have moved, or changed image
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        {
+        system_t::drawn_t sprite = { 0, 0, 0, 0 };
+        int data_index = system->sprites.draw_data[ i ];
+        if( data_index >= 1 && data_index <= sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ) && system->sprite_data[ data_index - 1 ].pixels )
+            {
+            sprite.x = system->sprites.draw_x[ i ];
+            sprite.y = system->sprites.draw_y[ i ];
+            sprite.height = system->sprite_data[ data_index - 1 ].height;
+            sprite.data = data_index;
+            }
+        if( system->sprites_changed ) 
+            {
+            system_mark_dirty( system, system->drawn_sprites[ i ].y, system->drawn_sprites[ i ].height );
+            system_mark_dirty( system, sprite.y, sprite.height );
+            }
+        system_update_drawn( system, &system->drawn_sprites[ i ], &sprite );
+        }
+    system->sprites_changed = false;
+
+    // Clip the visible sprites, in draw order, and put them into buckets for each band of rows, so that each band only
+    // looks at the sprites which might cover it
+    system_t::render_frame_t* frame = &system->render_frame;
+    frame->cursor = cursor;
+    memset( frame->bucket_counts, 0, sizeof( *frame->bucket_counts ) * system->band_count );
+    int visible_count = 0;
+    for( int i = 0; i < sprite_count; ++i )
+        {
+        system_t::drawn_t const* drawn = &system->drawn_sprites[ system->sprite_order[ i ].index ];
+        if( !drawn->data ) continue;
+        system_t::render_frame_t::visible_t* spr = &frame->visible[ visible_count ];
+        spr->data = &system->sprite_data[ drawn->data - 1 ];
+        spr->x = drawn->x;
+        spr->y = drawn->y;
+        spr->x0 = drawn->x < 0 ? -drawn->x : 0;
+        spr->x1 = drawn->x + spr->data->width > system->screen_width ? system->screen_width - drawn->x : spr->data->width;
+        int y0 = drawn->y < 0 ? 0 : drawn->y;
+        int y1 = drawn->y + drawn->height > system->screen_height ? system->screen_height : drawn->y + drawn->height;
+        if( spr->x0 >= spr->x1 || y0 >= y1 ) continue;
+        for( int band = y0 / SYSTEM_BAND_HEIGHT; band <= ( y1 - 1 ) / SYSTEM_BAND_HEIGHT; ++band )
+            frame->buckets[ band ][ frame->bucket_counts[ band ]++ ] = (uint8_t) visible_count;
+        ++visible_count;
+        }
+
+    // Render screen
+    if( full_redraw )
+        {
+        for( int i = 0; i < system->out_width * system->out_height; ++i )
+            system->out_screen_xbgr[ i ] = palette->xbgr[ 0 ];
         }
 
-    // Draw sprites
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+    // Worker threads, if there are any and there is something to do, take bands alongside this thread. Each band is 
+    // only ever written by the thread which took it, so the output is the same however the bands are shared out.
+    thread_atomic_int_store( &system->render_next_band, 0 );
+    if( system->render_worker_count > 0 && memchr( system->dirty_rows, 1, (size_t) system->screen_height ) )
+        {
+        thread_atomic_int_store( &system->render_busy_workers, system->render_worker_count );
+        for( int i = 0; i < system->render_worker_count; ++i )
+            thread_signal_raise( &system->render_workers[ i ].start );
+        system_render_bands( system, system->band );
+        thread_signal_wait( &system->render_done, THREAD_SIGNAL_WAIT_INFINITE );
+        }
+    else
         {
-        int index = (int) ( sizeof( system->sprites ) /  sizeof( *system->sprites ) ) - i - 1;
-        system->sprite_order[ i ].index = index;
-        system->sprite_order[ i ].ypos = system->sprites[ index ].draw_y;
+        system_render_bands( system, system->band );
         }
+    memset( system->dirty_rows, 0, (size_t) system->screen_height );
+
+    *width = system->out_width;
+    *height = system->out_height;
+    return system->out_screen_xbgr;
+    }
+
+
+void system_capture( system_t* system, bool enable )
+    {
+    free( system->final_screen );
+    system->final_screen = NULL;
+    if( enable )
+        {
+        // Everything is recomposed on the next frame, to fill it in
+        system->final_screen = (uint8_t*) malloc( (size_t) system->screen_width * system->screen_height );
+        system->full_redraw = true;
+        }
+    }
+
+
+uint8_t const* system_final_screen( system_t* system, int* width, int* height, uint16_t const** palette )
+    {
+    *width = system->screen_width;
+    *height = system->screen_height;
+    *palette = system->palette;
+    return system->final_screen;
+    }
+
 
-    if( system->ypos_priority ) 
-        sort_ns::sort<system_t::sprite_order_t, system_priority_compare_func>( 
-            system->sprite_order, sizeof( system->sprites ) /  sizeof( *system->sprites ) );
-
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
-        {
-        system_t::sprite_t* spr = &system->sprites[ system->sprite_order[ i ].index ];
-        int data_index = spr->draw_data;
-        if( data_index < 1 || data_index > sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ) ) continue;
-        --data_index;
-        if( !system->sprite_data[ data_index ].pixels ) continue;
-        system_t::sprite_data_t* data = &system->sprite_data[ data_index ];
-        for( int y = 0; y < data->height; ++y )
+void system_render_threads( system_t* system, int thread_count )
+    {
+    if( system->render_worker_count > 0 )
+        {
+        thread_atomic_int_store( &system->render_exit, 1 );
+        for( int i = 0; i < system->render_worker_count; ++i )
+            thread_signal_raise( &system->render_workers[ i ].start );
+        for( int i = 0; i < system->render_worker_count; ++i )
             {
-            for( int x = 0; x < data->width; ++x )
-                {
-                uint8_t p = data->pixels[ x + y * data->width ];
-                if( ( p & 0x80 ) == 0 )
-                    {
-                    int xp = spr->draw_x + x;
-                    int yp = spr->draw_y + y;
-                    if( xp >= 0 && yp >= 0 && xp < 320 && yp < 200 )
-                        system->final_screen[ xp + yp * 320 ] = p  & 31u;                    
-                    }
-                }
+            thread_join( system->render_workers[ i ].thread );
+            thread_destroy( system->render_workers[ i ].thread );
+            thread_signal_term( &system->render_workers[ i ].start );
+            free( system->render_workers[ i ].band );
             }
+        free( system->render_workers );
+        system->render_workers = NULL;
+        system->render_worker_count = 0;
+        thread_atomic_int_store( &system->render_exit, 0 );
         }
 
-    // Render screen
-    for( int y = 0; y < 288; ++y )
-        for( int x = 0; x < 384; ++x )
-            system->out_screen_xbgr[ x + y * 384 ] = palette[ 0 ];
-
-    for( int y = 0; y < 200; ++y )
-        for( int x = 0; x < 320; ++x )
-            system->out_screen_xbgr[ ( x + 32 ) + ( y + 44 ) * 384 ] = palette[ system->final_screen[ x + y * 320 ] & 31 ];
+    // There is no point in more threads than bands
+    thread_count = thread_count > system->band_count ? system->band_count : thread_count;
+    if( thread_count <= 1 ) return;
 
-    *width = 384;
-    *height = 288;
-    return system->out_screen_xbgr;
+    system->render_worker_count = thread_count - 1;
+    system->render_workers = (system_t::render_worker_t*) malloc( sizeof( system_t::render_worker_t ) * system->render_worker_count );
+    for( int i = 0; i < system->render_worker_count; ++i )
+        {
+        system_t::render_worker_t* worker = &system->render_workers[ i ];
+        worker->system = system;
+        worker->band = (uint8_t*) malloc( (size_t) SYSTEM_BAND_HEIGHT * system->screen_width );
+        thread_signal_init( &worker->start );
+        worker->thread = thread_create( system_render_worker, worker, NULL, THREAD_STACK_SIZE_DEFAULT );
+        }
     }
 
 
@@ -699,22 +1499,193 @@ void system_waitvbl( system_t* system )
     {
     vm_pause( system->vm );
     system->wait_vbl = true;
+    vm_idle( system->vm );
+    }
+
+
+int system_strstats( system_t* system, int stat )
+    {
+    if( stat == 3 ) return system->strstats_inject_rate;
+    if( stat == 4 ) return system->strstats_discard_rate;
+
+    vm_string_stats_t stats;
+    vm_string_stats( system->vm, &stats );
+    switch( stat )
+        {
+        case 0: return stats.count;
+        case 1: return stats.bytes_used;
+        case 2: return stats.bytes_free;
+        }
+    return 0;
+    }
+
+
+
+void system_screen( system_t* system, int width, int height, int colors )
+    {
+    if( width < 8 || width > 4096 || ( width & 7 ) || height < 8 || height > 4096 || ( height & 7 ) ) return;
+    if( colors < 2 || colors > 256 || ( colors & ( colors - 1 ) ) ) return;
+
+    system->screen_width = width;
+    system->screen_height = height;
+    system->screen_colors = colors;
+    system->color_mask = colors - 1;
+    system->text_width = width / 8;
+    system->text_height = height / 8;
+    system->border_width = width / 10;
+    system->border_height = height * 11 / 50;
+    system->out_width = width + system->border_width * 2;
+    system->out_height = height + system->border_height * 2;
+    system->band_count = ( height + SYSTEM_BAND_HEIGHT - 1 ) / SYSTEM_BAND_HEIGHT;
+
+    // Back to a single page. The others are allocated at the new size when next used.
+    for( int i = 0; i < SYSTEM_SCREEN_PAGES; ++i )
+        {
+        free( system->pages[ i ].screen );
+        free( system->pages[ i ].charmap );
+        }
+    memset( system->pages, 0, sizeof( system->pages ) );
+    system->logic_page = 0;
+    system->display_page = 0;
+    free( system->band );
+    free( system->out_screen_xbgr );
+    free( system->dirty_rows );
+    free( system->render_frame.bucket_counts );
+    free( system->render_frame.buckets );
+    system->pages[ 0 ].screen = (uint8_t*) malloc( (size_t) width * height );
+    system->pages[ 0 ].charmap = (uint8_t*) malloc( (size_t) system->text_width * system->text_height );
+    system->screen = system->pages[ 0 ].screen;
+    system->charmap = system->pages[ 0 ].charmap;
+    system->band = (uint8_t*) malloc( (size_t) SYSTEM_BAND_HEIGHT * width );
+    system->out_screen_xbgr = (uint32_t*) malloc( sizeof( uint32_t ) * system->out_width * system->out_height );
+    system->dirty_rows = (uint8_t*) malloc( (size_t) height );
+    system->render_frame.bucket_counts = (int*) malloc( sizeof( *system->render_frame.bucket_counts ) * system->band_count );
+    system->render_frame.buckets = (uint8_t (*)[ SYSTEM_SPRITE_COUNT ]) malloc( 
+        sizeof( *system->render_frame.buckets ) * system->band_count );
+    for( int i = 0; i < system->render_worker_count; ++i )
+        {
+        free( system->render_workers[ i ].band );
+        system->render_workers[ i ].band = (uint8_t*) malloc( (size_t) SYSTEM_BAND_HEIGHT * width );
+        }
+    if( system->final_screen )
+        {
+        free( system->final_screen );
+        system->final_screen = (uint8_t*) malloc( (size_t) width * height );
+        }
+
+    // The first 32 colors are the default palette, and the rest of a 256 color palette is a color cube with 8 levels 
+    // of red, 7 of green and 4 of blue
+    memcpy( system->palette, default_palette, sizeof( default_palette ) );
+    for( int i = 32; i < 256; ++i )
+        {
+        int r = ( i - 32 ) / 28;
+        int g = ( ( i - 32 ) / 4 ) % 7 * 7 / 6;
+        int b = ( i - 32 ) % 4 * 7 / 3;
+        system->palette[ i ] = (uint16_t)( ( r << 8 ) | ( g << 4 ) | b );
+        }
+    system->expand_pixels = system_select_expand( colors );
+
+    system->pen &= system->color_mask;
+    system->paper &= system->color_mask;
+    system->cursor_x = 0;
+    system->cursor_y = 0;
+    system->scroll_row = 0;
+    memset( system->screen, system->paper, (size_t) width * height );
+    memset( system->charmap, ' ', (size_t) system->text_width * system->text_height );
+    system->full_redraw = true;
+    system->sprites_changed = true;
+    system->collide_grid_valid = false;
+    }
+
+
+// Allocates a page the first time it is used, cleared to the paper color
+static void system_use_page( system_t* system, int page )
+    {
+    system_t::page_t* p = &system->pages[ page ];
+    if( p->screen ) return;
+    p->screen = (uint8_t*) malloc( (size_t) system->screen_width * system->screen_height );
+    p->charmap = (uint8_t*) malloc( (size_t) system->text_width * system->text_height );
+    p->scroll_row = 0;
+    memset( p->screen, system->paper, (size_t) system->screen_width * system->screen_height );
+    memset( p->charmap, ' ', (size_t) system->text_width * system->text_height );
+    }
+
+
+// Makes page the one drawn to. Only pointers change, the pixels stay where they are.
+static void system_set_logic_page( system_t* system, int page )
+    {
+    system_use_page( system, page );
+    system->pages[ system->logic_page ].scroll_row = system->scroll_row;
+    system->logic_page = page;
+    system->screen = system->pages[ page ].screen;
+    system->charmap = system->pages[ page ].charmap;
+    system->scroll_row = system->pages[ page ].scroll_row;
+    system->collide_grid_valid = false;
     }
 
 
+void system_screen_swap( system_t* system )
+    {
+    int page = system->display_page;
+    if( page == system->logic_page ) page = page + 1 < SYSTEM_SCREEN_PAGES ? page + 1 : 0;
+    system->display_page = system->logic_page;
+    system_set_logic_page( system, page );
+    system_mark_dirty( system, 0, system->screen_height );
+    }
+
+
+void system_screen_copy( system_t* system, int from_page, int to_page )
+    {
+    if( from_page < 1 || from_page > SYSTEM_SCREEN_PAGES || to_page < 1 || to_page > SYSTEM_SCREEN_PAGES ) return;
+    --from_page;
+    --to_page;
+    if( from_page == to_page ) return;
+    system_use_page( system, from_page );
+    system_use_page( system, to_page );
+
+    // The destination takes on the scroll position of the source along with its rows, so the copy is a straight one, 
+    // which memcpy does with the widest loads and stores the cpu has
+    system->pages[ system->logic_page ].scroll_row = system->scroll_row;
+    system_t::page_t const* from = &system->pages[ from_page ];
+    system_t::page_t* to = &system->pages[ to_page ];
+    memcpy( to->screen, from->screen, (size_t) system->screen_width * system->screen_height );
+    memcpy( to->charmap, from->charmap, (size_t) system->text_width * system->text_height );
+    to->scroll_row = from->scroll_row;
+    if( to_page == system->logic_page ) system->scroll_row = to->scroll_row;
+    if( to_page == system->display_page ) system_mark_dirty( system, 0, system->screen_height );
+    }
+
+
+void system_screen_logic( system_t* system, int page )
+    {
+    if( page < 1 || page > SYSTEM_SCREEN_PAGES ) return;
+    system_set_logic_page( system, page - 1 );
+    system_mark_dirty( system, 0, system->screen_height );
+    }
+
+
+void system_screen_display( system_t* system, int page )
+    {
+    if( page < 1 || page > SYSTEM_SCREEN_PAGES ) return;
+    system_use_page( system, page - 1 );
+    system->display_page = page - 1;
+    system_mark_dirty( system, 0, system->screen_height );
+    }
+
 
 void system_cdown( system_t* system )
     {
-    if( system->cursor_y < 24 )
+    if( system->cursor_y < system->text_height - 1 )
         {
         system->cursor_y++;
         }
     else
         {
-        for( int i = 0; i < 40 * 24; ++i ) system->charmap[ i ] = system->charmap[ i + 40 ];
-        for( int i = 40 * 24; i < 40 * 25; ++i ) system->charmap[ i ] = (uint8_t) ' ';
-        for( int i = 0; i < 320 * 192; ++i ) system->screen[ i ] = system->screen[ i + 320 * 8 ];
-        for( int i = 320 * 192; i < 320 * 200; ++i ) system->screen[ i ] = (uint8_t)( system->paper & 31 );
+        // The top row becomes the bottom one
+        system->scroll_row = system->scroll_row + 1 < system->text_height ? system->scroll_row + 1 : 0;
+        memset( system_charmap_row( system, system->text_height - 1 ), ' ', (size_t) system->text_width );
+        memset( system_screen_row( system, system->screen_height - 8 ), system->paper, (size_t) system->screen_width * 8 );
+        system_mark_dirty( system, 0, system->screen_height );
         }
     }
 
@@ -737,14 +1708,14 @@ void system_cleft( system_t* system )
     else if( system->cursor_y > 0 )
         {
         system->cursor_y--;
-        system->cursor_x = 39;
+        system->cursor_x = system->text_width - 1;
         }
     }
 
 
 void system_cright( system_t* system )
     {
-    if( system->cursor_x < 39 )
+    if( system->cursor_x < system->text_width - 1 )
         {
         system->cursor_x++;
         }
@@ -820,20 +1791,20 @@ void system_shade_off( system_t* system )
 
 void system_locate( system_t* system, int x, int y )
     {
-    system->cursor_x = x < 0 ? 0 : x > 39 ? 39 : x;
-    system->cursor_y = y < 0 ? 0 : y > 24 ? 24 : y;
+    system->cursor_x = x < 0 ? 0 : x > system->text_width - 1 ? system->text_width - 1 : x;
+    system->cursor_y = y < 0 ? 0 : y > system->text_height - 1 ? system->text_height - 1 : y;
     }
 
 
 void system_paper( system_t* system, int color )
     {
-    system->paper = color & 31;
+    system->paper = color & system->color_mask;
     }
 
 
 void system_pen( system_t* system, int color )
     {
-    system->pen = color & 31;
+    system->pen = color & system->color_mask;
     }
 
 
@@ -845,44 +1816,46 @@ void system_print( system_t* system, char const* str )
     }
 
 
-void system_write_char( system_t* system, uint8_t c )
+// Writes count characters at the cursor, which must all fit on the current line, without moving the cursor
+static void system_write_run( system_t* system, uint8_t const* str, int count )
     {
-    system->charmap[ system->cursor_x + system->cursor_y * 40 ] = c;
+    memcpy( system_charmap_row( system, system->cursor_y ) + system->cursor_x, str, (size_t) count );
 
-    uint8_t pen = system->text_inverse ? (uint8_t)( system->paper & 31 ) : (uint8_t)( system->pen & 31 );
-    uint8_t paper = system->text_inverse ? (uint8_t)( system->pen & 31 ) : (uint8_t)( system->paper & 31 );
+    uint64_t pen = ( system->text_inverse ? system->paper : system->pen ) * 0x0101010101010101ull;
+    uint64_t paper = ( system->text_inverse ? system->pen : system->paper ) * 0x0101010101010101ull;
+    uint8_t const (*glyphs)[ 8 ] = system->glyph_rows[ ( system->text_shaded ? 1 : 0 ) | ( system->text_underline ? 2 : 0 ) ];
 
-    int x = system->cursor_x * 8;
     int y = system->cursor_y * 8;
-    unsigned long long chr = default_font[ c ];
-    for( int iy = 0; iy < 8; ++iy ) 
+    uint8_t* out = system_screen_row( system, y ) + system->cursor_x * 8; // the 8 rows of a text row are never split
+    switch( system->write_mode )
         {
-        for( int ix = 0; ix < 8; ++ix ) 
-            {
-            uint8_t col;
-            if( chr & ( 1ull << ( ix + iy * 8 ) ) && ( !system->text_shaded || ( ix + iy ) & 1 ) || ( system->text_underline && iy == 7 ) )
-                col = pen;
-            else
-                col = paper;
-            switch( system->write_mode )
-                {
-                case 1: system->screen[ x + ix + ( y + iy ) * 320 ] = col; break;
-                case 2: system->screen[ x + ix + ( y + iy ) * 320 ] |= col; break;
-                case 3: system->screen[ x + ix + ( y + iy ) * 320 ] ^= col; break;
-                case 4: system->screen[ x + ix + ( y + iy ) * 320 ] &= col; break;
-                }
-            }
+        case 1: system_write_glyphs< 1 >( out, system->screen_width, str, count, glyphs, system->glyph_bytes, pen, paper ); break;
+        case 2: system_write_glyphs< 2 >( out, system->screen_width, str, count, glyphs, system->glyph_bytes, pen, paper ); break;
+        case 3: system_write_glyphs< 3 >( out, system->screen_width, str, count, glyphs, system->glyph_bytes, pen, paper ); break;
+        case 4: system_write_glyphs< 4 >( out, system->screen_width, str, count, glyphs, system->glyph_bytes, pen, paper ); break;
         }
+    system_mark_dirty( system, y, 8 );
+    }
+
+
+void system_write_char( system_t* system, uint8_t c )
+    {
+    system_write_run( system, &c, 1 );
     }
 
 
 void system_write( system_t* system, char const* str )
     {
-    for( char const* c = str; *c != 0; ++c )
+    uint8_t const* c = (uint8_t const*) str;
+    while( *c != 0 )
         {
-        system_write_char( system, (uint8_t) *c );
-        system->cursor_x++;
-        if( system->cursor_x >= 40 ) 
+        // Write as much of the string as fits on the current line in one go
+        int count = 0;
+        while( c[ count ] != 0 && system->cursor_x + count < system->text_width ) ++count;
+        system_write_run( system, c, count );
+        c += count;
+        system->cursor_x += count;
+        if( system->cursor_x >= system->text_width ) 
             { 
             system->cursor_x = 0; 
             system_cdown( system ); 
@@ -894,14 +1867,14 @@ void system_write( system_t* system, char const* str )
 void system_centre( system_t* system, char const* str )
     {
     int len = (int) strlen( str );
-    if( len >= 40 )
+    if( len >= system->text_width )
         {
         system_locate( system, 0, system_ycurs( system ) );
         system_print( system, str );
         }
     else
         {
-        int x = ( 40 - len ) / 2;
+        int x = ( system->text_width - len ) / 2;
         system_locate( system, x, system_ycurs( system ) );
         system_print( system, str );
         }
@@ -910,7 +1883,7 @@ void system_centre( system_t* system, char const* str )
 
 int system_scrn( system_t* system )
     {
-    return system->charmap[ system->cursor_x + system->cursor_y * 40 ];
+    return system_charmap_row( system, system->cursor_y )[ system->cursor_x ];
     }
 
 
@@ -928,8 +1901,8 @@ void system_square( system_t* system, int wx, int wy, int border )
     if( border < 1 || border > sizeof( tl ) / sizeof( *tl ) ) return;
     --border;
 
-    if( system->cursor_x + wx >= 40 ) wx = 40 - system->cursor_x;
-    if( system->cursor_y + wy >= 25 ) wy = 25 - system->cursor_y;
+    if( system->cursor_x + wx >= system->text_width ) wx = system->text_width - system->cursor_x;
+    if( system->cursor_y + wy >= system->text_height ) wy = system->text_height - system->cursor_y;
 
     if( wx <= 2 || wy <= 2 ) return;
 
@@ -1022,23 +1995,20 @@ void system_load_sprite( system_t* system, int sprite_data_index, char const* st
     {
     if( sprite_data_index < 1 || sprite_data_index > sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ) )
         return;
+    system->sprites_changed = true;
+    system->collide_grid_valid = false;
+    if( system->map.tiles ) system_mark_dirty( system, 0, system->screen_height );
 
     --sprite_data_index;
 
-    if( system->sprite_data[ sprite_data_index ].pixels )
-        {
-        free( system->sprite_data[ sprite_data_index ].pixels );
-        system->sprite_data[ sprite_data_index ].pixels = NULL;
-        system->sprite_data[ sprite_data_index ].width = 0;
-        system->sprite_data[ sprite_data_index ].height = 0;
-        }
+    system_free_sprite_data( &system->sprite_data[ sprite_data_index ] );
 
     int w, h, c;
     stbi_uc* img = stbi_load( string, &w, &h, &c, 4 );
     if( !img ) return;
    
-    u32 palette[ 32 ];
-    for( int i = 0; i < 32; ++i )
+    u32 palette[ 256 ];
+    for( int i = 0; i < system->screen_colors; ++i )
         {
         unsigned short p = system->palette[ i ];
         u32 b = ( p )      & 0x7u;
@@ -1054,48 +2024,55 @@ void system_load_sprite( system_t* system, int sprite_data_index, char const* st
     system->sprite_data[ sprite_data_index ].height = h;
     system->sprite_data[ sprite_data_index ].pixels = (uint8_t*) malloc( (size_t) w * h );
     memset( system->sprite_data[ sprite_data_index ].pixels, 0, (size_t) w * h ); 
-    palettize_remap_xbgr32( (PALETTIZE_U32*) img, w, h, palette, 32, system->sprite_data[ sprite_data_index ].pixels );
+    palettize_remap_xbgr32( (PALETTIZE_U32*) img, w, h, palette, system->screen_colors, system->sprite_data[ sprite_data_index ].pixels );
     
+    // Pixels which are less than half opaque are transparent
+    uint8_t* transparent = (uint8_t*) malloc( (size_t) w * h );
     for( int i = 0; i < w * h; ++i )
-        if( ( ( (PALETTIZE_U32*) img )[ i ] & 0xff000000 ) >> 24 < 0x80 )
-            system->sprite_data[ sprite_data_index ].pixels[ i ] |=  0x80u;       
+        transparent[ i ] = ( ( ( (PALETTIZE_U32*) img )[ i ] & 0xff000000 ) >> 24 < 0x80 ) ? 1 : 0;
     stbi_image_free( img );     
+    system_compile_sprite( &system->sprite_data[ sprite_data_index ], transparent );
+    free( transparent );
     }
 
 
 void system_sprite( system_t* system, int spr_index, int x, int y, int data_index )
     {
     if( data_index < 1 || data_index > sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ) ) return;
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     if( !system->sprite_data[ data_index - 1 ].pixels ) return;
     --spr_index;
-    system->sprites[ spr_index ].data = data_index;
-    system->sprites[ spr_index ].x = x;
-    system->sprites[ spr_index ].y = y;
-    system->sprites[ spr_index ].draw_data = data_index;
-    system->sprites[ spr_index ].draw_x = x;
-    system->sprites[ spr_index ].draw_y = y;
+    system->collide_grid_valid = false;
+    system->sprites.data[ spr_index ] = data_index;
+    system->sprites.x[ spr_index ] = x;
+    system->sprites.y[ spr_index ] = y;
+    system->sprites.draw_data[ spr_index ] = data_index;
+    system->sprites.draw_x[ spr_index ] = x;
+    system->sprites.draw_y[ spr_index ] = y;
     }
 
 
 void system_spritepos( system_t* system, int spr_index, int x, int y )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
-    system->sprites[ spr_index ].x = x;
-    system->sprites[ spr_index ].y = y;
-    system->sprites[ spr_index ].draw_x = x;
-    system->sprites[ spr_index ].draw_y = y;
+    system->collide_grid_valid = false;
+    system->sprites.x[ spr_index ] = x;
+    system->sprites.y[ spr_index ] = y;
+    system->sprites.draw_x[ spr_index ] = x;
+    system->sprites.draw_y[ spr_index ] = y;
     }
 
 
 void system_move( system_t* system, bool horizontal, int spr_index, char const* move_str )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system_t::sprite_t::move_t* move = horizontal ? &system->sprites[ spr_index ].move_x : &system->sprites[ spr_index ].move_y ;  
-    move->frame_count = 0;
+    system_t::move_t* move = horizontal ? &system->move_x : &system->move_y;  
+    move->frame_count[ spr_index ] = 0;
+    system->active_sprites_valid = false;
+    system_t::move_t::frame_t frames[ 256 ];
 
     bool loop = false;
     bool end = false;
@@ -1165,9 +2142,10 @@ void system_move( system_t* system, bool horizontal, int spr_index, char const*
             if( speed < 1 || speed > 32768 ) return; // Error in move string
             if( step < -16384 || step > 16384 ) return; // Error in move string
             if( count < 0 || count > 32767 ) return; // Error in move string
-            move->frames[ frame_count ].speed = speed;
-            move->frames[ frame_count ].step = step;
-            move->frames[ frame_count ].count = count;
+            if( frame_count >= sizeof( frames ) / sizeof( *frames ) ) return; // Error in move string
+            frames[ frame_count ].speed = speed;
+            frames[ frame_count ].step = step;
+            frames[ frame_count ].count = count;
             ++frame_count;
             }
         else
@@ -1195,13 +2173,16 @@ void system_move( system_t* system, bool horizontal, int spr_index, char const*
         
     if( frame_count > 0 )
         {
-        move->frame_count = frame_count;
-        move->index = 0;
-        move->timer = move->frames[ 0 ].speed;
-        move->count = move->frames[ 0 ].count;
-        move->loop = loop;
-        move->pos_used = pos_used;
-        move->pos_value = pos_value;
+        free( move->frames[ spr_index ] );
+        move->frames[ spr_index ] = (system_t::move_t::frame_t*) malloc( sizeof( *frames ) * frame_count );
+        memcpy( move->frames[ spr_index ], frames, sizeof( *frames ) * frame_count );
+        move->frame_count[ spr_index ] = frame_count;
+        move->index[ spr_index ] = 0;
+        move->timer[ spr_index ] = frames[ 0 ].speed;
+        move->count[ spr_index ] = frames[ 0 ].count;
+        move->loop[ spr_index ] = loop;
+        move->pos_used[ spr_index ] = pos_used;
+        move->pos_value[ spr_index ] = pos_value;
         }
     }
 
@@ -1220,75 +2201,82 @@ void system_move_y( system_t* system, int spr_index, char const* move_str )
 
 void system_move_on( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system->sprites[ spr_index ].moving = true;  
+    system->sprites.moving[ spr_index ] = true;  
+    system->active_sprites_valid = false;
     }
 
 
 void system_move_off( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system->sprites[ spr_index ].moving = false;  
-    system->sprites[ spr_index ].move_x.count = 0;  
-    system->sprites[ spr_index ].move_y.count = 0;  
+    system->sprites.moving[ spr_index ] = false;  
+    system->move_x.count[ spr_index ] = 0;  
+    system->move_y.count[ spr_index ] = 0;  
+    system->active_sprites_valid = false;
     }
 
 
 void system_move_freeze( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system->sprites[ spr_index ].moving = false;  
+    system->sprites.moving[ spr_index ] = false;  
+    system->active_sprites_valid = false;
     }
 
 
 void system_move_all_on( system_t* system )
     {
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
-        system->sprites[ i ].moving = true;  
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        system->sprites.moving[ i ] = true;  
+    system->active_sprites_valid = false;
     }
 
 
 void system_move_all_off( system_t* system )
     {
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
         {
-        system->sprites[ i ].moving = false;  
-        system->sprites[ i ].move_x.count = 0;
-        system->sprites[ i ].move_y.count = 0;
+        system->sprites.moving[ i ] = false;  
+        system->move_x.count[ i ] = 0;
+        system->move_y.count[ i ] = 0;
         }
+    system->active_sprites_valid = false;
     }
 
 
 void system_move_all_freeze( system_t* system )
     {
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
-        system->sprites[ i ].moving = false;  
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        system->sprites.moving[ i ] = false;  
+    system->active_sprites_valid = false;
     }
 
 
 int system_movon( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return 0;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return 0;
     --spr_index;
 
-    system_t::sprite_t* spr = &system->sprites[ spr_index ];
-    return ( spr->moving && ( spr->move_x.frame_count || spr->move_y.frame_count ) ) ? 1 : 0;
+    return ( system->sprites.moving[ spr_index ] && ( system->move_x.frame_count[ spr_index ] || system->move_y.frame_count[ spr_index ] ) ) ? 1 : 0;
     }
 
 
 void system_anim( system_t* system, int spr_index, char const* anim_str )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system_t::sprite_t::anim_t* anim = &system->sprites[ spr_index ].anim;  
-    anim->frame_count = 0;
+    system_t::anim_t* anim = &system->anim;  
+    anim->frame_count[ spr_index ] = 0;
+    system->active_sprites_valid = false;
+    system_t::anim_t::frame_t frames[ 256 ];
 
     bool loop = false;
     int count = 0;
@@ -1334,8 +2322,9 @@ void system_anim( system_t* system, int spr_index, char const* anim_str )
             int delay = atoi( delaystr );
             if( frame < 1 || frame > sizeof( system->sprite_data ) / sizeof( *system->sprite_data ) ) return; // Error in anim string
             if( delay < 1 || delay > 16384 ) return; // Error in anim string
-            anim->frames[ count ].data = frame;
-            anim->frames[ count ].delay = delay;
+            if( count >= sizeof( frames ) / sizeof( *frames ) ) return; // Error in anim string
+            frames[ count ].data = frame;
+            frames[ count ].delay = delay;
             ++count;
             }
         else
@@ -1344,97 +2333,90 @@ void system_anim( system_t* system, int spr_index, char const* anim_str )
 
     if( count > 0 )
         {
-        anim->frame_count = count;
-        anim->index = 0;
-        anim->timer = anim->frames[ 0 ].delay;
-        anim->loop = loop;
-        system->sprites[ spr_index ].data = anim->frames[ 0 ].data;
+        free( anim->frames[ spr_index ] );
+        anim->frames[ spr_index ] = (system_t::anim_t::frame_t*) malloc( sizeof( *frames ) * count );
+        memcpy( anim->frames[ spr_index ], frames, sizeof( *frames ) * count );
+        anim->frame_count[ spr_index ] = count;
+        anim->index[ spr_index ] = 0;
+        anim->timer[ spr_index ] = frames[ 0 ].delay;
+        anim->loop[ spr_index ] = loop;
+        system->sprites.data[ spr_index ] = frames[ 0 ].data;
+        system->collide_grid_valid = false;
         }
     }
 
 
 void system_anim_on( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system_t::sprite_t::anim_t* anim = &system->sprites[ spr_index ].anim;  
-    anim->running = true;
+    system->anim.running[ spr_index ] = true;
+    system->active_sprites_valid = false;
     }
 
 
 void system_anim_off( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system_t::sprite_t::anim_t* anim = &system->sprites[ spr_index ].anim;  
-    anim->running = false;
-    anim->frame_count = 0;
+    system->anim.running[ spr_index ] = false;
+    system->anim.frame_count[ spr_index ] = 0;
+    system->active_sprites_valid = false;
     }
 
 
 void system_anim_freeze( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system_t::sprite_t::anim_t* anim = &system->sprites[ spr_index ].anim;  
-    anim->running = false;
+    system->anim.running[ spr_index ] = false;
+    system->active_sprites_valid = false;
     }
 
 
 void system_anim_all_on( system_t* system )
     {
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
-        system->sprites[ i ].anim.running = true;  
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        system->anim.running[ i ] = true;  
+    system->active_sprites_valid = false;
     }
 
 
 void system_anim_all_off( system_t* system )
     {
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
         {
-        system->sprites[ i ].anim.running = false;  
-        system->sprites[ i ].anim.frame_count = 0;
+        system->anim.running[ i ] = false;  
+        system->anim.frame_count[ i ] = 0;
         }
+    system->active_sprites_valid = false;
     }
 
 
 void system_anim_all_freeze( system_t* system )
     {
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
-        system->sprites[ i ].anim.running = false;  
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        system->anim.running[ i ] = false;  
+    system->active_sprites_valid = false;
     }
 
 
 void system_put_sprite( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return;
     --spr_index;
 
-    system_t::sprite_t* spr = &system->sprites[ spr_index ];
-    
-    int data_index = spr->draw_data;
+    int data_index = system->sprites.draw_data[ spr_index ];
     if( data_index < 1 || data_index > sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ) ) return;
     --data_index;
     if( !system->sprite_data[ data_index ].pixels ) return;
 
     system_t::sprite_data_t* data = &system->sprite_data[ data_index ];
-    for( int y = 0; y < data->height; ++y )
-        {
-        for( int x = 0; x < data->width; ++x )
-            {
-            uint8_t p = data->pixels[ x + y * data->width ];
-            if( ( p & 0x80 ) == 0 )
-                {
-                int xp = spr->draw_x + x;
-                int yp = spr->draw_y + y;
-                if( xp >= 0 && yp >= 0 && xp < 320 && yp < 200 )
-                    system->screen[ xp + yp * 320 ] = p  & 31u;                    
-                }
-            }
-        }
+    system_blit_sprite( system, data, system->sprites.draw_x[ spr_index ], system->sprites.draw_y[ spr_index ] );
+    system_mark_dirty( system, system->sprites.draw_y[ spr_index ], data->height );
     }
 
 
@@ -1444,10 +2426,15 @@ void system_get_sprite( system_t* system, int x, int y, int w, int h, int data_i
     --data_index;
 
     system_t::sprite_data_t* data = &system->sprite_data[ data_index ];
-    if( data->pixels ) free( data->pixels );
+    system->sprites_changed = true;
+    system->collide_grid_valid = false;
+    if( system->map.tiles ) system_mark_dirty( system, 0, system->screen_height );
+    system_free_sprite_data( data );
+    if( w <= 0 || h <= 0 ) return;
     data->pixels = (uint8_t*) malloc( w * h * sizeof( uint8_t ) );
     data->width = w;
     data->height = h;
+    uint8_t* transparent = (uint8_t*) malloc( w * h * sizeof( uint8_t ) );
     for( int iy = 0; iy < h; ++iy )
         {
         for( int ix = 0; ix < w; ++ix )
@@ -1455,12 +2442,14 @@ void system_get_sprite( system_t* system, int x, int y, int w, int h, int data_i
             int xp = ix + x;
             int yp = iy + y;
             uint8_t p = 0;
-            if( xp >= 0 && yp >= 0 && xp < 320 && yp < 200 )
-                p = system->screen[ xp + yp * 320 ] & 31u;                    
-            if( p == mask ) p |= 0x80u;
+            if( xp >= 0 && yp >= 0 && xp < system->screen_width && yp < system->screen_height )
+                p = system_screen_row( system, yp )[ xp ];                    
             data->pixels[ ix + iy * w ] = p;
+            transparent[ ix + iy * w ] = p == mask ? 1 : 0;
             }
         }
+    system_compile_sprite( data, transparent );
+    free( transparent );
     }
 
 
@@ -1480,11 +2469,11 @@ void system_update( system_t* system )
     {
     if( system->manual_sprite_update )
         {
-        for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+        for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
             {
-            system->sprites[ i ].draw_data = system->sprites[ i ].data;
-            system->sprites[ i ].draw_x = system->sprites[ i ].x;
-            system->sprites[ i ].draw_y = system->sprites[ i ].y;
+            system->sprites.draw_data[ i ] = system->sprites.data[ i ];
+            system->sprites.draw_x[ i ] = system->sprites.x[ i ];
+            system->sprites.draw_y[ i ] = system->sprites.y[ i ];
             }
         }
     }
@@ -1492,44 +2481,161 @@ void system_update( system_t* system )
 
 int system_xsprite( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return 0;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return 0;
     --spr_index;
 
-    return system->sprites[ spr_index ].x;
+    return system->sprites.x[ spr_index ];
     }
 
 
 int system_ysprite( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return 0;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return 0;
     --spr_index;
 
-    return system->sprites[ spr_index ].y;
+    return system->sprites.y[ spr_index ];
     }
 
 
 void system_priority_on( system_t* system )
     {
     system->ypos_priority = true;
+    system->sprites_changed = true;
     }
 
 
 void system_priority_off( system_t* system )
     {
     system->ypos_priority = false;
+    system->sprites_changed = true;
     }
 
 
 int system_detect( system_t* system, int spr_index )
     {
-    if( spr_index < 1 || spr_index > sizeof( system->sprites ) /  sizeof( *system->sprites ) ) return 0;
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return 0;
+    --spr_index;
+
+    int x = system->sprites.x[ spr_index ];
+    int y = system->sprites.y[ spr_index ];
+    if( x < 0 || x >= system->screen_width || y < 0 || y >= system->screen_height ) return 0;
+
+    return system_screen_row( system, y )[ x ];
+    }
+
+
+// The bounding box of what a sprite is showing, and its image. Returns NULL if it isn't showing anything.
+static system_t::sprite_data_t const* system_sprite_box( system_t* system, int index, int* x0, int* y0, int* x1, int* y1 )
+    {
+    int data_index = system->sprites.data[ index ];
+    if( data_index < 1 || data_index > sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ) ) return NULL;
+    system_t::sprite_data_t const* data = &system->sprite_data[ data_index - 1 ];
+    if( !data->pixels ) return NULL;
+    *x0 = system->sprites.x[ index ];
+    *y0 = system->sprites.y[ index ];
+    *x1 = *x0 + data->width;
+    *y1 = *y0 + data->height;
+    return data;
+    }
+
+
+// The grid cell a position is in. Positions off the screen go in the edge cells.
+static int system_collide_cell( int pos, int size )
+    {
+    int cell = pos < 0 ? 0 : pos * SYSTEM_COLLIDE_GRID / size;
+    return cell < SYSTEM_COLLIDE_GRID ? cell : SYSTEM_COLLIDE_GRID - 1;
+    }
+
+
+static void system_build_collide_grid( system_t* system )
+    {
+    memset( system->collide_grid, 0, sizeof( system->collide_grid ) );
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
+        {
+        int x0, y0, x1, y1;
+        if( !system_sprite_box( system, i, &x0, &y0, &x1, &y1 ) ) continue;
+        int cx0 = system_collide_cell( x0, system->screen_width );
+        int cx1 = system_collide_cell( x1 - 1, system->screen_width );
+        int cy0 = system_collide_cell( y0, system->screen_height );
+        int cy1 = system_collide_cell( y1 - 1, system->screen_height );
+        for( int cy = cy0; cy <= cy1; ++cy )
+            for( int cx = cx0; cx <= cx1; ++cx )
+                system->collide_grid[ cy ][ cx ] |= 1u << i;
+        }
+    system->collide_grid_valid = true;
+    }
+
+
+// 64 bits of the mask of a row of a sprite, from column start on. Columns outside the sprite are clear.
+static uint64_t system_mask_bits( system_t::sprite_data_t const* data, int row, int start )
+    {
+    uint64_t const* words = data->masks + row * data->mask_words;
+    int word = ( start < 0 ? start - 63 : start ) / 64;
+    int shift = start - word * 64;
+    uint64_t lo = word >= 0 && word < data->mask_words ? words[ word ] : 0;
+    uint64_t hi = word + 1 >= 0 && word + 1 < data->mask_words ? words[ word + 1 ] : 0;
+    return shift ? ( lo >> shift ) | ( hi << ( 64 - shift ) ) : lo;
+    }
+
+
+// Tests two sprites for overlapping opaque pixels. Where their bounding boxes overlap, the words of the first sprite's 
+// rows are ANDed with the bits of the second sprite's rows at the same screen columns.
+static bool system_sprites_overlap( system_t* system, int a, int b )
+    {
+    int ax0, ay0, ax1, ay1, bx0, by0, bx1, by1;
+    system_t::sprite_data_t const* data_a = system_sprite_box( system, a, &ax0, &ay0, &ax1, &ay1 );
+    system_t::sprite_data_t const* data_b = system_sprite_box( system, b, &bx0, &by0, &bx1, &by1 );
+    if( !data_a || !data_b ) return false;
+    int x0 = ax0 > bx0 ? ax0 : bx0;
+    int x1 = ax1 < bx1 ? ax1 : bx1;
+    int y0 = ay0 > by0 ? ay0 : by0;
+    int y1 = ay1 < by1 ? ay1 : by1;
+    if( x0 >= x1 || y0 >= y1 ) return false;
+
+    int word0 = ( x0 - ax0 ) / 64;
+    int word1 = ( x1 - 1 - ax0 ) / 64;
+    for( int y = y0; y < y1; ++y )
+        {
+        uint64_t const* row = data_a->masks + ( y - ay0 ) * data_a->mask_words;
+        for( int word = word0; word <= word1; ++word )
+            if( row[ word ] & system_mask_bits( data_b, y - by0, word * 64 + ax0 - bx0 ) ) return true;
+        }
+    return false;
+    }
+
+
+int system_collide( system_t* system, int spr_index )
+    {
+    if( spr_index < 1 || spr_index > SYSTEM_SPRITE_COUNT ) return 0;
     --spr_index;
 
-    int x = system->sprites[ spr_index ].x;
-    int y = system->sprites[ spr_index ].y;
-    if( x < 0 || x >= 320 || y < 0 || y >= 200 ) return 0;
+    int x0, y0, x1, y1;
+    if( !system_sprite_box( system, spr_index, &x0, &y0, &x1, &y1 ) ) return 0;
+    if( !system->collide_grid_valid ) system_build_collide_grid( system );
+
+    // Only sprites sharing a grid cell with it can overlap it
+    uint32_t candidates = 0;
+    int cx0 = system_collide_cell( x0, system->screen_width );
+    int cx1 = system_collide_cell( x1 - 1, system->screen_width );
+    int cy0 = system_collide_cell( y0, system->screen_height );
+    int cy1 = system_collide_cell( y1 - 1, system->screen_height );
+    for( int cy = cy0; cy <= cy1; ++cy )
+        for( int cx = cx0; cx <= cx1; ++cx )
+            candidates |= system->collide_grid[ cy ][ cx ];
+    candidates &= ~( 1u << spr_index );
+
+    for( int i = 0; candidates; ++i, candidates >>= 1 )
+        if( ( candidates & 1 ) && system_sprites_overlap( system, spr_index, i ) ) return i + 1;
+    return 0;
+    }
 
-    return system->screen[ x + y * 320 ];
+
+int system_collide_pair( system_t* system, int spr_a, int spr_b )
+    {
+    if( spr_a < 1 || spr_a > SYSTEM_SPRITE_COUNT ) return 0;
+    if( spr_b < 1 || spr_b > SYSTEM_SPRITE_COUNT ) return 0;
+    if( spr_a == spr_b ) return 0;
+    return system_sprites_overlap( system, spr_a - 1, spr_b - 1 ) ? 1 : 0;
     }
 
 
@@ -1560,13 +2666,15 @@ void system_synchro( system_t* system )
 
 void system_off( system_t* system )
     {
-    for( int i = 0; i < sizeof( system->sprites ) /  sizeof( *system->sprites ); ++i )
+    system->collide_grid_valid = false;
+    for( int i = 0; i < SYSTEM_SPRITE_COUNT; ++i )
         {
-        system->sprites[ i ].data = 0;
-        system->sprites[ i ].draw_data = 0;
-        system->sprites[ i ].anim.running = false;  
-        system->sprites[ i ].anim.frame_count = 0;
+        system->sprites.data[ i ] = 0;
+        system->sprites.draw_data[ i ] = 0;
+        system->anim.running[ i ] = false;  
+        system->anim.frame_count[ i ] = 0;
         }
+    system->active_sprites_valid = false;
     }
 
 
@@ -1582,6 +2690,379 @@ void system_unfreeze( system_t* system )
     }
 
 
+void system_map( system_t* system, int columns, int rows, int tile_width, int tile_height )
+    {
+    if( columns < 0 || columns > 4096 || rows < 0 || rows > 4096 ) return;
+    if( tile_width < 1 || tile_width > 256 || tile_height < 1 || tile_height > 256 ) return;
+
+    system_t::map_t* map = &system->map;
+    free( map->tiles );
+    memset( map, 0, sizeof( *map ) );
+    if( columns > 0 && rows > 0 )
+        {
+        map->tiles = (uint16_t*) malloc( sizeof( *map->tiles ) * columns * rows );
+        memset( map->tiles, 0, sizeof( *map->tiles ) * columns * rows );
+        map->columns = columns;
+        map->rows = rows;
+        map->tile_width = tile_width;
+        map->tile_height = tile_height;
+        }
+    system_mark_dirty( system, 0, system->screen_height );
+    }
+
+
+void system_tile( system_t* system, int x, int y, int data_index )
+    {
+    system_t::map_t* map = &system->map;
+    if( x < 0 || x >= map->columns || y < 0 || y >= map->rows ) return;
+    if( data_index < 0 || data_index > sizeof( system->sprite_data ) /  sizeof( *system->sprite_data ) ) return;
+    if( map->tiles[ x + y * map->columns ] == data_index ) return;
+    map->tiles[ x + y * map->columns ] = (uint16_t) data_index;
+
+    // Only the rows the tile is showing on need redrawing. The map may repeat down the screen, if it is smaller.
+    int const map_height = map->rows * map->tile_height;
+    int const top = ( ( y * map->tile_height - map->scroll_y ) % map_height + map_height ) % map_height;
+    for( int row = top - map_height; row < system->screen_height; row += map_height )
+        system_mark_dirty( system, row, map->tile_height );
+    }
+
+
+void system_scroll( system_t* system, int x, int y )
+    {
+    system_t::map_t* map = &system->map;
+    if( !map->tiles ) return;
+    int const map_width = map->columns * map->tile_width;
+    int const map_height = map->rows * map->tile_height;
+    x = ( x % map_width + map_width ) % map_width;
+    y = ( y % map_height + map_height ) % map_height;
+    if( x == map->scroll_x && y == map->scroll_y ) return;
+    map->scroll_x = x;
+    map->scroll_y = y;
+    system_mark_dirty( system, 0, system->screen_height );
+    }
+
+
+void system_cls( system_t* system )
+    {
+    system->scroll_row = 0;
+    system->cursor_x = 0;
+    system->cursor_y = 0;
+    memset( system->screen, system->paper, (size_t) system->screen_width * system->screen_height );
+    memset( system->charmap, ' ', (size_t) system->text_width * system->text_height );
+    system_mark_dirty( system, 0, system->screen_height );
+    }
+
+
+// Combines count pixels at out with color. Replace is a memset, and the other modes do 16 pixels at a time where 
+// there is SSE2 (which all x64 cpus have), and 8 at a time as an uint64_t otherwise.
+template< int MODE > static void system_fill_span( uint8_t* out, int count, uint8_t color )
+    {
+    if( MODE == 1 )
+        {
+        memset( out, color, (size_t) count );
+        return;
+        }
+
+    int i = 0;
+    #ifdef SYSTEM_SIMD
+        __m128i col16 = _mm_set1_epi8( (char) color );
+        for( ; i + 16 <= count; i += 16 )
+            {
+            __m128i pixels = _mm_loadu_si128( (__m128i const*)( out + i ) );
+            switch( MODE )
+                {
+                case 2: pixels = _mm_or_si128( pixels, col16 ); break;
+                case 3: pixels = _mm_xor_si128( pixels, col16 ); break;
+                case 4: pixels = _mm_and_si128( pixels, col16 ); break;
+                }
+            _mm_storeu_si128( (__m128i*)( out + i ), pixels );
+            }
+    #endif
+    uint64_t col8 = color * 0x0101010101010101ull;
+    for( ; i + 8 <= count; i += 8 )
+        {
+        uint64_t pixels;
+        memcpy( &pixels, out + i, sizeof( pixels ) );
+        switch( MODE )
+            {
+            case 2: pixels |= col8; break;
+            case 3: pixels ^= col8; break;
+            case 4: pixels &= col8; break;
+            }
+        memcpy( out + i, &pixels, sizeof( pixels ) );
+        }
+    for( ; i < count; ++i )
+        {
+        switch( MODE )
+            {
+            case 2: out[ i ] |= color; break;
+            case 3: out[ i ] ^= color; break;
+            case 4: out[ i ] &= color; break;
+            }
+        }
+    }
+
+
+// Draws pixels x0 to x1 inclusive of row y in the pen color, clipped to the screen. Does not mark the row dirty.
+static void system_draw_span( system_t* system, int x0, int x1, int y )
+    {
+    if( y < 0 || y >= system->screen_height ) return;
+    if( x0 < 0 ) x0 = 0;
+    if( x1 >= system->screen_width ) x1 = system->screen_width - 1;
+    if( x1 < x0 ) return;
+
+    uint8_t* out = system_screen_row( system, y ) + x0;
+    uint8_t color = (uint8_t) system->pen;
+    switch( system->write_mode )
+        {
+        case 1: system_fill_span< 1 >( out, x1 - x0 + 1, color ); break;
+        case 2: system_fill_span< 2 >( out, x1 - x0 + 1, color ); break;
+        case 3: system_fill_span< 3 >( out, x1 - x0 + 1, color ); break;
+        case 4: system_fill_span< 4 >( out, x1 - x0 + 1, color ); break;
+        }
+    }
+
+
+// Draws a single pixel, if it is on the screen. Does not mark the row dirty.
+static void system_draw_pixel( system_t* system, int x, int y, uint8_t color )
+    {
+    if( x < 0 || x >= system->screen_width || y < 0 || y >= system->screen_height ) return;
+    uint8_t* out = system_screen_row( system, y ) + x;
+    switch( system->write_mode )
+        {
+        case 1: *out = color; break;
+        case 2: *out |= color; break;
+        case 3: *out ^= color; break;
+        case 4: *out &= color; break;
+        }
+    }
+
+
+void system_plot( system_t* system, int x, int y )
+    {
+    system_draw_pixel( system, x, y, (uint8_t) system->pen );
+    system_mark_dirty( system, y, 1 );
+    }
+
+
+void system_plot_color( system_t* system, int x, int y, int color )
+    {
+    system_draw_pixel( system, x, y, (uint8_t)( color & system->color_mask ) );
+    system_mark_dirty( system, y, 1 );
+    }
+
+
+void system_draw( system_t* system, int x1, int y1, int x2, int y2 )
+    {
+    if( y1 > y2 )
+        {
+        int t = x1; x1 = x2; x2 = t;
+        t = y1; y1 = y2; y2 = t;
+        }
+    if( y2 < 0 || y1 >= system->screen_height ) return;
+    if( ( x1 < 0 && x2 < 0 ) || ( x1 >= system->screen_width && x2 >= system->screen_width ) ) return;
+    system_mark_dirty_rows( system, y1, y2 );
+
+    if( y1 == y2 )
+        {
+        system_draw_span( system, x1 < x2 ? x1 : x2, x1 < x2 ? x2 : x1, y1 );
+        return;
+        }
+
+    // Bresenham, stepping along whichever axis is longer. The deltas and error term are 64-bit, as they can exceed 
+    // the int range for extreme coordinates.
+    uint8_t color = (uint8_t) system->pen;
+    int64_t dx = x2 > x1 ? (int64_t) x2 - x1 : (int64_t) x1 - x2;
+    int64_t dy = (int64_t) y2 - y1;
+    int sx = x2 > x1 ? 1 : -1;
+    int64_t err = dx - dy;
+    int x = x1;
+    int y = y1;
+
+    // Skip the steps before the line can reach the screen, so off-screen parts of long lines cost nothing. Every step 
+    // moves along the longer axis, and the error term stays in a range one delta wide, which gives the position on the 
+    // shorter axis and the error term after any number of steps directly. The products fit in 64 bits unsigned.
+    int64_t before_x = sx > 0 ? -(int64_t) x1 : (int64_t) x1 - ( system->screen_width - 1 );
+    int64_t before_y = -(int64_t) y1;
+    if( dx >= dy )
+        {
+        uint64_t half = (uint64_t)( dx / 2 );
+        uint64_t i = before_x > 0 ? (uint64_t) before_x : 0;
+        if( before_y > 0 )
+            {
+            uint64_t i_y = ( (uint64_t)( before_y - 1 ) * (uint64_t) dx + half ) / (uint64_t) dy + 1;
+            if( i_y > i ) i = i_y;
+            }
+        if( i > (uint64_t) dx ) return;
+        if( i > 0 )
+            {
+            uint64_t n = i * (uint64_t) dy;
+            uint64_t ky = n <= half ? 0 : ( n - half + (uint64_t) dx - 1 ) / (uint64_t) dx;
+            int64_t rest = n <= half ? (int64_t)( half - n ) : (int64_t)( ky * (uint64_t) dx - ( n - half ) );
+            err = rest - dy + ( dx + 1 ) / 2;
+            x = (int)( x1 + sx * (int64_t) i );
+            y = (int)( y1 + (int64_t) ky );
+            }
+        }
+    else
+        {
+        uint64_t half = (uint64_t)( dy / 2 ) + 1;
+        uint64_t j = before_y > 0 ? (uint64_t) before_y : 0;
+        if( before_x > 0 )
+            {
+            uint64_t j_x = ( (uint64_t)( before_x - 1 ) * (uint64_t) dy + half + (uint64_t) dx - 1 ) / (uint64_t) dx;
+            if( j_x > j ) j = j_x;
+            }
+        if( j > (uint64_t) dy ) return;
+        if( j > 0 )
+            {
+            uint64_t n = j * (uint64_t) dx;
+            uint64_t kx = n < half ? 0 : ( n - half ) / (uint64_t) dy + 1;
+            int64_t rest = n < half ? -(int64_t)( half - n ) : -(int64_t)( kx * (uint64_t) dy - ( n - half ) );
+            err = dx + rest + 1 - ( dy + 1 ) / 2;
+            x = (int)( x1 + sx * (int64_t) kx );
+            y = (int)( y1 + (int64_t) j );
+            }
+        }
+
+    // x and y only move towards the end point, so the walk stops once either has left the screen in that direction
+    for( ; ; )
+        {
+        if( y >= system->screen_height || ( sx > 0 ? x >= system->screen_width : x < 0 ) ) break;
+        system_draw_pixel( system, x, y, color );
+        if( x == x2 && y == y2 ) break;
+        int64_t e2 = err * 2;
+        if( e2 > -dy ) { err -= dy; x += sx; }
+        if( e2 < dx ) { err += dx; ++y; }
+        }
+    }
+
+
+void system_box( system_t* system, int x1, int y1, int x2, int y2 )
+    {
+    if( x1 > x2 ) { int t = x1; x1 = x2; x2 = t; }
+    if( y1 > y2 ) { int t = y1; y1 = y2; y2 = t; }
+    if( y2 < 0 || y1 >= system->screen_height || x2 < 0 || x1 >= system->screen_width ) return;
+    system_draw_span( system, x1, x2, y1 );
+    if( y2 > y1 ) system_draw_span( system, x1, x2, y2 );
+
+    // The sides, without the corners which the top and bottom already drew
+    uint8_t color = (uint8_t) system->pen;
+    int top = y1 + 1 < 0 ? 0 : y1 + 1;
+    int bottom = y2 - 1 >= system->screen_height ? system->screen_height - 1 : y2 - 1;
+    for( int y = top; y <= bottom; ++y )
+        {
+        system_draw_pixel( system, x1, y, color );
+        if( x2 > x1 ) system_draw_pixel( system, x2, y, color );
+        }
+    system_mark_dirty_rows( system, y1, y2 );
+    }
+
+
+void system_bar( system_t* system, int x1, int y1, int x2, int y2 )
+    {
+    if( x1 > x2 ) { int t = x1; x1 = x2; x2 = t; }
+    if( y1 > y2 ) { int t = y1; y1 = y2; y2 = t; }
+    if( y2 < 0 || y1 >= system->screen_height || x2 < 0 || x1 >= system->screen_width ) return;
+    if( y1 < 0 ) y1 = 0;
+    if( y2 >= system->screen_height ) y2 = system->screen_height - 1;
+    for( int y = y1; y <= y2; ++y )
+        system_draw_span( system, x1, x2, y );
+    system_mark_dirty( system, y1, y2 - y1 + 1 );
+    }
+
+
+// Draws a single pixel given 64-bit coordinates, if it is on the screen
+static void system_draw_pixel_wide( system_t* system, int64_t x, int64_t y, uint8_t color )
+    {
+    if( x < 0 || x >= system->screen_width || y < 0 || y >= system->screen_height ) return;
+    system_draw_pixel( system, (int) x, (int) y, color );
+    }
+
+
+// The points of the circle at offsets (+-a, +-b), drawing each of them once when a or b is 0
+static void system_circle_points( system_t* system, int64_t x, int64_t y, int64_t a, int64_t b, uint8_t color )
+    {
+    system_draw_pixel_wide( system, x + a, y + b, color );
+    if( a != 0 ) system_draw_pixel_wide( system, x - a, y + b, color );
+    if( b != 0 ) system_draw_pixel_wide( system, x + a, y - b, color );
+    if( a != 0 && b != 0 ) system_draw_pixel_wide( system, x - a, y - b, color );
+    }
+
+
+void system_circle( system_t* system, int x, int y, int r )
+    {
+    if( r < 0 ) return;
+    if( (int64_t) x + r < 0 || (int64_t) x - r >= system->screen_width ) return;
+    if( (int64_t) y + r < 0 || (int64_t) y - r >= system->screen_height ) return;
+
+    // The outline is within one pixel of radius r, so nothing is drawn when the whole screen is further inside it
+    double far_x = (double) x - ( 2 * (int64_t) x < system->screen_width ? system->screen_width - 1 : 0 );
+    double far_y = (double) y - ( 2 * (int64_t) y < system->screen_height ? system->screen_height - 1 : 0 );
+    if( r > 2 && far_x * far_x + far_y * far_y < ( r - 2.0 ) * ( r - 2.0 ) ) return;
+
+    // Midpoint circle, stepping through one octant and mirroring it. The points on the diagonal are in both halves.
+    // The error term is 64-bit, as it can exceed the int range for large radii.
+    uint8_t color = (uint8_t) system->pen;
+    int64_t a = r;
+    int64_t b = 0;
+    int64_t err = 1 - (int64_t) r;
+
+    // Each step draws points b away from the centre along one axis, which can only be on the screen for b in these 
+    // ranges. Steps outside them are skipped, so large circles cost no more than the part of them on the screen.
+    int64_t ranges[ 4 ][ 2 ] = 
+        {
+        { (int64_t) y - system->screen_height + 1, y }, { -(int64_t) y, (int64_t) system->screen_height - 1 - y },
+        { (int64_t) x - system->screen_width + 1, x }, { -(int64_t) x, (int64_t) system->screen_width - 1 - x },
+        };
+    int64_t range_end = -1;
+    while( a >= b )
+        {
+        if( b > range_end )
+            {
+            int64_t start = INT64_MAX;
+            for( int i = 0; i < 4; ++i )
+                {
+                int64_t range_start = ranges[ i ][ 0 ] > b ? ranges[ i ][ 0 ] : b;
+                if( ranges[ i ][ 1 ] >= range_start && range_start < start ) 
+                    {
+                    start = range_start;
+                    range_end = ranges[ i ][ 1 ];
+                    }
+                }
+            if( start > a ) break;
+            if( start > b )
+                {
+                // After each step, a is the largest value where a * ( a - 1 ) < r * r - b * b, and the error term
+                // is a * ( a - 1 ) + b * ( b + 2 ) + 1 - r * r
+                b = start;
+                int64_t d = (int64_t) r * r - b * b;
+                a = (int64_t) sqrt( (double) d );
+                while( a * ( a - 1 ) >= d ) --a;
+                while( ( a + 1 ) * a < d ) ++a;
+                err = a * ( a - 1 ) - d + b * 2 + 1;
+                if( a < b ) break;
+                }
+            }
+        system_circle_points( system, x, y, a, b, color );
+        if( a != b ) system_circle_points( system, x, y, b, a, color );
+        ++b;
+        if( err < 0 )
+            {
+            err += 2 * b + 1;
+            }
+        else
+            {
+            --a;
+            err += 2 * ( b - a ) + 1;
+            }
+        }
+    int64_t top = (int64_t) y - r;
+    int64_t bottom = (int64_t) y + r;
+    system_mark_dirty_rows( system, top < 0 ? 0 : (int) top, bottom >= system->screen_height ? system->screen_height - 1 : (int) bottom );
+    }
+
+
 
 void system_say( system_t* system, char const* text )
     {
@@ -1652,7 +3133,7 @@ void system_load_palette( system_t* system, char const* string )
     stbi_uc* img = stbi_load( string, &w, &h, &c, 4 );
     if( !img ) return;
 
-    u32 palette[ 32 ] = { 0 };
+    u32 palette[ 256 ] = { 0 };
     int count = 0;      
     for( int y = 0; y < h; ++y )
         {
@@ -1668,7 +3149,7 @@ void system_load_palette( system_t* system, char const* string )
             r = ( r / 32 ) * 36;
             pixel = ( pixel & 0xff000000 ) | ( b << 16 ) | ( g << 8 ) | r;
             ((u32*)img)[ x + y * w ] = pixel;
-            if( count < 32 ) 
+            if( count < system->screen_colors ) 
                 {
                 for( int i = 0; i < count; ++i )
                     {
@@ -1682,10 +3163,10 @@ void system_load_palette( system_t* system, char const* string )
             ;
             }
         }   
-    if( count > 32 ) 
+    if( count > system->screen_colors ) 
         {
         memset( palette, 0, sizeof( palette ) );
-        count = palettize_generate_palette_xbgr32( (PALETTIZE_U32*) img, w, h, palette, 32, 0 );        
+        count = palettize_generate_palette_xbgr32( (PALETTIZE_U32*) img, w, h, palette, system->screen_colors, 0 );        
         }
     for( int i = 0; i < count; ++i )
         {
@@ -1698,6 +3179,7 @@ void system_load_palette( system_t* system, char const* string )
         r = ( r / 32 ) & 0x7;
         system->palette[ i ] = (uint16_t)( ( r << 8 ) | ( g << 4 ) | b );
         }
+    system->full_redraw = true;
 
     stbi_image_free( img );     
     }
@@ -1,6 +1,10 @@
 #ifndef vm_h
 #define vm_h
 
+#if defined( VM_JIT ) && !defined( _M_X64 ) && !defined( __x86_64__ )
+    #undef VM_JIT // The JIT only generates x86-64 code
+#endif
+
 
 struct vm_context_t;
 
@@ -23,6 +27,26 @@ void vm_resume( vm_context_t* ctx );
 
 bool vm_paused( vm_context_t* ctx );
 
+// Does a small, bounded amount of string pool defragmentation. Call it when the program is idle, e.g. in WAITVBL
+void vm_idle( vm_context_t* ctx );
+
+struct vm_string_stats_t
+    {
+    int count;
+    int bytes_used;
+    int bytes_free;
+    unsigned int injects; // Running totals, take the difference between two calls to get a rate
+    unsigned int discards;
+    };
+
+void vm_string_stats( vm_context_t* ctx, vm_string_stats_t* stats );
+
+#ifdef VM_JIT
+    // Runs the given number of randomly generated programs both interpreted and through the JIT, and compares 
+    // the resulting state. Returns the number of programs where they differ.
+    int vm_jit_fuzz( int iterations, unsigned int seed );
+#endif
+
 enum vm_op_t
     {
     VM_OP_HALT, 
@@ -37,9 +61,12 @@ enum vm_op_t
     VM_OP_MOD, VM_OP_AND, VM_OP_NEG, VM_OP_NOT, 
     VM_OP_ORB, VM_OP_XORB, VM_OP_ANDB, VM_OP_NOTB,  
     VM_OP_ADDF, VM_OP_SUBF, VM_OP_MULF, VM_OP_DIVF, VM_OP_MODF, VM_OP_NEGF,     
-    VM_OP_CATC,
-    VM_OP_READ, VM_OP_READF, VM_OP_READC, VM_OP_READB, VM_OP_RSTO,
-    VM_OP_RTSS,
+    VM_OP_CATC, VM_OP_APPENDC,
+    VM_OP_LEN, VM_OP_LEFT, VM_OP_RIGHT, VM_OP_MID, VM_OP_INSTR, VM_OP_CHR, VM_OP_ASC, VM_OP_UPPER, VM_OP_VAL,
+    VM_OP_STR, VM_OP_STRF,
+    VM_OP_READ, VM_OP_READF, VM_OP_READC, VM_OP_READB, VM_OP_RSTO, VM_OP_READA,
+    VM_OP_INDEX, VM_OP_LOADA, VM_OP_STOREA, VM_OP_LOADAC, VM_OP_STOREAC,
+    VM_OP_JTAB,
 
     VM_OPCOUNT,
     };
@@ -61,6 +88,23 @@ struct vm_context_t;
 typedef void (*vm_func_t)( vm_context_t* ctx );
 typedef void (*vm_trace_callback_t)( void* ctx, int pos );
 
+struct vm_builder_t
+    {
+    char* text;
+    int length;
+    int capacity;
+    u32 interned; // Pooled copy of the text, made when the string is loaded, or 0
+    int next_free;
+    };
+
+struct vm_transient_t
+    {
+    char const* text;
+    int length;
+    u32 source; // For substrings of pooled strings, the pooled string they are a view into, or 0
+    int offset; // Start of the substring in the source
+    };
+
 struct vm_context_t
     {
     vm_trace_callback_t trace_callback;
@@ -77,10 +121,37 @@ struct vm_context_t
     u32* pc;
     u32* sp;
     u32* dp;
+    u32 dp_type; // Type of the current DATA run
+    u32 dp_left; // Values left in the current DATA run
 
     strpool_t string_pool;
+
+    vm_builder_t* builders;
+    int builders_count;
+    int builders_capacity;
+    int builders_free;
+
+    vm_transient_t* transients; // Strings on the stack which are not in the string pool
+    int transients_count;
+    int transients_capacity;
+    int transients_live;
+    char* arena; // Text of transient strings, in linked blocks
+    int arena_used;
+    int arena_capacity;
+    u32* int_strings; // Pooled STR() results for small integers, filled in as they are used
+
+    #ifdef VM_JIT
+        struct vm_jit_t* jit;
+    #endif
     };
 
+// Strings on the stack are either string pool handles or transient handles, which can be passed to these
+char const* vm_string_cstr( vm_context_t* ctx, u32 handle );
+int vm_string_length( vm_context_t* ctx, u32 handle );
+u32 vm_string_transient( vm_context_t* ctx, char const* text, int length );
+u32 vm_string_promote( vm_context_t* ctx, u32 handle );
+void vm_string_release( vm_context_t* ctx, u32 handle );
+
 ////////////////////////////////////////////////////////////////////////
 
 template< typename T > struct param_cast
@@ -105,8 +176,8 @@ template<> struct param_cast<bool>
 template<> struct param_cast<char const*>
     {
     param_cast( vm_context_t* ctx, u32 p ) : ctx( ctx ), p( p ) { } 
-    ~param_cast() { if( strpool_decref( &ctx->string_pool, p ) == 0 ) strpool_discard( &ctx->string_pool, p ); }
-    operator char const*() { char const* x = strpool_cstr( &ctx->string_pool, p); return x == 0 ? "" : x; }
+    ~param_cast() { vm_string_release( ctx, p ); }
+    operator char const*() { char const* x = vm_string_cstr( ctx, p ); return x == 0 ? "" : x; }
 
     private:
         vm_context_t* ctx;
@@ -133,9 +204,7 @@ template<> struct ret_cast<char const*>
     {
     ret_cast( vm_context_t* ctx, char const* x )
         { 
-        p = (u32) strpool_inject( &ctx->string_pool, x == 0 ? "" : x, x == 0 ? 0 : ( (int) strlen( x ) ) ); 
-        assert( p );
-        strpool_incref( &ctx->string_pool, p );  
+        p = vm_string_transient( ctx, x == 0 ? "" : x, x == 0 ? 0 : ( (int) strlen( x ) ) ); 
         }   
     
     operator u32() { return p; }
@@ -321,25 +390,173 @@ void vm_proc( vm_context_t* ctx )
 
 ////////////////////////////////////////////////////////////////////////
 
-static char* vm_temp_buffer = 0;
-static int vm_temp_capacity = 0;
+// Strings returned by host functions and CATC are usually consumed by the very next op, so instead of going 
+// into the string pool they get a transient handle, with the text bump allocated from an arena. They are only 
+// added to the pool when stored in a variable, and the arena is reset as soon as no transient strings are left.
+
+#define VM_TRANSIENT_BIT 0x40000000U
+
+static void vm_arena_reset( vm_context_t* ctx )
+    {
+    ctx->transients_count = 0;
+    if( !ctx->arena ) return;
+
+    // Only the current block is kept, the ones before it were too small
+    char* block = *(char**) ctx->arena;
+    while( block )
+        {
+        char* next = *(char**) block;
+        free( block );
+        block = next;
+        }
+    *(char**) ctx->arena = 0;
+    ctx->arena_used = (int) sizeof( char* );
+    }
+
+// Returns space for a zero terminated string of the given length
+static char* vm_arena_alloc( vm_context_t* ctx, int length )
+    {
+    if( ctx->arena_used + length + 1 > ctx->arena_capacity )
+        {
+        // Full blocks are kept, linked through their first bytes, as live transient strings may point into them
+        int capacity = ctx->arena_capacity < 4096 ? 4096 : ctx->arena_capacity * 2;
+        while( capacity < length + 1 + (int) sizeof( char* ) ) capacity *= 2;
+        char* block = (char*) malloc( (size_t) capacity );
+        assert( block );
+        *(char**) block = ctx->arena;
+        ctx->arena = block;
+        ctx->arena_capacity = capacity;
+        ctx->arena_used = (int) sizeof( char* );
+        }
+    char* text = ctx->arena + ctx->arena_used;
+    ctx->arena_used += length + 1;
+    text[ length ] = '\0';
+    return text;
+    }
+
+static vm_transient_t* vm_transient_add( vm_context_t* ctx, u32* handle )
+    {
+    if( ctx->transients_count >= ctx->transients_capacity )
+        {
+        ctx->transients_capacity = ctx->transients_capacity < 64 ? 64 : ctx->transients_capacity * 2;
+        ctx->transients = (vm_transient_t*) realloc( ctx->transients, ctx->transients_capacity * sizeof( vm_transient_t ) );
+        assert( ctx->transients );
+        }
+    vm_transient_t* transient = &ctx->transients[ ctx->transients_count ];
+    transient->source = 0;
+    transient->offset = 0;
+    *handle = VM_TRANSIENT_BIT | (u32) ctx->transients_count++;
+    ++ctx->transients_live;
+    return transient;
+    }
+
+static char* vm_transient_create( vm_context_t* ctx, int length, u32* handle )
+    {
+    char* text = vm_arena_alloc( ctx, length );
+    vm_transient_t* transient = vm_transient_add( ctx, handle );
+    transient->text = text;
+    transient->length = length;
+    return text;
+    }
+
+// Takes over the reference to the given string, and returns a substring of it, without copying the text. The 
+// range must be within the string.
+static u32 vm_string_view( vm_context_t* ctx, u32 handle, int start, int length )
+    {
+    if( start == 0 && length == vm_string_length( ctx, handle ) ) return handle;
+
+    u32 view = 0;
+    vm_transient_t* transient = vm_transient_add( ctx, &view );
+    transient->length = length;
+    if( !( handle & VM_TRANSIENT_BIT ) )
+        {
+        transient->text = 0;
+        transient->source = handle;
+        transient->offset = start;
+        return view;
+        }
+
+    // Views of views refer to the same text, and take over the reference to the pooled source, if any
+    vm_transient_t* parent = &ctx->transients[ handle & ~VM_TRANSIENT_BIT ];
+    transient->text = parent->text ? parent->text + start : 0;
+    transient->source = parent->source;
+    transient->offset = parent->offset + start;
+    parent->source = 0;
+    vm_string_release( ctx, handle );
+    return view;
+    }
+
+u32 vm_string_transient( vm_context_t* ctx, char const* text, int length )
+    {
+    u32 handle = 0;
+    char* copy = vm_transient_create( ctx, length, &handle );
+    memcpy( copy, text, (size_t) length );
+    return handle;
+    }
+
+// The text of a string, which is not zero terminated for substrings ending before the end of their source
+static char const* vm_string_text( vm_context_t* ctx, u32 handle )
+    {
+    if( !( handle & VM_TRANSIENT_BIT ) ) return strpool_cstr( &ctx->string_pool, handle );
+
+    vm_transient_t* transient = &ctx->transients[ handle & ~VM_TRANSIENT_BIT ];
+    if( transient->source == 0 ) return transient->text;
+    return strpool_cstr( &ctx->string_pool, transient->source ) + transient->offset;
+    }
+
+char const* vm_string_cstr( vm_context_t* ctx, u32 handle )
+    {
+    char const* text = vm_string_text( ctx, handle );
+    if( !( handle & VM_TRANSIENT_BIT ) ) return text;
+
+    // Substrings are views into their source string, and only copied once they need to be zero terminated
+    vm_transient_t* transient = &ctx->transients[ handle & ~VM_TRANSIENT_BIT ];
+    if( text[ transient->length ] == '\0' ) return text;
+    char* copy = vm_arena_alloc( ctx, transient->length );
+    memcpy( copy, text, (size_t) transient->length );
+    if( transient->source != 0 )
+        {
+        if( strpool_decref( &ctx->string_pool, transient->source ) == 0 ) strpool_discard( &ctx->string_pool, transient->source );
+        }
+    transient->text = copy;
+    transient->source = 0;
+    transient->offset = 0;
+    return copy;
+    }
+
+int vm_string_length( vm_context_t* ctx, u32 handle )
+    {
+    if( handle & VM_TRANSIENT_BIT ) return ctx->transients[ handle & ~VM_TRANSIENT_BIT ].length;
+    return strpool_length( &ctx->string_pool, handle );
+    }
 
-static char* vm_temp_string( int length ) 
+void vm_string_release( vm_context_t* ctx, u32 handle )
     {
-    if( !vm_temp_buffer )
+    if( handle & VM_TRANSIENT_BIT )
         {
-        vm_temp_capacity = length + 1;
-        vm_temp_buffer = (char*) malloc( (size_t) vm_temp_capacity );
-        assert( vm_temp_buffer );
+        u32 source = ctx->transients[ handle & ~VM_TRANSIENT_BIT ].source;
+        if( source != 0 )
+            {
+            if( strpool_decref( &ctx->string_pool, source ) == 0 ) strpool_discard( &ctx->string_pool, source );
+            }
+        if( --ctx->transients_live == 0 ) vm_arena_reset( ctx );
         }
-    else if( vm_temp_capacity <= length )
+    else if( strpool_decref( &ctx->string_pool, handle ) == 0 ) 
         {
-        vm_temp_capacity = length + 1;
-        vm_temp_buffer = (char*) realloc( vm_temp_buffer, (size_t) vm_temp_capacity );
-        assert( vm_temp_buffer );
+        strpool_discard( &ctx->string_pool, handle );
         }
+    }
 
-    return vm_temp_buffer;
+// Returns a string pool handle holding one reference, for storing the string in a variable
+u32 vm_string_promote( vm_context_t* ctx, u32 handle )
+    {
+    if( !( handle & VM_TRANSIENT_BIT ) ) return handle;
+
+    u32 pooled = (u32) strpool_inject( &ctx->string_pool, vm_string_text( ctx, handle ), vm_string_length( ctx, handle ) );
+    assert( pooled );
+    strpool_incref( &ctx->string_pool, pooled );
+    vm_string_release( ctx, handle );
+    return pooled;
     }
 
 ////////////////////////////////////////////////////////////////////////
@@ -391,13 +608,67 @@ static void op_pushc( vm_context_t* ctx )
 static void op_popc( vm_context_t* ctx )
     {
     u32 value = POP();
-    if( strpool_decref( &ctx->string_pool, value ) == 0 ) strpool_discard( &ctx->string_pool, value );
+    vm_string_release( ctx, value );
+    }
+
+// String variables built up with A$ = A$ + ... hold a builder instead of a pooled string, so appending is done in
+// place in a growable buffer. The text is only added to the string pool when the variable is loaded.
+
+#define VM_BUILDER_BIT 0x80000000U
+
+static u32 vm_load_global( vm_context_t* ctx, u32 value )
+    {
+    if( !( value & VM_BUILDER_BIT ) ) return value;
+
+    vm_builder_t* builder = &ctx->builders[ value & ~VM_BUILDER_BIT ];
+    if( builder->interned == 0 )
+        {
+        builder->interned = (u32) strpool_inject( &ctx->string_pool, builder->text, builder->length );
+        assert( builder->interned );
+        strpool_incref( &ctx->string_pool, builder->interned );
+        }
+    return builder->interned;
+    }
+
+static void vm_release_global( vm_context_t* ctx, u32 value )
+    {
+    if( value & VM_BUILDER_BIT )
+        {
+        int index = (int)( value & ~VM_BUILDER_BIT );
+        vm_builder_t* builder = &ctx->builders[ index ];
+        if( builder->interned != 0 ) 
+            {
+            if( strpool_decref( &ctx->string_pool, builder->interned ) == 0 ) strpool_discard( &ctx->string_pool, builder->interned );
+            }
+        builder->interned = 0;
+        builder->length = 0;
+        builder->next_free = ctx->builders_free;
+        ctx->builders_free = index;
+        }
+    else if( value != 0 )
+        {
+        if( strpool_decref( &ctx->string_pool, value ) == 0 ) strpool_discard( &ctx->string_pool, value );
+        }
+    }
+
+static void vm_builder_append( vm_builder_t* builder, char const* text, int length )
+    {
+    if( !builder->text || builder->length + length > builder->capacity )
+        {
+        int capacity = builder->capacity < 64 ? 64 : builder->capacity;
+        while( capacity < builder->length + length ) capacity *= 2;
+        builder->capacity = capacity;
+        builder->text = (char*) realloc( builder->text, (size_t) capacity );
+        assert( builder->text );
+        }
+    memcpy( builder->text + builder->length, text, (size_t) length );
+    builder->length += length;
     }
 
 static void op_loadc( vm_context_t* ctx )
     {
     u32 index = POP();
-    u32 value = ctx->globals[ index ];
+    u32 value = vm_load_global( ctx, ctx->globals[ index ] );
     PUSH( value );
     strpool_incref( &ctx->string_pool, value );
     }
@@ -406,11 +677,8 @@ static void op_storec( vm_context_t* ctx )
     {
     u32 index = POP();
     u32 value = POP();
-    if( ctx->globals[ index ] != 0 )
-        {
-        if( strpool_decref( &ctx->string_pool, ctx->globals[ index ] ) == 0 ) strpool_discard( &ctx->string_pool, ctx->globals[ index ] );
-        }
-    ctx->globals[ index ] = value;
+    vm_release_global( ctx, ctx->globals[ index ] );
+    ctx->globals[ index ] = vm_string_promote( ctx, value );
     }
 
 static void op_jsr( vm_context_t* ctx )
@@ -445,6 +713,17 @@ static void op_jnz( vm_context_t* ctx )
         }
     }
 
+// Inline operands: entry count, value of the first entry, one offset per entry and a default offset, 
+// all relative to the JTAB op
+static void op_jtab( vm_context_t* ctx )
+    {
+    u32* op = ctx->pc - 1;
+    u32 count = ctx->pc[ 0 ];
+    u32 entry = POP() - ctx->pc[ 1 ];
+    u32* table = ctx->pc + 2;
+    ctx->pc = op + (int) table[ entry < count ? entry : count ];
+    }
+
 static bool op_eqs( int a, int b ) { return a == b; }
 static bool op_nes( int a, int b ) { return a != b; }
 static bool op_les( int a, int b ) { return a <= b; }
@@ -459,8 +738,8 @@ static bool op_gef( float a, float b ) { return a >= b; }
 static bool op_ltf( float a, float b ) { return a < b; }
 static bool op_gtf( float a, float b ) { return a > b; }
 
-static bool op_eqc( char const* a, char const* b ) { return a == b; }
-static bool op_nec( char const* a, char const* b ) { return a != b; }
+static bool op_eqc( char const* a, char const* b ) { return a == b || strcmp( a, b ) == 0; }
+static bool op_nec( char const* a, char const* b ) { return a != b && strcmp( a, b ) != 0; }
 static bool op_lec( char const* a, char const* b ) { return strcmp( a, b ) <= 0; }
 static bool op_gec( char const* a, char const* b ) { return strcmp( a, b ) >= 0; }
 static bool op_ltc( char const* a, char const* b ) { return strcmp( a, b ) < 0; }
@@ -482,30 +761,281 @@ static bool op_xorb( bool a, bool b ) { return (!a && b ) || ( !b && a ); }
 static bool op_andb( bool a, bool b ) { return a && b; }
 static bool op_notb( bool a ) { return !a; }
 
-static float op_addf( float a, float b ) { return a + b; }
-static float op_subf( float a, float b ) { return a - b; }
-static float op_mulf( float a, float b ) { return a * b; }
-static float op_divf( float a, float b ) { return a / b; }
-static float op_modf( float a, float b ) { return fmodf( a , b ); }
+// Float ops that give NaN return the quiet NaN VM_NAN, as the sign and payload of a NaN result depend on which
+// operand the hardware takes it from, and compilers and the JIT are free to apply the operands in either order
+#define VM_NAN 0x7fc00000U
+
+static float vm_nan_canonical( float value )
+    {
+    u32 bits = *(u32*)&value;
+    if( ( bits & 0x7fffffffU ) <= 0x7f800000U ) return value;
+    bits = VM_NAN;
+    return *(float*)&bits;
+    }
+
+static float op_addf( float a, float b ) { return vm_nan_canonical( a + b ); }
+static float op_subf( float a, float b ) { return vm_nan_canonical( a - b ); }
+static float op_mulf( float a, float b ) { return vm_nan_canonical( a * b ); }
+static float op_divf( float a, float b ) { return vm_nan_canonical( a / b ); }
+static float op_modf( float a, float b ) { return vm_nan_canonical( fmodf( a , b ) ); }
 static float op_negf( float a ) { return -a; }
 
 static void op_catc( vm_context_t* ctx )
     {
     u32 b = POP();
     u32 a = POP();
-    char const* sa = strpool_cstr( &ctx->string_pool, a );
-    char const* sb = strpool_cstr( &ctx->string_pool, b );
+    char const* sa = vm_string_cstr( ctx, a );
+    char const* sb = vm_string_cstr( ctx, b );
     assert( sa && sb );
-    int la = strpool_length( &ctx->string_pool, a );
-    int lb = strpool_length( &ctx->string_pool, b );
-    char* temp = vm_temp_string( la + lb );
-    strcpy( temp, sa );
-    strcat( temp, sb );
-    u32 r = (u32) strpool_inject( &ctx->string_pool, temp, la + lb );
+    int la = vm_string_length( ctx, a );
+    int lb = vm_string_length( ctx, b );
+    u32 r = 0;
+    char* text = vm_transient_create( ctx, la + lb, &r );
+    memcpy( text, sa, (size_t) la );
+    memcpy( text + la, sb, (size_t) lb );
+    PUSH( r );
+    vm_string_release( ctx, a );
+    vm_string_release( ctx, b );
+    }
+
+// A$ = A$ + value, turning the variable into a builder on the first append
+static void op_appendc( vm_context_t* ctx )
+    {
+    u32 index = POP();
+    u32 value = POP();
+    u32 current = ctx->globals[ index ];
+    vm_builder_t* builder = 0;
+    if( current & VM_BUILDER_BIT )
+        {
+        builder = &ctx->builders[ current & ~VM_BUILDER_BIT ];
+        if( builder->interned != 0 ) 
+            {
+            if( strpool_decref( &ctx->string_pool, builder->interned ) == 0 ) strpool_discard( &ctx->string_pool, builder->interned );
+            builder->interned = 0;
+            }
+        }
+    else
+        {
+        int builder_index = ctx->builders_free;
+        if( builder_index >= 0 )
+            {
+            ctx->builders_free = ctx->builders[ builder_index ].next_free;
+            }
+        else
+            {
+            if( ctx->builders_count >= ctx->builders_capacity )
+                {
+                ctx->builders_capacity = ctx->builders_capacity < 16 ? 16 : ctx->builders_capacity * 2;
+                ctx->builders = (vm_builder_t*) realloc( ctx->builders, ctx->builders_capacity * sizeof( vm_builder_t ) );
+                assert( ctx->builders );
+                }
+            builder_index = ctx->builders_count++;
+            ctx->builders[ builder_index ].text = 0;
+            ctx->builders[ builder_index ].capacity = 0;
+            }
+        builder = &ctx->builders[ builder_index ];
+        builder->length = 0;
+        builder->interned = 0;
+        if( current != 0 )
+            {
+            vm_builder_append( builder, strpool_cstr( &ctx->string_pool, current ), strpool_length( &ctx->string_pool, current ) );
+            vm_release_global( ctx, current );
+            }
+        ctx->globals[ index ] = VM_BUILDER_BIT | (u32) builder_index;
+        }
+
+    char const* text = vm_string_cstr( ctx, value );
+    assert( text );
+    vm_builder_append( builder, text, vm_string_length( ctx, value ) );
+    vm_string_release( ctx, value );
+    }
+
+// String functions. Positions are 1-based, and out of range lengths and positions are clamped to the string. 
+// LEFT$, RIGHT$ and MID$ return views into the original string, see vm_string_view.
+
+static void op_len( vm_context_t* ctx )
+    {
+    u32 s = POP();
+    int length = vm_string_length( ctx, s );
+    vm_string_release( ctx, s );
+    PUSH( length );
+    }
+
+static void op_left( vm_context_t* ctx )
+    {
+    int count = (int) POP();
+    u32 s = POP();
+    int length = vm_string_length( ctx, s );
+    count = count < 0 ? 0 : count > length ? length : count;
+    u32 r = vm_string_view( ctx, s, 0, count );
+    PUSH( r );
+    }
+
+static void op_right( vm_context_t* ctx )
+    {
+    int count = (int) POP();
+    u32 s = POP();
+    int length = vm_string_length( ctx, s );
+    count = count < 0 ? 0 : count > length ? length : count;
+    u32 r = vm_string_view( ctx, s, length - count, count );
+    PUSH( r );
+    }
+
+static void op_mid( vm_context_t* ctx )
+    {
+    int count = (int) POP();
+    int start = (int) POP() - 1;
+    u32 s = POP();
+    int length = vm_string_length( ctx, s );
+    start = start < 0 ? 0 : start > length ? length : start;
+    count = count < 0 ? 0 : count > length - start ? length - start : count;
+    u32 r = vm_string_view( ctx, s, start, count );
+    PUSH( r );
+    }
+
+static void op_instr( vm_context_t* ctx )
+    {
+    u32 find = POP();
+    u32 s = POP();
+    char const* text = vm_string_text( ctx, s );
+    char const* pattern = vm_string_text( ctx, find );
+    int length = vm_string_length( ctx, s );
+    int pattern_length = vm_string_length( ctx, find );
+    int position = 0;
+    if( text && pattern )
+        {
+        for( int i = 0; i + pattern_length <= length; ++i )
+            {
+            if( memcmp( text + i, pattern, (size_t) pattern_length ) == 0 ) { position = i + 1; break; }
+            }
+        }
+    vm_string_release( ctx, s );
+    vm_string_release( ctx, find );
+    PUSH( position );
+    }
+
+static void op_chr( vm_context_t* ctx )
+    {
+    u32 code = POP();
+    u32 r = 0;
+    char* text = vm_transient_create( ctx, 1, &r );
+    text[ 0 ] = (char) code;
+    PUSH( r );
+    }
+
+static void op_asc( vm_context_t* ctx )
+    {
+    u32 s = POP();
+    char const* text = vm_string_text( ctx, s );
+    int code = text && vm_string_length( ctx, s ) > 0 ? (int)(unsigned char) text[ 0 ] : 0;
+    vm_string_release( ctx, s );
+    PUSH( code );
+    }
+
+static void op_upper( vm_context_t* ctx )
+    {
+    u32 s = POP();
+    char const* text = vm_string_text( ctx, s );
+    int length = text ? vm_string_length( ctx, s ) : 0;
+    u32 r = 0;
+    char* upper = vm_transient_create( ctx, length, &r );
+    for( int i = 0; i < length; ++i ) upper[ i ] = ( text[ i ] >= 'a' && text[ i ] <= 'z' ) ? (char)( text[ i ] - 'a' + 'A' ) : text[ i ];
+    vm_string_release( ctx, s );
+    PUSH( r );
+    }
+
+static void op_val( vm_context_t* ctx )
+    {
+    u32 s = POP();
+    char const* text = vm_string_cstr( ctx, s );
+    float value = text ? (float) atof( text ) : 0.0f;
+    vm_string_release( ctx, s );
+    PUSH( value );
+    }
+
+// STR() formats without going through snprintf. Results for small integers are pooled the first time they are
+// needed and kept, so that the common case of printing a score or a counter is a table lookup.
+
+#define VM_STR_CACHE_MIN -1024
+#define VM_STR_CACHE_MAX 65535
+
+static int vm_format_digits( char* out, unsigned long long value )
+    {
+    char digits[ 20 ];
+    int count = 0;
+    do
+        {
+        digits[ count++ ] = (char)( '0' + value % 10 );
+        value /= 10;
+        }
+    while( value );
+    for( int i = 0; i < count; ++i ) out[ i ] = digits[ count - 1 - i ];
+    return count;
+    }
+
+static int vm_format_int( char* out, int value )
+    {
+    if( value >= 0 ) return vm_format_digits( out, (unsigned long long) value );
+    out[ 0 ] = '-';
+    return 1 + vm_format_digits( out + 1, 0ull - (unsigned long long)(long long) value );
+    }
+
+// Same output as "%f". A float has 24 significant bits, so value * 1000000 is exact in a double, and rounding it to
+// the nearest integer (ties to even) gives the same six decimals as printf.
+static int vm_format_float( char* out, float value )
+    {
+    double d = (double) value;
+    if( !( d > -9.0e12 && d < 9.0e12 ) ) return snprintf( out, 64, "%f", d ); // NaN, infinity or too large
+    long long fixed = llrint( fabs( d ) * 1000000.0 );
+    int length = 0;
+    if( signbit( d ) ) out[ length++ ] = '-';
+    length += vm_format_digits( out + length, (unsigned long long)( fixed / 1000000 ) );
+    out[ length++ ] = '.';
+    int fraction = (int)( fixed % 1000000 );
+    for( int i = 5; i >= 0; --i ) 
+        {
+        out[ length + i ] = (char)( '0' + fraction % 10 );
+        fraction /= 10;
+        }
+    return length + 6;
+    }
+
+static void op_str( vm_context_t* ctx )
+    {
+    int value = (int) POP();
+    char text[ 16 ];
+    if( value >= VM_STR_CACHE_MIN && value <= VM_STR_CACHE_MAX )
+        {
+        if( !ctx->int_strings )
+            {
+            ctx->int_strings = (u32*) calloc( VM_STR_CACHE_MAX - VM_STR_CACHE_MIN + 1, sizeof( u32 ) );
+            assert( ctx->int_strings );
+            }
+        u32* cached = &ctx->int_strings[ value - VM_STR_CACHE_MIN ];
+        if( *cached == 0 )
+            {
+            *cached = (u32) strpool_inject( &ctx->string_pool, text, vm_format_int( text, value ) );
+            assert( *cached );
+            strpool_incref( &ctx->string_pool, *cached ); // Held by the cache
+            }
+        strpool_incref( &ctx->string_pool, *cached );
+        PUSH( *cached );
+        return;
+        }
+    int length = vm_format_int( text, value );
+    u32 r = 0;
+    memcpy( vm_transient_create( ctx, length, &r ), text, (size_t) length );
+    PUSH( r );
+    }
+
+static void op_strf( vm_context_t* ctx )
+    {
+    float value = POPF();
+    char text[ 64 ];
+    int length = vm_format_float( text, value );
+    u32 r = 0;
+    memcpy( vm_transient_create( ctx, length, &r ), text, (size_t) length );
     PUSH( r );
-    strpool_incref( &ctx->string_pool, r );
-    if( strpool_decref( &ctx->string_pool, a ) == 0 ) strpool_discard( &ctx->string_pool, a );
-    if( strpool_decref( &ctx->string_pool, b ) == 0 ) strpool_discard( &ctx->string_pool, b );
     }
 
 enum type_t
@@ -518,12 +1048,27 @@ enum type_t
     TYPE_ID,
     };
 
+// DATA is stored as runs of untagged values, each preceded by its type and count. Returns the number of values 
+// left in the current run, moving on to the next run if needed, or 0 if out of data
+static u32 vm_data_run( vm_context_t* ctx, u32 type, u32 pos )
+    {
+    static char const* type_names[] = { "NONE", "BOOLEAN", "INTEGER", "FLOAT", "STRING" };
+    if( ctx->dp_left == 0 )
+        {
+        if( ctx->dp >= ctx->data_end ) { printf( "\nRUNTIME ERROR: Out of data, at %d\n\n", pos ); return 0; }
+        ctx->dp_type = *ctx->dp++;
+        ctx->dp_left = *ctx->dp++;
+        }
+    if( ctx->dp_type != type ) { printf( "\nRUNTIME ERROR: Type mismatch, expected %s, at %d\n\n", type_names[ type ], pos ); }
+    return ctx->dp_left;
+    }
+
 static void op_read( vm_context_t* ctx )
     {
     u32 index = POP();
     u32 pos = POP();
-    if( ctx->dp >= ctx->data_end ) { printf( "\nRUNTIME ERROR: Out of data, at %d\n\n", pos ); return; }
-    if( *ctx->dp++ != TYPE_INTEGER ) { printf( "\nRUNTIME ERROR: Type mismatch, expected INTEGER, at %d\n\n", pos ); }
+    if( !vm_data_run( ctx, TYPE_INTEGER, pos ) ) return;
+    --ctx->dp_left;
     ctx->globals[ index ] = *ctx->dp++;
     }
 
@@ -531,8 +1076,8 @@ static void op_readf( vm_context_t* ctx )
     {
     u32 index = POP();
     u32 pos = POP();
-    if( ctx->dp >= ctx->data_end ) { printf( "\nRUNTIME ERROR: Out of data, at %d\n\n", pos ); return; }
-    if( *ctx->dp++ != TYPE_FLOAT ) { printf( "\nRUNTIME ERROR: Type mismatch, expected FLOAT, at %d\n\n", pos ); }
+    if( !vm_data_run( ctx, TYPE_FLOAT, pos ) ) return;
+    --ctx->dp_left;
     ctx->globals[ index ] = *ctx->dp++;
     }
 
@@ -540,12 +1085,9 @@ static void op_readc( vm_context_t* ctx )
     {
     u32 index = POP();
     u32 pos = POP();
-    if( ctx->dp >= ctx->data_end ) { printf( "\nRUNTIME ERROR: Out of data, at %d\n\n", pos ); return; }
-    if( *ctx->dp++ != TYPE_STRING ) { printf( "\nRUNTIME ERROR: Type mismatch, expected STRING, at %d\n\n", pos ); }
-    if( ctx->globals[ index ] != 0 )
-        {
-        if( strpool_decref( &ctx->string_pool, ctx->globals[ index ] ) == 0 ) strpool_discard( &ctx->string_pool, ctx->globals[ index ] );
-        }
+    if( !vm_data_run( ctx, TYPE_STRING, pos ) ) return;
+    --ctx->dp_left;
+    vm_release_global( ctx, ctx->globals[ index ] );
     ctx->globals[ index ] = *ctx->dp++;
     strpool_incref( &ctx->string_pool, ctx->globals[ index ]  );
     }
@@ -554,27 +1096,111 @@ static void op_readb( vm_context_t* ctx )
     {
     u32 index = POP();
     u32 pos = POP();
-    if( ctx->dp >= ctx->data_end ) { printf( "\nRUNTIME ERROR: Out of data, at %d\n\n", pos ); return; }
-    if( *ctx->dp++ != TYPE_BOOL ) { printf( "\nRUNTIME ERROR: Type mismatch, expected BOOLEAN, at %d\n\n", pos ); }
+    if( !vm_data_run( ctx, TYPE_BOOL, pos ) ) return;
+    --ctx->dp_left;
     ctx->globals[ index ] = *ctx->dp++;
     }
 
+// READ ARRAY, filling the first count elements of an array from DATA, a run at a time
+static void op_reada( vm_context_t* ctx )
+    {
+    u32 count = POP();
+    u32 size = POP();
+    u32 index = POP();
+    u32 type = POP();
+    u32 pos = POP();
+    if( count > size ) 
+        {
+        printf( "\nRUNTIME ERROR: Count out of range [ %d <= %d <= %d ] at %d\n\n", 0, (int) count, (int) size, pos );
+        count = (int) count < 0 ? 0 : size;
+        }
+
+    u32* dest = ctx->globals + index;
+    while( count > 0 )
+        {
+        u32 run = vm_data_run( ctx, type, pos );
+        if( !run ) return;
+        if( run > count ) run = count;
+        if( type == TYPE_STRING )
+            {
+            for( u32 i = 0; i < run; ++i )
+                {
+                if( dest[ i ] != 0 )
+                    {
+                    if( strpool_decref( &ctx->string_pool, dest[ i ] ) == 0 ) strpool_discard( &ctx->string_pool, dest[ i ] );
+                    }
+                dest[ i ] = ctx->dp[ i ];
+                strpool_incref( &ctx->string_pool, dest[ i ] );
+                }
+            }
+        else
+            {
+            memcpy( dest, ctx->dp, run * sizeof( u32 ) );
+            }
+        dest += run;
+        ctx->dp += run;
+        ctx->dp_left -= run;
+        count -= run;
+        }
+    }
+
 static void op_rsto( vm_context_t* ctx )
     {
     u32 offset = POP();
     ctx->dp = (u32*) ctx->data;
     ctx->dp += offset;
+    ctx->dp_left = 0;
     }
 
-static int op_rtss( int index, int min, int max, int pos )
+// Array access. INDEX takes the array base, max subscript and source pos as inline operands, and 
+// turns the subscript on the stack into a range checked global index. The LOADA/STOREA family 
+// is used for subscripts the compiler has proven to be in range, and only takes the array base.
+
+static void op_index( vm_context_t* ctx )
     {
-    if( index < min || index > max )
+    int base = (int) *ctx->pc++;
+    int max = (int) *ctx->pc++;
+    int pos = (int) *ctx->pc++;
+    int index = (int) POP();
+    if( index < 0 || index > max )
         {
-        printf( "\nRUNTIME ERROR: Subscript out of range [ %d <= %d <= %d ] at %d\n\n", min, index, max, pos );
+        printf( "\nRUNTIME ERROR: Subscript out of range [ %d <= %d <= %d ] at %d\n\n", 0, index, max, pos );
         if( index > max ) index = max;
-        if( index < min ) index = min;
+        if( index < 0 ) index = 0;
+        }
+    u32 global = (u32)( base + index );
+    PUSH( global );
+    }
+
+static void op_loada( vm_context_t* ctx )
+    {
+    u32 index = *ctx->pc++ + POP();
+    PUSH( ctx->globals[ index ] );
+    }
+
+static void op_storea( vm_context_t* ctx )
+    {
+    u32 index = *ctx->pc++ + POP();
+    ctx->globals[ index ] = POP();
+    }
+
+static void op_loadac( vm_context_t* ctx )
+    {
+    u32 index = *ctx->pc++ + POP();
+    u32 value = ctx->globals[ index ];
+    PUSH( value );
+    strpool_incref( &ctx->string_pool, value );
+    }
+
+static void op_storeac( vm_context_t* ctx )
+    {
+    u32 index = *ctx->pc++ + POP();
+    u32 value = POP();
+    if( ctx->globals[ index ] != 0 )
+        {
+        if( strpool_decref( &ctx->string_pool, ctx->globals[ index ] ) == 0 ) strpool_discard( &ctx->string_pool, ctx->globals[ index ] );
         }
-    return index;
+    ctx->globals[ index ] = vm_string_promote( ctx, value );
     }
 
 ////////////////////////////////////////////////////////////////////////
@@ -632,40 +1258,766 @@ static vm_func_t vm_ops[] =
     vm_func< float, op_modf, float, float >,
     vm_func< float, op_negf, float >,
 
-    op_catc,
-    op_read, op_readf, op_readc, op_readb, op_rsto, 
+    op_catc, op_appendc,
+    op_len, op_left, op_right, op_mid, op_instr, op_chr, op_asc, op_upper, op_val,
+    op_str, op_strf,
+    op_read, op_readf, op_readc, op_readb, op_rsto, op_reada,
     
-    vm_func< int, op_rtss, int, int, int, int >,
+    op_index, op_loada, op_storea, op_loadac, op_storeac,
+    op_jtab,
     };
 
 ////////////////////////////////////////////////////////////////////////
 
-void vm_init( vm_context_t* ctx, void* code, int code_size, void* map, int map_size, void* data, int data_size,  
-    int stack_size, int globals_size, vm_func_t* host_funcs, int host_funcs_count, 
-    char const* strings, int string_count, vm_trace_callback_t trace_callback, void* trace_context )
-    {
-    ctx->trace_callback = trace_callback;
-    ctx->trace_context = trace_context;
-    ctx->tracing = false;
+#ifdef VM_JIT
 
-    ctx->is_paused = false;
+// Template JIT for hot loops. vm_run counts how often each backward jump is taken, and when a loop head reaches
+// the threshold, the bytecode from the loop head to the jump is translated to x86-64 code by stitching together
+// a fixed template per op. The VM stack stays in memory, with r13 holding the stack pointer, r12 the globals base
+// and rbx the context, so ops without a template are run by calling their handler through ctx->optable. The
+// native code returns to the interpreter when leaving the loop, on ops it can't run (HALT, TRON, TROFF, JSR, RET
+// and computed jumps), when a host function pauses the VM, and when the op budget given to vm_run runs out.
 
-    int vm_op_count = sizeof( vm_ops ) / sizeof( vm_ops[ 0 ] );
-    assert( vm_op_count == VM_OPCOUNT );
-    int optable_count = vm_op_count + host_funcs_count;
-    ctx->optable = (vm_func_t*) malloc( optable_count * sizeof( vm_func_t ) );
-    assert( ctx->optable );
-    for( int i = 0; i < vm_op_count; ++i ) ctx->optable[ i ] = vm_ops[ i ];
-    for( int i = 0; i < host_funcs_count; ++i ) ctx->optable[ vm_op_count + i ] = host_funcs[ i ];
+#ifdef _WIN32
+    #define _WINSOCKAPI_
+    #pragma warning( push )
+    #pragma warning( disable: 4668 ) // 'symbol' is not defined as a preprocessor macro, replacing with '0' for 'directives'
+    #pragma warning( disable: 4255 )
+    #include <windows.h>
+    #pragma warning( pop )
 
-    ctx->code = malloc( (size_t) code_size );
-    assert( ctx->code );
-    ctx->map = (u32*) malloc( (size_t) map_size );
-    assert( ctx->map );
-    ctx->data = malloc( (size_t) data_size );
-    assert( ctx->data );
-    ctx->data_end = (void*) ( ( (uintptr_t) ctx->data ) + data_size );
-    ctx->stack = malloc( (size_t) stack_size );
+    static unsigned char* vm_jit_alloc_exec( int size )
+        {
+        return (unsigned char*) VirtualAlloc( NULL, (SIZE_T) size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE );
+        }
+
+    static void vm_jit_free_exec( unsigned char* memory, int size )
+        {
+        (void) size;
+        VirtualFree( memory, 0, MEM_RELEASE );
+        }
+#else
+    #include <sys/mman.h>
+
+    static unsigned char* vm_jit_alloc_exec( int size )
+        {
+        void* memory = mmap( NULL, (size_t) size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        return memory == MAP_FAILED ? NULL : (unsigned char*) memory;
+        }
+
+    static void vm_jit_free_exec( unsigned char* memory, int size )
+        {
+        munmap( memory, (size_t) size );
+        }
+#endif
+
+#define VM_JIT_MEMORY_SIZE ( 1024 * 1024 )
+#define VM_JIT_THRESHOLD 64
+#define VM_JIT_MAX_REGION 8192
+#define VM_JIT_FAILED 0xffff
+
+typedef int (*vm_jit_func_t)( vm_context_t* ctx, int op_count );
+
+struct vm_jit_t
+    {
+    unsigned char* memory;
+    int memory_used;
+    int threshold;
+    unsigned short* counters; // Number of backward jumps taken to each code word, or VM_JIT_FAILED
+    vm_jit_func_t* entries; // Compiled loop starting at each code word, or NULL
+    };
+
+
+static vm_jit_t* vm_jit_create( int code_count )
+    {
+    unsigned char* memory = vm_jit_alloc_exec( VM_JIT_MEMORY_SIZE );
+    if( !memory ) return NULL;
+
+    vm_jit_t* jit = (vm_jit_t*) malloc( sizeof( vm_jit_t ) );
+    assert( jit );
+    jit->memory = memory;
+    jit->memory_used = 0;
+    jit->threshold = VM_JIT_THRESHOLD;
+    jit->counters = (unsigned short*) malloc( sizeof( *jit->counters ) * ( code_count + 1 ) );
+    assert( jit->counters );
+    memset( jit->counters, 0, sizeof( *jit->counters ) * ( code_count + 1 ) );
+    jit->entries = (vm_jit_func_t*) malloc( sizeof( *jit->entries ) * ( code_count + 1 ) );
+    assert( jit->entries );
+    for( int i = 0; i <= code_count; ++i ) jit->entries[ i ] = NULL;
+    return jit;
+    }
+
+
+static void vm_jit_destroy( vm_jit_t* jit )
+    {
+    vm_jit_free_exec( jit->memory, VM_JIT_MEMORY_SIZE );
+    free( jit->entries );
+    free( jit->counters );
+    free( jit );
+    }
+
+
+enum vm_jit_reg_t
+    {
+    JIT_RAX = 0, JIT_RCX = 1, JIT_RDX = 2, JIT_RBX = 3, JIT_RSP = 4, JIT_RBP = 5, JIT_RSI = 6, JIT_RDI = 7,
+    JIT_R12 = 12, JIT_R13 = 13, JIT_R14 = 14, JIT_R15 = 15,
+
+    JIT_CTX = JIT_RBX, JIT_GLOBALS = JIT_R12, JIT_SP = JIT_R13, JIT_BUDGET = JIT_R14, JIT_START_BUDGET = JIT_R15,
+    #ifdef _WIN32
+        JIT_ARG0 = JIT_RCX, JIT_ARG1 = JIT_RDX,
+    #else
+        JIT_ARG0 = JIT_RDI, JIT_ARG1 = JIT_RSI,
+    #endif
+    };
+
+enum vm_jit_cc_t { JIT_JMP = -1, JIT_AE = 0x3, JIT_Z = 0x4, JIT_NZ = 0x5, JIT_A = 0x7, JIT_L = 0xc, JIT_GE = 0xd,
+    JIT_LE = 0xe, JIT_G = 0xf };
+
+struct vm_jit_fixup_t
+    {
+    int at; // Position of the rel32 to patch
+    int base; // Position the rel32 is relative to
+    int target; // Bytecode position to jump to
+    bool exit; // Always leave native code, even if target is inside the loop
+    };
+
+struct vm_jit_emitter_t
+    {
+    unsigned char* out;
+    int count;
+    int capacity;
+
+    vm_jit_fixup_t* fixups;
+    int fixups_count;
+    int fixups_capacity;
+
+    int start;
+    int end;
+    int* labels; // Native offset of each code word in the loop, or -1 if not an op start
+    int loop_ops;
+    };
+
+
+static void jit_byte( vm_jit_emitter_t* e, int value )
+    {
+    if( e->count >= e->capacity )
+        {
+        e->capacity *= 2;
+        e->out = (unsigned char*) realloc( e->out, (size_t) e->capacity );
+        assert( e->out );
+        }
+    e->out[ e->count++ ] = (unsigned char) value;
+    }
+
+
+static void jit_u32( vm_jit_emitter_t* e, u32 value )
+    {
+    for( int i = 0; i < 4; ++i ) jit_byte( e, (int)( ( value >> ( i * 8 ) ) & 0xff ) );
+    }
+
+
+static void jit_u64( vm_jit_emitter_t* e, unsigned long long value )
+    {
+    for( int i = 0; i < 8; ++i ) jit_byte( e, (int)( ( value >> ( i * 8 ) ) & 0xff ) );
+    }
+
+
+static void jit_opcode( vm_jit_emitter_t* e, int prefix, bool wide, int opcode, int reg, int index, int base )
+    {
+    if( prefix ) jit_byte( e, prefix );
+    int rex = 0x40 | ( wide ? 8 : 0 ) | ( ( reg & 8 ) ? 4 : 0 ) | ( index >= 0 && ( index & 8 ) ? 2 : 0 ) | ( ( base & 8 ) ? 1 : 0 );
+    if( rex != 0x40 ) jit_byte( e, rex );
+    if( opcode > 0xff ) jit_byte( e, opcode >> 8 );
+    jit_byte( e, opcode & 0xff );
+    }
+
+
+// Instruction with a [ base + index * 4 + disp ] operand. Pass -1 for no index. Opcodes from the 0x0f map are
+// given as 0x0fXX, and prefix is the mandatory prefix of SSE instructions, or 0. For instructions with an opcode
+// extension, the extension is passed as reg
+static void jit_mem( vm_jit_emitter_t* e, int prefix, bool wide, int opcode, int reg, int base, int index, int disp )
+    {
+    jit_opcode( e, prefix, wide, opcode, reg, index, base );
+    if( index >= 0 )
+        {
+        jit_byte( e, 0x84 | ( ( reg & 7 ) << 3 ) );
+        jit_byte( e, 0x80 | ( ( index & 7 ) << 3 ) | ( base & 7 ) );
+        }
+    else if( ( base & 7 ) == JIT_RSP )
+        {
+        jit_byte( e, 0x84 | ( ( reg & 7 ) << 3 ) );
+        jit_byte( e, 0x24 );
+        }
+    else
+        {
+        jit_byte( e, 0x80 | ( ( reg & 7 ) << 3 ) | ( base & 7 ) );
+        }
+    jit_u32( e, (u32) disp );
+    }
+
+
+// Register to register instruction, with reg in the modrm reg field and rm in the modrm rm field
+static void jit_reg( vm_jit_emitter_t* e, bool wide, int opcode, int reg, int rm )
+    {
+    jit_opcode( e, 0, wide, opcode, reg, -1, rm );
+    jit_byte( e, 0xc0 | ( ( reg & 7 ) << 3 ) | ( rm & 7 ) );
+    }
+
+
+static void jit_adjust_sp( vm_jit_emitter_t* e, int bytes )
+    {
+    jit_reg( e, true, 0x81, bytes < 0 ? 5 : 0, JIT_SP ); // add/sub r13, imm32
+    jit_u32( e, (u32)( bytes < 0 ? -bytes : bytes ) );
+    }
+
+
+// Emits a rel32 to the native code for the given bytecode position, to be patched by vm_jit_compile
+static void jit_fixup( vm_jit_emitter_t* e, int base, int target, bool exit )
+    {
+    if( e->fixups_count >= e->fixups_capacity )
+        {
+        e->fixups_capacity *= 2;
+        e->fixups = (vm_jit_fixup_t*) realloc( e->fixups, sizeof( *e->fixups ) * e->fixups_capacity );
+        assert( e->fixups );
+        }
+    e->fixups[ e->fixups_count ].at = e->count;
+    e->fixups[ e->fixups_count ].base = base;
+    e->fixups[ e->fixups_count ].target = target;
+    e->fixups[ e->fixups_count ].exit = exit;
+    ++e->fixups_count;
+    jit_u32( e, 0 );
+    }
+
+
+// Jumps to the native code for the given bytecode position, or out to the interpreter if it isn't in the loop
+static void jit_jump( vm_jit_emitter_t* e, int cc, int target, bool exit )
+    {
+    if( cc == JIT_JMP )
+        {
+        jit_byte( e, 0xe9 );
+        }
+    else
+        {
+        jit_byte( e, 0x0f );
+        jit_byte( e, 0x80 | cc );
+        }
+    jit_fixup( e, e->count + 4, target, exit );
+    }
+
+
+// Backward jumps within the loop use up the op budget, and leaves native code when it is spent
+static void jit_branch( vm_jit_emitter_t* e, int cc, int pos, int target )
+    {
+    if( target < e->start || target > pos )
+        {
+        jit_jump( e, cc, target, false );
+        return;
+        }
+
+    int skip = -1;
+    if( cc != JIT_JMP )
+        {
+        jit_byte( e, 0x0f );
+        jit_byte( e, 0x80 | ( cc ^ 1 ) );
+        skip = e->count;
+        jit_u32( e, 0 );
+        }
+    jit_reg( e, true, 0x81, 5, JIT_BUDGET ); // sub r14, imm32
+    jit_u32( e, (u32) e->loop_ops );
+    jit_jump( e, JIT_LE, target, true );
+    jit_jump( e, JIT_JMP, target, false );
+    if( skip >= 0 )
+        {
+        u32 rel = (u32)( e->count - ( skip + 4 ) );
+        memcpy( e->out + skip, &rel, sizeof( rel ) );
+        }
+    }
+
+
+// Calls the op handler through ctx->optable, with ctx->pc pointing past the opcode, as in the interpreter
+static void jit_call( vm_jit_emitter_t* e, u32 op, u32* pc )
+    {
+    jit_opcode( e, 0, true, 0xb8, 0, -1, JIT_RAX ); // mov rax, imm64
+    jit_u64( e, (unsigned long long)(uintptr_t) pc );
+    jit_mem( e, 0, true, 0x89, JIT_RAX, JIT_CTX, -1, (int) offsetof( vm_context_t, pc ) ); // mov [rbx+pc], rax
+    jit_mem( e, 0, true, 0x89, JIT_SP, JIT_CTX, -1, (int) offsetof( vm_context_t, sp ) ); // mov [rbx+sp], r13
+    jit_reg( e, true, 0x89, JIT_CTX, JIT_ARG0 ); // mov arg0, rbx
+    jit_mem( e, 0, true, 0x8b, JIT_RAX, JIT_CTX, -1, (int) offsetof( vm_context_t, optable ) ); // mov rax, [rbx+optable]
+    jit_mem( e, 0, false, 0xff, 2, JIT_RAX, -1, (int)( op * sizeof( vm_func_t ) ) ); // call [rax+op*8]
+    jit_mem( e, 0, true, 0x8b, JIT_SP, JIT_CTX, -1, (int) offsetof( vm_context_t, sp ) ); // mov r13, [rbx+sp]
+    }
+
+
+// Binary op on the two topmost stack entries: eax = [sp-8], <op> eax, [sp-4], [sp-8] = eax, sp -= 4
+static void jit_binary( vm_jit_emitter_t* e, int opcode )
+    {
+    jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -8 );
+    jit_mem( e, 0, false, opcode, JIT_RAX, JIT_SP, -1, -4 );
+    jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -8 );
+    jit_adjust_sp( e, -4 );
+    }
+
+
+// Sets eax to 0 or 1 from the condition code
+static void jit_setcc( vm_jit_emitter_t* e, int cc )
+    {
+    jit_reg( e, false, 0x0f90 | cc, 0, JIT_RAX ); // setcc al
+    jit_reg( e, false, 0x0fb6, JIT_RAX, JIT_RAX ); // movzx eax, al
+    }
+
+
+static void jit_compare( vm_jit_emitter_t* e, int cc )
+    {
+    jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -8 ); // mov eax, [r13-8]
+    jit_mem( e, 0, false, 0x3b, JIT_RAX, JIT_SP, -1, -4 ); // cmp eax, [r13-4]
+    jit_setcc( e, cc );
+    jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -8 );
+    jit_adjust_sp( e, -4 );
+    }
+
+
+// Float compares are done with the operands swapped for < and <=, so that unordered compares are false
+static void jit_comparef( vm_jit_emitter_t* e, bool swap, int cc )
+    {
+    jit_mem( e, 0xf3, false, 0x0f10, 0, JIT_SP, -1, swap ? -4 : -8 ); // movss xmm0, [r13-8]
+    jit_mem( e, 0, false, 0x0f2e, 0, JIT_SP, -1, swap ? -8 : -4 ); // ucomiss xmm0, [r13-4]
+    jit_setcc( e, cc );
+    jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -8 );
+    jit_adjust_sp( e, -4 );
+    }
+
+
+// NaN results are replaced by VM_NAN, as in the interpreter
+static void jit_binaryf( vm_jit_emitter_t* e, int opcode )
+    {
+    jit_mem( e, 0xf3, false, 0x0f10, 0, JIT_SP, -1, -8 ); // movss xmm0, [r13-8]
+    jit_mem( e, 0xf3, false, opcode, 0, JIT_SP, -1, -4 ); // addss/subss/mulss/divss xmm0, [r13-4]
+    jit_mem( e, 0xf3, false, 0x0f11, 0, JIT_SP, -1, -8 ); // movss [r13-8], xmm0
+    jit_reg( e, false, 0x0f2e, 0, 0 ); // ucomiss xmm0, xmm0
+    jit_byte( e, 0x7b ); // jnp rel8
+    int skip = e->count;
+    jit_byte( e, 0 );
+    jit_mem( e, 0, false, 0xc7, 0, JIT_SP, -1, -8 ); // mov dword [r13-8], VM_NAN
+    jit_u32( e, VM_NAN );
+    e->out[ skip ] = (unsigned char)( e->count - ( skip + 1 ) );
+    jit_adjust_sp( e, -4 );
+    }
+
+
+// Logical ops on bools, where any non-zero value counts as true
+static void jit_logical( vm_jit_emitter_t* e, int opcode )
+    {
+    jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -8 ); // mov eax, [r13-8]
+    jit_reg( e, false, 0x85, JIT_RAX, JIT_RAX ); // test eax, eax
+    jit_reg( e, false, 0x0f95, 0, JIT_RAX ); // setnz al
+    jit_mem( e, 0, false, 0x8b, JIT_RCX, JIT_SP, -1, -4 ); // mov ecx, [r13-4]
+    jit_reg( e, false, 0x85, JIT_RCX, JIT_RCX ); // test ecx, ecx
+    jit_reg( e, false, 0x0f95, 0, JIT_RCX ); // setnz cl
+    jit_reg( e, false, opcode, JIT_RCX, JIT_RAX ); // and/or/xor al, cl
+    jit_reg( e, false, 0x0fb6, JIT_RAX, JIT_RAX ); // movzx eax, al
+    jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -8 );
+    jit_adjust_sp( e, -4 );
+    }
+
+
+static int vm_jit_operands( u32 const* op )
+    {
+    switch( *op )
+        {
+        case VM_OP_PUSH: case VM_OP_PUSHC: case VM_OP_LOADA: case VM_OP_STOREA: case VM_OP_LOADAC: case VM_OP_STOREAC:
+            return 1;
+        case VM_OP_INDEX:
+            return 3;
+        case VM_OP_JTAB:
+            return 3 + (int) op[ 1 ];
+        default:
+            return 0;
+        }
+    }
+
+
+static void vm_jit_emit_op( vm_jit_emitter_t* e, vm_context_t* ctx, int pos, int* next )
+    {
+    u32* code = (u32*) ctx->code;
+    u32 op = code[ pos ];
+    *next = pos + 1 + vm_jit_operands( code + pos );
+
+    switch( op )
+        {
+        case VM_OP_PUSH:
+            {
+            u32 value = code[ pos + 1 ];
+            u32 fused = pos + 2 <= e->end ? code[ pos + 2 ] : VM_OP_HALT;
+            if( fused == VM_OP_LOAD )
+                {
+                jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_GLOBALS, -1, (int)( value * 4 ) ); // mov eax, [r12+index*4]
+                jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, 0 ); // mov [r13], eax
+                jit_adjust_sp( e, 4 );
+                *next = pos + 3;
+                }
+            else if( fused == VM_OP_STORE )
+                {
+                jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+                jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_GLOBALS, -1, (int)( value * 4 ) ); // mov [r12+index*4], eax
+                jit_adjust_sp( e, -4 );
+                *next = pos + 3;
+                }
+            else if( fused == VM_OP_JMP )
+                {
+                jit_branch( e, JIT_JMP, pos + 2, pos + 2 + (int) value );
+                *next = pos + 3;
+                }
+            else if( fused == VM_OP_JNZ )
+                {
+                jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+                jit_adjust_sp( e, -4 );
+                jit_reg( e, false, 0x85, JIT_RAX, JIT_RAX ); // test eax, eax
+                jit_branch( e, JIT_NZ, pos + 2, pos + 2 + (int) value );
+                *next = pos + 3;
+                }
+            else
+                {
+                jit_mem( e, 0, false, 0xc7, 0, JIT_SP, -1, 0 ); // mov dword [r13], imm32
+                jit_u32( e, value );
+                jit_adjust_sp( e, 4 );
+                }
+            } break;
+
+        case VM_OP_POP:
+            jit_adjust_sp( e, -4 );
+            break;
+
+        case VM_OP_LOAD:
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_GLOBALS, JIT_RAX, 0 ); // mov eax, [r12+rax*4]
+            jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -4 ); // mov [r13-4], eax
+            break;
+
+        case VM_OP_STORE:
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+            jit_mem( e, 0, false, 0x8b, JIT_RCX, JIT_SP, -1, -8 ); // mov ecx, [r13-8]
+            jit_mem( e, 0, false, 0x89, JIT_RCX, JIT_GLOBALS, JIT_RAX, 0 ); // mov [r12+rax*4], ecx
+            jit_adjust_sp( e, -8 );
+            break;
+
+        case VM_OP_LOADA:
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_GLOBALS, JIT_RAX, (int)( code[ pos + 1 ] * 4 ) ); // mov eax, [r12+rax*4+base*4]
+            jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -4 ); // mov [r13-4], eax
+            break;
+
+        case VM_OP_STOREA:
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+            jit_mem( e, 0, false, 0x8b, JIT_RCX, JIT_SP, -1, -8 ); // mov ecx, [r13-8]
+            jit_mem( e, 0, false, 0x89, JIT_RCX, JIT_GLOBALS, JIT_RAX, (int)( code[ pos + 1 ] * 4 ) ); // mov [r12+rax*4+base*4], ecx
+            jit_adjust_sp( e, -8 );
+            break;
+
+        case VM_OP_INDEX:
+            {
+            // In range subscripts are handled inline, others call op_index to report the error and clamp
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+            jit_byte( e, 0x3d ); // cmp eax, max
+            jit_u32( e, code[ pos + 2 ] );
+            jit_byte( e, 0x0f ); // ja slow
+            jit_byte( e, 0x80 | JIT_A );
+            int slow = e->count;
+            jit_u32( e, 0 );
+            jit_byte( e, 0x05 ); // add eax, base
+            jit_u32( e, code[ pos + 1 ] );
+            jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -4 ); // mov [r13-4], eax
+            jit_byte( e, 0xe9 ); // jmp done
+            int done = e->count;
+            jit_u32( e, 0 );
+            u32 rel = (u32)( e->count - ( slow + 4 ) );
+            memcpy( e->out + slow, &rel, sizeof( rel ) );
+            jit_call( e, op, code + pos + 1 );
+            rel = (u32)( e->count - ( done + 4 ) );
+            memcpy( e->out + done, &rel, sizeof( rel ) );
+            } break;
+
+        case VM_OP_ADD: jit_binary( e, 0x03 ); break;
+        case VM_OP_SUB: jit_binary( e, 0x2b ); break;
+        case VM_OP_OR: jit_binary( e, 0x0b ); break;
+        case VM_OP_XOR: jit_binary( e, 0x33 ); break;
+        case VM_OP_AND: jit_binary( e, 0x23 ); break;
+        case VM_OP_MUL: jit_binary( e, 0x0faf ); break;
+
+        case VM_OP_DIV:
+        case VM_OP_MOD:
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -8 ); // mov eax, [r13-8]
+            jit_byte( e, 0x99 ); // cdq
+            jit_mem( e, 0, false, 0xf7, 7, JIT_SP, -1, -4 ); // idiv dword [r13-4]
+            jit_mem( e, 0, false, 0x89, op == VM_OP_DIV ? JIT_RAX : JIT_RDX, JIT_SP, -1, -8 ); // mov [r13-8], eax/edx
+            jit_adjust_sp( e, -4 );
+            break;
+
+        case VM_OP_NEG: jit_mem( e, 0, false, 0xf7, 3, JIT_SP, -1, -4 ); break; // neg dword [r13-4]
+        case VM_OP_NOT: jit_mem( e, 0, false, 0xf7, 2, JIT_SP, -1, -4 ); break; // not dword [r13-4]
+
+        case VM_OP_EQS: jit_compare( e, JIT_Z ); break;
+        case VM_OP_NES: jit_compare( e, JIT_NZ ); break;
+        case VM_OP_LES: jit_compare( e, JIT_LE ); break;
+        case VM_OP_GES: jit_compare( e, JIT_GE ); break;
+        case VM_OP_LTS: jit_compare( e, JIT_L ); break;
+        case VM_OP_GTS: jit_compare( e, JIT_G ); break;
+
+        case VM_OP_LEF: jit_comparef( e, true, JIT_AE ); break;
+        case VM_OP_GEF: jit_comparef( e, false, JIT_AE ); break;
+        case VM_OP_LTF: jit_comparef( e, true, JIT_A ); break;
+        case VM_OP_GTF: jit_comparef( e, false, JIT_A ); break;
+
+        case VM_OP_ORB: jit_logical( e, 0x08 ); break;
+        case VM_OP_XORB: jit_logical( e, 0x30 ); break;
+        case VM_OP_ANDB: jit_logical( e, 0x20 ); break;
+
+        case VM_OP_NOTB:
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+            jit_reg( e, false, 0x85, JIT_RAX, JIT_RAX ); // test eax, eax
+            jit_setcc( e, JIT_Z );
+            jit_mem( e, 0, false, 0x89, JIT_RAX, JIT_SP, -1, -4 ); // mov [r13-4], eax
+            break;
+
+        case VM_OP_ADDF: jit_binaryf( e, 0x0f58 ); break;
+        case VM_OP_SUBF: jit_binaryf( e, 0x0f5c ); break;
+        case VM_OP_MULF: jit_binaryf( e, 0x0f59 ); break;
+        case VM_OP_DIVF: jit_binaryf( e, 0x0f5e ); break;
+
+        case VM_OP_NEGF:
+            jit_mem( e, 0, false, 0x81, 6, JIT_SP, -1, -4 ); // xor dword [r13-4], 0x80000000
+            jit_u32( e, 0x80000000 );
+            break;
+
+        case VM_OP_JTAB:
+            {
+            // Indirect jump through a table of rel32s following the code. Backward entries leave native code, 
+            // as they don't go through the op budget check of jit_branch
+            u32 count = code[ pos + 1 ];
+            u32 const* offsets = code + pos + 3;
+            jit_mem( e, 0, false, 0x8b, JIT_RAX, JIT_SP, -1, -4 ); // mov eax, [r13-4]
+            jit_adjust_sp( e, -4 );
+            jit_byte( e, 0x2d ); // sub eax, bias
+            jit_u32( e, code[ pos + 2 ] );
+            jit_byte( e, 0x3d ); // cmp eax, count
+            jit_u32( e, count );
+            jit_branch( e, JIT_AE, pos, pos + (int) offsets[ count ] );
+            jit_byte( e, 0x48 ); jit_byte( e, 0x8d ); jit_byte( e, 0x0d ); // lea rcx, [rip+table]
+            int table_ref = e->count;
+            jit_u32( e, 0 );
+            jit_mem( e, 0, true, 0x63, JIT_RAX, JIT_RCX, JIT_RAX, 0 ); // movsxd rax, dword [rcx+rax*4]
+            jit_reg( e, true, 0x01, JIT_RCX, JIT_RAX ); // add rax, rcx
+            jit_reg( e, false, 0xff, 4, JIT_RAX ); // jmp rax
+            int table = e->count;
+            u32 rel = (u32)( table - ( table_ref + 4 ) );
+            memcpy( e->out + table_ref, &rel, sizeof( rel ) );
+            for( u32 i = 0; i < count; ++i )
+                {
+                int target = pos + (int) offsets[ i ];
+                jit_fixup( e, table, target, target <= pos );
+                }
+            } break;
+
+        case VM_OP_HALT:
+        case VM_OP_TRON:
+        case VM_OP_TROFF:
+        case VM_OP_JSR:
+        case VM_OP_RET:
+        case VM_OP_JMP:
+        case VM_OP_JNZ:
+            jit_jump( e, JIT_JMP, pos, true );
+            break;
+
+        default:
+            {
+            jit_call( e, op, code + pos + 1 );
+            if( op >= VM_OPCOUNT )
+                {
+                // Host functions may pause the VM, for INPUT and WAITVBL
+                jit_mem( e, 0, false, 0x80, 7, JIT_CTX, -1, (int) offsetof( vm_context_t, is_paused ) ); // cmp byte [rbx+is_paused], 0
+                jit_byte( e, 0 );
+                jit_jump( e, JIT_NZ, pos + 1, true );
+                }
+            } break;
+        }
+    }
+
+
+// Translates the loop from start to the backward jump at end, and installs it as the entry for start
+static bool vm_jit_compile( vm_context_t* ctx, int start, int end )
+    {
+    vm_jit_t* jit = ctx->jit;
+    u32* code = (u32*) ctx->code;
+    if( end - start >= VM_JIT_MAX_REGION ) return false;
+
+    vm_jit_emitter_t emitter;
+    vm_jit_emitter_t* e = &emitter;
+    e->capacity = 4096;
+    e->count = 0;
+    e->out = (unsigned char*) malloc( (size_t) e->capacity );
+    assert( e->out );
+    e->fixups_capacity = 256;
+    e->fixups_count = 0;
+    e->fixups = (vm_jit_fixup_t*) malloc( sizeof( *e->fixups ) * e->fixups_capacity );
+    assert( e->fixups );
+    e->start = start;
+    e->end = end;
+    e->labels = (int*) malloc( sizeof( *e->labels ) * ( end - start + 1 ) );
+    assert( e->labels );
+    for( int i = 0; i <= end - start; ++i ) e->labels[ i ] = -1;
+    e->loop_ops = 0;
+    for( int pos = start; pos <= end; pos += 1 + vm_jit_operands( code + pos ) ) ++e->loop_ops;
+
+    // Prologue
+    jit_byte( e, 0x53 ); // push rbx
+    jit_byte( e, 0x55 ); // push rbp
+    jit_byte( e, 0x41 ); jit_byte( e, 0x54 ); // push r12
+    jit_byte( e, 0x41 ); jit_byte( e, 0x55 ); // push r13
+    jit_byte( e, 0x41 ); jit_byte( e, 0x56 ); // push r14
+    jit_byte( e, 0x41 ); jit_byte( e, 0x57 ); // push r15
+    jit_reg( e, true, 0x83, 5, JIT_RSP ); jit_byte( e, 40 ); // sub rsp, 40 (aligns the stack and reserves shadow space)
+    jit_reg( e, true, 0x89, JIT_ARG0, JIT_CTX ); // mov rbx, arg0
+    jit_reg( e, true, 0x63, JIT_BUDGET, JIT_ARG1 ); // movsxd r14, arg1
+    jit_reg( e, true, 0x89, JIT_BUDGET, JIT_START_BUDGET ); // mov r15, r14
+    jit_mem( e, 0, true, 0x8b, JIT_GLOBALS, JIT_CTX, -1, (int) offsetof( vm_context_t, globals ) ); // mov r12, [rbx+globals]
+    jit_mem( e, 0, true, 0x8b, JIT_SP, JIT_CTX, -1, (int) offsetof( vm_context_t, sp ) ); // mov r13, [rbx+sp]
+
+    // Body
+    int pos = start;
+    while( pos <= end )
+        {
+        e->labels[ pos - start ] = e->count;
+        int next = pos;
+        vm_jit_emit_op( e, ctx, pos, &next );
+        pos = next;
+        }
+    jit_jump( e, JIT_JMP, end + 1, true );
+
+    // Exits, each setting rax to the bytecode position to resume at, and jumping to the epilogue
+    int const exit_size = 15;
+    int exits_count = 0;
+    for( int i = 0; i < e->fixups_count; ++i )
+        {
+        vm_jit_fixup_t* fixup = &e->fixups[ i ];
+        bool internal = fixup->target >= start && fixup->target <= end && e->labels[ fixup->target - start ] >= 0;
+        if( !fixup->exit && internal ) continue;
+        fixup->exit = true;
+        ++exits_count;
+        }
+    int epilogue = e->count + exits_count * exit_size;
+    for( int i = 0; i < e->fixups_count; ++i )
+        {
+        vm_jit_fixup_t* fixup = &e->fixups[ i ];
+        int target = fixup->exit ? e->count : e->labels[ fixup->target - start ];
+        u32 rel = (u32)( target - fixup->base );
+        memcpy( e->out + fixup->at, &rel, sizeof( rel ) );
+        if( !fixup->exit ) continue;
+
+        jit_opcode( e, 0, true, 0xb8, 0, -1, JIT_RAX ); // mov rax, imm64
+        jit_u64( e, (unsigned long long)(uintptr_t)( code + fixup->target ) );
+        jit_byte( e, 0xe9 ); // jmp epilogue
+        jit_u32( e, (u32)( epilogue - ( e->count + 4 ) ) );
+        }
+    assert( e->count == epilogue );
+
+    // Epilogue, returning the number of ops used from the budget
+    jit_mem( e, 0, true, 0x89, JIT_RAX, JIT_CTX, -1, (int) offsetof( vm_context_t, pc ) ); // mov [rbx+pc], rax
+    jit_mem( e, 0, true, 0x89, JIT_SP, JIT_CTX, -1, (int) offsetof( vm_context_t, sp ) ); // mov [rbx+sp], r13
+    jit_reg( e, true, 0x89, JIT_START_BUDGET, JIT_RAX ); // mov rax, r15
+    jit_reg( e, true, 0x29, JIT_BUDGET, JIT_RAX ); // sub rax, r14
+    jit_reg( e, true, 0x83, 0, JIT_RSP ); jit_byte( e, 40 ); // add rsp, 40
+    jit_byte( e, 0x41 ); jit_byte( e, 0x5f ); // pop r15
+    jit_byte( e, 0x41 ); jit_byte( e, 0x5e ); // pop r14
+    jit_byte( e, 0x41 ); jit_byte( e, 0x5d ); // pop r13
+    jit_byte( e, 0x41 ); jit_byte( e, 0x5c ); // pop r12
+    jit_byte( e, 0x5d ); // pop rbp
+    jit_byte( e, 0x5b ); // pop rbx
+    jit_byte( e, 0xc3 ); // ret
+
+    bool result = false;
+    if( jit->memory_used + e->count <= VM_JIT_MEMORY_SIZE )
+        {
+        unsigned char* entry = jit->memory + jit->memory_used;
+        memcpy( entry, e->out, (size_t) e->count );
+        jit->memory_used += ( e->count + 15 ) & ~15;
+        jit->entries[ start ] = (vm_jit_func_t)(uintptr_t) entry;
+        result = true;
+        }
+
+    free( e->labels );
+    free( e->fixups );
+    free( e->out );
+    return result;
+    }
+
+
+// Interpreter loop used when the JIT is enabled, which counts backward jumps and enters compiled loops
+static int vm_jit_run( vm_context_t* ctx, int op_count )
+    {
+    vm_jit_t* jit = ctx->jit;
+    u32* code = (u32*) ctx->code;
+    int count = 0;
+    while( count < op_count )
+        {
+        u32* from = ctx->pc;
+        u32 op = *ctx->pc;
+        assert( ctx->optable[ op ] );
+        ctx->optable[ *ctx->pc++ ]( ctx );
+        ++count;
+        if( ctx->is_paused ) return count;
+        if( ctx->tracing ) return count + vm_run( ctx, op_count - count );
+
+        if( ( op == VM_OP_JMP || op == VM_OP_JNZ || op == VM_OP_JTAB ) && ctx->pc < from )
+            {
+            int target = (int)( ctx->pc - code );
+            if( !jit->entries[ target ] && jit->counters[ target ] != VM_JIT_FAILED )
+                {
+                if( ++jit->counters[ target ] >= jit->threshold )
+                    {
+                    if( !vm_jit_compile( ctx, target, (int)( from - code ) ) )
+                        jit->counters[ target ] = VM_JIT_FAILED;
+                    }
+                }
+            if( jit->entries[ target ] )
+                {
+                count += jit->entries[ target ]( ctx, op_count - count );
+                if( ctx->is_paused ) return count < op_count ? count : op_count;
+                }
+            }
+        }
+
+    return op_count;
+    }
+
+#endif /* VM_JIT */
+
+////////////////////////////////////////////////////////////////////////
+
+void vm_init( vm_context_t* ctx, void* code, int code_size, void* map, int map_size, void* data, int data_size,  
+    int stack_size, int globals_size, vm_func_t* host_funcs, int host_funcs_count, 
+    char const* strings, int string_count, vm_trace_callback_t trace_callback, void* trace_context )
+    {
+    ctx->trace_callback = trace_callback;
+    ctx->trace_context = trace_context;
+    ctx->tracing = false;
+
+    ctx->is_paused = false;
+
+    int vm_op_count = sizeof( vm_ops ) / sizeof( vm_ops[ 0 ] );
+    assert( vm_op_count == VM_OPCOUNT );
+    int optable_count = vm_op_count + host_funcs_count;
+    ctx->optable = (vm_func_t*) malloc( optable_count * sizeof( vm_func_t ) );
+    assert( ctx->optable );
+    for( int i = 0; i < vm_op_count; ++i ) ctx->optable[ i ] = vm_ops[ i ];
+    for( int i = 0; i < host_funcs_count; ++i ) ctx->optable[ vm_op_count + i ] = host_funcs[ i ];
+
+    ctx->code = malloc( (size_t) code_size );
+    assert( ctx->code );
+    ctx->map = (u32*) malloc( (size_t) map_size );
+    assert( ctx->map );
+    ctx->data = malloc( (size_t) data_size );
+    assert( ctx->data );
+    ctx->data_end = (void*) ( ( (uintptr_t) ctx->data ) + data_size );
+    ctx->stack = malloc( (size_t) stack_size );
     assert( ctx->stack );
     ctx->globals = (u32*) malloc( (size_t) globals_size );
     assert( ctx->globals );
@@ -674,6 +2026,22 @@ void vm_init( vm_context_t* ctx, void* code, int code_size, void* map, int map_s
     ctx->pc = (u32*) ctx->code;
     ctx->sp = (u32*) ctx->stack;
     ctx->dp = (u32*) ctx->data;
+    ctx->dp_type = TYPE_NONE;
+    ctx->dp_left = 0;
+
+    ctx->builders = 0;
+    ctx->builders_count = 0;
+    ctx->builders_capacity = 0;
+    ctx->builders_free = -1;
+
+    ctx->transients = 0;
+    ctx->transients_count = 0;
+    ctx->transients_capacity = 0;
+    ctx->transients_live = 0;
+    ctx->arena = 0;
+    ctx->arena_used = 0;
+    ctx->arena_capacity = 0;
+    ctx->int_strings = 0;
 
     if( code_size > 0 ) memcpy( ctx->code, code, (size_t) code_size );
     if( map_size > 0 ) memcpy( ctx->map, map, (size_t) map_size );
@@ -690,19 +2058,28 @@ void vm_init( vm_context_t* ctx, void* code, int code_size, void* map, int map_s
         strpool_incref( &ctx->string_pool, handle );
         ptr += length + 1;
         }
+
+    #ifdef VM_JIT
+        ctx->jit = vm_jit_create( code_size / (int) sizeof( u32 ) );
+    #endif
     }
 
 
 void vm_term( vm_context_t* ctx )
     {
+    #ifdef VM_JIT
+        if( ctx->jit ) vm_jit_destroy( ctx->jit );
+    #endif
+
     strpool_term( &ctx->string_pool );
 
-    if( vm_temp_buffer )
-        {
-        free( vm_temp_buffer );
-        vm_temp_buffer = 0;
-        vm_temp_capacity = 0;
-        }
+    for( int i = 0; i < ctx->builders_count; ++i ) free( ctx->builders[ i ].text );
+    free( ctx->builders );
+
+    vm_arena_reset( ctx );
+    free( ctx->arena );
+    free( ctx->transients );
+    free( ctx->int_strings );
     free( ctx->globals );
 
 
@@ -739,11 +2116,33 @@ bool vm_paused( vm_context_t* ctx )
     }
 
 
+void vm_idle( vm_context_t* ctx )
+    {
+    strpool_defrag_step( &ctx->string_pool );
+    }
+
+
+void vm_string_stats( vm_context_t* ctx, vm_string_stats_t* stats )
+    {
+    strpool_stats_t pool_stats;
+    strpool_stats( &ctx->string_pool, &pool_stats );
+    stats->count = pool_stats.string_count;
+    stats->bytes_used = pool_stats.bytes_used;
+    stats->bytes_free = pool_stats.bytes_free;
+    stats->injects = pool_stats.inject_count;
+    stats->discards = pool_stats.discard_count;
+    }
+
+
 
 int vm_run( vm_context_t* ctx, int op_count )
     {
     if( ctx->is_paused ) return 0;
 
+    #ifdef VM_JIT
+        if( ctx->jit && !ctx->tracing ) return vm_jit_run( ctx, op_count );
+    #endif
+
     if( ctx->trace_callback )
         {
         for( int i = 0; i < op_count; ++i ) 
@@ -771,5 +2170,351 @@ int vm_run( vm_context_t* ctx, int op_count )
     }
 
 
+#ifdef VM_JIT
+
+// Fuzz testing of the JIT. Generates random loops of integer, float and bool expressions, array accesses,
+// conditional skips, nested loops and pausing host calls, runs them both interpreted and with the JIT compiling
+// every loop on its first iteration, and compares globals, stack and pc once they have finished.
+
+#define VM_JIT_FUZZ_INTS 0
+#define VM_JIT_FUZZ_FLOATS 8
+#define VM_JIT_FUZZ_ARRAY 16
+#define VM_JIT_FUZZ_COUNTERS 24
+#define VM_JIT_FUZZ_GLOBALS 26
+#define VM_JIT_FUZZ_CAPACITY 8192
+
+struct vm_jit_fuzz_t
+    {
+    u32* code;
+    int count;
+    u32 seed;
+    };
+
+
+static u32 vm_jit_fuzz_rand( vm_jit_fuzz_t* fuzz, u32 range )
+    {
+    fuzz->seed = fuzz->seed * 1664525U + 1013904223U;
+    return ( fuzz->seed >> 8 ) % range;
+    }
+
+
+static void vm_jit_fuzz_emit( vm_jit_fuzz_t* fuzz, u32 value )
+    {
+    assert( fuzz->count < VM_JIT_FUZZ_CAPACITY );
+    fuzz->code[ fuzz->count++ ] = value;
+    }
+
+
+static void vm_jit_fuzz_emit2( vm_jit_fuzz_t* fuzz, u32 op, u32 value )
+    {
+    vm_jit_fuzz_emit( fuzz, op );
+    vm_jit_fuzz_emit( fuzz, value );
+    }
+
+
+static void vm_jit_fuzz_pause( vm_context_t* ctx )
+    {
+    vm_pause( ctx );
+    }
+
+
+static void vm_jit_fuzz_float( vm_jit_fuzz_t* fuzz, int depth );
+
+static void vm_jit_fuzz_int( vm_jit_fuzz_t* fuzz, int depth )
+    {
+    static vm_op_t const binary[] = { VM_OP_ADD, VM_OP_SUB, VM_OP_OR, VM_OP_XOR, VM_OP_AND, VM_OP_MUL };
+    static vm_op_t const compare[] = { VM_OP_EQS, VM_OP_NES, VM_OP_LES, VM_OP_GES, VM_OP_LTS, VM_OP_GTS };
+    static vm_op_t const comparef[] = { VM_OP_EQF, VM_OP_NEF, VM_OP_LEF, VM_OP_GEF, VM_OP_LTF, VM_OP_GTF };
+    static vm_op_t const logical[] = { VM_OP_ORB, VM_OP_XORB, VM_OP_ANDB };
+
+    switch( vm_jit_fuzz_rand( fuzz, depth > 3 ? 2U : 10U ) )
+        {
+        case 0:
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, vm_jit_fuzz_rand( fuzz, 2 ) ? vm_jit_fuzz_rand( fuzz, 16 ) : fuzz->seed );
+            break;
+        case 1:
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, VM_JIT_FUZZ_INTS + vm_jit_fuzz_rand( fuzz, 8 ) );
+            vm_jit_fuzz_emit( fuzz, VM_OP_LOAD );
+            break;
+        case 2:
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, 7 );
+            vm_jit_fuzz_emit( fuzz, VM_OP_AND );
+            if( vm_jit_fuzz_rand( fuzz, 2 ) )
+                {
+                vm_jit_fuzz_emit2( fuzz, VM_OP_LOADA, VM_JIT_FUZZ_ARRAY );
+                }
+            else
+                {
+                vm_jit_fuzz_emit2( fuzz, VM_OP_INDEX, VM_JIT_FUZZ_ARRAY );
+                vm_jit_fuzz_emit2( fuzz, 7, 0 );
+                vm_jit_fuzz_emit( fuzz, VM_OP_LOAD );
+                }
+            break;
+        case 3:
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, binary[ vm_jit_fuzz_rand( fuzz, sizeof( binary ) / sizeof( *binary ) ) ] );
+            break;
+        case 4:
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, vm_jit_fuzz_rand( fuzz, 2 ) ? 1 + vm_jit_fuzz_rand( fuzz, 9 ) : (u32) -7 );
+            vm_jit_fuzz_emit( fuzz, vm_jit_fuzz_rand( fuzz, 2 ) ? VM_OP_DIV : VM_OP_MOD );
+            break;
+        case 5:
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, vm_jit_fuzz_rand( fuzz, 2 ) ? VM_OP_NEG : VM_OP_NOT );
+            break;
+        case 6:
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, compare[ vm_jit_fuzz_rand( fuzz, sizeof( compare ) / sizeof( *compare ) ) ] );
+            break;
+        case 7:
+            vm_jit_fuzz_float( fuzz, depth + 1 );
+            vm_jit_fuzz_float( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, comparef[ vm_jit_fuzz_rand( fuzz, sizeof( comparef ) / sizeof( *comparef ) ) ] );
+            break;
+        case 8:
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, logical[ vm_jit_fuzz_rand( fuzz, sizeof( logical ) / sizeof( *logical ) ) ] );
+            break;
+        case 9:
+            vm_jit_fuzz_int( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, VM_OP_NOTB );
+            break;
+        }
+    }
+
+
+static void vm_jit_fuzz_float( vm_jit_fuzz_t* fuzz, int depth )
+    {
+    static vm_op_t const binary[] = { VM_OP_ADDF, VM_OP_SUBF, VM_OP_MULF, VM_OP_DIVF, VM_OP_MODF };
+
+    switch( vm_jit_fuzz_rand( fuzz, depth > 3 ? 2U : 4U ) )
+        {
+        case 0:
+            {
+            float value = (float)( (int) vm_jit_fuzz_rand( fuzz, 2001 ) - 1000 ) / 16.0f;
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, *(u32*)&value );
+            } break;
+        case 1:
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, VM_JIT_FUZZ_FLOATS + vm_jit_fuzz_rand( fuzz, 8 ) );
+            vm_jit_fuzz_emit( fuzz, VM_OP_LOAD );
+            break;
+        case 2:
+            vm_jit_fuzz_float( fuzz, depth + 1 );
+            vm_jit_fuzz_float( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, binary[ vm_jit_fuzz_rand( fuzz, sizeof( binary ) / sizeof( *binary ) ) ] );
+            break;
+        case 3:
+            vm_jit_fuzz_float( fuzz, depth + 1 );
+            vm_jit_fuzz_emit( fuzz, VM_OP_NEGF );
+            break;
+        }
+    }
+
+
+static void vm_jit_fuzz_loop( vm_jit_fuzz_t* fuzz, int depth );
+
+static void vm_jit_fuzz_statement( vm_jit_fuzz_t* fuzz, int depth )
+    {
+    switch( vm_jit_fuzz_rand( fuzz, 9 ) )
+        {
+        case 0:
+        case 1:
+            vm_jit_fuzz_int( fuzz, 0 );
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, VM_JIT_FUZZ_INTS + vm_jit_fuzz_rand( fuzz, 8 ) );
+            vm_jit_fuzz_emit( fuzz, VM_OP_STORE );
+            break;
+        case 2:
+            vm_jit_fuzz_float( fuzz, 0 );
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, VM_JIT_FUZZ_FLOATS + vm_jit_fuzz_rand( fuzz, 8 ) );
+            vm_jit_fuzz_emit( fuzz, VM_OP_STORE );
+            break;
+        case 3:
+            vm_jit_fuzz_int( fuzz, 0 );
+            vm_jit_fuzz_int( fuzz, 2 );
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, 7 );
+            vm_jit_fuzz_emit( fuzz, VM_OP_AND );
+            if( vm_jit_fuzz_rand( fuzz, 2 ) )
+                {
+                vm_jit_fuzz_emit2( fuzz, VM_OP_STOREA, VM_JIT_FUZZ_ARRAY );
+                }
+            else
+                {
+                vm_jit_fuzz_emit2( fuzz, VM_OP_INDEX, VM_JIT_FUZZ_ARRAY );
+                vm_jit_fuzz_emit2( fuzz, 7, 0 );
+                vm_jit_fuzz_emit( fuzz, VM_OP_STORE );
+                }
+            break;
+        case 4:
+        case 5:
+            {
+            // Conditionally skip the next statement
+            vm_jit_fuzz_int( fuzz, 1 );
+            vm_jit_fuzz_emit( fuzz, VM_OP_PUSH );
+            int offset = fuzz->count;
+            vm_jit_fuzz_emit( fuzz, 0 );
+            int jump = fuzz->count;
+            vm_jit_fuzz_emit( fuzz, VM_OP_JNZ );
+            vm_jit_fuzz_statement( fuzz, depth );
+            fuzz->code[ offset ] = (u32)( fuzz->count - jump );
+            } break;
+        case 6:
+            if( depth < 2 && fuzz->count < VM_JIT_FUZZ_CAPACITY / 2 ) vm_jit_fuzz_loop( fuzz, depth + 1 );
+            break;
+        case 7:
+            if( vm_jit_fuzz_rand( fuzz, 4 ) == 0 ) vm_jit_fuzz_emit( fuzz, VM_OPCOUNT );
+            break;
+        case 8:
+            {
+            // Jump table selecting one of up to three statements, or none if out of range
+            if( fuzz->count >= VM_JIT_FUZZ_CAPACITY - 1024 ) break;
+            u32 count = 1 + vm_jit_fuzz_rand( fuzz, 3 );
+            vm_jit_fuzz_int( fuzz, 2 );
+            vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, 3 );
+            vm_jit_fuzz_emit( fuzz, VM_OP_AND );
+            int jtab = fuzz->count;
+            vm_jit_fuzz_emit( fuzz, VM_OP_JTAB );
+            vm_jit_fuzz_emit2( fuzz, count, vm_jit_fuzz_rand( fuzz, 2 ) );
+            int table = fuzz->count;
+            for( u32 i = 0; i <= count; ++i ) vm_jit_fuzz_emit( fuzz, 0 );
+            int exits[ 3 ];
+            for( u32 i = 0; i < count; ++i )
+                {
+                fuzz->code[ table + (int) i ] = (u32)( fuzz->count - jtab );
+                vm_jit_fuzz_statement( fuzz, depth );
+                vm_jit_fuzz_emit( fuzz, VM_OP_PUSH );
+                exits[ i ] = fuzz->count;
+                vm_jit_fuzz_emit2( fuzz, 0, VM_OP_JMP );
+                }
+            fuzz->code[ table + (int) count ] = (u32)( fuzz->count - jtab );
+            for( u32 i = 0; i < count; ++i ) fuzz->code[ exits[ i ] ] = (u32)( fuzz->count - ( exits[ i ] + 1 ) );
+            } break;
+        }
+    }
+
+
+static void vm_jit_fuzz_loop( vm_jit_fuzz_t* fuzz, int depth )
+    {
+    u32 counter = (u32)( VM_JIT_FUZZ_COUNTERS + depth - 1 );
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, 0 );
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, counter );
+    vm_jit_fuzz_emit( fuzz, VM_OP_STORE );
+
+    int head = fuzz->count;
+    int statements = 1 + (int) vm_jit_fuzz_rand( fuzz, 12 );
+    for( int i = 0; i < statements && fuzz->count < VM_JIT_FUZZ_CAPACITY - 512; ++i ) vm_jit_fuzz_statement( fuzz, depth );
+
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, counter );
+    vm_jit_fuzz_emit( fuzz, VM_OP_LOAD );
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, 1 );
+    vm_jit_fuzz_emit( fuzz, VM_OP_ADD );
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, counter );
+    vm_jit_fuzz_emit( fuzz, VM_OP_STORE );
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, counter );
+    vm_jit_fuzz_emit( fuzz, VM_OP_LOAD );
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, 1 + vm_jit_fuzz_rand( fuzz, depth > 1 ? 8U : 200U ) );
+    vm_jit_fuzz_emit( fuzz, VM_OP_LTS );
+    vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, (u32)( head - ( fuzz->count + 2 ) ) );
+    vm_jit_fuzz_emit( fuzz, VM_OP_JNZ );
+    }
+
+
+static void vm_jit_fuzz_program( vm_jit_fuzz_t* fuzz )
+    {
+    fuzz->count = 0;
+    for( u32 i = 0; i < 8; ++i )
+        {
+        vm_jit_fuzz_int( fuzz, 3 );
+        vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, VM_JIT_FUZZ_INTS + i );
+        vm_jit_fuzz_emit( fuzz, VM_OP_STORE );
+        vm_jit_fuzz_float( fuzz, 3 );
+        vm_jit_fuzz_emit2( fuzz, VM_OP_PUSH, VM_JIT_FUZZ_FLOATS + i );
+        vm_jit_fuzz_emit( fuzz, VM_OP_STORE );
+        }
+    vm_jit_fuzz_loop( fuzz, 1 );
+    vm_jit_fuzz_emit( fuzz, VM_OP_HALT );
+    }
+
+
+static void vm_jit_fuzz_run( vm_context_t* ctx )
+    {
+    for( int i = 0; i < 100000 && !vm_halted( ctx ); ++i )
+        {
+        vm_run( ctx, 256 );
+        if( vm_paused( ctx ) ) vm_resume( ctx );
+        }
+    }
+
+
+int vm_jit_fuzz( int iterations, unsigned int seed )
+    {
+    vm_func_t host_funcs[] = { vm_jit_fuzz_pause };
+    vm_jit_fuzz_t fuzz;
+    fuzz.code = (u32*) malloc( sizeof( u32 ) * VM_JIT_FUZZ_CAPACITY );
+    assert( fuzz.code );
+    fuzz.seed = seed;
+
+    int mismatches = 0;
+    for( int i = 0; i < iterations; ++i )
+        {
+        u32 program_seed = fuzz.seed;
+        vm_jit_fuzz_program( &fuzz );
+        int code_size = (int)( fuzz.count * sizeof( u32 ) );
+
+        vm_context_t interpreted;
+        vm_init( &interpreted, fuzz.code, code_size, fuzz.code, code_size, NULL, 0, 64 * 1024,
+            VM_JIT_FUZZ_GLOBALS * sizeof( u32 ), host_funcs, 1, "", 0, NULL, NULL );
+        if( interpreted.jit ) vm_jit_destroy( interpreted.jit );
+        interpreted.jit = NULL;
+
+        vm_context_t jitted;
+        vm_init( &jitted, fuzz.code, code_size, fuzz.code, code_size, NULL, 0, 64 * 1024,
+            VM_JIT_FUZZ_GLOBALS * sizeof( u32 ), host_funcs, 1, "", 0, NULL, NULL );
+        if( !jitted.jit )
+            {
+            printf( "JIT FUZZ: Could not allocate executable memory\n" );
+            vm_term( &jitted );
+            vm_term( &interpreted );
+            mismatches = -1;
+            break;
+            }
+        jitted.jit->threshold = 1;
+
+        vm_jit_fuzz_run( &interpreted );
+        vm_jit_fuzz_run( &jitted );
+
+        ptrdiff_t interpreted_pc = interpreted.pc - (u32*) interpreted.code;
+        ptrdiff_t jitted_pc = jitted.pc - (u32*) jitted.code;
+        ptrdiff_t interpreted_sp = interpreted.sp - (u32*) interpreted.stack;
+        ptrdiff_t jitted_sp = jitted.sp - (u32*) jitted.stack;
+        bool same = interpreted_pc == jitted_pc && interpreted_sp == jitted_sp
+            && memcmp( interpreted.globals, jitted.globals, VM_JIT_FUZZ_GLOBALS * sizeof( u32 ) ) == 0;
+        if( !same )
+            {
+            ++mismatches;
+            printf( "JIT FUZZ: Mismatch in program %d (seed %u, %d words), pc %d/%d, sp %d/%d\n", i, program_seed,
+                fuzz.count, (int) interpreted_pc, (int) jitted_pc, (int) interpreted_sp, (int) jitted_sp );
+            for( int j = 0; j < VM_JIT_FUZZ_GLOBALS; ++j )
+                {
+                if( interpreted.globals[ j ] != jitted.globals[ j ] )
+                    printf( "    global %d: %08x/%08x\n", j, interpreted.globals[ j ], jitted.globals[ j ] );
+                }
+            }
+
+        vm_term( &jitted );
+        vm_term( &interpreted );
+        }
+
+    free( fuzz.code );
+    return mismatches;
+    }
+
+#endif /* VM_JIT */
+
+
 #endif /* VM_IMPLEMENTATION */
 